@@ -39,6 +39,7 @@
 #include "update_engine/common/file_fetcher.h"
 #include "update_engine/common/metrics_reporter_interface.h"
 #include "update_engine/common/network_selector.h"
+#include "update_engine/common/parallel_http_fetcher.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/metrics_utils.h"
 #include "update_engine/payload_consumer/certificate_parser_interface.h"
@@ -290,10 +291,15 @@ bool UpdateAttempterAndroid::ApplyPayload(
 #ifdef _UE_SIDELOAD
     LOG(FATAL) << "Unsupported sideload URI: " << payload_url;
 #else
-    LibcurlHttpFetcher* libcurl_fetcher =
-        new LibcurlHttpFetcher(&proxy_resolver_, hardware_);
-    libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
-    fetcher = libcurl_fetcher;
+    vector<std::unique_ptr<HttpFetcher>> connection_fetchers;
+    for (int i = 0; i < kDownloadParallelConnections; i++) {
+      auto libcurl_fetcher =
+          std::make_unique<LibcurlHttpFetcher>(&proxy_resolver_, hardware_);
+      libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
+      connection_fetchers.push_back(std::move(libcurl_fetcher));
+    }
+    fetcher = new ParallelHttpFetcher(std::move(connection_fetchers),
+                                      kDownloadParallelSegmentSize);
 #endif  // _UE_SIDELOAD
   }
   // Setup extra headers.
@@ -495,43 +501,73 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
   TEST_AND_RETURN_FALSE(
       VerifyPayloadParseManifest(metadata_filename, &manifest, error));
 
-  FileDescriptorPtr fd(new EintrSafeFileDescriptor);
   ErrorCode errorcode;
 
   BootControlInterface::Slot current_slot = GetCurrentSlot();
-  for (const PartitionUpdate& partition : manifest.partitions()) {
-    if (!partition.has_old_partition_info())
-      continue;
+  // The current slot devices of the partitions read so far, by name. An
+  // operation may read its source data from another partition.
+  std::map<string, FileDescriptorPtr> source_fds;
+  auto get_source_fd = [&](const string& partition_name,
+                           FileDescriptorPtr* fd) {
+    auto it = source_fds.find(partition_name);
+    if (it != source_fds.end()) {
+      *fd = it->second;
+      return true;
+    }
     string partition_path;
     if (!boot_control_->GetPartitionDevice(
-            partition.partition_name(), current_slot, &partition_path)) {
+            partition_name, current_slot, &partition_path)) {
       return LogAndSetError(
           error,
           FROM_HERE,
-          "Failed to get partition device for " + partition.partition_name());
+          "Failed to get partition device for " + partition_name);
     }
-    if (!fd->Open(partition_path.c_str(), O_RDONLY)) {
+    fd->reset(new EintrSafeFileDescriptor);
+    if (!(*fd)->Open(partition_path.c_str(), O_RDONLY)) {
       return LogAndSetError(
           error, FROM_HERE, "Failed to open " + partition_path);
     }
+    source_fds[partition_name] = *fd;
+    return true;
+  };
+
+  for (const PartitionUpdate& partition : manifest.partitions()) {
+    if (!partition.has_old_partition_info())
+      continue;
+    // The operations stored in the data blobs aren't part of the metadata, so
+    // there is nothing to check the source partition against.
+    if (partition.has_operations_data_offset()) {
+      return LogAndSetError(error,
+                            FROM_HERE,
+                            "Can't verify the operations of " +
+                                partition.partition_name() +
+                                " stored outside of the metadata.");
+    }
     for (const InstallOperation& operation : partition.operations()) {
       if (!operation.has_src_sha256_hash())
         continue;
+      const string& source_name = operation.has_src_partition_name()
+                                      ? operation.src_partition_name()
+                                      : partition.partition_name();
+      FileDescriptorPtr fd;
+      if (!get_source_fd(source_name, &fd))
+        return false;
       brillo::Blob source_hash;
       if (!fd_utils::ReadAndHashExtents(fd,
                                         operation.src_extents(),
                                         manifest.block_size(),
                                         &source_hash)) {
         return LogAndSetError(
-            error, FROM_HERE, "Failed to hash " + partition_path);
+            error, FROM_HERE, "Failed to hash the source of " + source_name);
       }
       if (!PartitionWriter::ValidateSourceHash(
               source_hash, operation, fd, &errorcode)) {
         return false;
       }
     }
-    fd->Close();
   }
+  for (auto& name_and_fd : source_fds)
+    name_and_fd.second->Close();
   return true;
 }
 
@@ -109,6 +109,7 @@ extern const char kPrefsVerityWritten[];
 extern const char kPrefsWallClockScatteringWaitPeriod[];
 extern const char kPrefsWallClockStagingWaitPeriod[];
 extern const char kPrefsManifestBytes[];
+extern const char kPrefsPartitionOperationsBytes[];
 
 // Keys used when storing and loading payload properties.
 extern const char kPayloadPropertyFileSize[];
@@ -219,6 +220,39 @@ constexpr int kDownloadP2PMaxRetryCount = 5;
 constexpr int kDownloadConnectTimeoutSeconds = 30;
 constexpr int kDownloadP2PConnectTimeoutSeconds = 5;
 
+// The number of connections the payload is downloaded over at once, and the
+// size of the segments downloaded over each of them.
+//
+// A single connection doesn't fill the pipe on links with a high latency and
+// a high bandwidth. The segments are large enough that the extra range
+// requests don't matter, while the reorder buffer of the downloads stays at
+// (connections - 1) segments.
+constexpr int kDownloadParallelConnections = 4;
+constexpr size_t kDownloadParallelSegmentSize = 4 * kNumBytesInOneMiB;
+
+// The interval at which the throughput of every download connection is
+// measured, and the throughput below which the rest of the segment of a
+// connection is raced from another payload URL.
+//
+// A single slow CDN edge otherwise holds back the whole download, since the
+// segments after the one of the slow connection wait in the reorder buffer.
+constexpr int kDownloadHedgeCheckIntervalSeconds = 10;
+constexpr int kDownloadHedgeLowSpeedBps = 64 * 1024;
+
+// The interval at which the rate limit of a background download is evaluated
+// again, so it follows the measured link capacity and the network changes.
+constexpr int kDownloadRateLimitCheckIntervalSeconds = 30;
+
+// A rate limited download never runs at the full speed of the link for long,
+// and the bytes buffered while it's paused burst out after the pause. So once
+// every kDownloadCapacityProbeIntervalSeconds it's let go at full speed for
+// kDownloadCapacityProbeSeconds to measure the link capacity, without
+// counting the bytes of the first kDownloadCapacityProbeWarmupMs. The bytes
+// of a probe still count against the rate limit.
+constexpr int kDownloadCapacityProbeIntervalSeconds = 300;
+constexpr int kDownloadCapacityProbeSeconds = 1;
+constexpr int kDownloadCapacityProbeWarmupMs = 250;
+
 // Size in bytes of SHA256 hash.
 constexpr int kSHA256Size = 32;
 
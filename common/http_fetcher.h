@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_COMMON_HTTP_FETCHER_H_
 
 #include <deque>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -144,6 +145,31 @@ class HttpFetcher {
   // Get the total number of bytes downloaded by fetcher.
   virtual size_t GetBytesDownloaded() = 0;
 
+  // Sets other URLs serving the same content as the one passed to
+  // BeginTransfer(), which the fetcher may download from instead if it is
+  // slow. Ignored by default.
+  virtual void SetAlternateUrls(const std::vector<std::string>& urls) {}
+
+  // Limits the number of connections the next transfers are downloaded over
+  // at once to |max_connections|, or removes the limit if it's 0. Ignored by
+  // default.
+  virtual void SetMaxConnections(size_t max_connections) {}
+
+  // Returns the throughput measured for every URL downloaded from so far, in
+  // bytes per second. Empty by default.
+  virtual std::map<std::string, int64_t> GetUrlThroughputs() const {
+    return {};
+  }
+
+  // Limits the download to |bytes_per_second|, or removes the limit if it's 0.
+  // Takes effect right away, also in the middle of a transfer. Ignored by
+  // default.
+  virtual void SetMaxDownloadRate(int64_t bytes_per_second) {}
+
+  // Returns the bytes per second the link was measured to carry while the
+  // download wasn't held back by the limit, or 0 if it wasn't measured.
+  virtual int64_t GetLinkCapacity() const { return 0; }
+
   ProxyResolver* proxy_resolver() const { return proxy_resolver_; }
 
  protected:
@@ -897,8 +897,8 @@ TYPED_TEST(HttpFetcherTest, NoResponseTest) {
   fetcher->set_delegate(&delegate);
   // The server will not reply at all, so we can limit the execution time of the
   // test by reducing the low-speed timeout to something small. The test will
-  // finish once the TimeoutCallback() triggers (every second) and the timeout
-  // expired.
+  // finish once the timer libcurl sets for its low-speed check triggers and the
+  // timeout expired.
   fetcher->set_low_speed_limit(kDownloadLowSpeedLimitBps, 1);
 
   this->loop_.PostTask(
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_COMMON_MULTI_RANGE_HTTP_FETCHER_H_
 
 #include <deque>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -121,6 +122,26 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
     base_fetcher_->set_max_retry_count(max_retry_count);
   }
 
+  void SetAlternateUrls(const std::vector<std::string>& urls) override {
+    base_fetcher_->SetAlternateUrls(urls);
+  }
+
+  void SetMaxConnections(size_t max_connections) override {
+    base_fetcher_->SetMaxConnections(max_connections);
+  }
+
+  std::map<std::string, int64_t> GetUrlThroughputs() const override {
+    return base_fetcher_->GetUrlThroughputs();
+  }
+
+  void SetMaxDownloadRate(int64_t bytes_per_second) override {
+    base_fetcher_->SetMaxDownloadRate(bytes_per_second);
+  }
+
+  int64_t GetLinkCapacity() const override {
+    return base_fetcher_->GetLinkCapacity();
+  }
+
  private:
   // A range object defining the offset and length of a download chunk.  Zero
   // length indicates an unspecified end offset (note that it is impossible to
@@ -0,0 +1,748 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/parallel_http_fetcher.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/logging.h>
+
+#include "update_engine/common/constants.h"
+
+using brillo::MessageLoop;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+ParallelHttpFetcher::ParallelHttpFetcher(
+    vector<unique_ptr<HttpFetcher>> fetchers, size_t segment_size)
+    : HttpFetcher(fetchers.empty() ? nullptr : fetchers[0]->proxy_resolver()),
+      num_connections_(fetchers.size()),
+      segment_size_(segment_size) {
+  CHECK(!fetchers.empty());
+  CHECK_GT(segment_size_, 0U);
+  connections_.resize(fetchers.size());
+  for (size_t i = 0; i < fetchers.size(); i++) {
+    connections_[i].fetcher = std::move(fetchers[i]);
+    connections_[i].fetcher->set_delegate(this);
+  }
+}
+
+ParallelHttpFetcher::~ParallelHttpFetcher() {
+  if (throughput_check_id_ != MessageLoop::kTaskIdNull)
+    MessageLoop::current()->CancelTask(throughput_check_id_);
+  if (throttle_id_ != MessageLoop::kTaskIdNull)
+    MessageLoop::current()->CancelTask(throttle_id_);
+}
+
+void ParallelHttpFetcher::SetHedgeFetcher(unique_ptr<HttpFetcher> fetcher) {
+  CHECK(!transfer_active_);
+  CHECK_EQ(connections_.size(), num_connections_);
+  connections_.emplace_back();
+  connections_.back().fetcher = std::move(fetcher);
+  connections_.back().fetcher->set_delegate(this);
+  connections_.back().hedge = true;
+}
+
+void ParallelHttpFetcher::BeginTransfer(const string& url) {
+  CHECK(!transfer_active_) << "BeginTransfer but already active.";
+  // The connections keep the URL they switched to over the ranges of the
+  // same URL.
+  if (url != url_) {
+    for (Connection& connection : connections_)
+      connection.url = url;
+  }
+  url_ = url;
+  segments_.clear();
+  size_t connection_limit = ActiveConnectionLimit();
+  if (length_ == 0 || connection_limit == 1) {
+    // A single connection downloads the whole range in one request.
+    segments_.push_back({offset_, length_});
+  } else {
+    for (size_t pos = 0; pos < length_; pos += segment_size_) {
+      segments_.push_back(
+          {offset_ + static_cast<off_t>(pos),
+           std::min(segment_size_, length_ - pos)});
+    }
+  }
+  next_delivered_segment_ = next_started_segment_ = 0;
+  transfer_active_ = true;
+  LOG(INFO) << "Downloading " << segments_.size() << " segments over "
+            << std::min(segments_.size(), connection_limit)
+            << " connections.";
+  if ((connections_.size() > num_connections_ && !alternate_urls_.empty()) ||
+      token_bucket_.rate() > 0) {
+    ScheduleThroughputCheck();
+  }
+  StartSegments();
+}
+
+void ParallelHttpFetcher::TerminateTransfer() {
+  if (!transfer_active_) {
+    LOG(INFO) << "Called TerminateTransfer but not active.";
+    // Note that after the callback returns this object may be destroyed.
+    if (delegate_)
+      delegate_->TransferTerminated(this);
+    return;
+  }
+  terminating_ = true;
+  StopConnections();
+}
+
+void ParallelHttpFetcher::SetHeader(const string& header_name,
+                                    const string& header_value) {
+  for (Connection& connection : connections_)
+    connection.fetcher->SetHeader(header_name, header_value);
+}
+
+void ParallelHttpFetcher::Pause() {
+  paused_ = true;
+  interval_paused_ = true;
+  // A paused probe is started again at a later throughput check.
+  probing_ = false;
+  for (Connection& connection : connections_) {
+    // The throughput is only measured over intervals without pauses.
+    connection.sampled = false;
+    if (connection.active && !connection.terminating && !connection.paused) {
+      connection.paused = true;
+      connection.fetcher->Pause();
+    }
+  }
+}
+
+void ParallelHttpFetcher::Unpause() {
+  paused_ = false;
+  ResumeConnections();
+}
+
+void ParallelHttpFetcher::ResumeConnections() {
+  // Unpausing a connection may deliver bytes and end its transfer right away.
+  bool was_deferred = defer_end_signal_;
+  defer_end_signal_ = true;
+  for (Connection& connection : connections_) {
+    // The bytes received over a connection may throttle the transfer again.
+    if (paused_ || throttled_)
+      break;
+    if (connection.paused) {
+      connection.paused = false;
+      connection.fetcher->Unpause();
+    }
+  }
+  defer_end_signal_ = was_deferred;
+  if (!transfer_active_ || !DeliverSegments())
+    return;
+  StartSegments();
+}
+
+void ParallelHttpFetcher::SetMaxDownloadRate(int64_t bytes_per_second) {
+  LOG(INFO) << "Limiting the download to " << bytes_per_second
+            << " bytes/s (0 means unlimited).";
+  token_bucket_.SetRate(bytes_per_second, clock_->GetMonotonicTime());
+  if (!transfer_active_)
+    return;
+  if (bytes_per_second > 0) {
+    ScheduleThroughputCheck();
+  } else if (throttled_) {
+    MessageLoop::current()->CancelTask(throttle_id_);
+    EndThrottle();
+  }
+}
+
+void ParallelHttpFetcher::Throttle(base::TimeDelta delay) {
+  if (delay.is_zero() || throttled_ || probing_)
+    return;
+  throttled_ = true;
+  throttle_start_ = clock_->GetMonotonicTime();
+  for (Connection& connection : connections_) {
+    if (connection.active && !connection.terminating && !connection.paused) {
+      connection.paused = true;
+      connection.fetcher->Pause();
+    }
+  }
+  throttle_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ParallelHttpFetcher::EndThrottle, base::Unretained(this)),
+      delay);
+}
+
+void ParallelHttpFetcher::EndThrottle() {
+  throttle_id_ = MessageLoop::kTaskIdNull;
+  throttled_ = false;
+  interval_throttled_time_ += clock_->GetMonotonicTime() - throttle_start_;
+  ResumeConnections();
+}
+
+void ParallelHttpFetcher::set_idle_seconds(int seconds) {
+  for (Connection& connection : connections_)
+    connection.fetcher->set_idle_seconds(seconds);
+}
+
+void ParallelHttpFetcher::set_retry_seconds(int seconds) {
+  for (Connection& connection : connections_)
+    connection.fetcher->set_retry_seconds(seconds);
+}
+
+void ParallelHttpFetcher::set_low_speed_limit(int low_speed_bps,
+                                              int low_speed_sec) {
+  for (Connection& connection : connections_)
+    connection.fetcher->set_low_speed_limit(low_speed_bps, low_speed_sec);
+}
+
+void ParallelHttpFetcher::set_connect_timeout(int connect_timeout_seconds) {
+  for (Connection& connection : connections_)
+    connection.fetcher->set_connect_timeout(connect_timeout_seconds);
+}
+
+void ParallelHttpFetcher::set_max_retry_count(int max_retry_count) {
+  for (Connection& connection : connections_)
+    connection.fetcher->set_max_retry_count(max_retry_count);
+}
+
+size_t ParallelHttpFetcher::GetBytesDownloaded() {
+  size_t bytes_downloaded = 0;
+  for (Connection& connection : connections_)
+    bytes_downloaded += connection.fetcher->GetBytesDownloaded();
+  return bytes_downloaded;
+}
+
+std::map<string, int64_t> ParallelHttpFetcher::GetUrlThroughputs() const {
+  std::map<string, int64_t> throughputs;
+  for (const auto& url_throughput : url_throughputs_) {
+    throughputs[url_throughput.first] =
+        url_throughput.second.bytes / url_throughput.second.seconds;
+  }
+  return throughputs;
+}
+
+bool ParallelHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
+                                        const void* bytes,
+                                        size_t length) {
+  Connection* connection = FindConnection(fetcher);
+  CHECK(connection);
+  if (!connection->active || connection->terminating || failing_ ||
+      terminating_) {
+    return false;
+  }
+  http_response_code_ = fetcher->http_response_code();
+  connection->sample_bytes += length;
+  base::Time now = clock_->GetMonotonicTime();
+  base::TimeDelta delay = token_bucket_.Consume(length, now);
+  if (probing_)
+    ProbeReceivedBytes(length, now);
+  if (connection->hedge) {
+    if (!HedgeReceivedBytes(connection, bytes, length))
+      return false;
+    Throttle(delay);
+    return true;
+  }
+
+  Segment& segment = segments_[connection->segment];
+  size_t size = length;
+  if (segment.length > 0)
+    size = std::min(size, segment.length - segment.bytes_received);
+  segment.bytes_received += size;
+  bool segment_received =
+      segment.length > 0 && segment.bytes_received == segment.length;
+
+  if (!AddSegmentBytes(connection->segment, bytes, size))
+    return false;
+
+  if (segment_received) {
+    // This connection won the race, if any.
+    StopHedge(connection->segment);
+    // Like MultiRangeHttpFetcher, waits for the TransferTerminated callback
+    // before starting the next segment over this connection.
+    connection->terminating = true;
+    Throttle(delay);
+    fetcher->TerminateTransfer();
+    return false;
+  }
+  Throttle(delay);
+  return true;
+}
+
+bool ParallelHttpFetcher::HedgeReceivedBytes(Connection* hedge,
+                                             const void* bytes,
+                                             size_t length) {
+  Segment& segment = segments_[hedge->segment];
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  size_t size = std::min(
+      length, segment.length - hedge_start_ - hedge_buffer_.size());
+  hedge_buffer_.insert(hedge_buffer_.end(), data, data + size);
+  if (hedge_start_ + hedge_buffer_.size() < segment.length)
+    return true;
+
+  LOG(INFO) << hedge->url << " won the race for the segment at offset "
+            << segment.offset << ".";
+  // Only the bytes the connection of the segment didn't receive yet are
+  // added.
+  size_t index = hedge->segment;
+  brillo::Blob remaining(
+      hedge_buffer_.begin() + (segment.bytes_received - hedge_start_),
+      hedge_buffer_.end());
+  hedge_buffer_.clear();
+  segment.bytes_received = segment.length;
+  if (!AddSegmentBytes(index, remaining.data(), remaining.size()))
+    return false;
+
+  Connection* connection = FindSegmentConnection(index);
+  hedge->terminating = true;
+  hedge->fetcher->TerminateTransfer();
+  if (connection && !connection->terminating) {
+    // The connection keeps the faster URL for its next segments.
+    connection->url = hedge->url;
+    connection->terminating = true;
+    // Note that after this call this object may be destroyed.
+    connection->fetcher->TerminateTransfer();
+  }
+  return false;
+}
+
+bool ParallelHttpFetcher::AddSegmentBytes(size_t index,
+                                          const void* bytes,
+                                          size_t length) {
+  Segment& segment = segments_[index];
+  if (index == next_delivered_segment_ && segment.buffer.empty() &&
+      !paused_) {
+    // Note that after the callback returns false this object may be
+    // destroyed.
+    if (delegate_ && !delegate_->ReceivedBytes(this, bytes, length))
+      return false;
+  } else {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    segment.buffer.insert(segment.buffer.end(), data, data + length);
+  }
+  return true;
+}
+
+void ParallelHttpFetcher::TransferComplete(HttpFetcher* fetcher,
+                                           bool successful) {
+  ConnectionEnded(fetcher, successful);
+}
+
+void ParallelHttpFetcher::TransferTerminated(HttpFetcher* fetcher) {
+  ConnectionEnded(fetcher, false);
+}
+
+void ParallelHttpFetcher::ConnectionEnded(HttpFetcher* fetcher,
+                                          bool successful) {
+  Connection* connection = FindConnection(fetcher);
+  CHECK(connection);
+  CHECK(connection->active) << "Transfer ended unexpectedly.";
+  connection->active = connection->terminating = connection->paused = false;
+  connection->sampled = false;
+  if (connection->hedge) {
+    HedgeEnded(connection);
+    return;
+  }
+  // Keeps the response code of the segment that failed.
+  if (!failing_)
+    http_response_code_ = fetcher->http_response_code();
+  if (failing_ || terminating_) {
+    MaybeSignalEnded();
+    return;
+  }
+
+  Segment& segment = segments_[connection->segment];
+  if (segment.length > 0 && segment.bytes_received < segment.length &&
+      HedgeConnection(connection->segment)) {
+    LOG(WARNING) << "Failed to download the segment at offset "
+                 << segment.offset << " from " << connection->url
+                 << ", waiting for the race from "
+                 << HedgeConnection(connection->segment)->url << ".";
+    StartSegments();
+    return;
+  }
+  if (segment.length > 0 ? segment.bytes_received < segment.length
+                         : !successful) {
+    LOG(ERROR) << "Failed to download the segment at offset "
+               << segment.offset << ", received " << segment.bytes_received
+               << " bytes with code " << http_response_code_ << ".";
+    failing_ = true;
+    StopConnections();
+    return;
+  }
+  segment.done = true;
+  if (!DeliverSegments())
+    return;
+  StartSegments();
+}
+
+void ParallelHttpFetcher::StartSegments() {
+  // The transfer over a connection may end while it's being started, so the
+  // delegate is only signaled once all of them were started.
+  bool was_deferred = defer_end_signal_;
+  defer_end_signal_ = true;
+  size_t connection_limit = ActiveConnectionLimit();
+  for (size_t i = 0; i < connection_limit; i++) {
+    if (failing_ || terminating_ || paused_ || throttled_)
+      break;
+    if (next_started_segment_ >= segments_.size() ||
+        next_started_segment_ >=
+            next_delivered_segment_ + connection_limit) {
+      break;
+    }
+    Connection& connection = connections_[i];
+    if (connection.active)
+      continue;
+    const Segment& segment = segments_[next_started_segment_];
+    connection.segment = next_started_segment_++;
+    connection.active = true;
+    connection.fetcher->SetOffset(segment.offset);
+    if (segment.length > 0)
+      connection.fetcher->SetLength(segment.length);
+    else
+      connection.fetcher->UnsetLength();
+    connection.fetcher->BeginTransfer(connection.url);
+  }
+  defer_end_signal_ = was_deferred;
+  MaybeSignalEnded();
+}
+
+void ParallelHttpFetcher::HedgeEnded(Connection* hedge) {
+  hedge_buffer_.clear();
+  if (failing_ || terminating_) {
+    MaybeSignalEnded();
+    return;
+  }
+  Segment& segment = segments_[hedge->segment];
+  bool segment_received = segment.bytes_received == segment.length;
+  if (FindSegmentConnection(hedge->segment)) {
+    // The connection of the segment is still transferring it, or it's being
+    // terminated because the hedge connection won.
+    return;
+  }
+  if (!segment_received) {
+    LOG(ERROR) << "Failed to download the segment at offset "
+               << segment.offset << " from any URL.";
+    http_response_code_ = hedge->fetcher->http_response_code();
+    failing_ = true;
+    StopConnections();
+    return;
+  }
+  if (!segment.done) {
+    // The hedge connection won after the connection of the segment failed.
+    segment.done = true;
+    if (!DeliverSegments())
+      return;
+    StartSegments();
+    return;
+  }
+  MaybeSignalEnded();
+}
+
+void ParallelHttpFetcher::ScheduleThroughputCheck() {
+  if (throughput_check_id_ != MessageLoop::kTaskIdNull)
+    return;
+  interval_start_ = clock_->GetMonotonicTime();
+  interval_throttled_time_ = base::TimeDelta();
+  interval_paused_ = paused_;
+  throughput_check_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ParallelHttpFetcher::CheckThroughput,
+                 base::Unretained(this)),
+      base::TimeDelta::FromSeconds(kDownloadHedgeCheckIntervalSeconds));
+}
+
+void ParallelHttpFetcher::CheckThroughput() {
+  throughput_check_id_ = MessageLoop::kTaskIdNull;
+  base::Time now = clock_->GetMonotonicTime();
+  base::TimeDelta throttled_time = interval_throttled_time_;
+  if (throttled_) {
+    // The rest of the throttling counts in the next interval.
+    throttled_time += now - throttle_start_;
+    throttle_start_ = now;
+  }
+  // A probe the link was too slow to finish is measured over the time it
+  // had.
+  if (probing_)
+    EndProbe(now);
+  // The stretches between the pauses of a throttled interval are too short
+  // to measure, and start with the bytes buffered during the pauses, so only
+  // the intervals without any pause are. The throttled ones are measured by
+  // the probes.
+  base::TimeDelta interval_time = now - interval_start_;
+  uint64_t interval_bytes = 0;
+  for (const Connection& connection : connections_)
+    interval_bytes += connection.sample_bytes;
+  if (!interval_paused_ && throttled_time.is_zero() && interval_bytes > 0 &&
+      interval_time > base::TimeDelta()) {
+    AddLinkCapacitySample(interval_bytes * base::Time::kMicrosecondsPerSecond /
+                          interval_time.InMicroseconds());
+  }
+
+  Connection* slowest = nullptr;
+  int64_t slowest_bps = 0;
+  for (Connection& connection : connections_) {
+    // Only the connections transferring since the last check are measured.
+    if (connection.active && connection.sampled) {
+      int64_t bps =
+          connection.sample_bytes / kDownloadHedgeCheckIntervalSeconds;
+      UrlThroughput& url_throughput = url_throughputs_[connection.url];
+      url_throughput.bytes += connection.sample_bytes;
+      url_throughput.seconds += kDownloadHedgeCheckIntervalSeconds;
+      if (!connection.hedge && !connection.terminating &&
+          (!slowest || bps < slowest_bps)) {
+        slowest = &connection;
+        slowest_bps = bps;
+      }
+    }
+    connection.sampled = connection.active && !connection.paused;
+    connection.sample_bytes = 0;
+  }
+  ScheduleThroughputCheck();
+
+  if (!throttled_time.is_zero() && token_bucket_.rate() > 0 && !paused_ &&
+      now >= next_probe_) {
+    // Note that after this call this object may be destroyed.
+    StartProbe(now);
+    return;
+  }
+
+  // The connections of a rate limited transfer are slow on purpose.
+  if (!slowest || slowest_bps >= kDownloadHedgeLowSpeedBps || paused_ ||
+      token_bucket_.rate() > 0 || connections_.size() == num_connections_ ||
+      connections_.back().active) {
+    return;
+  }
+  const Segment& segment = segments_[slowest->segment];
+  if (segment.length == 0 || segment.hedged)
+    return;
+  string url = PickHedgeUrl(slowest->url);
+  if (url.empty())
+    return;
+  LOG(INFO) << "Downloading at " << slowest_bps << " bytes/s from "
+            << slowest->url << ", racing the rest of the segment at offset "
+            << segment.offset << " from " << url << ".";
+  StartHedge(slowest, url);
+}
+
+void ParallelHttpFetcher::StartProbe(base::Time now) {
+  LOG(INFO) << "Probing the link capacity.";
+  probing_ = true;
+  probe_start_ = now;
+  probe_bytes_ = 0;
+  if (throttled_) {
+    MessageLoop::current()->CancelTask(throttle_id_);
+    // Note that after this call this object may be destroyed.
+    EndThrottle();
+  }
+}
+
+void ParallelHttpFetcher::ProbeReceivedBytes(size_t length, base::Time now) {
+  base::TimeDelta elapsed = now - probe_start_;
+  if (elapsed < base::TimeDelta::FromMilliseconds(
+                    kDownloadCapacityProbeWarmupMs)) {
+    return;
+  }
+  probe_bytes_ += length;
+  if (elapsed >= base::TimeDelta::FromMilliseconds(
+                     kDownloadCapacityProbeWarmupMs) +
+                     base::TimeDelta::FromSeconds(
+                         kDownloadCapacityProbeSeconds)) {
+    EndProbe(now);
+  }
+}
+
+void ParallelHttpFetcher::EndProbe(base::Time now) {
+  probing_ = false;
+  next_probe_ =
+      now + base::TimeDelta::FromSeconds(kDownloadCapacityProbeIntervalSeconds);
+  base::TimeDelta probe_time =
+      now - probe_start_ -
+      base::TimeDelta::FromMilliseconds(kDownloadCapacityProbeWarmupMs);
+  if (probe_bytes_ == 0 || probe_time <= base::TimeDelta())
+    return;
+  AddLinkCapacitySample(probe_bytes_ * base::Time::kMicrosecondsPerSecond /
+                        probe_time.InMicroseconds());
+  LOG(INFO) << "Measured a link capacity of " << link_capacity_
+            << " bytes/s.";
+}
+
+void ParallelHttpFetcher::AddLinkCapacitySample(int64_t bps) {
+  // Smooths the measurements, since a connection may be idle for part of
+  // an interval.
+  link_capacity_ = link_capacity_ > 0 ? (link_capacity_ + bps) / 2 : bps;
+}
+
+void ParallelHttpFetcher::StartHedge(Connection* slow, const string& url) {
+  Segment& segment = segments_[slow->segment];
+  segment.hedged = true;
+  hedge_start_ = segment.bytes_received;
+  hedge_buffer_.clear();
+  Connection& hedge = connections_.back();
+  hedge.segment = slow->segment;
+  hedge.active = true;
+  hedge.url = url;
+  hedge.fetcher->SetOffset(segment.offset + hedge_start_);
+  hedge.fetcher->SetLength(segment.length - hedge_start_);
+  // Note that after this call this object may be destroyed.
+  hedge.fetcher->BeginTransfer(url);
+}
+
+string ParallelHttpFetcher::PickHedgeUrl(const string& slow_url) const {
+  vector<string> urls = {url_};
+  urls.insert(urls.end(), alternate_urls_.begin(), alternate_urls_.end());
+  for (const string& url : urls) {
+    if (url == slow_url)
+      continue;
+    auto it = url_throughputs_.find(url);
+    if (it != url_throughputs_.end() &&
+        it->second.bytes / it->second.seconds < kDownloadHedgeLowSpeedBps) {
+      continue;
+    }
+    return url;
+  }
+  return "";
+}
+
+void ParallelHttpFetcher::StopHedge(size_t index) {
+  Connection* hedge = HedgeConnection(index);
+  if (hedge) {
+    hedge->terminating = true;
+    hedge->fetcher->TerminateTransfer();
+  }
+}
+
+bool ParallelHttpFetcher::DeliverSegments() {
+  while (next_delivered_segment_ < segments_.size() && !paused_) {
+    if (!segments_[next_delivered_segment_].buffer.empty()) {
+      brillo::Blob buffer;
+      buffer.swap(segments_[next_delivered_segment_].buffer);
+      // Note that after the callback returns false this object may be
+      // destroyed.
+      if (delegate_ &&
+          !delegate_->ReceivedBytes(this, buffer.data(), buffer.size())) {
+        return false;
+      }
+      continue;
+    }
+    if (!segments_[next_delivered_segment_].done)
+      break;
+    next_delivered_segment_++;
+  }
+  return true;
+}
+
+void ParallelHttpFetcher::StopConnections() {
+  bool was_deferred = defer_end_signal_;
+  defer_end_signal_ = true;
+  for (Connection& connection : connections_) {
+    if (connection.active && !connection.terminating) {
+      connection.terminating = true;
+      connection.fetcher->TerminateTransfer();
+    }
+  }
+  defer_end_signal_ = was_deferred;
+  MaybeSignalEnded();
+}
+
+void ParallelHttpFetcher::MaybeSignalEnded() {
+  if (defer_end_signal_ || !transfer_active_ || HasActiveConnections())
+    return;
+  if (terminating_) {
+    LOG(INFO) << "Terminating.";
+    Reset();
+    // Note that after the callback returns this object may be destroyed.
+    if (delegate_)
+      delegate_->TransferTerminated(this);
+    return;
+  }
+  if (failing_) {
+    Reset();
+    // Note that after the callback returns this object may be destroyed.
+    if (delegate_)
+      delegate_->TransferComplete(this, false);
+    return;
+  }
+  if (next_delivered_segment_ < segments_.size())
+    return;
+  LOG(INFO) << "Done w/ all segments";
+  Reset();
+  // Note that after the callback returns this object may be destroyed.
+  if (delegate_)
+    delegate_->TransferComplete(this, true);
+}
+
+size_t ParallelHttpFetcher::ActiveConnectionLimit() const {
+  return max_connections_ > 0 ? std::min(max_connections_, num_connections_)
+                              : num_connections_;
+}
+
+ParallelHttpFetcher::Connection* ParallelHttpFetcher::FindConnection(
+    HttpFetcher* fetcher) {
+  for (Connection& connection : connections_) {
+    if (connection.fetcher.get() == fetcher)
+      return &connection;
+  }
+  return nullptr;
+}
+
+ParallelHttpFetcher::Connection* ParallelHttpFetcher::FindSegmentConnection(
+    size_t index) {
+  for (size_t i = 0; i < num_connections_; i++) {
+    if (connections_[i].active && connections_[i].segment == index)
+      return &connections_[i];
+  }
+  return nullptr;
+}
+
+ParallelHttpFetcher::Connection* ParallelHttpFetcher::HedgeConnection(
+    size_t index) {
+  if (connections_.size() == num_connections_)
+    return nullptr;
+  Connection* hedge = &connections_.back();
+  return hedge->active && !hedge->terminating && hedge->segment == index
+             ? hedge
+             : nullptr;
+}
+
+bool ParallelHttpFetcher::HasActiveConnections() const {
+  return std::any_of(
+      connections_.begin(),
+      connections_.end(),
+      [](const Connection& connection) { return connection.active; });
+}
+
+void ParallelHttpFetcher::Reset() {
+  transfer_active_ = paused_ = failing_ = terminating_ = false;
+  if (throughput_check_id_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(throughput_check_id_);
+    throughput_check_id_ = MessageLoop::kTaskIdNull;
+  }
+  if (throttle_id_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(throttle_id_);
+    throttle_id_ = MessageLoop::kTaskIdNull;
+  }
+  throttled_ = false;
+  // A probe cut short by the end of the transfer is measured over the time
+  // it had.
+  if (probing_)
+    EndProbe(clock_->GetMonotonicTime());
+  for (Connection& connection : connections_) {
+    connection.sampled = false;
+    connection.sample_bytes = 0;
+  }
+  hedge_buffer_.clear();
+  segments_.clear();
+  next_delivered_segment_ = next_started_segment_ = 0;
+}
+
+}  // namespace chromeos_update_engine
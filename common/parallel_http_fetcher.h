@@ -0,0 +1,321 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_PARALLEL_HTTP_FETCHER_H_
+#define UPDATE_ENGINE_COMMON_PARALLEL_HTTP_FETCHER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/clock.h"
+#include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/token_bucket.h"
+
+// ParallelHttpFetcher downloads a range of a URL over several connections at
+// once. The range is split in segments of a fixed size and every connection,
+// which is an HttpFetcher of its own, downloads one segment at a time. The
+// bytes are passed to the delegate in order: the bytes of the first segment
+// not delivered yet go straight to the delegate and the bytes of the segments
+// after it are kept in a reorder buffer until their turn comes. A connection
+// only starts a segment less than the number of connections ahead of the
+// first one not delivered yet, so the reorder buffer never holds more than
+// (connections - 1) segments.
+//
+// Since the delegate sees a single in-order stream starting at the offset
+// passed to SetOffset(), this fetcher can be used as the base fetcher of a
+// MultiRangeHttpFetcher without changing the offsets it reports. A range of
+// unspecified length is downloaded over the first connection only, and so is
+// every range when SetMaxConnections() limits the transfer to one connection.
+//
+// Given a hedge fetcher and alternate URLs, the throughput of every connection
+// is checked periodically. When the slowest one drops below a threshold, the
+// bytes of its segment not received yet are raced from an alternate URL over
+// the hedge fetcher. Whichever gets them first completes the segment and the
+// other one is terminated. If the alternate URL wins, the slow connection
+// keeps using it for its next segments. The throughput measured for every URL
+// is reported by GetUrlThroughputs().
+//
+// SetMaxDownloadRate() limits the rate of all the connections together with a
+// token bucket: once the bytes received get ahead of the rate, all the
+// connections are paused until the bucket is out of debt. The link capacity
+// reported by GetLinkCapacity() is measured over the intervals between two
+// throughput checks without any pause and, while the rate is limited, by
+// letting the connections go at full speed for a short probe from time to
+// time.
+
+namespace chromeos_update_engine {
+
+class ParallelHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
+ public:
+  // Takes ownership of the passed in |fetchers|, one per connection. There
+  // must be at least one. Each connection downloads |segment_size| bytes at a
+  // time.
+  ParallelHttpFetcher(std::vector<std::unique_ptr<HttpFetcher>> fetchers,
+                      size_t segment_size);
+  ~ParallelHttpFetcher() override;
+
+  // Takes ownership of the passed in |fetcher|, used to race the segment of a
+  // slow connection from an alternate URL.
+  void SetHedgeFetcher(std::unique_ptr<HttpFetcher> fetcher);
+
+  // HttpFetcher overrides.
+  void SetOffset(off_t offset) override { offset_ = offset; }
+  void SetLength(size_t length) override { length_ = length; }
+  void UnsetLength() override { length_ = 0; }
+
+  void BeginTransfer(const std::string& url) override;
+  void TerminateTransfer() override;
+
+  void SetHeader(const std::string& header_name,
+                 const std::string& header_value) override;
+  bool GetHeader(const std::string& header_name,
+                 std::string* header_value) const override {
+    return connections_[0].fetcher->GetHeader(header_name, header_value);
+  }
+
+  void Pause() override;
+  void Unpause() override;
+
+  void set_idle_seconds(int seconds) override;
+  void set_retry_seconds(int seconds) override;
+  void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override;
+  void set_connect_timeout(int connect_timeout_seconds) override;
+  void set_max_retry_count(int max_retry_count) override;
+
+  size_t GetBytesDownloaded() override;
+
+  void SetAlternateUrls(const std::vector<std::string>& urls) override {
+    alternate_urls_ = urls;
+  }
+  void SetMaxConnections(size_t max_connections) override {
+    max_connections_ = max_connections;
+  }
+  std::map<std::string, int64_t> GetUrlThroughputs() const override;
+
+  void SetMaxDownloadRate(int64_t bytes_per_second) override;
+  int64_t GetLinkCapacity() const override { return link_capacity_; }
+
+  size_t num_connections() const { return num_connections_; }
+
+  // Testing
+  void set_clock(ClockInterface* clock) { clock_ = clock; }
+
+ private:
+  // A part of the range downloaded over a single connection. Zero length
+  // indicates an unspecified end offset.
+  struct Segment {
+    off_t offset;
+    size_t length;
+    size_t bytes_received = 0;
+    // Whether all the bytes of the segment were received.
+    bool done = false;
+    // Whether the segment was raced over the hedge connection.
+    bool hedged = false;
+    // The bytes received but not passed to the delegate yet.
+    brillo::Blob buffer;
+  };
+
+  struct Connection {
+    std::unique_ptr<HttpFetcher> fetcher;
+    // Whether |fetcher| is transferring a segment.
+    bool active = false;
+    // Whether TerminateTransfer() or Pause() was called on |fetcher| during
+    // the current transfer.
+    bool terminating = false;
+    bool paused = false;
+    // The index in |segments_| of the segment being transferred.
+    size_t segment = 0;
+    // Whether this is the connection racing the segment of a slow one.
+    bool hedge = false;
+    // The URL the segments are downloaded from.
+    std::string url;
+    // Whether the connection was transferring at the last throughput check,
+    // and the bytes received since then.
+    bool sampled = false;
+    size_t sample_bytes = 0;
+  };
+
+  // The bytes received from a URL and the time it took, over the intervals
+  // between two throughput checks.
+  struct UrlThroughput {
+    uint64_t bytes = 0;
+    int64_t seconds = 0;
+  };
+
+  // HttpFetcherDelegate overrides.
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void SeekToOffset(off_t offset) override {}
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+  void TransferTerminated(HttpFetcher* fetcher) override;
+
+  // Called when the transfer of a segment over |fetcher| ended.
+  void ConnectionEnded(HttpFetcher* fetcher, bool successful);
+
+  // Adds the |length| bytes received for the segment |index| to the stream
+  // passed to the delegate, right away if they are next in order or else
+  // through the reorder buffer. Returns false if the delegate returned false,
+  // in which case this object may have been destroyed.
+  bool AddSegmentBytes(size_t index, const void* bytes, size_t length);
+
+  // Called when the transfer of a segment over the hedge connection ended.
+  void HedgeEnded(Connection* hedge);
+
+  // Handles the bytes received over the hedge connection.
+  bool HedgeReceivedBytes(Connection* hedge, const void* bytes, size_t length);
+
+  // Starts the next segments on the idle connections.
+  void StartSegments();
+
+  // Measures the throughput of every connection and of the link, and races
+  // the segment of the slowest connection if it's below
+  // kDownloadHedgeLowSpeedBps.
+  void CheckThroughput();
+  void ScheduleThroughputCheck();
+
+  // Races the bytes of the segment of |slow| not received yet from |url|.
+  void StartHedge(Connection* slow, const std::string& url);
+
+  // Returns the first URL other than |slow_url| that isn't known to be slow,
+  // or an empty string if there is none.
+  std::string PickHedgeUrl(const std::string& slow_url) const;
+
+  // Stops the hedge connection if it's racing the segment |index|.
+  void StopHedge(size_t index);
+
+  // Pauses all the connections for |delay|, unless it's zero, they are
+  // throttled already or the link capacity is being probed.
+  void Throttle(base::TimeDelta delay);
+  void EndThrottle();
+
+  // Lets the connections go at full speed to measure the link capacity,
+  // until enough bytes were received at |now| or the next throughput check.
+  // Note that after StartProbe() this object may be destroyed.
+  void StartProbe(base::Time now);
+  void ProbeReceivedBytes(size_t length, base::Time now);
+  void EndProbe(base::Time now);
+
+  // Adds the |bps| measured to the link capacity.
+  void AddLinkCapacitySample(int64_t bps);
+
+  // Unpauses the connections unless the transfer is paused or throttled, then
+  // passes the buffered bytes to the delegate and starts the next segments.
+  void ResumeConnections();
+
+  // Passes the buffered bytes that are next in order to the delegate. Returns
+  // false if the delegate returned false, in which case this object may have
+  // been destroyed.
+  bool DeliverSegments();
+
+  // Stops the transfer over all the connections. Once they are all idle the
+  // delegate is signaled that the transfer failed, or was terminated if
+  // TerminateTransfer() was called.
+  void StopConnections();
+
+  // Signals the delegate that the transfer ended once no connection is
+  // active and, if it didn't fail, all the segments were passed to the
+  // delegate. Does nothing while |defer_end_signal_| is set.
+  void MaybeSignalEnded();
+
+  // Returns the number of connections the transfer may use at once.
+  size_t ActiveConnectionLimit() const;
+
+  Connection* FindConnection(HttpFetcher* fetcher);
+  // Returns the connection other than the hedge one transferring the segment
+  // |index|, if any.
+  Connection* FindSegmentConnection(size_t index);
+  // Returns the hedge connection if it's racing the segment |index|.
+  Connection* HedgeConnection(size_t index);
+  bool HasActiveConnections() const;
+
+  void Reset();
+
+  // The connections, followed by the hedge connection if there is one.
+  std::vector<Connection> connections_;
+  const size_t num_connections_;
+  const size_t segment_size_;
+  // The limit set by SetMaxConnections(), 0 if there is none.
+  size_t max_connections_{0};
+
+  std::string url_;
+  std::vector<std::string> alternate_urls_;
+  off_t offset_{0};
+  size_t length_{0};
+
+  std::vector<Segment> segments_;
+  // The index of the first segment not passed to the delegate yet.
+  size_t next_delivered_segment_{0};
+  // The index of the first segment not started yet.
+  size_t next_started_segment_{0};
+
+  bool transfer_active_{false};
+  bool paused_{false};
+  // Whether the transfer is being stopped because a segment failed, or
+  // because TerminateTransfer() was called.
+  bool failing_{false};
+  bool terminating_{false};
+  // Set while calling into several connections, any of which may end its
+  // transfer right away, so the delegate is only signaled after the last one.
+  bool defer_end_signal_{false};
+
+  // The bytes received over the hedge connection, which start
+  // |hedge_start_| bytes into its segment.
+  size_t hedge_start_{0};
+  brillo::Blob hedge_buffer_;
+
+  std::map<std::string, UrlThroughput> url_throughputs_;
+  brillo::MessageLoop::TaskId throughput_check_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  Clock default_clock_;
+  ClockInterface* clock_{&default_clock_};
+
+  // Shapes the rate of all the connections together.
+  TokenBucket token_bucket_;
+  // Whether the connections are paused because the bucket is in debt, since
+  // when, and the task that unpauses them.
+  bool throttled_{false};
+  base::Time throttle_start_;
+  brillo::MessageLoop::TaskId throttle_id_{brillo::MessageLoop::kTaskIdNull};
+
+  // The start of the current interval between two throughput checks, the
+  // time the connections were throttled in it and whether the transfer was
+  // paused in it.
+  base::Time interval_start_;
+  base::TimeDelta interval_throttled_time_;
+  bool interval_paused_{false};
+  int64_t link_capacity_{0};
+
+  // Whether the link capacity is being probed, since when, the bytes received
+  // after the warmup of the probe, and when the next probe is due.
+  bool probing_{false};
+  base::Time probe_start_;
+  uint64_t probe_bytes_{0};
+  base::Time next_probe_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelHttpFetcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_PARALLEL_HTTP_FETCHER_H_
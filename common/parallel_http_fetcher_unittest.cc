@@ -0,0 +1,332 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/parallel_http_fetcher.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/test/simple_test_clock.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/clock_interface.h"
+#include "update_engine/common/fake_clock.h"
+#include "update_engine/common/http_common.h"
+#include "update_engine/common/mock_http_fetcher.h"
+#include "update_engine/common/multi_range_http_fetcher.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Every segment takes two chunks of the MockHttpFetcher, so the connections
+// after the first one receive bytes before their turn comes.
+constexpr size_t kSegmentSize = kMockHttpFetcherChunkSize + 1000;
+
+const char kTestUrl[] = "http://example.com/payload";
+const char kAlternateUrl[] = "http://mirror.example.com/payload";
+
+// A MockHttpFetcher that records the URLs it's started with and, if
+// |stall_once| is set, receives nothing in its first transfer.
+class UrlRecordingHttpFetcher : public MockHttpFetcher {
+ public:
+  UrlRecordingHttpFetcher(const string& data, bool stall_once)
+      : MockHttpFetcher(data.data(), data.size(), nullptr),
+        stall_once_(stall_once) {}
+
+  void BeginTransfer(const string& url) override {
+    urls_.push_back(url);
+    if (stall_once_) {
+      stall_once_ = false;
+      return;
+    }
+    MockHttpFetcher::BeginTransfer(url);
+  }
+
+  const vector<string>& urls() const { return urls_; }
+
+ private:
+  bool stall_once_;
+  vector<string> urls_;
+};
+
+// A MockHttpFetcher that counts the times it's paused.
+class PauseCountingHttpFetcher : public MockHttpFetcher {
+ public:
+  explicit PauseCountingHttpFetcher(const string& data)
+      : MockHttpFetcher(data.data(), data.size(), nullptr) {}
+
+  void Pause() override {
+    pauses_++;
+    MockHttpFetcher::Pause();
+  }
+
+  int pauses() const { return pauses_; }
+
+ private:
+  int pauses_{0};
+};
+
+// A clock following the time of the FakeMessageLoop, which moves forward to
+// the time of every delayed task it runs.
+class LoopClock : public ClockInterface {
+ public:
+  explicit LoopClock(const base::SimpleTestClock* clock) : clock_(clock) {}
+
+  base::Time GetWallclockTime() const override { return clock_->Now(); }
+  base::Time GetMonotonicTime() const override { return clock_->Now(); }
+  base::Time GetBootTime() const override { return clock_->Now(); }
+
+ private:
+  const base::SimpleTestClock* clock_;
+};
+
+class ParallelHttpFetcherTestDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    data_.append(static_cast<const char*>(bytes), length);
+    return true;
+  }
+
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    times_transfer_complete_called_++;
+    successful_ = successful;
+    http_response_code_ = fetcher->http_response_code();
+    brillo::MessageLoop::current()->BreakLoop();
+  }
+
+  void TransferTerminated(HttpFetcher* fetcher) override {
+    ADD_FAILURE();
+    brillo::MessageLoop::current()->BreakLoop();
+  }
+
+  string data_;
+  int times_transfer_complete_called_{0};
+  bool successful_{false};
+  int http_response_code_{0};
+};
+
+void StartTransfer(HttpFetcher* http_fetcher, const string& url) {
+  http_fetcher->BeginTransfer(url);
+}
+
+}  // namespace
+
+class ParallelHttpFetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    data_.resize(7 * kSegmentSize + 123);
+    for (size_t i = 0; i < data_.size(); i++)
+      data_[i] = 'a' + i * 7 % 26;
+  }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  // Creates a ParallelHttpFetcher with |num_connections| MockHttpFetchers,
+  // all of them serving |data_|.
+  unique_ptr<ParallelHttpFetcher> CreateFetcher(size_t num_connections) {
+    vector<unique_ptr<HttpFetcher>> fetchers;
+    mock_fetchers_.clear();
+    for (size_t i = 0; i < num_connections; i++) {
+      auto fetcher = std::make_unique<MockHttpFetcher>(
+          data_.data(), data_.size(), nullptr);
+      mock_fetchers_.push_back(fetcher.get());
+      fetchers.push_back(std::move(fetcher));
+    }
+    return std::make_unique<ParallelHttpFetcher>(std::move(fetchers),
+                                                 kSegmentSize);
+  }
+
+  void RunTransfer(HttpFetcher* fetcher) {
+    fetcher->set_delegate(&delegate_);
+    loop_.PostTask(FROM_HERE, base::Bind(StartTransfer, fetcher, kTestUrl));
+    loop_.Run();
+  }
+
+  base::SimpleTestClock test_clock_;
+  brillo::FakeMessageLoop loop_{&test_clock_};
+  string data_;
+  vector<MockHttpFetcher*> mock_fetchers_;
+  ParallelHttpFetcherTestDelegate delegate_;
+};
+
+TEST_F(ParallelHttpFetcherTest, SegmentsAreDeliveredInOrderTest) {
+  auto fetcher = CreateFetcher(3);
+  fetcher->SetOffset(0);
+  fetcher->SetLength(data_.size());
+  RunTransfer(fetcher.get());
+
+  EXPECT_EQ(1, delegate_.times_transfer_complete_called_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_, delegate_.data_);
+  // All the connections were used.
+  for (MockHttpFetcher* mock_fetcher : mock_fetchers_)
+    EXPECT_LT(0U, mock_fetcher->GetBytesDownloaded());
+}
+
+TEST_F(ParallelHttpFetcherTest, OffsetAndLengthTest) {
+  auto fetcher = CreateFetcher(2);
+  fetcher->SetOffset(1000);
+  fetcher->SetLength(3 * kSegmentSize + 10);
+  RunTransfer(fetcher.get());
+
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_.substr(1000, 3 * kSegmentSize + 10), delegate_.data_);
+}
+
+TEST_F(ParallelHttpFetcherTest, UnsetLengthUsesOneConnectionTest) {
+  auto fetcher = CreateFetcher(3);
+  fetcher->SetOffset(5);
+  fetcher->UnsetLength();
+  RunTransfer(fetcher.get());
+
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_.substr(5), delegate_.data_);
+  EXPECT_EQ(0U, mock_fetchers_[1]->GetBytesDownloaded());
+  EXPECT_EQ(0U, mock_fetchers_[2]->GetBytesDownloaded());
+}
+
+TEST_F(ParallelHttpFetcherTest, MaxConnectionsTest) {
+  // The limit passes through a MultiRangeHttpFetcher.
+  MultiRangeHttpFetcher multi_fetcher(CreateFetcher(3).release());
+  multi_fetcher.SetMaxConnections(1);
+  multi_fetcher.ClearRanges();
+  multi_fetcher.AddRange(0, data_.size());
+  RunTransfer(&multi_fetcher);
+
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_, delegate_.data_);
+  EXPECT_EQ(data_.size(), mock_fetchers_[0]->GetBytesDownloaded());
+  EXPECT_EQ(0U, mock_fetchers_[1]->GetBytesDownloaded());
+  EXPECT_EQ(0U, mock_fetchers_[2]->GetBytesDownloaded());
+}
+
+TEST_F(ParallelHttpFetcherTest, FailedSegmentFailsTransferTest) {
+  auto fetcher = CreateFetcher(3);
+  mock_fetchers_[1]->FailTransfer(kHttpResponseNotFound);
+  fetcher->SetOffset(0);
+  fetcher->SetLength(data_.size());
+  RunTransfer(fetcher.get());
+
+  EXPECT_EQ(1, delegate_.times_transfer_complete_called_);
+  EXPECT_FALSE(delegate_.successful_);
+  EXPECT_EQ(kHttpResponseNotFound, delegate_.http_response_code_);
+  // Nothing past the failed segment was delivered.
+  EXPECT_GE(kSegmentSize, delegate_.data_.size());
+}
+
+TEST_F(ParallelHttpFetcherTest, SlowConnectionIsRacedTest) {
+  vector<unique_ptr<HttpFetcher>> fetchers;
+  vector<UrlRecordingHttpFetcher*> recording_fetchers;
+  for (size_t i = 0; i < 3; i++) {
+    // The second connection receives nothing for its first segment.
+    auto fetcher = std::make_unique<UrlRecordingHttpFetcher>(data_, i == 1);
+    recording_fetchers.push_back(fetcher.get());
+    fetchers.push_back(std::move(fetcher));
+  }
+  ParallelHttpFetcher fetcher(std::move(fetchers), kSegmentSize);
+  auto hedge_fetcher = std::make_unique<UrlRecordingHttpFetcher>(data_, false);
+  UrlRecordingHttpFetcher* hedge = hedge_fetcher.get();
+  fetcher.SetHedgeFetcher(std::move(hedge_fetcher));
+  fetcher.SetAlternateUrls({kAlternateUrl});
+  fetcher.SetOffset(0);
+  fetcher.SetLength(data_.size());
+  RunTransfer(&fetcher);
+
+  EXPECT_EQ(1, delegate_.times_transfer_complete_called_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_, delegate_.data_);
+  // The stalled segment was raced from the alternate URL, which the slow
+  // connection kept for its next segment.
+  EXPECT_EQ(vector<string>{kAlternateUrl}, hedge->urls());
+  ASSERT_LE(2U, recording_fetchers[1]->urls().size());
+  EXPECT_EQ(kTestUrl, recording_fetchers[1]->urls()[0]);
+  EXPECT_EQ(kAlternateUrl, recording_fetchers[1]->urls()[1]);
+  EXPECT_EQ(0, fetcher.GetUrlThroughputs()[kTestUrl]);
+}
+
+TEST_F(ParallelHttpFetcherTest, RateLimitThrottlesAllConnectionsTest) {
+  vector<unique_ptr<HttpFetcher>> fetchers;
+  vector<PauseCountingHttpFetcher*> counting_fetchers;
+  for (size_t i = 0; i < 3; i++) {
+    auto fetcher = std::make_unique<PauseCountingHttpFetcher>(data_);
+    counting_fetchers.push_back(fetcher.get());
+    fetchers.push_back(std::move(fetcher));
+  }
+  ParallelHttpFetcher fetcher(std::move(fetchers), kSegmentSize);
+  // The time doesn't move, so the bucket is in debt after the first chunk and
+  // every chunk after it throttles the transfer.
+  FakeClock fake_clock;
+  fetcher.set_clock(&fake_clock);
+  fetcher.SetMaxDownloadRate(kMockHttpFetcherChunkSize);
+  fetcher.SetOffset(0);
+  fetcher.SetLength(data_.size());
+  RunTransfer(&fetcher);
+
+  EXPECT_EQ(1, delegate_.times_transfer_complete_called_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_, delegate_.data_);
+  for (const PauseCountingHttpFetcher* counting_fetcher : counting_fetchers)
+    EXPECT_LT(0, counting_fetcher->pauses());
+}
+
+TEST_F(ParallelHttpFetcherTest, LinkCapacityIsProbedTest) {
+  // The MockHttpFetcher receives a chunk every 10 ms, so the link is about 25
+  // times faster than the rate limit, like a fast link under the default
+  // limit of background downloads, and the intervals between the throughput
+  // checks are throttled most of the time.
+  constexpr int64_t kRate = 4 * kMockHttpFetcherChunkSize;
+  data_.resize(200 * kMockHttpFetcherChunkSize);
+  auto fetcher = CreateFetcher(1);
+  LoopClock clock(&test_clock_);
+  fetcher->set_clock(&clock);
+  fetcher->SetMaxDownloadRate(kRate);
+  fetcher->SetOffset(0);
+  fetcher->SetLength(data_.size());
+  RunTransfer(fetcher.get());
+
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_, delegate_.data_);
+  // The probe measured the link, so the rate limit can follow it.
+  EXPECT_LT(8 * kRate, fetcher->GetLinkCapacity());
+}
+
+TEST_F(ParallelHttpFetcherTest, MultiRangeHttpFetcherTest) {
+  MultiRangeHttpFetcher multi_fetcher(CreateFetcher(3).release());
+  multi_fetcher.ClearRanges();
+  multi_fetcher.AddRange(0, 2 * kSegmentSize + 10);
+  multi_fetcher.AddRange(5 * kSegmentSize, kSegmentSize);
+  RunTransfer(&multi_fetcher);
+
+  EXPECT_EQ(1, delegate_.times_transfer_complete_called_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(data_.substr(0, 2 * kSegmentSize + 10) +
+                data_.substr(5 * kSegmentSize, kSegmentSize),
+            delegate_.data_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,54 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/token_bucket.h"
+
+#include <algorithm>
+
+namespace chromeos_update_engine {
+
+void TokenBucket::SetRate(int64_t bytes_per_second, base::Time now) {
+  rate_ = std::max<int64_t>(bytes_per_second, 0);
+  tokens_ = rate_;
+  last_refill_ = now;
+}
+
+base::TimeDelta TokenBucket::Consume(size_t bytes, base::Time now) {
+  if (rate_ == 0)
+    return base::TimeDelta();
+  Refill(now);
+  tokens_ -= bytes;
+  if (tokens_ >= 0)
+    return base::TimeDelta();
+  // Rounds up, so the debt is paid back once the delay is over.
+  return base::TimeDelta::FromMicroseconds(
+      (-tokens_ * base::Time::kMicrosecondsPerSecond + rate_ - 1) / rate_);
+}
+
+void TokenBucket::Refill(base::Time now) {
+  int64_t elapsed_us = (now - last_refill_).InMicroseconds();
+  if (elapsed_us <= 0)
+    return;
+  // Checks for a full bucket first, so long pauses don't overflow.
+  int64_t missing = rate_ - tokens_;
+  if (elapsed_us >= missing * base::Time::kMicrosecondsPerSecond / rate_)
+    tokens_ = rate_;
+  else
+    tokens_ += elapsed_us * rate_ / base::Time::kMicrosecondsPerSecond;
+  last_refill_ = now;
+}
+
+}  // namespace chromeos_update_engine
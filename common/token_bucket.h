@@ -0,0 +1,59 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_TOKEN_BUCKET_H_
+#define UPDATE_ENGINE_COMMON_TOKEN_BUCKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// TokenBucket limits the rate of a stream of bytes. The bucket fills up with
+// one token per byte at the given rate and holds up to one second worth of
+// tokens, so short bursts go through at full speed. Since the bytes of a
+// download were already received when they are counted, the bucket may go
+// into debt; the stream must then stop until the debt is paid back.
+class TokenBucket {
+ public:
+  TokenBucket() = default;
+
+  // Sets the rate to |bytes_per_second|, or removes the limit if it's 0. The
+  // bucket starts full at |now|.
+  void SetRate(int64_t bytes_per_second, base::Time now);
+  int64_t rate() const { return rate_; }
+
+  // Takes |bytes| tokens out of the bucket at |now|. Returns how long the
+  // stream must stop for the bucket to be out of debt, which is zero if it
+  // isn't in debt or there is no limit.
+  base::TimeDelta Consume(size_t bytes, base::Time now);
+
+ private:
+  // Adds the tokens accumulated since the last call, up to the size of the
+  // bucket.
+  void Refill(base::Time now);
+
+  int64_t rate_{0};
+  // The tokens in the bucket, negative when it's in debt.
+  int64_t tokens_{0};
+  base::Time last_refill_;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_TOKEN_BUCKET_H_
@@ -0,0 +1,71 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/token_bucket.h"
+
+#include <gtest/gtest.h>
+
+using base::Time;
+using base::TimeDelta;
+
+namespace chromeos_update_engine {
+
+class TokenBucketTest : public ::testing::Test {
+ protected:
+  const Time start_ = Time::FromInternalValue(1000000);
+  TokenBucket bucket_;
+};
+
+TEST_F(TokenBucketTest, UnlimitedTest) {
+  EXPECT_EQ(0, bucket_.rate());
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(1 << 30, start_));
+}
+
+TEST_F(TokenBucketTest, BurstGoesThroughTest) {
+  bucket_.SetRate(1000, start_);
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(600, start_));
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(400, start_));
+  // The bucket is empty now.
+  EXPECT_EQ(TimeDelta::FromMilliseconds(1), bucket_.Consume(1, start_));
+}
+
+TEST_F(TokenBucketTest, DebtIsPaidBackOverTimeTest) {
+  bucket_.SetRate(1000, start_);
+  EXPECT_EQ(TimeDelta::FromMilliseconds(1500), bucket_.Consume(2500, start_));
+  // Half a second later a second is left to wait.
+  Time now = start_ + TimeDelta::FromMilliseconds(500);
+  EXPECT_EQ(TimeDelta::FromSeconds(1), bucket_.Consume(0, now));
+  now += TimeDelta::FromSeconds(1);
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(0, now));
+}
+
+TEST_F(TokenBucketTest, BucketHoldsOneSecondTest) {
+  bucket_.SetRate(1000, start_);
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(1000, start_));
+  // A long pause only refills the bucket up to one second worth of tokens.
+  Time now = start_ + TimeDelta::FromDays(365);
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(1000, now));
+  EXPECT_EQ(TimeDelta::FromMilliseconds(100), bucket_.Consume(100, now));
+}
+
+TEST_F(TokenBucketTest, RemovingTheLimitTest) {
+  bucket_.SetRate(1000, start_);
+  EXPECT_LT(TimeDelta(), bucket_.Consume(5000, start_));
+  bucket_.SetRate(0, start_);
+  EXPECT_EQ(TimeDelta(), bucket_.Consume(5000, start_));
+}
+
+}  // namespace chromeos_update_engine
@@ -20,7 +20,9 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
+#include <base/bind.h>
 #include <base/files/file_path.h>
 #include <base/metrics/statistics_recorder.h>
 #include <base/strings/stringprintf.h>
@@ -34,9 +36,15 @@
 #include "update_engine/cros/omaha_request_params.h"
 #include "update_engine/cros/p2p_manager.h"
 #include "update_engine/cros/payload_state_interface.h"
+#include "update_engine/update_manager/policy.h"
+#include "update_engine/update_manager/update_manager.h"
 
 using base::FilePath;
+using brillo::MessageLoop;
+using chromeos_update_manager::EvalStatus;
+using chromeos_update_manager::Policy;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -57,7 +65,9 @@ DownloadActionChromeos::DownloadActionChromeos(
       p2p_sharing_fd_(-1),
       p2p_visible_(true) {}
 
-DownloadActionChromeos::~DownloadActionChromeos() {}
+DownloadActionChromeos::~DownloadActionChromeos() {
+  CancelDownloadRateLimitCheck();
+}
 
 void DownloadActionChromeos::CloseP2PSharingFd(bool delete_p2p_file) {
   if (p2p_sharing_fd_ != -1) {
@@ -331,6 +341,23 @@ void DownloadActionChromeos::StartDownloading() {
                                          kDownloadP2PLowSpeedTimeSeconds);
       http_fetcher_->set_max_retry_count(kDownloadP2PMaxRetryCount);
       http_fetcher_->set_connect_timeout(kDownloadP2PConnectTimeoutSeconds);
+      // A peer serves the payload as it downloads it itself, over a single
+      // connection per client.
+      http_fetcher_->SetMaxConnections(1);
+    } else {
+      http_fetcher_->SetMaxConnections(0);
+      // Lets the fetcher race the slow parts of the download from the other
+      // candidate URLs.
+      vector<string> alternate_urls;
+      for (const string& url : payload_state->GetCandidateUrls()) {
+        if (url != install_plan_.download_url)
+          alternate_urls.push_back(url);
+      }
+      http_fetcher_->SetAlternateUrls(alternate_urls);
+      // Background downloads leave part of the link to the rest of the
+      // traffic.
+      if (!interactive_ && rate_limit_check_id_ == MessageLoop::kTaskIdNull)
+        UpdateDownloadRateLimit();
     }
   }
 
@@ -351,6 +378,7 @@ void DownloadActionChromeos::TerminateProcessing() {
     writer_ = nullptr;
   }
   download_active_ = false;
+  CancelDownloadRateLimitCheck();
   CloseP2PSharingFd(false);  // Keep p2p file.
   // Terminates the transfer. The action is terminated, if necessary, when the
   // TransferTerminated callback is received.
@@ -402,8 +430,43 @@ bool DownloadActionChromeos::ReceivedBytes(HttpFetcher* fetcher,
   return true;
 }
 
+void DownloadActionChromeos::ReportUrlThroughputs() {
+  for (const auto& url_throughput : http_fetcher_->GetUrlThroughputs()) {
+    SystemState::Get()->payload_state()->SetUrlThroughput(
+        url_throughput.first, url_throughput.second);
+  }
+}
+
+void DownloadActionChromeos::UpdateDownloadRateLimit() {
+  rate_limit_check_id_ = MessageLoop::kTaskIdNull;
+  int64_t rate = 0;
+  if (SystemState::Get()->update_manager()->PolicyRequest(
+          &Policy::DownloadRateLimit,
+          &rate,
+          interactive_,
+          http_fetcher_->GetLinkCapacity()) == EvalStatus::kSucceeded &&
+      rate != download_rate_limit_) {
+    download_rate_limit_ = rate;
+    http_fetcher_->SetMaxDownloadRate(rate);
+  }
+  rate_limit_check_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&DownloadActionChromeos::UpdateDownloadRateLimit,
+                 base::Unretained(this)),
+      base::TimeDelta::FromSeconds(kDownloadRateLimitCheckIntervalSeconds));
+}
+
+void DownloadActionChromeos::CancelDownloadRateLimitCheck() {
+  if (rate_limit_check_id_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(rate_limit_check_id_);
+    rate_limit_check_id_ = MessageLoop::kTaskIdNull;
+  }
+}
+
 void DownloadActionChromeos::TransferComplete(HttpFetcher* fetcher,
                                               bool successful) {
+  CancelDownloadRateLimitCheck();
+  ReportUrlThroughputs();
   if (writer_) {
     LOG_IF(WARNING, writer_->Close() != 0) << "Error closing the writer.";
     if (delta_performer_.get() == writer_) {
@@ -457,6 +520,8 @@ void DownloadActionChromeos::TransferComplete(HttpFetcher* fetcher,
 }
 
 void DownloadActionChromeos::TransferTerminated(HttpFetcher* fetcher) {
+  CancelDownloadRateLimitCheck();
+  ReportUrlThroughputs();
   if (code_ != ErrorCode::kSuccess) {
     processor_->ActionComplete(this, code_);
   } else if (payload_->already_applied) {
@@ -24,6 +24,8 @@
 #include <memory>
 #include <string>
 
+#include <brillo/message_loops/message_loop.h>
+
 #include "update_engine/common/action.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/download_action.h"
@@ -113,6 +115,15 @@ class DownloadActionChromeos : public InstallPlanAction,
   // Start downloading the current payload using delta_performer.
   void StartDownloading();
 
+  // Passes the throughput measured by the fetcher for every URL to the
+  // payload state, to order the URLs of later attempts.
+  void ReportUrlThroughputs();
+
+  // Limits the download to the rate the policy allows and schedules the next
+  // evaluation.
+  void UpdateDownloadRateLimit();
+  void CancelDownloadRateLimitCheck();
+
   // Pointer to the current payload in install_plan_.payloads.
   InstallPlan::Payload* payload_{nullptr};
 
@@ -162,6 +173,12 @@ class DownloadActionChromeos : public InstallPlanAction,
   // Offset of the payload in the download URL, used by UpdateAttempterAndroid.
   int64_t base_offset_{0};
 
+  // The rate the download is limited to, 0 for none, and the task that
+  // evaluates it again.
+  int64_t download_rate_limit_{0};
+  brillo::MessageLoop::TaskId rate_limit_check_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
   DISALLOW_COPY_AND_ASSIGN(DownloadActionChromeos);
 };
 
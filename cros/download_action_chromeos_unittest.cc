@@ -505,6 +505,84 @@ TEST(DownloadActionTest, PassObjectOutTest) {
   EXPECT_EQ(true, delegate.did_test_action_run_);
 }
 
+namespace {
+
+// A MockHttpFetcher that records the limit passed to SetMaxConnections() in
+// |max_connections|.
+class ConnectionLimitHttpFetcher : public MockHttpFetcher {
+ public:
+  ConnectionLimitHttpFetcher(const char* data,
+                             size_t size,
+                             size_t* max_connections)
+      : MockHttpFetcher(data, size, nullptr),
+        max_connections_(max_connections) {}
+
+  void SetMaxConnections(size_t max_connections) override {
+    *max_connections_ = max_connections;
+  }
+
+ private:
+  size_t* max_connections_;
+};
+
+// Downloads a payload from |download_url| while the payload state uses
+// |p2p_url| for P2P, and returns the connection limit the fetcher was given.
+size_t DownloadConnectionLimit(const string& download_url,
+                               const string& p2p_url) {
+  FakeSystemState::CreateInstance();
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  EXPECT_CALL(*FakeSystemState::Get()->mock_payload_state(),
+              GetUsingP2PForDownloading())
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(*FakeSystemState::Get()->mock_payload_state(), GetP2PUrl())
+      .WillRepeatedly(Return(p2p_url));
+
+  DirectFileWriter writer;
+  EXPECT_EQ(0, writer.Open("/dev/null", O_WRONLY | O_CREAT, 0));
+  InstallPlan install_plan;
+  install_plan.download_url = download_url;
+  install_plan.payloads.push_back({.size = 1});
+  EXPECT_TRUE(
+      HashCalculator::RawHashOfData({'x'}, &install_plan.payloads[0].hash));
+  auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
+  feeder_action->set_obj(install_plan);
+  MockPrefs prefs;
+  size_t max_connections = SIZE_MAX;
+  auto download_action = std::make_unique<DownloadAction>(
+      &prefs,
+      FakeSystemState::Get()->boot_control(),
+      FakeSystemState::Get()->hardware(),
+      new ConnectionLimitHttpFetcher("x", 1, &max_connections),
+      false /* interactive */);
+  download_action->SetTestFileWriter(&writer);
+  BondActions(feeder_action.get(), download_action.get());
+
+  ActionProcessor processor;
+  PassObjectOutTestProcessorDelegate delegate;
+  processor.set_delegate(&delegate);
+  processor.EnqueueAction(std::move(feeder_action));
+  processor.EnqueueAction(std::move(download_action));
+  loop.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor) { processor->StartProcessing(); },
+          base::Unretained(&processor)));
+  loop.Run();
+  EXPECT_FALSE(loop.PendingTasks());
+  return max_connections;
+}
+
+}  // namespace
+
+TEST(DownloadActionTest, P2PDownloadUsesOneConnectionTest) {
+  const string kP2PUrl = "http://192.168.1.2:16725/cros_update_size_1";
+  EXPECT_EQ(1U, DownloadConnectionLimit(kP2PUrl, kP2PUrl));
+  // Downloads from the update server aren't limited.
+  EXPECT_EQ(0U,
+            DownloadConnectionLimit("http://example.com/payload", kP2PUrl));
+}
+
 // Test fixture for P2P tests.
 class P2PDownloadActionTest : public testing::Test {
  protected:
@@ -50,6 +50,8 @@ class MockPayloadState : public PayloadStateInterface {
   MOCK_METHOD1(SetScatteringWaitPeriod, void(base::TimeDelta));
   MOCK_METHOD1(SetP2PUrl, void(const std::string&));
   MOCK_METHOD0(NextPayload, bool());
+  MOCK_METHOD2(SetUrlThroughput,
+               void(const std::string& url, int64_t bytes_per_second));
   MOCK_METHOD1(SetStagingWaitPeriod, void(base::TimeDelta));
 
   // Getters.
@@ -58,6 +60,7 @@ class MockPayloadState : public PayloadStateInterface {
   MOCK_METHOD0(GetFullPayloadAttemptNumber, int());
   MOCK_METHOD0(GetCurrentUrl, std::string());
   MOCK_METHOD0(GetUrlFailureCount, uint32_t());
+  MOCK_CONST_METHOD0(GetCandidateUrls, std::vector<std::string>());
   MOCK_METHOD0(GetUrlSwitchCount, uint32_t());
   MOCK_METHOD0(GetNumResponsesSeen, int());
   MOCK_METHOD0(GetBackoffExpiryTime, base::Time());
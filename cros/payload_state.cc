@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include <base/logging.h>
 #include <base/strings/string_util.h>
@@ -43,6 +44,7 @@ using base::Time;
 using base::TimeDelta;
 using std::min;
 using std::string;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -129,6 +131,7 @@ void PayloadState::SetResponse(const OmahaResponse& omaha_response) {
     SetNumResponsesSeen(num_responses_seen_ + 1);
     SetResponseSignature(new_response_signature);
     ResetPersistedState();
+    PreferFastestUrl();
     return;
   }
 
@@ -151,6 +154,7 @@ void PayloadState::SetResponse(const OmahaResponse& omaha_response) {
   // Update the current download source which depends on the latest value of
   // the response.
   UpdateCurrentDownloadSource();
+  PreferFastestUrl();
 }
 
 void PayloadState::SetUsingP2PForDownloading(bool value) {
@@ -499,6 +503,55 @@ void PayloadState::IncrementUrlIndex() {
   SetUrlFailureCount(0);
 }
 
+vector<string> PayloadState::GetCandidateUrls() const {
+  if (payload_index_ >= candidate_urls_.size())
+    return {};
+  // The measured URLs are sorted among themselves, so the order of the
+  // response is kept for the others.
+  vector<string> urls = candidate_urls_[payload_index_];
+  vector<size_t> measured_indexes;
+  vector<string> measured_urls;
+  for (size_t i = 0; i < urls.size(); i++) {
+    if (url_throughputs_.count(urls[i])) {
+      measured_indexes.push_back(i);
+      measured_urls.push_back(urls[i]);
+    }
+  }
+  std::stable_sort(measured_urls.begin(),
+                   measured_urls.end(),
+                   [this](const string& a, const string& b) {
+                     return url_throughputs_.at(a) > url_throughputs_.at(b);
+                   });
+  for (size_t i = 0; i < measured_indexes.size(); i++)
+    urls[measured_indexes[i]] = measured_urls[i];
+  return urls;
+}
+
+void PayloadState::PreferFastestUrl() {
+  // Once a URL failed, the URL index follows the failures.
+  if (url_switch_count_ != 0 || url_failure_count_ != 0)
+    return;
+  auto current = url_throughputs_.find(GetCurrentUrl());
+  if (current == url_throughputs_.end())
+    return;
+  const vector<string>& urls = candidate_urls_[payload_index_];
+  size_t fastest_index = url_index_;
+  int64_t fastest_throughput = current->second;
+  for (size_t i = 0; i < urls.size(); i++) {
+    auto it = url_throughputs_.find(urls[i]);
+    if (it != url_throughputs_.end() && it->second > fastest_throughput) {
+      fastest_index = i;
+      fastest_throughput = it->second;
+    }
+  }
+  if (fastest_index == url_index_)
+    return;
+  LOG(INFO) << "Starting from Url" << fastest_index << " measured at "
+            << fastest_throughput << " bytes/s instead of " << current->second
+            << " bytes/s for Url" << url_index_;
+  SetUrlIndex(fastest_index);
+}
+
 void PayloadState::IncrementFailureCount() {
   uint32_t next_url_failure_count = GetUrlFailureCount() + 1;
   if (next_url_failure_count < response_.max_failure_count_per_url) {
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_CROS_PAYLOAD_STATE_H_
 
 #include <algorithm>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -89,6 +90,13 @@ class PayloadState : public PayloadStateInterface {
 
   inline uint32_t GetUrlFailureCount() override { return url_failure_count_; }
 
+  std::vector<std::string> GetCandidateUrls() const override;
+
+  void SetUrlThroughput(const std::string& url,
+                        int64_t bytes_per_second) override {
+    url_throughputs_[url] = bytes_per_second;
+  }
+
   inline uint32_t GetUrlSwitchCount() override { return url_switch_count_; }
 
   inline int GetNumResponsesSeen() override { return num_responses_seen_; }
@@ -385,6 +393,10 @@ class PayloadState : public PayloadStateInterface {
                : 0;
   }
 
+  // Switches to the fastest candidate URL of the current payload if the
+  // current one was measured slower, unless a URL failed in this attempt.
+  void PreferFastestUrl();
+
   // Computes the list of candidate URLs from the total list of payload URLs in
   // the Omaha response.
   void ComputeCandidateUrls();
@@ -558,6 +570,10 @@ class PayloadState : public PayloadStateInterface {
   // allowed as per device policy.
   std::vector<std::vector<std::string>> candidate_urls_;
 
+  // The throughput measured for the URLs downloaded from, in bytes per
+  // second. It isn't persisted.
+  std::map<std::string, int64_t> url_throughputs_;
+
   // This stores whether rollback has happened since the last time device policy
   // was available during update check. When this is set, we're preventing
   // forced updates to avoid update-rollback loops.
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_CROS_PAYLOAD_STATE_INTERFACE_H_
 
 #include <string>
+#include <vector>
 
 #include "update_engine/common/action_processor.h"
 #include "update_engine/common/constants.h"
@@ -117,6 +118,15 @@ class PayloadStateInterface {
   // Returns the current URL's failure count.
   virtual uint32_t GetUrlFailureCount() = 0;
 
+  // Returns the candidate URLs of the current payload, with the ones measured
+  // faster by SetUrlThroughput() ahead of the ones measured slower.
+  virtual std::vector<std::string> GetCandidateUrls() const = 0;
+
+  // Records the throughput measured while downloading from |url|, in bytes
+  // per second. Until a URL fails, later attempts start from the fastest one.
+  virtual void SetUrlThroughput(const std::string& url,
+                                int64_t bytes_per_second) = 0;
+
   // Returns the total number of times a new URL has been switched to
   // for the current response.
   virtual uint32_t GetUrlSwitchCount() = 0;
@@ -37,6 +37,7 @@
 using base::Time;
 using base::TimeDelta;
 using std::string;
+using std::vector;
 using testing::_;
 using testing::AnyNumber;
 using testing::AtLeast;
@@ -628,6 +629,44 @@ TEST_F(PayloadStateTest, SetResponseResetsInvalidUrlIndex) {
   EXPECT_EQ(0U, payload_state.GetUrlSwitchCount());
 }
 
+TEST_F(PayloadStateTest, LaterAttemptsStartFromFastestUrl) {
+  OmahaResponse response;
+  PayloadState payload_state;
+
+  EXPECT_TRUE(payload_state.Initialize());
+  SetupPayloadStateWith2Urls(
+      "Hash4428", true, false, &payload_state, &response);
+  EXPECT_EQ("http://test", payload_state.GetCurrentUrl());
+  EXPECT_EQ((vector<string>{"http://test", "https://test"}),
+            payload_state.GetCandidateUrls());
+
+  payload_state.SetUrlThroughput("http://test", 1000);
+  payload_state.SetUrlThroughput("https://test", 5000);
+  EXPECT_EQ((vector<string>{"https://test", "http://test"}),
+            payload_state.GetCandidateUrls());
+
+  // The next attempt for the same response starts from the faster URL.
+  payload_state.SetResponse(response);
+  EXPECT_EQ("https://test", payload_state.GetCurrentUrl());
+  EXPECT_EQ(0U, payload_state.GetUrlSwitchCount());
+}
+
+TEST_F(PayloadStateTest, FailedUrlsAreNotReorderedByThroughput) {
+  OmahaResponse response;
+  PayloadState payload_state;
+
+  EXPECT_TRUE(payload_state.Initialize());
+  SetupPayloadStateWith2Urls(
+      "Hash4429", true, false, &payload_state, &response);
+  payload_state.UpdateFailed(ErrorCode::kDownloadMetadataSignatureMismatch);
+  EXPECT_EQ("https://test", payload_state.GetCurrentUrl());
+
+  payload_state.SetUrlThroughput("http://test", 5000);
+  payload_state.SetUrlThroughput("https://test", 1000);
+  payload_state.SetResponse(response);
+  EXPECT_EQ("https://test", payload_state.GetCurrentUrl());
+}
+
 TEST_F(PayloadStateTest, NoBackoffInteractiveChecks) {
   OmahaResponse response;
   PayloadState payload_state;
@@ -50,6 +50,7 @@
 #include "update_engine/common/excluder_interface.h"
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/metrics_reporter_interface.h"
+#include "update_engine/common/parallel_http_fetcher.h"
 #include "update_engine/common/platform_constants.h"
 #include "update_engine/common/prefs.h"
 #include "update_engine/common/prefs_interface.h"
@@ -760,12 +761,26 @@ void UpdateAttempter::BuildUpdateActions(bool interactive) {
       false,
       session_id_);
 
-  LibcurlHttpFetcher* download_fetcher = new LibcurlHttpFetcher(
-      GetProxyResolver(), SystemState::Get()->hardware());
-  download_fetcher->set_server_to_check(ServerToCheck::kDownload);
-  if (interactive)
-    download_fetcher->set_max_retry_count(kDownloadMaxRetryCountInteractive);
-  download_fetcher->SetHeader(kXGoogleUpdateSessionId, session_id_);
+  auto create_connection_fetcher = [this, interactive]() {
+    auto connection_fetcher = std::make_unique<LibcurlHttpFetcher>(
+        GetProxyResolver(), SystemState::Get()->hardware());
+    connection_fetcher->set_server_to_check(ServerToCheck::kDownload);
+    if (interactive) {
+      connection_fetcher->set_max_retry_count(
+          kDownloadMaxRetryCountInteractive);
+    }
+    connection_fetcher->SetHeader(kXGoogleUpdateSessionId, session_id_);
+    return connection_fetcher;
+  };
+  // Whether to download from a peer is only decided once the response is
+  // handled, so the download action limits the fetcher to one connection
+  // then.
+  vector<std::unique_ptr<HttpFetcher>> connection_fetchers;
+  for (int i = 0; i < kDownloadParallelConnections; i++)
+    connection_fetchers.push_back(create_connection_fetcher());
+  ParallelHttpFetcher* download_fetcher = new ParallelHttpFetcher(
+      std::move(connection_fetchers), kDownloadParallelSegmentSize);
+  download_fetcher->SetHedgeFetcher(create_connection_fetcher());
   auto download_action = std::make_unique<DownloadActionChromeos>(
       prefs_,
       SystemState::Get()->boot_control(),
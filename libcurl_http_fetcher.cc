@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/format_macros.h>
@@ -44,7 +45,6 @@
 
 using base::TimeDelta;
 using brillo::MessageLoop;
-using std::max;
 using std::string;
 
 // This is a concrete implementation of HttpFetcher that uses libcurl to do the
@@ -56,6 +56,12 @@ namespace {
 
 const int kNoNetworkRetrySeconds = 10;
 
+// The CURLOPT_SSL_CTX_DATA of the transfers checking each server. It outlives
+// the fetchers, since their easy handles may be freed after them, see
+// LibcurlMultiHandle::RemoveTransfer().
+const ServerToCheck kServersToCheck[] = {
+    ServerToCheck::kUpdate, ServerToCheck::kDownload, ServerToCheck::kNone};
+
 // libcurl's CURLOPT_SOCKOPTFUNCTION callback function. Called after the socket
 // is created but before it is connected. This callback tags the created socket
 // so the network usage can be tracked in Android.
@@ -71,20 +77,58 @@ int LibcurlSockoptCallback(void* /* clientp */,
   return CURL_SOCKOPT_OK;
 }
 
+// libcurl's CURLOPT_WRITEFUNCTION callback of the transfers removed while
+// libcurl is running, see LibcurlMultiHandle::RemoveTransfer(). Aborts them.
+size_t AbortWrite(void* /* ptr */,
+                  size_t /* size */,
+                  size_t /* nmemb */,
+                  void* /* stream */) {
+  return 0;
+}
+
 }  // namespace
 
 // static
-int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
-                                                   curl_socket_t item) {
+LibcurlMultiHandle* LibcurlMultiHandle::Get(ServerToCheck server_to_check) {
+  static LibcurlMultiHandle*
+      multi_handles[static_cast<int>(ServerToCheck::kNone) + 1] = {};
+  LibcurlMultiHandle*& multi_handle =
+      multi_handles[static_cast<int>(server_to_check)];
+  if (!multi_handle)
+    multi_handle = new LibcurlMultiHandle();
+  return multi_handle;
+}
+
+LibcurlMultiHandle::LibcurlMultiHandle() : handle_(curl_multi_init()) {
+  CHECK(handle_);
+  // libcurl tells us which sockets to watch and when to call it back, so the
+  // message loop sources only change when libcurl asks.
+  CHECK_EQ(curl_multi_setopt(
+               handle_, CURLMOPT_SOCKETFUNCTION, StaticSocketCallback),
+           CURLM_OK);
+  CHECK_EQ(curl_multi_setopt(handle_, CURLMOPT_SOCKETDATA, this), CURLM_OK);
+  CHECK_EQ(
+      curl_multi_setopt(handle_, CURLMOPT_TIMERFUNCTION, StaticTimerCallback),
+      CURLM_OK);
+  CHECK_EQ(curl_multi_setopt(handle_, CURLMOPT_TIMERDATA, this), CURLM_OK);
+#if LIBCURL_VERSION_NUM >= 0x072B00
+  // Let the transfers to the same server share a single HTTP/2 connection.
+  // Multiplexing is supported since libcurl 7.43.0.
+  CHECK_EQ(
+      curl_multi_setopt(handle_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX),
+      CURLM_OK);
+#endif  // LIBCURL_VERSION_NUM >= 0x072B00
+}
+
+// static
+int LibcurlMultiHandle::CloseSocketCallback(void* clientp,
+                                            curl_socket_t item) {
 #ifdef __ANDROID__
   qtaguid_untagSocket(item);
 #endif  // __ANDROID__
 
-  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(clientp);
   // Stop watching the socket before closing it.
-  for (size_t t = 0; t < base::size(fetcher->fd_controller_maps_); ++t) {
-    fetcher->fd_controller_maps_[t].erase(item);
-  }
+  reinterpret_cast<LibcurlMultiHandle*>(clientp)->ForgetSocket(item);
 
   // Documentation for this callback says to return 0 on success or 1 on error.
   if (!IGNORE_EINTR(close(item)))
@@ -92,6 +136,230 @@ int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
   return 1;
 }
 
+void LibcurlMultiHandle::AddTransfer(CURL* easy, LibcurlHttpFetcher* fetcher) {
+  transfers_[easy] = {fetcher, next_transfer_id_++};
+  // libcurl's functions can't be called from its callbacks, the transfer is
+  // added once libcurl returns.
+  if (in_socket_action_) {
+    pending_adds_.push_back(easy);
+    return;
+  }
+  CHECK_EQ(curl_multi_add_handle(handle_, easy), CURLM_OK);
+}
+
+void LibcurlMultiHandle::RemoveTransfer(CURL* easy) {
+  transfers_.erase(easy);
+  auto pending_add = std::find(pending_adds_.begin(), pending_adds_.end(), easy);
+  if (pending_add != pending_adds_.end()) {
+    pending_adds_.erase(pending_add);
+    curl_easy_cleanup(easy);
+  } else if (in_socket_action_) {
+    // The transfer is removed once libcurl returns, and the fetcher may be
+    // gone by then, so it must not be called anymore.
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, AbortWrite);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, nullptr);
+    pending_removals_.push_back(easy);
+  } else {
+    CHECK_EQ(curl_multi_remove_handle(handle_, easy), CURLM_OK);
+    curl_easy_cleanup(easy);
+  }
+
+  if (transfers_.empty()) {
+    // The tasks are posted to the message loop of the transfers, which may
+    // not be the one of the next transfers.
+    MessageLoop::current()->CancelTask(timeout_id_);
+    timeout_id_ = MessageLoop::kTaskIdNull;
+    MessageLoop::current()->CancelTask(poll_task_id_);
+    poll_task_id_ = MessageLoop::kTaskIdNull;
+  }
+}
+
+void LibcurlMultiHandle::SocketAction(curl_socket_t fd, int ev_bitmask) {
+  if (in_socket_action_) {
+    // Called from a libcurl callback, where libcurl can't be called.
+    action_pending_ = true;
+    return;
+  }
+  int running_handles = 0;
+  in_socket_action_ = true;
+  CURLMcode retcode =
+      curl_multi_socket_action(handle_, fd, ev_bitmask, &running_handles);
+  in_socket_action_ = false;
+  if (retcode != CURLM_OK)
+    LOG(ERROR) << "curl_multi_socket_action returns error: " << retcode;
+
+  // Repeated calls to |curl_multi_info_read| will return a new struct each
+  // time, until a NULL is returned as a signal that there is no more to get
+  // at this point. When |curl_msg| is |CURLMSG_DONE|, a transfer of an easy
+  // handle is done, and then data contains the return code for this transfer.
+  // Transfer return code reference:
+  // https://curl.haxx.se/libcurl/c/libcurl-errors.html
+  std::map<uint64_t, CURLcode> done_transfers;
+  int msgs_in_queue;
+  while (CURLMsg* curl_msg = curl_multi_info_read(handle_, &msgs_in_queue)) {
+    if (curl_msg->msg != CURLMSG_DONE)
+      continue;
+    auto transfer = transfers_.find(curl_msg->easy_handle);
+    if (transfer != transfers_.end())
+      done_transfers[transfer->second.id] = curl_msg->data.result;
+  }
+
+  for (CURL* easy : pending_removals_) {
+    CHECK_EQ(curl_multi_remove_handle(handle_, easy), CURLM_OK);
+    curl_easy_cleanup(easy);
+  }
+  pending_removals_.clear();
+  for (CURL* easy : pending_adds_) {
+    CHECK_EQ(curl_multi_add_handle(handle_, easy), CURLM_OK);
+    action_pending_ = true;
+  }
+  pending_adds_.clear();
+
+  // The fetchers may start, remove and restart transfers or be destroyed when
+  // told, so a transfer is only told if it's still there.
+  std::vector<std::pair<CURL*, uint64_t>> transfers;
+  for (const auto& transfer : transfers_)
+    transfers.emplace_back(transfer.first, transfer.second.id);
+  for (const auto& easy_id : transfers) {
+    auto transfer = transfers_.find(easy_id.first);
+    if (transfer == transfers_.end() || transfer->second.id != easy_id.second)
+      continue;
+    auto done = done_transfers.find(easy_id.second);
+    transfer->second.fetcher->OnCurlAction(
+        retcode,
+        done != done_transfers.end(),
+        done != done_transfers.end() ? done->second : CURLE_OK);
+  }
+
+  if (action_pending_) {
+    action_pending_ = false;
+    PerformOnce();
+    return;
+  }
+
+  // While there are transfers, we wait for libcurl to call us back through the
+  // sockets and the timer it asked for.
+  //
+  // When there's no |base::SingleThreadTaskRunner| on current thread, it's
+  // not possible to watch file descriptors. Just poll them later, as often as
+  // the most frequent of the fetchers asks. This usually happens if
+  // |brillo::FakeMessageLoop| is used.
+  if (transfers_.empty() || base::ThreadTaskRunnerHandle::IsSet() ||
+      poll_task_id_ != MessageLoop::kTaskIdNull) {
+    return;
+  }
+  int idle_seconds = transfers_.begin()->second.fetcher->idle_seconds();
+  for (const auto& transfer : transfers_)
+    idle_seconds = std::min(idle_seconds, transfer.second.fetcher->idle_seconds());
+  poll_task_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&LibcurlMultiHandle::PollSockets, base::Unretained(this)),
+      TimeDelta::FromSeconds(idle_seconds));
+}
+
+void LibcurlMultiHandle::PollSockets() {
+  poll_task_id_ = MessageLoop::kTaskIdNull;
+  // Let libcurl find out which events happened on every socket, and handle the
+  // outcome once at the end. |sockets_| may change with any of the calls.
+  std::vector<curl_socket_t> fds;
+  for (const auto& curl_socket : sockets_)
+    fds.push_back(curl_socket.first);
+  for (curl_socket_t fd : fds) {
+    int running_handles = 0;
+    in_socket_action_ = true;
+    curl_multi_socket_action(handle_, fd, 0, &running_handles);
+    in_socket_action_ = false;
+  }
+  PerformOnce();
+}
+
+void LibcurlMultiHandle::TimeoutCallback() {
+  timeout_id_ = MessageLoop::kTaskIdNull;
+  if (!transfers_.empty())
+    SocketAction(CURL_SOCKET_TIMEOUT, 0);
+}
+
+void LibcurlMultiHandle::WatchSocket(curl_socket_t fd, int what) {
+  if (what == CURL_POLL_REMOVE)
+    sockets_.erase(fd);
+  else
+    sockets_[fd] = what;
+
+  // Without a task runner the sockets are polled instead.
+  if (!base::ThreadTaskRunnerHandle::IsSet())
+    return;
+
+  bool must_track[2] = {
+      what == CURL_POLL_IN || what == CURL_POLL_INOUT,   // track 0 -- read
+      what == CURL_POLL_OUT || what == CURL_POLL_INOUT,  // track 1 -- write
+  };
+  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
+    if (!must_track[t]) {
+      // If we have an outstanding watcher, remove it.
+      fd_controller_maps_[t].erase(fd);
+      continue;
+    }
+
+    // If we are already tracking this fd, continue -- nothing to do.
+    if (fd_controller_maps_[t].find(fd) != fd_controller_maps_[t].end())
+      continue;
+
+    // Track a new fd.
+    switch (t) {
+      case 0:  // Read
+        fd_controller_maps_[t][fd] = base::FileDescriptorWatcher::WatchReadable(
+            fd,
+            base::BindRepeating(&LibcurlMultiHandle::SocketAction,
+                                base::Unretained(this),
+                                fd,
+                                CURL_CSELECT_IN));
+        break;
+      case 1:  // Write
+        fd_controller_maps_[t][fd] = base::FileDescriptorWatcher::WatchWritable(
+            fd,
+            base::BindRepeating(&LibcurlMultiHandle::SocketAction,
+                                base::Unretained(this),
+                                fd,
+                                CURL_CSELECT_OUT));
+    }
+  }
+}
+
+void LibcurlMultiHandle::SetTimer(long timeout_ms) {  // NOLINT(runtime/int)
+  // libcurl must not be called back from here, only from the message loop.
+  MessageLoop::current()->CancelTask(timeout_id_);
+  timeout_id_ = MessageLoop::kTaskIdNull;
+  if (timeout_ms < 0)
+    return;
+  timeout_id_ = MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&LibcurlMultiHandle::TimeoutCallback, base::Unretained(this)),
+      TimeDelta::FromMilliseconds(timeout_ms));
+}
+
+void LibcurlMultiHandle::ForgetSocket(curl_socket_t fd) {
+  sockets_.erase(fd);
+  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t)
+    fd_controller_maps_[t].erase(fd);
+}
+
+// static
+CURLSH* LibcurlHttpFetcher::GetCurlShareHandle(ServerToCheck server_to_check) {
+  static CURLSH* share_handles[static_cast<int>(ServerToCheck::kNone) + 1] = {};
+  CURLSH*& share_handle = share_handles[static_cast<int>(server_to_check)];
+  if (!share_handle) {
+    share_handle = curl_share_init();
+    CHECK(share_handle);
+    CHECK_EQ(
+        curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS),
+        CURLSHE_OK);
+    CHECK_EQ(curl_share_setopt(
+                 share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION),
+             CURLSHE_OK);
+  }
+  return share_handle;
+}
+
 LibcurlHttpFetcher::LibcurlHttpFetcher(ProxyResolver* proxy_resolver,
                                        HardwareInterface* hardware)
     : HttpFetcher(proxy_resolver), hardware_(hardware) {
@@ -143,8 +411,7 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   LOG(INFO) << "Starting/Resuming transfer";
   CHECK(!transfer_in_progress_);
   url_ = url;
-  curl_multi_handle_ = curl_multi_init();
-  CHECK(curl_multi_handle_);
+  multi_handle_ = LibcurlMultiHandle::Get(server_to_check_);
 
   curl_handle_ = curl_easy_init();
   CHECK(curl_handle_);
@@ -153,9 +420,21 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   // Tag and untag the socket for network usage stats.
   curl_easy_setopt(
       curl_handle_, CURLOPT_SOCKOPTFUNCTION, LibcurlSockoptCallback);
-  curl_easy_setopt(
-      curl_handle_, CURLOPT_CLOSESOCKETFUNCTION, LibcurlCloseSocketCallback);
-  curl_easy_setopt(curl_handle_, CURLOPT_CLOSESOCKETDATA, this);
+  curl_easy_setopt(curl_handle_,
+                   CURLOPT_CLOSESOCKETFUNCTION,
+                   LibcurlMultiHandle::CloseSocketCallback);
+  curl_easy_setopt(curl_handle_, CURLOPT_CLOSESOCKETDATA, multi_handle_);
+
+  // Reuse the DNS entries and SSL sessions of the previous transfers. The
+  // connections are cached by the multi handle.
+  CHECK_EQ(curl_easy_setopt(curl_handle_,
+                            CURLOPT_SHARE,
+                            GetCurlShareHandle(server_to_check_)),
+           CURLE_OK);
+  // Negotiate HTTP/2 over TLS, so the concurrent transfers to a server are
+  // multiplexed over one connection of the shared multi handle. This fails and
+  // keeps HTTP/1.1 if libcurl was built without HTTP/2 support.
+  curl_easy_setopt(curl_handle_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
 
   CHECK(HasProxy());
   bool is_direct = (GetCurrentProxy() == kNoProxy);
@@ -249,6 +528,10 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   CHECK_EQ(curl_easy_setopt(
                curl_handle_, CURLOPT_CONNECTTIMEOUT, connect_timeout_seconds_),
            CURLE_OK);
+  CHECK_EQ(curl_easy_setopt(curl_handle_,
+                            CURLOPT_MAX_RECV_SPEED_LARGE,
+                            static_cast<curl_off_t>(max_download_rate_)),
+           CURLE_OK);
 
   // By default, libcurl doesn't follow redirections. Allow up to
   // |kDownloadMaxRedirects| redirections.
@@ -281,7 +564,7 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
               << "running a dev/test image";
   }
 
-  CHECK_EQ(curl_multi_add_handle(curl_multi_handle_, curl_handle_), CURLM_OK);
+  multi_handle_->AddTransfer(curl_handle_, this);
   transfer_in_progress_ = true;
 }
 
@@ -314,9 +597,12 @@ void LibcurlHttpFetcher::SetCurlOptionsForHttps() {
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_SSL_CIPHER_LIST, "HIGH:!ADH"),
            CURLE_OK);
   if (server_to_check_ != ServerToCheck::kNone) {
-    CHECK_EQ(
-        curl_easy_setopt(curl_handle_, CURLOPT_SSL_CTX_DATA, &server_to_check_),
-        CURLE_OK);
+    CHECK_EQ(curl_easy_setopt(
+                 curl_handle_,
+                 CURLOPT_SSL_CTX_DATA,
+                 const_cast<ServerToCheck*>(
+                     &kServersToCheck[static_cast<int>(server_to_check_)])),
+             CURLE_OK);
     CHECK_EQ(curl_easy_setopt(curl_handle_,
                               CURLOPT_SSL_CTX_FUNCTION,
                               CertificateChecker::ProcessSSLContext),
@@ -371,7 +657,11 @@ void LibcurlHttpFetcher::ForceTransferTermination() {
 }
 
 void LibcurlHttpFetcher::TerminateTransfer() {
-  if (in_write_callback_) {
+  // libcurl can't be called from its callbacks, including the ones of the
+  // other transfers of the multi handle, so the transfer is terminated once
+  // libcurl returns.
+  if (in_write_callback_ ||
+      (transfer_in_progress_ && multi_handle_->in_socket_action())) {
     terminate_requested_ = true;
   } else {
     ForceTransferTermination();
@@ -420,19 +710,13 @@ bool LibcurlHttpFetcher::GetHeader(const string& header_name,
   return true;
 }
 
-void LibcurlHttpFetcher::CurlPerformOnce() {
+void LibcurlHttpFetcher::OnCurlAction(CURLMcode retcode,
+                                      bool done,
+                                      CURLcode curl_code) {
   CHECK(transfer_in_progress_);
-  int running_handles = 0;
-  CURLMcode retcode = CURLM_CALL_MULTI_PERFORM;
-
-  // libcurl may request that we immediately call curl_multi_perform after it
-  // returns, so we do. libcurl promises that curl_multi_perform will not block.
-  while (CURLM_CALL_MULTI_PERFORM == retcode) {
-    retcode = curl_multi_perform(curl_multi_handle_, &running_handles);
-    if (terminate_requested_) {
-      ForceTransferTermination();
-      return;
-    }
+  if (terminate_requested_) {
+    ForceTransferTermination();
+    return;
   }
 
   // When retcode is not |CURLM_OK| at this point, libcurl has an internal error
@@ -441,39 +725,28 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
   if (is_update_check_ &&
       (retcode == CURLM_OUT_OF_MEMORY || retcode == CURLM_INTERNAL_ERROR)) {
     auxiliary_error_code_ = ErrorCode::kInternalLibCurlError;
-    LOG(ERROR) << "curl_multi_perform is in an unrecoverable error condition: "
-               << retcode;
-  } else if (retcode != CURLM_OK) {
-    LOG(ERROR) << "curl_multi_perform returns error: " << retcode;
+    LOG(ERROR) << "curl_multi_socket_action is in an unrecoverable error "
+               << "condition: " << retcode;
   }
 
+  // There's more work to do, so we just wait for the multi handle to tell us
+  // again.
+  if (!done)
+    return;
+  transfer_done_ = true;
+  curl_code_ = curl_code;
+
   // If the transfer completes while paused, we should ignore the failure once
-  // the fetcher is unpaused.
-  if (running_handles == 0 && transfer_paused_ && !ignore_failure_) {
+  // the fetcher is unpaused, and complete it then.
+  if (transfer_paused_) {
     LOG(INFO) << "Connection closed while paused, ignoring failure.";
     ignore_failure_ = true;
-  }
-
-  if (running_handles != 0 || transfer_paused_) {
-    // There's either more work to do or we are paused, so we just keep the
-    // file descriptors to watch up to date and exit, until we are done with the
-    // work and we are not paused.
-    //
-    // When there's no |base::SingleThreadTaskRunner| on current thread, it's
-    // not possible to watch file descriptors. Just poll it later. This usually
-    // happens if |brillo::FakeMessageLoop| is used.
-    if (!base::ThreadTaskRunnerHandle::IsSet()) {
-      MessageLoop::current()->PostDelayedTask(
-          FROM_HERE,
-          base::Bind(&LibcurlHttpFetcher::CurlPerformOnce,
-                     base::Unretained(this)),
-          TimeDelta::FromSeconds(1));
-      return;
-    }
-    SetupMessageLoopSources();
     return;
   }
+  CompleteTransfer();
+}
 
+void LibcurlHttpFetcher::CompleteTransfer() {
   // At this point, the transfer was completed in some way (error, connection
   // closed or download finished).
 
@@ -591,6 +864,10 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
 }
 
 size_t LibcurlHttpFetcher::LibcurlWrite(void* ptr, size_t size, size_t nmemb) {
+  // Abort the transfer that will be terminated.
+  if (terminate_requested_)
+    return 0;
+
   // Update HTTP response first.
   GetHttpResponseCode();
   const size_t payload_size = size * nmemb;
@@ -663,98 +940,26 @@ void LibcurlHttpFetcher::Unpause() {
     return;
   }
   CHECK(curl_handle_);
+  if (transfer_done_) {
+    // The transfer finished while paused.
+    CompleteTransfer();
+    return;
+  }
   CHECK_EQ(curl_easy_pause(curl_handle_, CURLPAUSE_CONT), CURLE_OK);
   // Since the transfer is in progress, we need to dispatch a CurlPerformOnce()
   // now to let the connection continue, otherwise it would be called by the
-  // TimeoutCallback but with a delay.
+  // timer of the multi handle but with a delay.
   CurlPerformOnce();
 }
 
-// This method sets up callbacks with the MessageLoop.
-void LibcurlHttpFetcher::SetupMessageLoopSources() {
-  fd_set fd_read;
-  fd_set fd_write;
-  fd_set fd_exc;
-
-  FD_ZERO(&fd_read);
-  FD_ZERO(&fd_write);
-  FD_ZERO(&fd_exc);
-
-  int fd_max = 0;
-
-  // Ask libcurl for the set of file descriptors we should track on its
-  // behalf.
-  CHECK_EQ(curl_multi_fdset(
-               curl_multi_handle_, &fd_read, &fd_write, &fd_exc, &fd_max),
-           CURLM_OK);
-
-  // We should iterate through all file descriptors up to libcurl's fd_max or
-  // the highest one we're tracking, whichever is larger.
-  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
-    if (!fd_controller_maps_[t].empty())
-      fd_max = max(fd_max, fd_controller_maps_[t].rbegin()->first);
-  }
-
-  // For each fd, if we're not tracking it, track it. If we are tracking it, but
-  // libcurl doesn't care about it anymore, stop tracking it. After this loop,
-  // there should be exactly as many tasks scheduled in
-  // fd_controller_maps_[0|1] as there are read/write fds that we're tracking.
-  for (int fd = 0; fd <= fd_max; ++fd) {
-    // Note that fd_exc is unused in the current version of libcurl so is_exc
-    // should always be false.
-    bool is_exc = FD_ISSET(fd, &fd_exc) != 0;
-    bool must_track[2] = {
-        is_exc || (FD_ISSET(fd, &fd_read) != 0),  // track 0 -- read
-        is_exc || (FD_ISSET(fd, &fd_write) != 0)  // track 1 -- write
-    };
-
-    for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
-      bool tracked =
-          fd_controller_maps_[t].find(fd) != fd_controller_maps_[t].end();
-
-      if (!must_track[t]) {
-        // If we have an outstanding io_channel, remove it.
-        fd_controller_maps_[t].erase(fd);
-        continue;
-      }
-
-      // If we are already tracking this fd, continue -- nothing to do.
-      if (tracked)
-        continue;
-
-      // Track a new fd.
-      switch (t) {
-        case 0:  // Read
-          fd_controller_maps_[t][fd] =
-              base::FileDescriptorWatcher::WatchReadable(
-                  fd,
-                  base::BindRepeating(&LibcurlHttpFetcher::CurlPerformOnce,
-                                      base::Unretained(this)));
-          break;
-        case 1:  // Write
-          fd_controller_maps_[t][fd] =
-              base::FileDescriptorWatcher::WatchWritable(
-                  fd,
-                  base::BindRepeating(&LibcurlHttpFetcher::CurlPerformOnce,
-                                      base::Unretained(this)));
-      }
-      static int io_counter = 0;
-      io_counter++;
-      if (io_counter % 50 == 0) {
-        LOG(INFO) << "io_counter = " << io_counter;
-      }
-    }
-  }
-
-  // Set up a timeout callback for libcurl.
-  if (timeout_id_ == MessageLoop::kTaskIdNull) {
-    VLOG(1) << "Setting up timeout source: " << idle_seconds_ << " seconds.";
-    timeout_id_ = MessageLoop::current()->PostDelayedTask(
-        FROM_HERE,
-        base::Bind(&LibcurlHttpFetcher::TimeoutCallback,
-                   base::Unretained(this)),
-        TimeDelta::FromSeconds(idle_seconds_));
-  }
+void LibcurlHttpFetcher::SetMaxDownloadRate(int64_t bytes_per_second) {
+  max_download_rate_ = bytes_per_second;
+  if (!curl_handle_)
+    return;
+  CHECK_EQ(curl_easy_setopt(curl_handle_,
+                            CURLOPT_MAX_RECV_SPEED_LARGE,
+                            static_cast<curl_off_t>(max_download_rate_)),
+           CURLE_OK);
 }
 
 void LibcurlHttpFetcher::RetryTimeoutCallback() {
@@ -767,50 +972,23 @@ void LibcurlHttpFetcher::RetryTimeoutCallback() {
   CurlPerformOnce();
 }
 
-void LibcurlHttpFetcher::TimeoutCallback() {
-  // We always re-schedule the callback, even if we don't want to be called
-  // anymore. We will remove the event source separately if we don't want to
-  // be called back.
-  timeout_id_ = MessageLoop::current()->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(&LibcurlHttpFetcher::TimeoutCallback, base::Unretained(this)),
-      TimeDelta::FromSeconds(idle_seconds_));
-
-  // CurlPerformOnce() may call CleanUp(), so we need to schedule our callback
-  // first, since it could be canceled by this call.
-  if (transfer_in_progress_)
-    CurlPerformOnce();
-}
-
 void LibcurlHttpFetcher::CleanUp() {
-  MessageLoop::current()->CancelTask(retry_task_id_);
-  retry_task_id_ = MessageLoop::kTaskIdNull;
-
-  MessageLoop::current()->CancelTask(timeout_id_);
-  timeout_id_ = MessageLoop::kTaskIdNull;
-
-  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
-    fd_controller_maps_[t].clear();
+  if (curl_handle_) {
+    // The multi handle frees the easy handle once libcurl is done with it.
+    multi_handle_->RemoveTransfer(curl_handle_);
+    curl_handle_ = nullptr;
   }
-
   if (curl_http_headers_) {
     curl_slist_free_all(curl_http_headers_);
     curl_http_headers_ = nullptr;
   }
-  if (curl_handle_) {
-    if (curl_multi_handle_) {
-      CHECK_EQ(curl_multi_remove_handle(curl_multi_handle_, curl_handle_),
-               CURLM_OK);
-    }
-    curl_easy_cleanup(curl_handle_);
-    curl_handle_ = nullptr;
-  }
-  if (curl_multi_handle_) {
-    CHECK_EQ(curl_multi_cleanup(curl_multi_handle_), CURLM_OK);
-    curl_multi_handle_ = nullptr;
-  }
+
+  MessageLoop::current()->CancelTask(retry_task_id_);
+  retry_task_id_ = MessageLoop::kTaskIdNull;
+
   transfer_in_progress_ = false;
   transfer_paused_ = false;
+  transfer_done_ = false;
   restart_transfer_on_unpause_ = false;
 }
 
@@ -829,28 +1007,6 @@ void LibcurlHttpFetcher::GetHttpResponseCode() {
 }
 
 CURLcode LibcurlHttpFetcher::GetCurlCode() {
-  CURLcode curl_code = CURLE_OK;
-  while (true) {
-    // Repeated calls to |curl_multi_info_read| will return a new struct each
-    // time, until a NULL is returned as a signal that there is no more to get
-    // at this point.
-    int msgs_in_queue;
-    CURLMsg* curl_msg =
-        curl_multi_info_read(curl_multi_handle_, &msgs_in_queue);
-    if (curl_msg == nullptr)
-      break;
-    // When |curl_msg| is |CURLMSG_DONE|, a transfer of an easy handle is done,
-    // and then data contains the return code for this transfer.
-    if (curl_msg->msg == CURLMSG_DONE) {
-      // Make sure |curl_multi_handle_| has one and only one easy handle
-      // |curl_handle_|.
-      CHECK_EQ(curl_handle_, curl_msg->easy_handle);
-      // Transfer return code reference:
-      // https://curl.haxx.se/libcurl/c/libcurl-errors.html
-      curl_code = curl_msg->data.result;
-    }
-  }
-
   // Gets connection error if exists.
   long connect_error = 0;  // NOLINT(runtime/int) - curl needs long.
   CURLcode res =
@@ -859,7 +1015,7 @@ CURLcode LibcurlHttpFetcher::GetCurlCode() {
     LOG(ERROR) << "Connect error code from the OS: " << connect_error;
   }
 
-  return curl_code;
+  return curl_code_;
 }
 
 void UnresolvedHostStateMachine::UpdateState(bool failed_to_resolve_host) {
@@ -21,6 +21,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <curl/curl.h>
 
@@ -80,6 +81,127 @@ class UnresolvedHostStateMachine {
   DISALLOW_COPY_AND_ASSIGN(UnresolvedHostStateMachine);
 };
 
+class LibcurlHttpFetcher;
+
+// A curl multi handle shared by all the fetchers checking the certificate of
+// the same server, so their transfers reuse the connections of the handle and
+// concurrent HTTP/2 transfers are multiplexed over a single connection. It
+// watches the sockets and runs the timer libcurl asks for, and hands every
+// finished transfer to the fetcher that added it, matched by its easy handle.
+// The handles live as long as the process; all the fetchers run on the same
+// thread.
+class LibcurlMultiHandle {
+ public:
+  // Returns the multi handle of the fetchers checking |server_to_check|.
+  static LibcurlMultiHandle* Get(ServerToCheck server_to_check);
+
+  // libcurl's CURLOPT_CLOSESOCKETFUNCTION callback function, with the multi
+  // handle of the transfer that opened the socket as |clientp|. Stops watching
+  // the socket and closes it.
+  static int CloseSocketCallback(void* clientp, curl_socket_t item);
+
+  // Adds the transfer with the easy handle |easy| of |fetcher|, which is told
+  // about its progress until it's removed with RemoveTransfer().
+  void AddTransfer(CURL* easy, LibcurlHttpFetcher* fetcher);
+  void RemoveTransfer(CURL* easy);
+
+  // Lets libcurl do its work on the socket |fd| with curl_multi_socket_action,
+  // where |ev_bitmask| are the CURL_CSELECT_* events that happened on it. Pass
+  // CURL_SOCKET_TIMEOUT to let libcurl handle its timeouts. Then tells every
+  // fetcher about it, and hands the finished transfers to their fetchers. This
+  // method will not block.
+  void SocketAction(curl_socket_t fd, int ev_bitmask);
+
+  // Lets libcurl start or continue the transfers, with SocketAction().
+  void PerformOnce() { SocketAction(CURL_SOCKET_TIMEOUT, 0); }
+
+  // Whether libcurl is running, so it may be calling back a fetcher. libcurl
+  // can't be called then; SocketAction() and the transfers added and removed
+  // are deferred until it returns.
+  bool in_socket_action() const { return in_socket_action_; }
+
+ private:
+  FRIEND_TEST(LibcurlHttpFetcherTest, MultiHandlePerServerToCheckTest);
+
+  LibcurlMultiHandle();
+  ~LibcurlMultiHandle() = delete;
+
+  // A transfer added to the multi handle. Easy handles may be reused by new
+  // transfers once freed, so every transfer gets a new |id|.
+  struct Transfer {
+    LibcurlHttpFetcher* fetcher;
+    uint64_t id;
+  };
+
+  // Lets libcurl check all the sockets it uses, when they can't be watched
+  // with the message loop.
+  void PollSockets();
+
+  void TimeoutCallback();
+
+  // libcurl's CURLMOPT_SOCKETFUNCTION callback. Called by libcurl when it
+  // wants the socket |fd| to be watched for the CURL_POLL_* events |what|, or
+  // not watched anymore, so the message loop watchers are only changed when
+  // libcurl asks.
+  void WatchSocket(curl_socket_t fd, int what);
+  static int StaticSocketCallback(CURL* easy,
+                                  curl_socket_t fd,
+                                  int what,
+                                  void* userp,
+                                  void* socketp) {
+    reinterpret_cast<LibcurlMultiHandle*>(userp)->WatchSocket(fd, what);
+    return 0;
+  }
+
+  // libcurl's CURLMOPT_TIMERFUNCTION callback. Called by libcurl when it
+  // wants SocketAction() to be called with CURL_SOCKET_TIMEOUT after
+  // |timeout_ms| milliseconds, or not at all if it's -1.
+  void SetTimer(long timeout_ms);  // NOLINT(runtime/int) - curl needs long.
+  static int StaticTimerCallback(CURLM* multi,
+                                 long timeout_ms,  // NOLINT(runtime/int)
+                                 void* userp) {
+    reinterpret_cast<LibcurlMultiHandle*>(userp)->SetTimer(timeout_ms);
+    return 0;
+  }
+
+  // Stops watching the socket |fd|.
+  void ForgetSocket(curl_socket_t fd);
+
+  CURLM* handle_;
+
+  // The transfers in progress, by easy handle.
+  std::map<CURL*, Transfer> transfers_;
+  uint64_t next_transfer_id_{0};
+
+  bool in_socket_action_{false};
+  bool action_pending_{false};
+
+  // The easy handles added and removed while libcurl was running, see
+  // in_socket_action(). The removed ones are freed once removed.
+  std::vector<CURL*> pending_adds_;
+  std::vector<CURL*> pending_removals_;
+
+  // The sockets libcurl asked to watch, and the CURL_POLL_* events it's
+  // interested in.
+  std::map<curl_socket_t, int> sockets_;
+
+  // Lists of all read(0)/write(1) file descriptors that we're waiting on from
+  // the message loop. libcurl may open/close descriptors and switch their
+  // directions so maintain two separate lists so that watch conditions can be
+  // set appropriately.
+  std::map<int, std::unique_ptr<base::FileDescriptorWatcher::Controller>>
+      fd_controller_maps_[2];
+
+  // The TaskId of the libcurl timer we're waiting on. kTaskIdNull if we are not
+  // waiting on it.
+  brillo::MessageLoop::TaskId timeout_id_{brillo::MessageLoop::kTaskIdNull};
+
+  // The TaskId of the next poll of the sockets, when they can't be watched.
+  brillo::MessageLoop::TaskId poll_task_id_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(LibcurlMultiHandle);
+};
+
 class LibcurlHttpFetcher : public HttpFetcher {
  public:
   LibcurlHttpFetcher(ProxyResolver* proxy_resolver,
@@ -113,17 +235,15 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Resume the transfer by calling curl_easy_pause(CURLPAUSE_CONT).
   void Unpause() override;
 
-  // Libcurl sometimes asks to be called back after some time while
-  // leaving that time unspecified. In that case, we pick a reasonable
-  // default of one second, but it can be overridden here. This is
-  // primarily useful for testing.
-  // From http://curl.haxx.se/libcurl/c/curl_multi_timeout.html:
-  //     if libcurl returns a -1 timeout here, it just means that libcurl
-  //     currently has no stored timeout value. You must not wait too long
-  //     (more than a few seconds perhaps) before you call
-  //     curl_multi_perform() again.
+  // Sets how often the sockets are polled when they can't be watched because
+  // there's no task runner on the current thread, which usually happens if
+  // |brillo::FakeMessageLoop| is used. The sockets shared with other transfers
+  // are polled as often as the most frequent of them asks. This is primarily
+  // useful for testing.
   void set_idle_seconds(int seconds) override { idle_seconds_ = seconds; }
 
+  int idle_seconds() const { return idle_seconds_; }
+
   // Sets the retry timeout. Useful for testing.
   void set_retry_seconds(int seconds) override { retry_seconds_ = seconds; }
 
@@ -146,6 +266,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
     low_speed_time_seconds_ = low_speed_sec;
   }
 
+  // Sets CURLOPT_MAX_RECV_SPEED_LARGE, also on the transfer in progress.
+  void SetMaxDownloadRate(int64_t bytes_per_second) override;
+
   void set_connect_timeout(int connect_timeout_seconds) override {
     connect_timeout_seconds_ = connect_timeout_seconds;
   }
@@ -159,11 +282,21 @@ class LibcurlHttpFetcher : public HttpFetcher {
   }
 
  private:
+  friend class LibcurlMultiHandle;
   FRIEND_TEST(LibcurlHttpFetcherTest, HostResolvedTest);
-
-  // libcurl's CURLOPT_CLOSESOCKETFUNCTION callback function. Called when
-  // closing a socket created with the CURLOPT_OPENSOCKETFUNCTION callback.
-  static int LibcurlCloseSocketCallback(void* clientp, curl_socket_t item);
+  FRIEND_TEST(LibcurlHttpFetcherTest, ShareHandlePerServerToCheckTest);
+  FRIEND_TEST(LibcurlHttpFetcherTest, ConcurrentTransfersTest);
+
+  // Returns the curl share handle used by all the fetchers checking the
+  // certificate of |server_to_check|. It shares the DNS cache and the SSL
+  // session cache, so consecutive transfers, retries and concurrent range
+  // requests to the same server skip the DNS lookup and the full TLS
+  // handshake; the connections themselves are cached by the LibcurlMultiHandle
+  // of the same server. Fetchers checking different servers don't share SSL
+  // sessions, so a session is only resumed after the certificate check it
+  // needs was done. The handles live as long as the process and aren't locked,
+  // since all the fetchers run on the same thread.
+  static CURLSH* GetCurlShareHandle(ServerToCheck server_to_check);
 
   // Callback for when proxy resolution has completed. This begins the
   // transfer.
@@ -172,7 +305,7 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Asks libcurl for the http response code and stores it in the object.
   virtual void GetHttpResponseCode();
 
-  // Returns the last |CURLcode|.
+  // Returns the |CURLcode| the transfer finished with.
   CURLcode GetCurlCode();
 
   // Checks whether stored HTTP response is within the success range.
@@ -191,21 +324,18 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // left off.
   virtual void ResumeTransfer(const std::string& url);
 
-  void TimeoutCallback();
   void RetryTimeoutCallback();
 
-  // Calls into curl_multi_perform to let libcurl do its work. Returns after
-  // curl_multi_perform is finished, which may actually be after more than
-  // one call to curl_multi_perform. This method will set up the message
-  // loop with sources for future work that libcurl will do, if any, or complete
-  // the transfer and finish the action if no work left to do.
-  // This method will not block.
-  void CurlPerformOnce();
+  // Called by the multi handle after libcurl worked on its transfers, with
+  // the |retcode| of curl_multi_socket_action(). |done| tells whether the
+  // transfer of this fetcher finished, with the result |curl_code|.
+  void OnCurlAction(CURLMcode retcode, bool done, CURLcode curl_code);
+
+  // Completes the finished transfer and finishes the action or retries it.
+  void CompleteTransfer();
 
-  // Sets up message loop sources as needed by libcurl. This is generally
-  // the file descriptor of the socket and a timer in case nothing happens
-  // on the fds.
-  void SetupMessageLoopSources();
+  // Lets libcurl start or continue the transfer.
+  void CurlPerformOnce() { multi_handle_->PerformOnce(); }
 
   // Callback called by libcurl when new data has arrived on the transfer
   size_t LibcurlWrite(void* ptr, size_t size, size_t nmemb);
@@ -218,7 +348,7 @@ class LibcurlHttpFetcher : public HttpFetcher {
   }
 
   // Cleans up the following if they are non-null:
-  // curl(m) handles, fd_controller_maps_(fd_task_maps_), timeout_id_.
+  // curl handle, curl_http_headers_, retry_task_id_.
   void CleanUp();
 
   // Force terminate the transfer. This will invoke the delegate's (if any)
@@ -243,28 +373,23 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Hardware interface used to query dev-mode and official build settings.
   HardwareInterface* hardware_;
 
-  // Handles for the libcurl library
-  CURLM* curl_multi_handle_{nullptr};
+  // Handles for the libcurl library. The multi handle is the one of the
+  // |server_to_check_| of the transfer in progress.
+  LibcurlMultiHandle* multi_handle_{nullptr};
   CURL* curl_handle_{nullptr};
   struct curl_slist* curl_http_headers_{nullptr};
 
   // The extra headers that will be sent on each request.
   std::map<std::string, std::string> extra_headers_;
 
-  // Lists of all read(0)/write(1) file descriptors that we're waiting on from
-  // the message loop. libcurl may open/close descriptors and switch their
-  // directions so maintain two separate lists so that watch conditions can be
-  // set appropriately.
-  std::map<int, std::unique_ptr<base::FileDescriptorWatcher::Controller>>
-      fd_controller_maps_[2];
-
-  // The TaskId of the timer we're waiting on. kTaskIdNull if we are not waiting
-  // on it.
-  brillo::MessageLoop::TaskId timeout_id_{brillo::MessageLoop::kTaskIdNull};
-
   bool transfer_in_progress_{false};
   bool transfer_paused_{false};
 
+  // Whether the transfer in progress finished, and its result. A transfer that
+  // finishes while paused is completed once unpaused.
+  bool transfer_done_{false};
+  CURLcode curl_code_{CURLE_OK};
+
   // Whether it should ignore transfer failures for the purpose of retrying the
   // connection.
   bool ignore_failure_{false};
@@ -304,7 +429,7 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int no_network_retry_count_{0};
   int no_network_max_retries_{0};
 
-  // Seconds to wait before asking libcurl to "perform".
+  // Seconds between polls of the sockets, when they can't be watched.
   int idle_seconds_{1};
 
   // If true, we are currently performing a write callback on the delegate.
@@ -332,6 +457,8 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int low_speed_limit_bps_{kDownloadLowSpeedLimitBps};
   int low_speed_time_seconds_{kDownloadLowSpeedTimeSeconds};
   int connect_timeout_seconds_{kDownloadConnectTimeoutSeconds};
+  // The limit of the download rate in bytes per second, 0 for none.
+  int64_t max_download_rate_{0};
 
   DISALLOW_COPY_AND_ASSIGN(LibcurlHttpFetcher);
 };
@@ -24,6 +24,7 @@
 
 #include "update_engine/common/fake_hardware.h"
 #include "update_engine/common/mock_proxy_resolver.h"
+#include "update_engine/common/utils.h"
 #include "update_engine/mock_libcurl_http_fetcher.h"
 
 using std::string;
@@ -181,6 +182,82 @@ TEST_F(LibcurlHttpFetcherTest, HostResolvedTest) {
             no_network_max_retries + 1);
 }
 
+TEST_F(LibcurlHttpFetcherTest, ShareHandlePerServerToCheckTest) {
+  CURLSH* update_share =
+      LibcurlHttpFetcher::GetCurlShareHandle(ServerToCheck::kUpdate);
+  ASSERT_NE(nullptr, update_share);
+  EXPECT_EQ(update_share,
+            LibcurlHttpFetcher::GetCurlShareHandle(ServerToCheck::kUpdate));
+  // Fetchers checking different servers never share connections.
+  EXPECT_NE(update_share,
+            LibcurlHttpFetcher::GetCurlShareHandle(ServerToCheck::kDownload));
+  EXPECT_NE(update_share,
+            LibcurlHttpFetcher::GetCurlShareHandle(ServerToCheck::kNone));
+}
+
+TEST_F(LibcurlHttpFetcherTest, MultiHandlePerServerToCheckTest) {
+  LibcurlMultiHandle* update_multi =
+      LibcurlMultiHandle::Get(ServerToCheck::kUpdate);
+  ASSERT_NE(nullptr, update_multi);
+  EXPECT_NE(nullptr, update_multi->handle_);
+  EXPECT_EQ(update_multi, LibcurlMultiHandle::Get(ServerToCheck::kUpdate));
+  EXPECT_NE(update_multi, LibcurlMultiHandle::Get(ServerToCheck::kDownload));
+  EXPECT_NE(update_multi, LibcurlMultiHandle::Get(ServerToCheck::kNone));
+}
+
+namespace {
+// Stores the bytes received by a fetcher and whether its transfer succeeded.
+class StoringDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    data_.append(static_cast<const char*>(bytes), length);
+    return true;
+  }
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    completed_ = true;
+    successful_ = successful;
+  }
+
+  string data_;
+  bool completed_{false};
+  bool successful_{false};
+};
+}  // namespace
+
+TEST_F(LibcurlHttpFetcherTest, ConcurrentTransfersTest) {
+  // file:// URLs are only allowed on Android in official builds.
+  fake_hardware_.SetIsOfficialBuild(false);
+  ScopedTempFile first_file("first-transfer.XXXXXX");
+  ScopedTempFile second_file("second-transfer.XXXXXX");
+  ASSERT_TRUE(utils::WriteFile(first_file.path().c_str(), "first", 5));
+  ASSERT_TRUE(utils::WriteFile(second_file.path().c_str(), "second", 6));
+
+  // Both transfers are added to the same multi handle before libcurl runs, so
+  // their results are handed to their fetchers from the same action.
+  LibcurlHttpFetcher first_fetcher(nullptr, &fake_hardware_);
+  LibcurlHttpFetcher second_fetcher(nullptr, &fake_hardware_);
+  StoringDelegate first_delegate, second_delegate;
+  first_fetcher.set_delegate(&first_delegate);
+  second_fetcher.set_delegate(&second_delegate);
+  first_fetcher.ResumeTransfer("file://" + first_file.path());
+  second_fetcher.ResumeTransfer("file://" + second_file.path());
+  EXPECT_EQ(first_fetcher.multi_handle_, second_fetcher.multi_handle_);
+  first_fetcher.CurlPerformOnce();
+  while (loop_.PendingTasks() &&
+         !(first_delegate.completed_ && second_delegate.completed_)) {
+    loop_.RunOnce(true);
+  }
+
+  EXPECT_TRUE(first_delegate.completed_);
+  EXPECT_TRUE(first_delegate.successful_);
+  EXPECT_EQ("first", first_delegate.data_);
+  EXPECT_TRUE(second_delegate.completed_);
+  EXPECT_TRUE(second_delegate.successful_);
+  EXPECT_EQ("second", second_delegate.data_);
+}
+
 TEST_F(LibcurlHttpFetcherTest, HttpFetcherStateMachineRetryFailedTest) {
   state_machine_.UpdateState(true);
   state_machine_.UpdateState(true);
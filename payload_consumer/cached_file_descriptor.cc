@@ -48,6 +48,17 @@ off64_t CachedFileDescriptor::Seek(off64_t offset, int whence) {
   return offset_;
 }
 
+ssize_t CachedFileDescriptor::Read(void* buf, size_t count) {
+  if (!FlushCache()) {
+    return -1;
+  }
+  auto bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0) {
+    offset_ += bytes_read;
+  }
+  return bytes_read;
+}
+
 ssize_t CachedFileDescriptor::Write(const void* buf, size_t count) {
   auto bytes = static_cast<const uint8_t*>(buf);
   size_t total_bytes_wrote = 0;
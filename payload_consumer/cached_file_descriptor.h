@@ -42,9 +42,8 @@ class CachedFileDescriptor : public FileDescriptor {
   bool Open(const char* path, int flags) override {
     return fd_->Open(path, flags);
   }
-  ssize_t Read(void* buf, size_t count) override {
-    return fd_->Read(buf, count);
-  }
+  // Writes the cached bytes first, so the read sees them.
+  ssize_t Read(void* buf, size_t count) override;
   ssize_t Write(const void* buf, size_t count) override;
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
@@ -201,4 +201,30 @@ TEST_F(CachedFileDescriptorTest, SeekAfterWriteTest) {
   EXPECT_EQ(blob_in, blob_out);
 }
 
+TEST_F(CachedFileDescriptorTest, ReadAfterWriteTest) {
+  size_t size = kCacheSize / 2;
+  brillo::Blob old_blob(size, value_ + 1);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  Write(old_blob.data(), old_blob.size());
+  EXPECT_TRUE(cfd_->Flush());
+  brillo::Blob blob_in(size, value_);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  Write(blob_in.data(), blob_in.size());
+
+  // A read right after the cached bytes doesn't see the bytes they replace.
+  brillo::Blob blob_out(size);
+  EXPECT_EQ(cfd_->Read(blob_out.data(), blob_out.size()),
+            static_cast<ssize_t>(size));
+  EXPECT_EQ(brillo::Blob(size, 0), blob_out);
+
+  // Reading the same bytes twice returns them twice.
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+    EXPECT_EQ(cfd_->Read(blob_out.data(), blob_out.size()),
+              static_cast<ssize_t>(size));
+    EXPECT_EQ(blob_in, blob_out);
+  }
+  EXPECT_EQ(cfd_->Seek(0, SEEK_CUR), static_cast<off64_t>(size));
+}
+
 }  // namespace chromeos_update_engine
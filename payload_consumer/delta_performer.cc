@@ -81,6 +81,36 @@ namespace {
 const int kUpdateStateOperationInvalid = -1;
 const int kMaxResumedUpdateFailures = 10;
 
+// Returns whether the partition |partition_name| is a dynamic partition that
+// gets a snapshot when applying |manifest|.
+bool IsSnapshotPartition(const DeltaArchiveManifest& manifest,
+                         const string& partition_name) {
+  if (!manifest.has_dynamic_partition_metadata() ||
+      !manifest.dynamic_partition_metadata().snapshot_enabled()) {
+    return false;
+  }
+  for (const DynamicPartitionGroup& group :
+       manifest.dynamic_partition_metadata().groups()) {
+    for (const string& name : group.partition_names()) {
+      if (name == partition_name)
+        return true;
+    }
+  }
+  return false;
+}
+
+// Returns whether an operation of |partition| reads its source data from
+// another partition than |partition|.
+bool ReadsOtherPartitions(const PartitionUpdate& partition) {
+  for (const InstallOperation& operation : partition.operations()) {
+    if (operation.has_src_partition_name() &&
+        operation.src_partition_name() != partition.partition_name()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 // Computes the ratio of |part| and |total|, scaled to |norm|, using integer
@@ -227,14 +257,15 @@ int DeltaPerformer::CloseCurrentPartition() {
   }
   int err = partition_writer_->Close();
   partition_writer_ = nullptr;
+  streamed_partition_.reset();
   return err;
 }
 
 bool DeltaPerformer::OpenCurrentPartition() {
-  if (current_partition_ >= partitions_.size())
+  if (current_partition_ >= static_cast<size_t>(partitions_.size()))
     return false;
 
-  const PartitionUpdate& partition = partitions_[current_partition_];
+  const PartitionUpdate& partition = GetPartition(current_partition_);
   size_t num_previous_partitions =
       install_plan_->partitions.size() - partitions_.size();
   const InstallPlan::Partition& install_part =
@@ -249,7 +280,7 @@ bool DeltaPerformer::OpenCurrentPartition() {
       IsDynamicPartition(install_part.name, install_plan_->target_slot));
   // Open source fds if we have a delta payload, or for partitions in the
   // partial update.
-  bool source_may_exist = manifest_.partial_update() ||
+  bool source_may_exist = manifest_->partial_update() ||
                           payload_->type == InstallPayloadType::kDelta;
   const size_t partition_operation_num = GetPartitionOperationNum();
 
@@ -259,6 +290,12 @@ bool DeltaPerformer::OpenCurrentPartition() {
   return true;
 }
 
+const PartitionUpdate& DeltaPerformer::GetPartition(size_t index) const {
+  if (streamed_partition_ && index == current_partition_)
+    return *streamed_partition_;
+  return partitions_[index];
+}
+
 size_t DeltaPerformer::GetPartitionOperationNum() {
   return next_operation_num_ -
          (current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0);
@@ -272,7 +309,8 @@ void LogPartitionInfoHash(const PartitionInfo& info, const string& tag) {
             << " size: " << info.size();
 }
 
-void LogPartitionInfo(const vector<PartitionUpdate>& partitions) {
+void LogPartitionInfo(
+    const google::protobuf::RepeatedPtrField<PartitionUpdate>& partitions) {
   for (const PartitionUpdate& partition : partitions) {
     if (partition.has_old_partition_info()) {
       LogPartitionInfoHash(partition.old_partition_info(),
@@ -381,7 +419,7 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
   }
 
   // The payload metadata is deemed valid, it's safe to parse the protobuf.
-  if (!payload_metadata_.GetManifest(payload, &manifest_)) {
+  if (!payload_metadata_.GetManifest(payload, manifest_)) {
     LOG(ERROR) << "Unable to parse manifest in update file.";
     *error = ErrorCode::kDownloadManifestParseError;
     return MetadataParseResult::kError;
@@ -443,7 +481,7 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     // Clear the download buffer.
     DiscardBuffer(false, metadata_size_);
 
-    block_size_ = manifest_.block_size();
+    block_size_ = manifest_->block_size();
 
     // This populates |partitions_| and the |install_plan.partitions| with the
     // list of partitions from the manifest.
@@ -458,7 +496,9 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
 
     num_total_operations_ = 0;
     for (const auto& partition : partitions_) {
-      num_total_operations_ += partition.operations_size();
+      num_total_operations_ += partition.has_operations_data_offset()
+                                   ? partition.num_operations()
+                                   : partition.operations_size();
       acc_num_operations_.push_back(num_total_operations_);
     }
 
@@ -476,13 +516,6 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       return false;
     }
 
-    if (next_operation_num_ < acc_num_operations_[current_partition_]) {
-      if (!OpenCurrentPartition()) {
-        *error = ErrorCode::kInstallDeviceOpenError;
-        return false;
-      }
-    }
-
     if (next_operation_num_ > 0)
       UpdateOverallProgress(true, "Resuming after ");
     LOG(INFO) << "Starting to apply update payload operations";
@@ -506,6 +539,17 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       while (next_operation_num_ >= acc_num_operations_[current_partition_]) {
         current_partition_++;
       }
+    }
+
+    if (!partition_writer_) {
+      // The operations of the partition may come before its data blobs.
+      MetadataParseResult result =
+          ParsePartitionOperations(&c_bytes, &count, error);
+      if (result == MetadataParseResult::kError)
+        return false;
+      if (result == MetadataParseResult::kInsufficientData)
+        return true;
+
       if (!OpenCurrentPartition()) {
         *error = ErrorCode::kInstallDeviceOpenError;
         return false;
@@ -513,7 +557,7 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     }
 
     const InstallOperation& op =
-        partitions_[current_partition_].operations(GetPartitionOperationNum());
+        GetPartition(current_partition_).operations(GetPartitionOperationNum());
 
     CopyDataToBuffer(&c_bytes, &count, op.data_length());
 
@@ -573,6 +617,18 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
         op_result = PerformPuffDiffOperation(op, error);
         OP_DURATION_HISTOGRAM("PUFFDIFF", op_start_time);
         break;
+      case InstallOperation::LZ4DIFF_BSDIFF:
+        op_result = PerformLz4diffOperation(op, error);
+        OP_DURATION_HISTOGRAM("LZ4DIFF_BSDIFF", op_start_time);
+        break;
+      case InstallOperation::EXECUTABLE_BSDIFF:
+        op_result = PerformExecutableDiffOperation(op, error);
+        OP_DURATION_HISTOGRAM("EXECUTABLE_BSDIFF", op_start_time);
+        break;
+      case InstallOperation::TARGET_COPY:
+        op_result = PerformTargetCopyOperation(op);
+        OP_DURATION_HISTOGRAM("TARGET_COPY", op_start_time);
+        break;
       default:
         op_result = false;
     }
@@ -581,7 +637,11 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
 
     next_operation_num_++;
     UpdateOverallProgress(false, "Completed ");
-    CheckpointUpdateProgress(false);
+    // Always checkpoint at the end of a partition, so a resume never needs
+    // the operations of an earlier partition than the last ones stored in the
+    // prefs by ParsePartitionOperations().
+    CheckpointUpdateProgress(next_operation_num_ ==
+                             acc_num_operations_[current_partition_]);
   }
 
   if (partition_writer_) {
@@ -591,18 +651,18 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
 
   // In major version 2, we don't add unused operation to the payload.
   // If we already extracted the signature we should skip this step.
-  if (manifest_.has_signatures_offset() && manifest_.has_signatures_size() &&
+  if (manifest_->has_signatures_offset() && manifest_->has_signatures_size() &&
       signatures_message_data_.empty()) {
-    if (manifest_.signatures_offset() != buffer_offset_) {
+    if (manifest_->signatures_offset() != buffer_offset_) {
       LOG(ERROR) << "Payload signatures offset points to blob offset "
-                 << manifest_.signatures_offset()
+                 << manifest_->signatures_offset()
                  << " but signatures are expected at offset " << buffer_offset_;
       *error = ErrorCode::kDownloadPayloadVerificationError;
       return false;
     }
-    CopyDataToBuffer(&c_bytes, &count, manifest_.signatures_size());
+    CopyDataToBuffer(&c_bytes, &count, manifest_->signatures_size());
     // Needs more data to cover entire signature.
-    if (buffer_.size() < manifest_.signatures_size())
+    if (buffer_.size() < manifest_->signatures_size())
       return true;
     if (!ExtractSignatureMessage()) {
       LOG(ERROR) << "Extract payload signature failed.";
@@ -626,11 +686,6 @@ bool DeltaPerformer::IsManifestValid() {
 }
 
 bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
-  partitions_.clear();
-  for (const PartitionUpdate& partition : manifest_.partitions()) {
-    partitions_.push_back(partition);
-  }
-
   // For VAB and partial updates, the partition preparation will copy the
   // dynamic partitions metadata to the target metadata slot, and rename the
   // slot suffix of the partitions in the metadata.
@@ -647,17 +702,19 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
   }
 
   // Partitions in manifest are no longer needed after preparing partitions.
-  manifest_.clear_partitions();
+  // Both live in |manifest_arena_|, so this moves them without copying.
+  partitions_.Clear();
+  partitions_.Swap(manifest_->mutable_partitions());
   // TODO(xunchang) TBD: allow partial update only on devices with dynamic
   // partition.
-  if (manifest_.partial_update()) {
+  if (manifest_->partial_update()) {
     std::set<std::string> touched_partitions;
     for (const auto& partition_update : partitions_) {
       touched_partitions.insert(partition_update.partition_name());
     }
 
-    auto generator = partition_update_generator::Create(boot_control_,
-                                                        manifest_.block_size());
+    auto generator = partition_update_generator::Create(
+        boot_control_, manifest_->block_size());
     std::vector<PartitionUpdate> untouched_static_partitions;
     TEST_AND_RETURN_FALSE(
         generator->GenerateOperationsForPartitionsNotInPayload(
@@ -665,9 +722,9 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
             install_plan_->target_slot,
             touched_partitions,
             &untouched_static_partitions));
-    partitions_.insert(partitions_.end(),
-                       untouched_static_partitions.begin(),
-                       untouched_static_partitions.end());
+    for (auto& partition_update : untouched_static_partitions) {
+      *partitions_.Add() = std::move(partition_update);
+    }
 
     // Save the untouched dynamic partitions in install plan.
     std::vector<std::string> dynamic_partitions;
@@ -772,6 +829,79 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
   return true;
 }
 
+MetadataParseResult DeltaPerformer::ParsePartitionOperations(
+    const char** bytes_p, size_t* count_p, ErrorCode* error) {
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  if (!partition.has_operations_data_offset())
+    return MetadataParseResult::kSuccess;
+
+  string operations_data;
+  if (buffer_offset_ > partition.operations_data_offset()) {
+    // Resuming an update after the operations of the partition were
+    // downloaded, they were stored in the prefs before they were used.
+    if (!prefs_->GetString(kPrefsPartitionOperationsBytes, &operations_data)) {
+      LOG(ERROR) << "Unable to load the operations of partition "
+                 << partition.partition_name();
+      *error = ErrorCode::kDownloadStateInitializationError;
+      return MetadataParseResult::kError;
+    }
+  } else {
+    if (buffer_offset_ != partition.operations_data_offset()) {
+      LOG(ERROR) << "The operations of partition "
+                 << partition.partition_name() << " are at offset "
+                 << partition.operations_data_offset()
+                 << " but are expected at offset " << buffer_offset_;
+      *error = ErrorCode::kDownloadManifestParseError;
+      return MetadataParseResult::kError;
+    }
+    CopyDataToBuffer(bytes_p, count_p, partition.operations_data_length());
+    if (buffer_.size() < partition.operations_data_length())
+      return MetadataParseResult::kInsufficientData;
+    operations_data.assign(buffer_.begin(), buffer_.end());
+    DiscardBuffer(true, buffer_.size());
+  }
+
+  // The hash of the operations is the only link between them and the signed
+  // manifest, so it's checked even if hash checks are not mandatory.
+  brillo::Blob calculated_hash;
+  if (!HashCalculator::RawHashOfBytes(
+          operations_data.data(), operations_data.size(), &calculated_hash) ||
+      calculated_hash !=
+          brillo::Blob(partition.operations_data_sha256_hash().begin(),
+                       partition.operations_data_sha256_hash().end())) {
+    LOG(ERROR) << "Hash verification failed for the operations of partition "
+               << partition.partition_name();
+    *error = ErrorCode::kDownloadOperationHashMismatch;
+    return MetadataParseResult::kError;
+  }
+
+  auto streamed_partition = std::make_unique<PartitionUpdate>(partition);
+  if (!PayloadMetadata::DecodePartitionOperations(
+          partition,
+          operations_data.data(),
+          operations_data.size(),
+          streamed_partition->mutable_operations())) {
+    LOG(ERROR) << "Unable to parse the operations of partition "
+               << partition.partition_name();
+    *error = ErrorCode::kDownloadManifestParseError;
+    return MetadataParseResult::kError;
+  }
+  if (manifest_->minor_version() < kCrossPartitionMinorPayloadVersion &&
+      ReadsOtherPartitions(*streamed_partition)) {
+    LOG(ERROR) << "Partition " << partition.partition_name()
+               << " reads from other partitions, which isn't allowed in "
+               << "minor version " << manifest_->minor_version();
+    *error = ErrorCode::kDownloadManifestParseError;
+    return MetadataParseResult::kError;
+  }
+  LOG_IF(WARNING,
+         !prefs_->SetString(kPrefsPartitionOperationsBytes, operations_data))
+      << "Unable to save the operations of partition "
+      << partition.partition_name();
+  streamed_partition_ = std::move(streamed_partition);
+  return MetadataParseResult::kSuccess;
+}
+
 bool DeltaPerformer::PreparePartitionsForUpdate(uint64_t* required_size) {
   // Call static PreparePartitionsForUpdate with hash from
   // kPrefsUpdateCheckResponseHash to ensure hash of payload that space is
@@ -782,7 +912,7 @@ bool DeltaPerformer::PreparePartitionsForUpdate(uint64_t* required_size) {
   return PreparePartitionsForUpdate(prefs_,
                                     boot_control_,
                                     install_plan_->target_slot,
-                                    manifest_,
+                                    *manifest_,
                                     update_check_response_hash,
                                     required_size);
 }
@@ -920,6 +1050,16 @@ bool DeltaPerformer::PerformSourceCopyOperation(
   return partition_writer_->PerformSourceCopyOperation(operation, error);
 }
 
+bool DeltaPerformer::PerformTargetCopyOperation(
+    const InstallOperation& operation) {
+  if (manifest_->minor_version() < kTargetCopyMinorPayloadVersion) {
+    LOG(ERROR) << "TARGET_COPY operations aren't allowed in minor version "
+               << manifest_->minor_version();
+    return false;
+  }
+  return partition_writer_->PerformTargetCopyOperation(operation);
+}
+
 bool DeltaPerformer::ExtentsToBsdiffPositionsString(
     const RepeatedPtrField<Extent>& extents,
     uint64_t block_size,
@@ -971,16 +1111,50 @@ bool DeltaPerformer::PerformPuffDiffOperation(const InstallOperation& operation,
   return true;
 }
 
+bool DeltaPerformer::PerformLz4diffOperation(const InstallOperation& operation,
+                                             ErrorCode* error) {
+  if (manifest_->minor_version() < kLz4diffMinorPayloadVersion) {
+    LOG(ERROR) << "LZ4DIFF_BSDIFF operations aren't allowed in minor version "
+               << manifest_->minor_version();
+    return false;
+  }
+  // Since we delete data off the beginning of the buffer as we use it,
+  // the data we need should be exactly at the beginning of the buffer.
+  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
+  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+  TEST_AND_RETURN_FALSE(partition_writer_->PerformLz4diffOperation(
+      operation, error, buffer_.data(), buffer_.size()));
+  DiscardBuffer(true, buffer_.size());
+  return true;
+}
+
+bool DeltaPerformer::PerformExecutableDiffOperation(
+    const InstallOperation& operation, ErrorCode* error) {
+  if (manifest_->minor_version() < kExecutableDiffMinorPayloadVersion) {
+    LOG(ERROR) << "EXECUTABLE_BSDIFF operations aren't allowed in minor "
+               << "version " << manifest_->minor_version();
+    return false;
+  }
+  // Since we delete data off the beginning of the buffer as we use it,
+  // the data we need should be exactly at the beginning of the buffer.
+  TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
+  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+  TEST_AND_RETURN_FALSE(partition_writer_->PerformExecutableDiffOperation(
+      operation, error, buffer_.data(), buffer_.size()));
+  DiscardBuffer(true, buffer_.size());
+  return true;
+}
+
 bool DeltaPerformer::ExtractSignatureMessage() {
   TEST_AND_RETURN_FALSE(signatures_message_data_.empty());
-  TEST_AND_RETURN_FALSE(buffer_offset_ == manifest_.signatures_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= manifest_.signatures_size());
+  TEST_AND_RETURN_FALSE(buffer_offset_ == manifest_->signatures_offset());
+  TEST_AND_RETURN_FALSE(buffer_.size() >= manifest_->signatures_size());
   signatures_message_data_.assign(
-      buffer_.begin(), buffer_.begin() + manifest_.signatures_size());
+      buffer_.begin(), buffer_.begin() + manifest_->signatures_size());
 
   LOG(INFO) << "Extracted signature data of size "
-            << manifest_.signatures_size() << " at "
-            << manifest_.signatures_offset();
+            << manifest_->signatures_size() << " at "
+            << manifest_->signatures_offset();
   return true;
 }
 
@@ -1028,8 +1202,8 @@ DeltaPerformer::CreatePayloadVerifier() {
 ErrorCode DeltaPerformer::ValidateManifest() {
   // Perform assorted checks to validation check the manifest, make sure it
   // matches data from other sources, and that it is a supported version.
-  bool has_old_fields = std::any_of(manifest_.partitions().begin(),
-                                    manifest_.partitions().end(),
+  bool has_old_fields = std::any_of(manifest_->partitions().begin(),
+                                    manifest_->partitions().end(),
                                     [](const PartitionUpdate& partition) {
                                       return partition.has_old_partition_info();
                                     });
@@ -1038,7 +1212,7 @@ ErrorCode DeltaPerformer::ValidateManifest() {
   // update. Also, always treat the partial update as delta so that we can
   // perform the minor version check correctly.
   InstallPayloadType actual_payload_type =
-      (has_old_fields || manifest_.partial_update())
+      (has_old_fields || manifest_->partial_update())
           ? InstallPayloadType::kDelta
           : InstallPayloadType::kFull;
 
@@ -1058,18 +1232,18 @@ ErrorCode DeltaPerformer::ValidateManifest() {
   // Check that the minor version is compatible.
   // TODO(xunchang) increment minor version & add check for partial update
   if (actual_payload_type == InstallPayloadType::kFull) {
-    if (manifest_.minor_version() != kFullPayloadMinorVersion) {
+    if (manifest_->minor_version() != kFullPayloadMinorVersion) {
       LOG(ERROR) << "Manifest contains minor version "
-                 << manifest_.minor_version()
+                 << manifest_->minor_version()
                  << ", but all full payloads should have version "
                  << kFullPayloadMinorVersion << ".";
       return ErrorCode::kUnsupportedMinorPayloadVersion;
     }
   } else {
-    if (manifest_.minor_version() < kMinSupportedMinorPayloadVersion ||
-        manifest_.minor_version() > kMaxSupportedMinorPayloadVersion) {
+    if (manifest_->minor_version() < kMinSupportedMinorPayloadVersion ||
+        manifest_->minor_version() > kMaxSupportedMinorPayloadVersion) {
       LOG(ERROR) << "Manifest contains minor version "
-                 << manifest_.minor_version()
+                 << manifest_->minor_version()
                  << " not in the range of supported minor versions ["
                  << kMinSupportedMinorPayloadVersion << ", "
                  << kMaxSupportedMinorPayloadVersion << "].";
@@ -1092,6 +1266,37 @@ ErrorCode DeltaPerformer::ValidateManifest() {
     }
   }
 
+  for (const PartitionUpdate& partition : manifest_->partitions()) {
+    if (manifest_->minor_version() < kCrossPartitionMinorPayloadVersion &&
+        ReadsOtherPartitions(partition)) {
+      LOG(ERROR) << "Partition " << partition.partition_name()
+                 << " reads from other partitions, which isn't allowed in "
+                 << "minor version " << manifest_->minor_version();
+      return ErrorCode::kDownloadManifestParseError;
+    }
+    if (!partition.has_operations_data_offset())
+      continue;
+    // Every serialized operation takes at least one byte.
+    if (manifest_->minor_version() < kStreamedOperationsMinorPayloadVersion ||
+        partition.operations_size() > 0 || partition.num_operations() == 0 ||
+        partition.num_operations() > partition.operations_data_length() ||
+        partition.operations_data_sha256_hash().size() != kSHA256Size) {
+      LOG(ERROR) << "Invalid operations data of partition "
+                 << partition.partition_name();
+      return ErrorCode::kDownloadManifestParseError;
+    }
+    // The snapshots are created before any operation is downloaded. Without a
+    // COW size estimate, their size would be computed from the operations in
+    // the manifest, which doesn't have the streamed ones.
+    if (IsSnapshotPartition(*manifest_, partition.partition_name()) &&
+        !partition.has_estimate_cow_size()) {
+      LOG(ERROR) << "The operations of partition "
+                 << partition.partition_name()
+                 << " are streamed but it has no COW size estimate.";
+      return ErrorCode::kDownloadManifestParseError;
+    }
+  }
+
   // TODO(crbug.com/37661) we should be adding more and more manifest checks,
   // such as partition boundaries, etc.
 
@@ -1100,8 +1305,8 @@ ErrorCode DeltaPerformer::ValidateManifest() {
 
 ErrorCode DeltaPerformer::CheckTimestampError() const {
   bool is_partial_update =
-      manifest_.has_partial_update() && manifest_.partial_update();
-  const auto& partitions = manifest_.partitions();
+      manifest_->has_partial_update() && manifest_->partial_update();
+  const auto& partitions = manifest_->partitions();
 
   // Check version field for a given PartitionUpdate object. If an error
   // is encountered, set |error_code| accordingly. If downgrade is detected,
@@ -1166,11 +1371,11 @@ ErrorCode DeltaPerformer::CheckTimestampError() const {
   }
 
   // For non-partial updates, check max_timestamp first.
-  if (manifest_.max_timestamp() < hardware_->GetBuildTimestamp()) {
+  if (manifest_->max_timestamp() < hardware_->GetBuildTimestamp()) {
     LOG(ERROR) << "The current OS build timestamp ("
                << hardware_->GetBuildTimestamp()
                << ") is newer than the maximum timestamp in the manifest ("
-               << manifest_.max_timestamp() << ")";
+               << manifest_->max_timestamp() << ")";
     return ErrorCode::kPayloadTimestampError;
   }
   // Otherwise... partitions can have empty timestamps.
@@ -1209,8 +1414,8 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
     // that doesn't have a hash at the time the manifest is created. So we
     // should not complaint about that operation. This operation can be
     // recognized by the fact that it's offset is mentioned in the manifest.
-    if (manifest_.signatures_offset() &&
-        manifest_.signatures_offset() == operation.data_offset()) {
+    if (manifest_->signatures_offset() &&
+        manifest_->signatures_offset() == operation.data_offset()) {
       LOG(INFO) << "Skipping hash verification for signature operation "
                 << next_operation_num_ + 1;
     } else {
@@ -1384,6 +1589,7 @@ bool DeltaPerformer::ResetUpdateProgress(
     prefs->SetInt64(kPrefsResumedUpdateFailures, 0);
     prefs->Delete(kPrefsPostInstallSucceeded);
     prefs->Delete(kPrefsVerityWritten);
+    prefs->Delete(kPrefsPartitionOperationsBytes);
 
     if (!skip_dynamic_partititon_metadata_updated) {
       LOG(INFO) << "Resetting recorded hash for prepared partitions.";
@@ -1442,10 +1648,16 @@ bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
       const size_t partition_operation_num =
           next_operation_num_ -
           (partition_index ? acc_num_operations_[partition_index - 1] : 0);
-      const InstallOperation& op =
-          partitions_[partition_index].operations(partition_operation_num);
+      const PartitionUpdate& partition = GetPartition(partition_index);
+      // The operations of the next partition weren't read yet if they are
+      // stored in the data blobs, so they are the next data.
+      uint64_t next_data_length =
+          partition_operation_num <
+                  static_cast<size_t>(partition.operations_size())
+              ? partition.operations(partition_operation_num).data_length()
+              : partition.operations_data_length();
       TEST_AND_RETURN_FALSE(
-          prefs_->SetInt64(kPrefsUpdateStateNextDataLength, op.data_length()));
+          prefs_->SetInt64(kPrefsUpdateStateNextDataLength, next_data_length));
     } else {
       TEST_AND_RETURN_FALSE(
           prefs_->SetInt64(kPrefsUpdateStateNextDataLength, 0));
@@ -27,6 +27,7 @@
 
 #include <base/time/time.h>
 #include <brillo/secure_blob.h>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/repeated_field.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
@@ -234,6 +235,19 @@ class DeltaPerformer : public FileWriter {
   // manifest to be parsed and valid.
   bool ParseManifestPartitions(ErrorCode* error);
 
+  // Reads the operations of the current partition when they are stored in
+  // the data blobs instead of the manifest, from the downloaded data in
+  // |*bytes_p| and |*count_p| or, when resuming after they were downloaded,
+  // from the prefs. The partition with its operations is stored in
+  // |streamed_partition_|. Returns kSuccess if there's nothing to read.
+  MetadataParseResult ParsePartitionOperations(const char** bytes_p,
+                                               size_t* count_p,
+                                               ErrorCode* error);
+
+  // Returns the partition at |index| in |partitions_|, or
+  // |streamed_partition_| if it holds the operations of that partition.
+  const PartitionUpdate& GetPartition(size_t index) const;
+
   // Appends up to |*count_p| bytes from |*bytes_p| to |buffer_|, but only to
   // the extent that the size of |buffer_| does not exceed |max|. Advances
   // |*cbytes_p| and decreases |*count_p| by the actual number of bytes copied,
@@ -279,6 +293,11 @@ class DeltaPerformer : public FileWriter {
                                     ErrorCode* error);
   bool PerformPuffDiffOperation(const InstallOperation& operation,
                                 ErrorCode* error);
+  bool PerformLz4diffOperation(const InstallOperation& operation,
+                               ErrorCode* error);
+  bool PerformExecutableDiffOperation(const InstallOperation& operation,
+                                      ErrorCode* error);
+  bool PerformTargetCopyOperation(const InstallOperation& operation);
 
   // Extracts the payload signature message from the current |buffer_| if the
   // offset matches the one specified by the manifest. Returns whether the
@@ -346,9 +365,16 @@ class DeltaPerformer : public FileWriter {
 
   PayloadMetadata payload_metadata_;
 
+  // Arena holding |manifest_| and |partitions_|. A large payload has millions
+  // of nested messages in the manifest, allocating them from an arena makes
+  // both parsing and destroying them much cheaper.
+  google::protobuf::Arena manifest_arena_;
+
   // Parsed manifest. Set after enough bytes to parse the manifest were
   // downloaded.
-  DeltaArchiveManifest manifest_;
+  DeltaArchiveManifest* manifest_{
+      google::protobuf::Arena::CreateMessage<DeltaArchiveManifest>(
+          &manifest_arena_)};
   bool manifest_parsed_{false};
   bool manifest_valid_{false};
   uint64_t metadata_size_{0};
@@ -367,12 +393,19 @@ class DeltaPerformer : public FileWriter {
   // The list of partitions to update as found in the manifest major
   // version 2. When parsing an older manifest format, the information is
   // converted over to this format instead.
-  std::vector<PartitionUpdate> partitions_;
+  google::protobuf::RepeatedPtrField<PartitionUpdate> partitions_{
+      &manifest_arena_};
 
   // Index in the list of partitions (|partitions_| member) of the current
   // partition being processed.
   size_t current_partition_{0};
 
+  // A copy of the current partition with its operations, when they are
+  // stored in the data blobs instead of the manifest. It's allocated apart
+  // from |manifest_arena_| so the memory of the operations of every partition
+  // is released when the partition is closed.
+  std::unique_ptr<PartitionUpdate> streamed_partition_;
+
   // Index of the next operation to perform in the manifest. The index is
   // linear on the total number of operation on the manifest.
   size_t next_operation_num_{0};
@@ -153,7 +153,7 @@ class DeltaPerformerIntegrationTest : public ::testing::Test {
                                              : InstallPayloadType::kFull;
 
     // The Manifest we are validating.
-    performer.manifest_.CopyFrom(manifest);
+    performer.manifest_->CopyFrom(manifest);
     performer.major_payload_version_ = major_version;
 
     EXPECT_EQ(expected, performer.ValidateManifest());
@@ -184,7 +184,7 @@ class DeltaPerformerTest : public ::testing::Test {
     payload_.type = payload_type;
 
     // The Manifest we are validating.
-    performer_.manifest_.CopyFrom(manifest);
+    performer_.manifest_->CopyFrom(manifest);
     performer_.major_payload_version_ = major_version;
 
     EXPECT_EQ(expected, performer_.ValidateManifest());
@@ -214,6 +214,7 @@ class DeltaPerformerTest : public ::testing::Test {
     PayloadGenerationConfig config;
     config.version.major = major_version;
     config.version.minor = minor_version;
+    config.stream_operations = stream_operations_;
 
     PayloadFile payload;
     EXPECT_TRUE(payload.Init(config));
@@ -432,6 +433,9 @@ class DeltaPerformerTest : public ::testing::Test {
     EXPECT_EQ(payload_.metadata_size, performer_.metadata_size_);
   }
 
+  // Whether GeneratePayload() stores the operations in the data blobs.
+  bool stream_operations_{false};
+
   FakePrefs prefs_;
   InstallPlan install_plan_;
   InstallPlan::Payload payload_;
@@ -514,6 +518,28 @@ TEST_F(DeltaPerformerTest, ReplaceOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, StreamedOperationsTest) {
+  brillo::Blob expected_data =
+      brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
+  expected_data.resize(2 * 4096);  // two blocks
+  vector<AnnotatedOperation> aops;
+  for (uint64_t i = 0; i < 2; i++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(i, 1);
+    aop.op.set_data_offset(i * 4096);
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+
+  stream_operations_ = true;
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  // The operations were stored for resuming the update.
+  EXPECT_TRUE(prefs_.Exists(kPrefsPartitionOperationsBytes));
+}
+
 TEST_F(DeltaPerformerTest, ReplaceBzOperationTest) {
   brillo::Blob expected_data =
       brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
@@ -780,6 +806,88 @@ TEST_F(DeltaPerformerTest, ValidateManifestFullPartitionUpdateTest) {
                         ErrorCode::kPayloadMismatchedType);
 }
 
+TEST_F(DeltaPerformerTest, ValidateManifestStreamedOperationsWithoutHash) {
+  // The Manifest we are validating.
+  DeltaArchiveManifest manifest;
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->mutable_old_partition_info();
+  partition->mutable_new_partition_info();
+  partition->set_operations_data_offset(0);
+  partition->set_operations_data_length(100);
+  partition->set_num_operations(10);
+  manifest.set_minor_version(kStreamedOperationsMinorPayloadVersion);
+
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        ErrorCode::kDownloadManifestParseError);
+}
+
+TEST_F(DeltaPerformerTest, ValidateManifestStreamedOperationsCowSize) {
+  // The Manifest we are validating.
+  DeltaArchiveManifest manifest;
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->set_partition_name("system");
+  partition->mutable_old_partition_info();
+  partition->mutable_new_partition_info();
+  partition->set_operations_data_offset(0);
+  partition->set_operations_data_length(100);
+  partition->set_num_operations(10);
+  partition->set_operations_data_sha256_hash(string(32, 'a'));
+  manifest.set_minor_version(kStreamedOperationsMinorPayloadVersion);
+  DynamicPartitionMetadata* metadata =
+      manifest.mutable_dynamic_partition_metadata();
+  metadata->set_snapshot_enabled(true);
+  DynamicPartitionGroup* group = metadata->add_groups();
+  group->set_name("group");
+  group->add_partition_names("system");
+
+  // The snapshot of the partition can't be sized without the operations.
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        ErrorCode::kDownloadManifestParseError);
+
+  manifest.mutable_partitions(0)->set_estimate_cow_size(4096);
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        ErrorCode::kSuccess);
+}
+
+TEST_F(DeltaPerformerTest, ValidateManifestCrossPartitionMinorVersion) {
+  // The Manifest we are validating.
+  DeltaArchiveManifest manifest;
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->set_partition_name("product");
+  partition->mutable_old_partition_info();
+  partition->mutable_new_partition_info();
+  InstallOperation* op = partition->add_operations();
+  op->set_type(InstallOperation::SOURCE_COPY);
+  op->set_src_partition_name("system");
+  manifest.set_minor_version(kCrossPartitionMinorPayloadVersion - 1);
+
+  // Older payloads can't read from other partitions.
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        ErrorCode::kDownloadManifestParseError);
+
+  // Naming the partition itself is not a cross-partition read.
+  op->set_src_partition_name("product");
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        ErrorCode::kSuccess);
+
+  op->set_src_partition_name("system");
+  manifest.set_minor_version(kCrossPartitionMinorPayloadVersion);
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        ErrorCode::kSuccess);
+}
+
 TEST_F(DeltaPerformerTest, ValidateManifestBadMinorVersion) {
   // The Manifest we are validating.
   DeltaArchiveManifest manifest;
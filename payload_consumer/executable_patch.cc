@@ -0,0 +1,220 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/executable_patch.h"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <base/logging.h>
+#include <bsdiff/bspatch.h>
+
+#include "update_engine/common/utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+const char kExecutableDiffMagic[8] = {'E', 'X', 'E', 'D', 'I', 'F', 'F', '1'};
+
+namespace {
+
+// The size of the big endian header size stored after the magic.
+constexpr size_t kHeaderSizeSize = 4;
+
+// x86-64 CALL rel32 and JMP rel32 opcodes.
+constexpr uint8_t kX86Call = 0xE8;
+constexpr uint8_t kX86Jmp = 0xE9;
+constexpr size_t kX86BranchSize = 5;
+// Only the rel32 values that fit in 25 bits are converted, modulo 2^25, so
+// the conversion maps them to values that also fit in 25 bits. Bigger values
+// are more likely data than branches within the same file.
+constexpr uint32_t kX86RangeBits = 25;
+
+// ARM64 B and BL (imm26, in words) and ADRP (imm21, in 4 KiB pages).
+constexpr uint32_t kArm64BranchMask = 0x7C000000;
+constexpr uint32_t kArm64Branch = 0x14000000;
+constexpr uint32_t kArm64AdrpMask = 0x9F000000;
+constexpr uint32_t kArm64Adrp = 0x90000000;
+constexpr size_t kArm64InstructionSize = 4;
+
+uint32_t ReadLE32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return le32toh(value);
+}
+
+void WriteLE32(uint8_t* data, uint32_t value) {
+  value = htole32(value);
+  memcpy(data, &value, sizeof(value));
+}
+
+// Returns |value| + |delta| modulo 2^|bits|, keeping the other bits of
+// |value|.
+uint32_t AddInField(uint32_t value, uint64_t delta, uint32_t bits) {
+  uint32_t mask = (1U << bits) - 1;
+  return (value & ~mask) | ((value + delta) & mask);
+}
+
+// Returns whether the rel32 |value| sign extends its low |kX86RangeBits| bits.
+bool IsX86Convertible(uint32_t value) {
+  uint32_t high = value >> (kX86RangeBits - 1);
+  return high == 0 || high == (0xFFFFFFFFU >> (kX86RangeBits - 1));
+}
+
+void ConvertX86(uint8_t* code,
+                size_t size,
+                uint64_t address,
+                bool to_absolute) {
+  for (size_t i = 0; i + kX86BranchSize <= size;) {
+    if (code[i] != kX86Call && code[i] != kX86Jmp) {
+      i++;
+      continue;
+    }
+    uint32_t value = ReadLE32(code + i + 1);
+    if (IsX86Convertible(value)) {
+      // The target is relative to the next instruction.
+      uint64_t next = address + i + kX86BranchSize;
+      value = AddInField(value, to_absolute ? next : -next, kX86RangeBits);
+      // Sign extend the converted field.
+      if (value & (1U << (kX86RangeBits - 1)))
+        value |= ~((1U << kX86RangeBits) - 1);
+      else
+        value &= (1U << kX86RangeBits) - 1;
+      WriteLE32(code + i + 1, value);
+    }
+    // The converted bytes are never the opcode of another branch.
+    i += kX86BranchSize;
+  }
+}
+
+void ConvertArm64(uint8_t* code,
+                  size_t size,
+                  uint64_t address,
+                  bool to_absolute) {
+  // Instructions are aligned to their size.
+  size_t start = (kArm64InstructionSize - address % kArm64InstructionSize) %
+                 kArm64InstructionSize;
+  for (size_t i = start; i + kArm64InstructionSize <= size;
+       i += kArm64InstructionSize) {
+    uint32_t instruction = ReadLE32(code + i);
+    uint64_t pc = address + i;
+    if ((instruction & kArm64BranchMask) == kArm64Branch) {
+      uint64_t delta = pc >> 2;
+      instruction =
+          AddInField(instruction, to_absolute ? delta : -delta, 26);
+    } else if ((instruction & kArm64AdrpMask) == kArm64Adrp) {
+      // The 21 bits page offset is split in immhi (bits 5-23) and immlo
+      // (bits 29-30).
+      uint32_t imm = ((instruction >> 5) & 0x7FFFF) << 2 |
+                     ((instruction >> 29) & 3);
+      uint64_t delta = pc >> 12;
+      imm = AddInField(imm, to_absolute ? delta : -delta, 21);
+      instruction = (instruction & ~(0x7FFFFU << 5 | 3U << 29)) |
+                    (imm >> 2) << 5 | (imm & 3) << 29;
+    } else {
+      continue;
+    }
+    WriteLE32(code + i, instruction);
+  }
+}
+
+}  // namespace
+
+bool ConvertBranchTargets(uint8_t* data,
+                          size_t size,
+                          const vector<ExecutableRegion>& regions,
+                          bool to_absolute) {
+  // Converting overlapping regions in the same order in both directions
+  // wouldn't undo the conversion, so they are rejected.
+  vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (const ExecutableRegion& region : regions) {
+    TEST_AND_RETURN_FALSE(region.offset() <= size &&
+                          region.length() <= size - region.offset());
+    ranges.emplace_back(region.offset(), region.offset() + region.length());
+  }
+  std::sort(ranges.begin(), ranges.end());
+  for (size_t i = 1; i < ranges.size(); i++) {
+    if (ranges[i].first < ranges[i - 1].second) {
+      LOG(ERROR) << "The executable regions at offsets " << ranges[i - 1].first
+                 << " and " << ranges[i].first << " overlap.";
+      return false;
+    }
+  }
+
+  for (const ExecutableRegion& region : regions) {
+    uint8_t* code = data + region.offset();
+    switch (region.architecture()) {
+      case ExecutableRegion::X86_64:
+        ConvertX86(code, region.length(), region.address(), to_absolute);
+        break;
+      case ExecutableRegion::ARM64:
+        ConvertArm64(code, region.length(), region.address(), to_absolute);
+        break;
+      default:
+        LOG(ERROR) << "Unsupported architecture " << region.architecture();
+        return false;
+    }
+  }
+  return true;
+}
+
+bool ExecutablePatch(const brillo::Blob& src_data,
+                     const uint8_t* patch,
+                     size_t patch_size,
+                     brillo::Blob* dst_data) {
+  constexpr size_t kPrefixSize = sizeof(kExecutableDiffMagic) + kHeaderSizeSize;
+  TEST_AND_RETURN_FALSE(patch_size >= kPrefixSize);
+  TEST_AND_RETURN_FALSE(std::equal(kExecutableDiffMagic,
+                                   kExecutableDiffMagic +
+                                       sizeof(kExecutableDiffMagic),
+                                   patch));
+  uint32_t header_size = 0;
+  for (size_t i = 0; i < kHeaderSizeSize; i++)
+    header_size = (header_size << 8) | patch[sizeof(kExecutableDiffMagic) + i];
+  TEST_AND_RETURN_FALSE(header_size <= patch_size - kPrefixSize);
+  ExecutableDiffHeader header;
+  TEST_AND_RETURN_FALSE(
+      header.ParseFromArray(patch + kPrefixSize, header_size));
+
+  brillo::Blob src_converted = src_data;
+  TEST_AND_RETURN_FALSE(ConvertBranchTargets(
+      src_converted.data(),
+      src_converted.size(),
+      {header.src_regions().begin(), header.src_regions().end()},
+      true));
+  dst_data->clear();
+  auto sink = [dst_data](const uint8_t* data, size_t size) {
+    dst_data->insert(dst_data->end(), data, data + size);
+    return size;
+  };
+  TEST_AND_RETURN_FALSE(bsdiff::bspatch(src_converted.data(),
+                                        src_converted.size(),
+                                        patch + kPrefixSize + header_size,
+                                        patch_size - kPrefixSize - header_size,
+                                        sink) == 0);
+  TEST_AND_RETURN_FALSE(ConvertBranchTargets(
+      dst_data->data(),
+      dst_data->size(),
+      {header.dst_regions().begin(), header.dst_regions().end()},
+      false));
+  return true;
+}
+
+}  // namespace chromeos_update_engine
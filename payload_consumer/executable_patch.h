@@ -0,0 +1,53 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_EXECUTABLE_PATCH_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_EXECUTABLE_PATCH_H_
+
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The magic at the start of the blob of an EXECUTABLE_BSDIFF operation.
+extern const char kExecutableDiffMagic[8];
+
+// Converts the targets of the relative branches (x86-64 CALL and JMP rel32,
+// ARM64 B, BL and ADRP) in the code |regions| of the |size| bytes at |data| to
+// absolute addresses if |to_absolute| is true, or back to relative addresses
+// otherwise. The conversion is a bijection on every branch field, so
+// converting to absolute and back always returns the original data, even if
+// a region holds data and not code. Returns false if a region is out of
+// bounds or if two regions overlap.
+bool ConvertBranchTargets(uint8_t* data,
+                          size_t size,
+                          const std::vector<ExecutableRegion>& regions,
+                          bool to_absolute);
+
+// Applies the blob |patch| of an EXECUTABLE_BSDIFF operation, |patch_size|
+// bytes, to the data |src_data| read from its source extents and stores the
+// data to write to its destination extents in |dst_data|.
+bool ExecutablePatch(const brillo::Blob& src_data,
+                     const uint8_t* patch,
+                     size_t patch_size,
+                     brillo::Blob* dst_data);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_EXECUTABLE_PATCH_H_
@@ -0,0 +1,231 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/executable_patch.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kPrefixSize = sizeof(kExecutableDiffMagic) + 4;
+
+// Returns random data of |size| bytes.
+brillo::Blob RandomData(size_t size, uint32_t seed) {
+  std::mt19937 gen(seed);
+  brillo::Blob data(size);
+  for (uint8_t& byte : data)
+    byte = gen();
+  return data;
+}
+
+ExecutableRegion MakeRegion(uint64_t offset,
+                            uint64_t length,
+                            uint64_t address,
+                            ExecutableRegion::Architecture architecture) {
+  ExecutableRegion region;
+  region.set_offset(offset);
+  region.set_length(length);
+  region.set_address(address);
+  region.set_architecture(architecture);
+  return region;
+}
+
+// Builds an EXECUTABLE_BSDIFF blob from its |header| and its bsdiff
+// |inner_patch|.
+brillo::Blob JoinPatch(const ExecutableDiffHeader& header,
+                       const brillo::Blob& inner_patch) {
+  string header_data;
+  EXPECT_TRUE(header.SerializeToString(&header_data));
+  brillo::Blob patch(kExecutableDiffMagic,
+                     kExecutableDiffMagic + sizeof(kExecutableDiffMagic));
+  for (int shift = 24; shift >= 0; shift -= 8)
+    patch.push_back((header_data.size() >> shift) & 0xFF);
+  patch.insert(patch.end(), header_data.begin(), header_data.end());
+  patch.insert(patch.end(), inner_patch.begin(), inner_patch.end());
+  return patch;
+}
+
+// Splits the EXECUTABLE_BSDIFF blob |patch| in its |header| and its bsdiff
+// |inner_patch|.
+bool SplitPatch(const brillo::Blob& patch,
+                ExecutableDiffHeader* header,
+                brillo::Blob* inner_patch) {
+  if (patch.size() < kPrefixSize)
+    return false;
+  size_t size = 0;
+  for (size_t i = 0; i < 4; i++)
+    size = (size << 8) | patch[sizeof(kExecutableDiffMagic) + i];
+  if (!header->ParseFromArray(patch.data() + kPrefixSize, size))
+    return false;
+  inner_patch->assign(patch.begin() + kPrefixSize + size, patch.end());
+  return true;
+}
+
+// Returns the blob of an EXECUTABLE_BSDIFF operation from |old_data| with the
+// code |old_regions| to |new_data| with the code |new_regions|, built as the
+// generator does.
+brillo::Blob MakePatch(const brillo::Blob& old_data,
+                       const vector<ExecutableRegion>& old_regions,
+                       const brillo::Blob& new_data,
+                       const vector<ExecutableRegion>& new_regions) {
+  ExecutableDiffHeader header;
+  for (const ExecutableRegion& region : old_regions)
+    *header.add_src_regions() = region;
+  for (const ExecutableRegion& region : new_regions)
+    *header.add_dst_regions() = region;
+  brillo::Blob old_converted = old_data;
+  brillo::Blob new_converted = new_data;
+  EXPECT_TRUE(ConvertBranchTargets(
+      old_converted.data(), old_converted.size(), old_regions, true));
+  EXPECT_TRUE(ConvertBranchTargets(
+      new_converted.data(), new_converted.size(), new_regions, true));
+  brillo::Blob inner_patch;
+  EXPECT_TRUE(diff_utils::GenerateBrotliBsdiff(old_converted.data(),
+                                               old_converted.size(),
+                                               new_converted.data(),
+                                               new_converted.size(),
+                                               &inner_patch));
+  return JoinPatch(header, inner_patch);
+}
+
+}  // namespace
+
+class ExecutablePatchTest : public ::testing::Test {
+ protected:
+  // Checks that converting the branch targets of |regions| in |data| changes
+  // it and that converting them back restores it, then that a patch from
+  // |data| to |data| with a few changed bytes reproduces the new data.
+  void TestRoundTrip(const brillo::Blob& data,
+                     const vector<ExecutableRegion>& regions) {
+    brillo::Blob converted = data;
+    ASSERT_TRUE(ConvertBranchTargets(
+        converted.data(), converted.size(), regions, true));
+    EXPECT_NE(data, converted);
+    ASSERT_TRUE(ConvertBranchTargets(
+        converted.data(), converted.size(), regions, false));
+    EXPECT_EQ(data, converted);
+
+    brillo::Blob new_data = data;
+    for (size_t i = 0; i < new_data.size(); i += 1000)
+      new_data[i] ^= 0x5A;
+    brillo::Blob patch = MakePatch(data, regions, new_data, regions);
+    brillo::Blob patched;
+    ASSERT_TRUE(ExecutablePatch(data, patch.data(), patch.size(), &patched));
+    EXPECT_EQ(new_data, patched);
+  }
+};
+
+TEST_F(ExecutablePatchTest, X86RoundTripTest) {
+  brillo::Blob data = RandomData(8192, 1);
+  // Make sure there are CALL and JMP instructions with short targets.
+  for (size_t i = 0; i + 5 <= data.size(); i += 64) {
+    data[i] = i % 128 ? 0xE8 : 0xE9;
+    data[i + 4] = 0;
+  }
+  TestRoundTrip(data,
+                {MakeRegion(0, 4096, 0x401000, ExecutableRegion::X86_64),
+                 MakeRegion(4096, 4000, 0x7FFFF000, ExecutableRegion::X86_64)});
+}
+
+TEST_F(ExecutablePatchTest, Arm64RoundTripTest) {
+  brillo::Blob data = RandomData(8192, 2);
+  // Make sure there are BL and ADRP instructions.
+  for (size_t i = 0; i + 4 <= data.size(); i += 32) {
+    data[i + 3] = 0x94;
+    data[i + 19] = 0x90;
+  }
+  // The second region isn't aligned to the instruction size.
+  TestRoundTrip(data,
+                {MakeRegion(0, 4096, 0x10000, ExecutableRegion::ARM64),
+                 MakeRegion(4096, 4096, 0x200002, ExecutableRegion::ARM64)});
+}
+
+TEST_F(ExecutablePatchTest, OutOfRangeRegionsTest) {
+  brillo::Blob data = RandomData(4096, 3);
+  for (const ExecutableRegion& region :
+       {MakeRegion(4097, 0, 0x1000, ExecutableRegion::X86_64),
+        MakeRegion(0, 4097, 0x1000, ExecutableRegion::X86_64),
+        MakeRegion(1, UINT64_MAX, 0x1000, ExecutableRegion::ARM64),
+        MakeRegion(UINT64_MAX, 2, 0x1000, ExecutableRegion::ARM64)}) {
+    EXPECT_FALSE(
+        ConvertBranchTargets(data.data(), data.size(), {region}, true));
+  }
+
+  // The regions of the patch are checked against the data too.
+  vector<ExecutableRegion> regions = {
+      MakeRegion(0, 4096, 0x1000, ExecutableRegion::X86_64)};
+  brillo::Blob patch = MakePatch(data, regions, data, regions);
+  brillo::Blob short_data(data.begin(), data.begin() + 2048);
+  brillo::Blob patched;
+  EXPECT_FALSE(
+      ExecutablePatch(short_data, patch.data(), patch.size(), &patched));
+}
+
+TEST_F(ExecutablePatchTest, TruncatedHeaderTest) {
+  brillo::Blob data = RandomData(4096, 4);
+  vector<ExecutableRegion> regions = {
+      MakeRegion(0, 4096, 0x1000, ExecutableRegion::X86_64)};
+  brillo::Blob patch = MakePatch(data, regions, data, regions);
+  brillo::Blob patched;
+  ASSERT_TRUE(ExecutablePatch(data, patch.data(), patch.size(), &patched));
+
+  EXPECT_FALSE(ExecutablePatch(data, patch.data(), kPrefixSize - 1, &patched));
+  // The header size is larger than the patch.
+  EXPECT_FALSE(ExecutablePatch(data, patch.data(), kPrefixSize + 1, &patched));
+  brillo::Blob bad_patch = patch;
+  bad_patch[0] ^= 0xFF;
+  EXPECT_FALSE(
+      ExecutablePatch(data, bad_patch.data(), bad_patch.size(), &patched));
+}
+
+TEST_F(ExecutablePatchTest, OverlappingRegionsTest) {
+  brillo::Blob data = RandomData(8192, 5);
+  vector<ExecutableRegion> regions = {
+      MakeRegion(0, 4096, 0x1000, ExecutableRegion::X86_64),
+      MakeRegion(4095, 4096, 0x1FFF, ExecutableRegion::X86_64)};
+  EXPECT_FALSE(
+      ConvertBranchTargets(data.data(), data.size(), regions, true));
+
+  // Regions that are only adjacent are fine, in any order.
+  regions[1].set_offset(4096);
+  std::swap(regions[0], regions[1]);
+  EXPECT_TRUE(ConvertBranchTargets(data.data(), data.size(), regions, true));
+
+  // A patch with overlapping regions is rejected.
+  brillo::Blob patch = MakePatch(data, regions, data, regions);
+  brillo::Blob patched;
+  ASSERT_TRUE(ExecutablePatch(data, patch.data(), patch.size(), &patched));
+  ExecutableDiffHeader header;
+  brillo::Blob inner_patch;
+  ASSERT_TRUE(SplitPatch(patch, &header, &inner_patch));
+  header.mutable_dst_regions(0)->set_offset(4000);
+  brillo::Blob bad_patch = JoinPatch(header, inner_patch);
+  EXPECT_FALSE(
+      ExecutablePatch(data, bad_patch.data(), bad_patch.size(), &patched));
+}
+
+}  // namespace chromeos_update_engine
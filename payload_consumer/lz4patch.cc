@@ -0,0 +1,296 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/lz4patch.h"
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include <algorithm>
+#include <climits>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <bsdiff/bspatch.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+const char kLz4diffMagic[8] = {'L', 'Z', '4', 'D', 'I', 'F', 'F', '1'};
+
+namespace {
+
+// The size of the big endian header size stored after the magic.
+constexpr size_t kLz4diffHeaderSizeSize = 4;
+
+// An LZ4 sequence of n bytes decompresses to less than 256 * n bytes, which
+// bounds the uncompressed size of a block.
+constexpr uint64_t kLz4MaxCompressionRatio = 256;
+
+// Applies the bsdiff patch |patch| of |patch_size| bytes to the |old_size|
+// bytes at |old_data| and stores the result in |new_data|. Fails if the result
+// would take more than |max_size| bytes.
+bool ApplyBsdiff(const uint8_t* old_data,
+                 size_t old_size,
+                 const uint8_t* patch,
+                 size_t patch_size,
+                 size_t max_size,
+                 brillo::Blob* new_data) {
+  new_data->clear();
+  auto sink = [new_data, max_size](const uint8_t* data, size_t size) {
+    if (size > max_size - new_data->size())
+      return static_cast<size_t>(0);
+    new_data->insert(new_data->end(), data, data + size);
+    return size;
+  };
+  TEST_AND_RETURN_FALSE(
+      bsdiff::bspatch(old_data, old_size, patch, patch_size, sink) == 0);
+  return true;
+}
+
+// Checks that the uncompressed data of the LZ4 |blocks| is contiguous,
+// starting at offset 0, that the blocks take exactly |size| bytes and that
+// every block fits the LZ4 API and the maximum LZ4 compression ratio. Stores
+// the size of the uncompressed data in |uncompressed_size|.
+bool ValidateBlocks(const vector<Lz4Block>& blocks,
+                    size_t size,
+                    size_t* uncompressed_size) {
+  size_t compressed_size = 0;
+  *uncompressed_size = 0;
+  for (const Lz4Block& block : blocks) {
+    TEST_AND_RETURN_FALSE(block.compressed_length() <= INT_MAX);
+    TEST_AND_RETURN_FALSE(block.uncompressed_length() <= INT_MAX);
+    TEST_AND_RETURN_FALSE(block.compressed_length() <=
+                          size - compressed_size);
+    if (block.plain()) {
+      TEST_AND_RETURN_FALSE(block.uncompressed_length() <=
+                            block.compressed_length());
+    } else {
+      TEST_AND_RETURN_FALSE(block.uncompressed_length() <=
+                            block.compressed_length() *
+                                kLz4MaxCompressionRatio);
+    }
+    TEST_AND_RETURN_FALSE(block.uncompressed_offset() == *uncompressed_size);
+    compressed_size += block.compressed_length();
+    // Can't overflow: it's at most kLz4MaxCompressionRatio * |size|.
+    *uncompressed_size += block.uncompressed_length();
+  }
+  TEST_AND_RETURN_FALSE(compressed_size == size);
+  return true;
+}
+
+}  // namespace
+
+bool Lz4DecompressBlocks(const uint8_t* data,
+                         size_t size,
+                         const vector<Lz4Block>& blocks,
+                         bool zero_padding,
+                         brillo::Blob* out) {
+  size_t uncompressed_size;
+  TEST_AND_RETURN_FALSE(ValidateBlocks(blocks, size, &uncompressed_size));
+
+  out->resize(uncompressed_size);
+  const uint8_t* in = data;
+  for (const Lz4Block& block : blocks) {
+    size_t in_size = block.compressed_length();
+    char* dst = reinterpret_cast<char*>(out->data()) +
+                block.uncompressed_offset();
+    int dst_size = static_cast<int>(block.uncompressed_length());
+    if (block.plain()) {
+      std::copy(in, in + dst_size, dst);
+    } else if (zero_padding) {
+      // The compressed data never starts with a zero byte, so the padding
+      // ends at the first non-zero byte.
+      size_t padding = std::find_if(in,
+                                    in + in_size,
+                                    [](uint8_t byte) { return byte != 0; }) -
+                       in;
+      TEST_AND_RETURN_FALSE(padding < in_size);
+      TEST_AND_RETURN_FALSE(
+          LZ4_decompress_safe(reinterpret_cast<const char*>(in + padding),
+                              dst,
+                              static_cast<int>(in_size - padding),
+                              dst_size) == dst_size);
+    } else {
+      TEST_AND_RETURN_FALSE(
+          LZ4_decompress_safe_partial(reinterpret_cast<const char*>(in),
+                                      dst,
+                                      static_cast<int>(in_size),
+                                      dst_size,
+                                      dst_size) == dst_size);
+    }
+    in += in_size;
+  }
+  return true;
+}
+
+bool Lz4CompressBlocks(const uint8_t* data,
+                       size_t size,
+                       const vector<Lz4Block>& blocks,
+                       bool zero_padding,
+                       uint32_t lz4hc_level,
+                       brillo::Blob* out) {
+  size_t compressed_size = 0;
+  for (const Lz4Block& block : blocks) {
+    TEST_AND_RETURN_FALSE(block.compressed_length() <= INT_MAX);
+    TEST_AND_RETURN_FALSE(block.uncompressed_length() <= INT_MAX);
+    TEST_AND_RETURN_FALSE(block.uncompressed_length() <= size &&
+                          block.uncompressed_offset() <=
+                              size - block.uncompressed_length());
+    TEST_AND_RETURN_FALSE(block.compressed_length() <=
+                          SIZE_MAX - compressed_size);
+    compressed_size += block.compressed_length();
+  }
+
+  out->assign(compressed_size, 0);
+  vector<char> hc_state;
+  if (lz4hc_level)
+    hc_state.resize(LZ4_sizeofStateHC());
+  uint8_t* block_data = out->data();
+  for (const Lz4Block& block : blocks) {
+    const uint8_t* src = data + block.uncompressed_offset();
+    int block_size = static_cast<int>(block.compressed_length());
+    if (block.plain()) {
+      std::copy(src,
+                src + std::min<uint64_t>(block.uncompressed_length(),
+                                         block_size),
+                block_data);
+    } else {
+      // A block that doesn't fit keeps only the data that does; the postfix
+      // patch of the block fixes it.
+      int src_size = static_cast<int>(block.uncompressed_length());
+      const char* src_chars = reinterpret_cast<const char*>(src);
+      char* dst = reinterpret_cast<char*>(block_data);
+      int compressed =
+          lz4hc_level ? LZ4_compress_HC_destSize(hc_state.data(),
+                                                 src_chars,
+                                                 dst,
+                                                 &src_size,
+                                                 block_size,
+                                                 lz4hc_level)
+                      : LZ4_compress_destSize(
+                            src_chars, dst, &src_size, block_size);
+      TEST_AND_RETURN_FALSE(compressed >= 0 && compressed <= block_size);
+      if (zero_padding && compressed < block_size) {
+        std::copy_backward(
+            block_data, block_data + compressed, block_data + block_size);
+        std::fill(block_data, block_data + block_size - compressed, 0);
+      }
+    }
+    block_data += block_size;
+  }
+  return true;
+}
+
+bool Lz4Patch(const brillo::Blob& src_data,
+              const uint8_t* patch,
+              size_t patch_size,
+              size_t dst_size,
+              brillo::Blob* dst_data) {
+  constexpr size_t kPrefixSize = sizeof(kLz4diffMagic) + kLz4diffHeaderSizeSize;
+  TEST_AND_RETURN_FALSE(patch_size >= kPrefixSize);
+  TEST_AND_RETURN_FALSE(
+      std::equal(kLz4diffMagic, kLz4diffMagic + sizeof(kLz4diffMagic), patch));
+  uint32_t header_size = 0;
+  for (size_t i = 0; i < kLz4diffHeaderSizeSize; i++)
+    header_size = (header_size << 8) | patch[sizeof(kLz4diffMagic) + i];
+  TEST_AND_RETURN_FALSE(header_size <= patch_size - kPrefixSize);
+  Lz4diffHeader header;
+  TEST_AND_RETURN_FALSE(
+      header.ParseFromArray(patch + kPrefixSize, header_size));
+  const uint8_t* inner_patch = patch + kPrefixSize + header_size;
+  size_t inner_patch_size = patch_size - kPrefixSize - header_size;
+
+  vector<Lz4Block> src_blocks(header.src_blocks().begin(),
+                              header.src_blocks().end());
+  vector<Lz4Block> dst_blocks(header.dst_blocks().begin(),
+                              header.dst_blocks().end());
+  // The new blocks must fill the destination extents, which bounds the memory
+  // used for the uncompressed data before anything is allocated.
+  size_t dst_uncompressed_size;
+  TEST_AND_RETURN_FALSE(
+      ValidateBlocks(dst_blocks, dst_size, &dst_uncompressed_size));
+  brillo::Blob src_uncompressed;
+  TEST_AND_RETURN_FALSE(Lz4DecompressBlocks(src_data.data(),
+                                            src_data.size(),
+                                            src_blocks,
+                                            header.src_zero_padding(),
+                                            &src_uncompressed));
+  brillo::Blob dst_uncompressed;
+  TEST_AND_RETURN_FALSE(ApplyBsdiff(src_uncompressed.data(),
+                                    src_uncompressed.size(),
+                                    inner_patch,
+                                    inner_patch_size,
+                                    dst_uncompressed_size,
+                                    &dst_uncompressed));
+  TEST_AND_RETURN_FALSE(dst_uncompressed.size() == dst_uncompressed_size);
+  TEST_AND_RETURN_FALSE(Lz4CompressBlocks(dst_uncompressed.data(),
+                                          dst_uncompressed.size(),
+                                          dst_blocks,
+                                          header.dst_zero_padding(),
+                                          header.lz4hc_level(),
+                                          dst_data));
+
+  // The postfix patches only fix the blocks that the LZ4 library used by the
+  // generator didn't reproduce. A library that compresses differently would
+  // make them write corrupted blocks, so this is detected here.
+  if (!header.recompressed_sha256_hash().empty()) {
+    brillo::Blob recompressed_hash;
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfData(*dst_data, &recompressed_hash));
+    if (recompressed_hash !=
+        brillo::Blob(header.recompressed_sha256_hash().begin(),
+                     header.recompressed_sha256_hash().end())) {
+      LOG(ERROR) << "The LZ4 library of the device (version "
+                 << LZ4_versionNumber()
+                 << ") doesn't compress the new blocks like the one used to "
+                 << "generate the payload (version " << header.lz4_version()
+                 << "), expected sha256|hex = "
+                 << base::HexEncode(header.recompressed_sha256_hash().data(),
+                                    header.recompressed_sha256_hash().size())
+                 << ", calculated sha256|hex = "
+                 << base::HexEncode(recompressed_hash.data(),
+                                    recompressed_hash.size());
+      return false;
+    }
+  }
+
+  // Fix the blocks the compressor didn't reproduce exactly.
+  uint8_t* block_data = dst_data->data();
+  brillo::Blob fixed_block;
+  for (const Lz4Block& block : dst_blocks) {
+    size_t block_size = block.compressed_length();
+    if (!block.postfix_patch().empty()) {
+      TEST_AND_RETURN_FALSE(ApplyBsdiff(
+          block_data,
+          block_size,
+          reinterpret_cast<const uint8_t*>(block.postfix_patch().data()),
+          block.postfix_patch().size(),
+          block_size,
+          &fixed_block));
+      TEST_AND_RETURN_FALSE(fixed_block.size() == block_size);
+      std::copy(fixed_block.begin(), fixed_block.end(), block_data);
+    }
+    block_data += block_size;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_LZ4PATCH_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_LZ4PATCH_H_
+
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The magic at the start of the blob of a LZ4DIFF_BSDIFF operation.
+extern const char kLz4diffMagic[8];
+
+// Decompresses the LZ4 |blocks| stored back-to-back in the |size| bytes at
+// |data| into |out|. The uncompressed data of the blocks must be contiguous,
+// starting at offset 0, the blocks must take exactly |size| bytes and no block
+// can be larger than the LZ4 format allows. If
+// |zero_padding| is true, the compressed data of every block is stored at the
+// end of the block instead of the start. Returns whether the data of all the
+// blocks was decompressed to the expected size.
+bool Lz4DecompressBlocks(const uint8_t* data,
+                         size_t size,
+                         const std::vector<Lz4Block>& blocks,
+                         bool zero_padding,
+                         brillo::Blob* out);
+
+// Compresses the |size| bytes at |data| again in the LZ4 |blocks| described as
+// in Lz4DecompressBlocks(), and stores them in |out|. Every block takes exactly
+// its |compressed_length| bytes. The blocks are compressed with LZ4HC with the
+// level |lz4hc_level|, or with the default LZ4 compressor if it's 0. The
+// result only depends on the input and the LZ4 library, so the same blocks
+// are produced while generating and applying a payload, but they may differ
+// from the blocks of the original image.
+bool Lz4CompressBlocks(const uint8_t* data,
+                       size_t size,
+                       const std::vector<Lz4Block>& blocks,
+                       bool zero_padding,
+                       uint32_t lz4hc_level,
+                       brillo::Blob* out);
+
+// Applies the blob |patch| of a LZ4DIFF_BSDIFF operation, |patch_size| bytes,
+// to the data |src_data| read from its source extents and stores the data to
+// write to its destination extents, |dst_size| bytes, in |dst_data|. Fails if
+// the new blocks compressed again don't match the hash recorded by the
+// generator, which happens if the LZ4 library of the device compresses
+// differently.
+bool Lz4Patch(const brillo::Blob& src_data,
+              const uint8_t* patch,
+              size_t patch_size,
+              size_t dst_size,
+              brillo::Blob* dst_data);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_LZ4PATCH_H_
@@ -0,0 +1,252 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/lz4patch.h"
+
+#include <climits>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/lz4diff.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kTestBlockSize = 4096;
+constexpr size_t kPrefixSize = sizeof(kLz4diffMagic) + 4;
+
+// Returns compressible data of |size| bytes that depends on |seed|.
+brillo::Blob TestData(size_t size, uint8_t seed) {
+  brillo::Blob data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = "lz4patch"[i % 8] + (i / 300 + seed) % 4;
+  return data;
+}
+
+// Returns |num_blocks| LZ4 blocks of one block each, storing |block_data|
+// bytes of uncompressed data.
+vector<Lz4Block> TestBlocks(size_t num_blocks, size_t block_data) {
+  vector<Lz4Block> blocks(num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) {
+    blocks[i].set_uncompressed_offset(i * block_data);
+    blocks[i].set_uncompressed_length(block_data);
+    blocks[i].set_compressed_length(kTestBlockSize);
+  }
+  return blocks;
+}
+
+// Splits the LZ4DIFF_BSDIFF blob |patch| in its |header| and its bsdiff
+// |inner_patch|.
+bool SplitPatch(const brillo::Blob& patch,
+                Lz4diffHeader* header,
+                brillo::Blob* inner_patch) {
+  if (patch.size() < kPrefixSize)
+    return false;
+  size_t size = 0;
+  for (size_t i = 0; i < 4; i++)
+    size = (size << 8) | patch[sizeof(kLz4diffMagic) + i];
+  if (!header->ParseFromArray(patch.data() + kPrefixSize, size))
+    return false;
+  inner_patch->assign(patch.begin() + kPrefixSize + size, patch.end());
+  return true;
+}
+
+// Builds a LZ4DIFF_BSDIFF blob from its |header| and its bsdiff |inner_patch|.
+brillo::Blob JoinPatch(const Lz4diffHeader& header,
+                       const brillo::Blob& inner_patch) {
+  string header_data;
+  EXPECT_TRUE(header.SerializeToString(&header_data));
+  brillo::Blob patch(kLz4diffMagic, kLz4diffMagic + sizeof(kLz4diffMagic));
+  for (int shift = 24; shift >= 0; shift -= 8)
+    patch.push_back((header_data.size() >> shift) & 0xFF);
+  patch.insert(patch.end(), header_data.begin(), header_data.end());
+  patch.insert(patch.end(), inner_patch.begin(), inner_patch.end());
+  return patch;
+}
+
+}  // namespace
+
+class Lz4PatchTest : public ::testing::Test {
+ protected:
+  // Compresses |data| in |blocks| with the default LZ4 compressor.
+  brillo::Blob Compress(const brillo::Blob& data,
+                        const vector<Lz4Block>& blocks,
+                        bool zero_padding) {
+    brillo::Blob compressed;
+    EXPECT_TRUE(Lz4CompressBlocks(
+        data.data(), data.size(), blocks, zero_padding, 0, &compressed));
+    return compressed;
+  }
+
+  // Generates a patch from |old_data_| to |new_data_| in |patch_|.
+  void GeneratePatch() {
+    old_data_ = Compress(TestData(6 * kTestBlockSize, 0), old_blocks_, true);
+    new_data_ = Compress(TestData(9 * kTestBlockSize, 1), new_blocks_, true);
+    ASSERT_TRUE(Lz4Diff(old_data_,
+                        old_blocks_,
+                        true,
+                        new_data_,
+                        new_blocks_,
+                        true,
+                        &patch_));
+  }
+
+  vector<Lz4Block> old_blocks_ = TestBlocks(2, 3 * kTestBlockSize);
+  vector<Lz4Block> new_blocks_ = TestBlocks(3, 3 * kTestBlockSize);
+  brillo::Blob old_data_;
+  brillo::Blob new_data_;
+  brillo::Blob patch_;
+};
+
+TEST_F(Lz4PatchTest, BlocksRoundTripTest) {
+  brillo::Blob data = TestData(6 * kTestBlockSize, 2);
+  vector<Lz4Block> blocks = TestBlocks(2, 3 * kTestBlockSize);
+  for (bool zero_padding : {false, true}) {
+    brillo::Blob compressed = Compress(data, blocks, zero_padding);
+    ASSERT_EQ(2 * kTestBlockSize, compressed.size());
+    brillo::Blob decompressed;
+    EXPECT_TRUE(Lz4DecompressBlocks(compressed.data(),
+                                    compressed.size(),
+                                    blocks,
+                                    zero_padding,
+                                    &decompressed));
+    EXPECT_EQ(data, decompressed);
+  }
+}
+
+TEST_F(Lz4PatchTest, PatchRoundTripTest) {
+  GeneratePatch();
+  brillo::Blob patched;
+  ASSERT_TRUE(Lz4Patch(
+      old_data_, patch_.data(), patch_.size(), new_data_.size(), &patched));
+  EXPECT_EQ(new_data_, patched);
+
+  // The new blocks must fill the destination extents exactly.
+  EXPECT_FALSE(Lz4Patch(old_data_,
+                        patch_.data(),
+                        patch_.size(),
+                        new_data_.size() + kTestBlockSize,
+                        &patched));
+}
+
+TEST_F(Lz4PatchTest, MalformedBlocksTest) {
+  brillo::Blob data = TestData(3 * kTestBlockSize, 3);
+  vector<Lz4Block> blocks = TestBlocks(1, data.size());
+  brillo::Blob compressed = Compress(data, blocks, false);
+  brillo::Blob out;
+  auto decompress = [&compressed, &out](const vector<Lz4Block>& blocks) {
+    return Lz4DecompressBlocks(
+        compressed.data(), compressed.size(), blocks, false, &out);
+  };
+  ASSERT_TRUE(decompress(blocks));
+
+  // The uncompressed data must start at offset 0.
+  vector<Lz4Block> bad_blocks = blocks;
+  bad_blocks[0].set_uncompressed_offset(1);
+  EXPECT_FALSE(decompress(bad_blocks));
+
+  // The blocks must take all the compressed data.
+  bad_blocks = blocks;
+  bad_blocks[0].set_compressed_length(kTestBlockSize / 2);
+  EXPECT_FALSE(decompress(bad_blocks));
+
+  // Lengths that don't fit the LZ4 API or the LZ4 format are rejected before
+  // allocating the uncompressed data.
+  bad_blocks = blocks;
+  bad_blocks[0].set_uncompressed_length(uint64_t{INT_MAX} + 1);
+  EXPECT_FALSE(decompress(bad_blocks));
+  bad_blocks[0].set_uncompressed_length(256 * kTestBlockSize + 1);
+  EXPECT_FALSE(decompress(bad_blocks));
+  bad_blocks = blocks;
+  bad_blocks[0].set_plain(true);
+  EXPECT_FALSE(decompress(bad_blocks));
+
+  // The compressed data must be valid.
+  compressed.assign(kTestBlockSize, 0xff);
+  EXPECT_FALSE(decompress(blocks));
+
+  // The uncompressed data of a block must be in the data to compress, even
+  // if its offset and length overflow.
+  bad_blocks = blocks;
+  bad_blocks[0].set_uncompressed_offset(UINT64_MAX);
+  EXPECT_FALSE(Lz4CompressBlocks(
+      data.data(), data.size(), bad_blocks, false, 0, &out));
+}
+
+TEST_F(Lz4PatchTest, MalformedPatchTest) {
+  GeneratePatch();
+  brillo::Blob patched;
+  auto patch = [this, &patched](const brillo::Blob& patch) {
+    return Lz4Patch(
+        old_data_, patch.data(), patch.size(), new_data_.size(), &patched);
+  };
+
+  // Truncated header.
+  EXPECT_FALSE(patch(brillo::Blob(patch_.begin(), patch_.begin() + 4)));
+  EXPECT_FALSE(
+      patch(brillo::Blob(patch_.begin(), patch_.begin() + kPrefixSize + 1)));
+
+  // Bad magic.
+  brillo::Blob bad_patch = patch_;
+  bad_patch[0] ^= 0xff;
+  EXPECT_FALSE(patch(bad_patch));
+
+  // The header size is larger than the patch.
+  bad_patch = patch_;
+  bad_patch[sizeof(kLz4diffMagic)] = 0xff;
+  EXPECT_FALSE(patch(bad_patch));
+
+  Lz4diffHeader header;
+  brillo::Blob inner_patch;
+  ASSERT_TRUE(SplitPatch(patch_, &header, &inner_patch));
+  EXPECT_TRUE(patch(JoinPatch(header, inner_patch)));
+
+  // A new block that doesn't fit the LZ4 format.
+  Lz4diffHeader bad_header = header;
+  bad_header.mutable_dst_blocks(0)->set_uncompressed_length(UINT64_MAX);
+  EXPECT_FALSE(patch(JoinPatch(bad_header, inner_patch)));
+
+  // The bsdiff patch is truncated.
+  inner_patch.resize(inner_patch.size() / 2);
+  EXPECT_FALSE(patch(JoinPatch(header, inner_patch)));
+}
+
+TEST_F(Lz4PatchTest, RecompressedHashMismatchTest) {
+  GeneratePatch();
+  Lz4diffHeader header;
+  brillo::Blob inner_patch;
+  ASSERT_TRUE(SplitPatch(patch_, &header, &inner_patch));
+  ASSERT_EQ(32U, header.recompressed_sha256_hash().size());
+
+  // A device whose LZ4 library compresses differently fails early instead of
+  // applying the postfix patches to different blocks.
+  header.mutable_recompressed_sha256_hash()->at(0) ^= 0xff;
+  brillo::Blob bad_patch = JoinPatch(header, inner_patch);
+  brillo::Blob patched;
+  EXPECT_FALSE(Lz4Patch(old_data_,
+                        bad_patch.data(),
+                        bad_patch.size(),
+                        new_data_.size(),
+                        &patched));
+}
+
+}  // namespace chromeos_update_engine
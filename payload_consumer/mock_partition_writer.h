@@ -61,6 +61,14 @@ class MockPartitionWriter : public PartitionWriter {
               PerformPuffDiffOperation,
               (const InstallOperation&, ErrorCode*, const void*, size_t),
               (override));
+  MOCK_METHOD(bool,
+              PerformLz4diffOperation,
+              (const InstallOperation&, ErrorCode*, const void*, size_t),
+              (override));
+  MOCK_METHOD(bool,
+              PerformExecutableDiffOperation,
+              (const InstallOperation&, ErrorCode*, const void*, size_t),
+              (override));
 };
 
 }  // namespace chromeos_update_engine
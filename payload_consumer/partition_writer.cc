@@ -34,11 +34,13 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/executable_patch.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/lz4patch.h"
 #include "update_engine/payload_consumer/mount_history.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
@@ -277,6 +279,7 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
                            bool source_may_exist,
                            size_t next_op_index) {
   const PartitionUpdate& partition = partition_update_;
+  install_plan_ = install_plan;
   uint32_t source_slot = install_plan->source_slot;
   uint32_t target_slot = install_plan->target_slot;
   TEST_AND_RETURN_FALSE(OpenSourcePartition(source_slot, source_may_exist));
@@ -368,6 +371,26 @@ bool PartitionWriter::PerformZeroOrDiscardOperation(
 
 bool PartitionWriter::PerformSourceCopyOperation(
     const InstallOperation& operation, ErrorCode* error) {
+  if (ReadsOtherPartition(operation)) {
+    // The source blocks are hashed while copying them, so they are only read
+    // once. There is no error corrected device to fall back to for other
+    // partitions.
+    FileDescriptorPtr source_fd =
+        OpenOtherSourcePartition(operation.src_partition_name());
+    TEST_AND_RETURN_FALSE(source_fd != nullptr);
+    brillo::Blob source_hash;
+    TEST_AND_RETURN_FALSE(fd_utils::CopyAndHashExtents(
+        source_fd,
+        operation.src_extents(),
+        target_fd_,
+        operation.dst_extents(),
+        block_size_,
+        operation.has_src_sha256_hash() ? &source_hash : nullptr));
+    if (operation.has_src_sha256_hash())
+      TEST_AND_RETURN_FALSE(
+          ValidateSourceHash(source_hash, operation, source_fd, error));
+    return true;
+  }
   TEST_AND_RETURN_FALSE(source_fd_ != nullptr);
 
   // The device may optimize the SOURCE_COPY operation.
@@ -538,8 +561,85 @@ bool PartitionWriter::PerformPuffDiffOperation(
   return true;
 }
 
+bool PartitionWriter::PerformLz4diffOperation(
+    const InstallOperation& operation,
+    ErrorCode* error,
+    const void* data,
+    size_t count) {
+  // The LZ4 blocks are decompressed and compressed again as a whole, so the
+  // source and target data are kept in memory.
+  brillo::Blob src_data;
+  TEST_AND_RETURN_FALSE(ReadSourceData(operation, error, &src_data));
+  brillo::Blob dst_data;
+  TEST_AND_RETURN_FALSE(
+      Lz4Patch(src_data,
+               reinterpret_cast<const uint8_t*>(data),
+               count,
+               utils::BlocksInExtents(operation.dst_extents()) * block_size_,
+               &dst_data));
+  return WriteTargetData(operation, dst_data);
+}
+
+bool PartitionWriter::PerformExecutableDiffOperation(
+    const InstallOperation& operation,
+    ErrorCode* error,
+    const void* data,
+    size_t count) {
+  // The branch targets are converted in place, so the source and target data
+  // are kept in memory.
+  brillo::Blob src_data;
+  TEST_AND_RETURN_FALSE(ReadSourceData(operation, error, &src_data));
+  brillo::Blob dst_data;
+  TEST_AND_RETURN_FALSE(ExecutablePatch(
+      src_data, reinterpret_cast<const uint8_t*>(data), count, &dst_data));
+  return WriteTargetData(operation, dst_data);
+}
+
+bool PartitionWriter::PerformTargetCopyOperation(
+    const InstallOperation& operation) {
+  TEST_AND_RETURN_FALSE(target_fd_ != nullptr);
+  // Reads through |target_fd_| write its cached blocks first, so they see the
+  // blocks written by the previous operations without a full flush, which
+  // only happens in CheckpointUpdateProgress().
+  brillo::Blob data(utils::BlocksInExtents(operation.src_extents()) *
+                    block_size_);
+  TEST_AND_RETURN_FALSE(
+      data.size() ==
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_);
+  DirectExtentReader reader;
+  TEST_AND_RETURN_FALSE(
+      reader.Init(target_fd_, operation.src_extents(), block_size_));
+  TEST_AND_RETURN_FALSE(reader.Read(data.data(), data.size()));
+
+  auto writer = CreateBaseExtentWriter();
+  TEST_AND_RETURN_FALSE(
+      writer->Init(target_fd_, operation.dst_extents(), block_size_));
+  TEST_AND_RETURN_FALSE(writer->Write(data.data(), data.size()));
+  return true;
+}
+
 FileDescriptorPtr PartitionWriter::ChooseSourceFD(
     const InstallOperation& operation, ErrorCode* error) {
+  if (ReadsOtherPartition(operation)) {
+    // The error corrected device is only opened for this partition, so the
+    // data of other partitions is read from the raw device.
+    FileDescriptorPtr source_fd =
+        OpenOtherSourcePartition(operation.src_partition_name());
+    if (source_fd == nullptr)
+      return nullptr;
+    if (operation.has_src_sha256_hash()) {
+      brillo::Blob source_hash;
+      if (!fd_utils::ReadAndHashExtents(source_fd,
+                                        operation.src_extents(),
+                                        block_size_,
+                                        &source_hash) ||
+          !ValidateSourceHash(source_hash, operation, source_fd, error)) {
+        return nullptr;
+      }
+    }
+    return source_fd;
+  }
+
   if (source_fd_ == nullptr) {
     LOG(ERROR) << "ChooseSourceFD fail: source_fd_ == nullptr";
     return nullptr;
@@ -593,6 +693,31 @@ FileDescriptorPtr PartitionWriter::ChooseSourceFD(
   return nullptr;
 }
 
+bool PartitionWriter::ReadSourceData(const InstallOperation& operation,
+                                     ErrorCode* error,
+                                     brillo::Blob* data) {
+  FileDescriptorPtr source_fd = ChooseSourceFD(operation, error);
+  TEST_AND_RETURN_FALSE(source_fd != nullptr);
+  data->resize(utils::BlocksInExtents(operation.src_extents()) * block_size_);
+  DirectExtentReader reader;
+  TEST_AND_RETURN_FALSE(
+      reader.Init(source_fd, operation.src_extents(), block_size_));
+  TEST_AND_RETURN_FALSE(reader.Read(data->data(), data->size()));
+  return true;
+}
+
+bool PartitionWriter::WriteTargetData(const InstallOperation& operation,
+                                      const brillo::Blob& data) {
+  TEST_AND_RETURN_FALSE(
+      data.size() ==
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_);
+  auto writer = CreateBaseExtentWriter();
+  TEST_AND_RETURN_FALSE(
+      writer->Init(target_fd_, operation.dst_extents(), block_size_));
+  TEST_AND_RETURN_FALSE(writer->Write(data.data(), data.size()));
+  return true;
+}
+
 bool PartitionWriter::OpenCurrentECCPartition() {
   // No support for ECC for full payloads.
   // Full payload should not have any opeartion that requires ECC partitions.
@@ -622,6 +747,47 @@ bool PartitionWriter::OpenCurrentECCPartition() {
   return !source_ecc_open_failure_;
 }
 
+bool PartitionWriter::ReadsOtherPartition(
+    const InstallOperation& operation) const {
+  return operation.has_src_partition_name() &&
+         operation.src_partition_name() != partition_update_.partition_name();
+}
+
+FileDescriptorPtr PartitionWriter::OpenOtherSourcePartition(
+    const std::string& name) {
+  auto it = other_source_fds_.find(name);
+  if (it != other_source_fds_.end())
+    return it->second;
+
+  if (install_plan_ == nullptr) {
+    LOG(ERROR) << "Unable to open source partition " << name
+               << " before initializing the partition writer.";
+    return nullptr;
+  }
+  auto part = std::find_if(install_plan_->partitions.begin(),
+                           install_plan_->partitions.end(),
+                           [&name](const InstallPlan::Partition& part) {
+                             return part.name == name;
+                           });
+  if (part == install_plan_->partitions.end() || part->source_size == 0 ||
+      part->source_path.empty()) {
+    LOG(ERROR) << "Partition " << partition_update_.partition_name()
+               << " reads from partition " << name
+               << ", which has no source in the install plan.";
+    return nullptr;
+  }
+  int err;
+  FileDescriptorPtr fd =
+      OpenFile(part->source_path.c_str(), O_RDONLY, false, &err);
+  if (fd == nullptr) {
+    LOG(ERROR) << "Unable to open source partition " << name << ", file "
+               << part->source_path;
+    return nullptr;
+  }
+  other_source_fds_[name] = fd;
+  return fd;
+}
+
 int PartitionWriter::Close() {
   int err = 0;
   if (source_fd_ && !source_fd_->Close()) {
@@ -650,6 +816,16 @@ int PartitionWriter::Close() {
   }
   source_ecc_fd_.reset();
   source_ecc_open_failure_ = false;
+
+  for (auto& [name, fd] : other_source_fds_) {
+    if (!fd->Close()) {
+      err = errno;
+      PLOG(ERROR) << "Error closing source partition " << name;
+      if (!err)
+        err = 1;
+    }
+  }
+  other_source_fds_.clear();
   return -err;
 }
 
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_PARTITION_WRITER_H_
 
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 
@@ -82,6 +83,21 @@ class PartitionWriter {
       ErrorCode* error,
       const void* data,
       size_t count);
+  [[nodiscard]] virtual bool PerformLz4diffOperation(
+      const InstallOperation& operation,
+      ErrorCode* error,
+      const void* data,
+      size_t count);
+  [[nodiscard]] virtual bool PerformExecutableDiffOperation(
+      const InstallOperation& operation,
+      ErrorCode* error,
+      const void* data,
+      size_t count);
+  // The source blocks of a TARGET_COPY operation were written by earlier
+  // operations of the partition. They are flushed on every checkpoint, before
+  // the next operation is stored, so they are still there when resuming.
+  [[nodiscard]] virtual bool PerformTargetCopyOperation(
+      const InstallOperation& operation);
 
   // |DeltaPerformer| calls this when all Install Ops are sent to partition
   // writer. No |Perform*Operation| methods will be called in the future, and
@@ -95,12 +111,29 @@ class PartitionWriter {
   bool OpenSourcePartition(uint32_t source_slot, bool source_may_exist);
 
   bool OpenCurrentECCPartition();
+
+  // Returns whether |operation| reads its source data from the source slot of
+  // another partition than this one.
+  bool ReadsOtherPartition(const InstallOperation& operation) const;
+  // Returns the raw source device of the partition |name|, opening it on the
+  // first call. Returns nullptr on error.
+  FileDescriptorPtr OpenOtherSourcePartition(const std::string& name);
+
   // For a given operation, choose the source fd to be used (raw device or error
   // correction device) based on the source operation hash.
   // Returns nullptr if the source hash mismatch cannot be corrected, and set
   // the |error| accordingly.
   FileDescriptorPtr ChooseSourceFD(const InstallOperation& operation,
                                    ErrorCode* error);
+  // Reads the whole source data of |operation| into |data|, from the source fd
+  // chosen by ChooseSourceFD(). Used by the operations that transform their
+  // source data before patching it.
+  bool ReadSourceData(const InstallOperation& operation,
+                      ErrorCode* error,
+                      brillo::Blob* data);
+  // Writes the whole target data |data| of |operation| to its dst_extents.
+  bool WriteTargetData(const InstallOperation& operation,
+                       const brillo::Blob& data);
   [[nodiscard]] virtual std::unique_ptr<ExtentWriter> CreateBaseExtentWriter();
 
   const PartitionUpdate& partition_update_;
@@ -112,6 +145,12 @@ class PartitionWriter {
   std::string target_path_;
   FileDescriptorPtr source_fd_;
   FileDescriptorPtr target_fd_;
+  // The install plan given to Init(), used to find the source slot of the
+  // other partitions.
+  const InstallPlan* install_plan_{nullptr};
+  // The source devices of the other partitions read by the operations, by
+  // partition name.
+  std::map<std::string, FileDescriptorPtr> other_source_fds_;
   const bool interactive_;
   const size_t block_size_;
   // File descriptor of the error corrected source partition. Only set while
@@ -14,6 +14,7 @@
 // limitations under the License.
 //
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -201,4 +202,144 @@ TEST_F(PartitionWriterTest, ChooseSourceFDTest) {
   EXPECT_EQ(1U, GetSourceEccRecoveredFailures());
 }
 
+TEST_F(PartitionWriterTest, SourceCopyFromOtherPartitionTest) {
+  constexpr size_t kCopyOperationSize = 4 * 4096;
+  // The data is copied from the source slot of the "system" partition, not
+  // from the one of the partition being written.
+  brillo::Blob expected_data = FakeFileDescriptorData(kCopyOperationSize);
+  ScopedTempFile other_source("OtherSource-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(other_source.path(), expected_data));
+  InstallPlan::Partition other_part;
+  other_part.name = "system";
+  other_part.source_path = other_source.path();
+  other_part.source_size = expected_data.size();
+  install_plan_.partitions.push_back(other_part);
+  partition_update_.set_partition_name("product");
+
+  auto source_copy_op = GenerateSourceCopyOp(expected_data, true);
+  source_copy_op.op.set_src_partition_name("system");
+  brillo::Blob invalid_data(kCopyOperationSize, 0x55);
+  auto output_data = PerformSourceCopyOp(source_copy_op.op, invalid_data);
+  EXPECT_EQ(expected_data, output_data);
+
+  // The source hash is checked on the data that was copied.
+  ErrorCode error = ErrorCode::kSuccess;
+  auto bad_hash_op = GenerateSourceCopyOp(invalid_data, true);
+  bad_hash_op.op.set_src_partition_name("system");
+  EXPECT_FALSE(writer_.PerformSourceCopyOperation(bad_hash_op.op, &error));
+  EXPECT_EQ(ErrorCode::kDownloadStateInitializationError, error);
+
+  // Partitions not in the install plan can't be read.
+  source_copy_op.op.set_src_partition_name("vendor");
+  EXPECT_FALSE(writer_.PerformSourceCopyOperation(source_copy_op.op, &error));
+}
+
+TEST_F(PartitionWriterTest, TargetCopyTest) {
+  constexpr size_t kNumBlocks = 4;
+  ScopedTempFile target_partition("Target-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(
+      target_partition.path(), brillo::Blob(kNumBlocks * kBlockSize)));
+  install_part_.target_path = target_partition.path();
+  install_part_.target_size = kNumBlocks * kBlockSize;
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+
+  // The first two blocks are written by a REPLACE operation and copied to the
+  // last two blocks in reverse order. The copy must see the data even if it
+  // wasn't flushed yet.
+  brillo::Blob data = FakeFileDescriptorData(2 * kBlockSize);
+  InstallOperation replace_op;
+  replace_op.set_type(InstallOperation::REPLACE);
+  *replace_op.add_dst_extents() = ExtentForRange(0, 2);
+  EXPECT_TRUE(
+      writer_.PerformReplaceOperation(replace_op, data.data(), data.size()));
+
+  InstallOperation target_copy_op;
+  target_copy_op.set_type(InstallOperation::TARGET_COPY);
+  *target_copy_op.add_src_extents() = ExtentForRange(0, 2);
+  *target_copy_op.add_dst_extents() = ExtentForRange(3, 1);
+  *target_copy_op.add_dst_extents() = ExtentForRange(2, 1);
+  EXPECT_TRUE(writer_.PerformTargetCopyOperation(target_copy_op));
+  writer_.CheckpointUpdateProgress(2);
+
+  brillo::Blob expected_data = data;
+  expected_data.insert(
+      expected_data.end(), data.begin() + kBlockSize, data.end());
+  expected_data.insert(
+      expected_data.end(), data.begin(), data.begin() + kBlockSize);
+  brillo::Blob output_data;
+  EXPECT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  EXPECT_EQ(expected_data, output_data);
+}
+
+TEST_F(PartitionWriterTest, TargetCopyRepeatedSourceBlockTest) {
+  constexpr size_t kNumBlocks = 4;
+  ScopedTempFile target_partition("Target-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(
+      target_partition.path(), brillo::Blob(kNumBlocks * kBlockSize)));
+  install_part_.target_path = target_partition.path();
+  install_part_.target_size = kNumBlocks * kBlockSize;
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+
+  brillo::Blob data(kBlockSize, 0xFF);
+  InstallOperation replace_op;
+  replace_op.set_type(InstallOperation::REPLACE);
+  *replace_op.add_dst_extents() = ExtentForRange(0, 1);
+  EXPECT_TRUE(
+      writer_.PerformReplaceOperation(replace_op, data.data(), data.size()));
+
+  // The generator maps every copy of a block to the first one, so the same
+  // source block is read twice in a row.
+  InstallOperation target_copy_op;
+  target_copy_op.set_type(InstallOperation::TARGET_COPY);
+  *target_copy_op.add_src_extents() = ExtentForRange(0, 1);
+  *target_copy_op.add_src_extents() = ExtentForRange(0, 1);
+  *target_copy_op.add_dst_extents() = ExtentForRange(2, 2);
+  EXPECT_TRUE(writer_.PerformTargetCopyOperation(target_copy_op));
+  writer_.CheckpointUpdateProgress(2);
+
+  brillo::Blob expected_data = data;
+  expected_data.resize(2 * kBlockSize, 0);
+  expected_data.insert(expected_data.end(), data.begin(), data.end());
+  expected_data.insert(expected_data.end(), data.begin(), data.end());
+  brillo::Blob output_data;
+  EXPECT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  EXPECT_EQ(expected_data, output_data);
+}
+
+TEST_F(PartitionWriterTest, TargetCopyFromWritePositionTest) {
+  constexpr size_t kNumBlocks = 4;
+  ScopedTempFile target_partition("Target-XXXXXX");
+  brillo::Blob old_data;
+  for (size_t i = 0; i < kNumBlocks; i++)
+    old_data.insert(old_data.end(), kBlockSize, 'a' + i);
+  EXPECT_TRUE(test_utils::WriteFileVector(target_partition.path(), old_data));
+  install_part_.target_path = target_partition.path();
+  install_part_.target_size = kNumBlocks * kBlockSize;
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+
+  brillo::Blob data(kBlockSize, 0xFF);
+  InstallOperation replace_op;
+  replace_op.set_type(InstallOperation::REPLACE);
+  *replace_op.add_dst_extents() = ExtentForRange(0, 1);
+  EXPECT_TRUE(
+      writer_.PerformReplaceOperation(replace_op, data.data(), data.size()));
+
+  // The source starts right where the unflushed write ended.
+  InstallOperation target_copy_op;
+  target_copy_op.set_type(InstallOperation::TARGET_COPY);
+  *target_copy_op.add_src_extents() = ExtentForRange(1, 1);
+  *target_copy_op.add_dst_extents() = ExtentForRange(3, 1);
+  EXPECT_TRUE(writer_.PerformTargetCopyOperation(target_copy_op));
+  writer_.CheckpointUpdateProgress(2);
+
+  brillo::Blob expected_data = old_data;
+  std::copy(data.begin(), data.end(), expected_data.begin());
+  std::copy(old_data.begin() + kBlockSize,
+            old_data.begin() + 2 * kBlockSize,
+            expected_data.begin() + 3 * kBlockSize);
+  brillo::Blob output_data;
+  EXPECT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  EXPECT_EQ(expected_data, output_data);
+}
+
 }  // namespace chromeos_update_engine
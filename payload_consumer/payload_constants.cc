@@ -34,10 +34,16 @@ const uint32_t kBrotliBsdiffMinorPayloadVersion = 4;
 const uint32_t kPuffdiffMinorPayloadVersion = 5;
 const uint32_t kVerityMinorPayloadVersion = 6;
 const uint32_t kPartialUpdateMinorPayloadVersion = 7;
+const uint32_t kPackedExtentsMinorPayloadVersion = 8;
+const uint32_t kStreamedOperationsMinorPayloadVersion = 9;
+const uint32_t kCrossPartitionMinorPayloadVersion = 10;
+const uint32_t kTargetCopyMinorPayloadVersion = 11;
+const uint32_t kLz4diffMinorPayloadVersion = 12;
+const uint32_t kExecutableDiffMinorPayloadVersion = 13;
 
 const uint32_t kMinSupportedMinorPayloadVersion = kSourceMinorPayloadVersion;
 const uint32_t kMaxSupportedMinorPayloadVersion =
-    kPartialUpdateMinorPayloadVersion;
+    kExecutableDiffMinorPayloadVersion;
 
 const uint64_t kMaxPayloadHeaderSize = 24;
 
@@ -66,6 +72,12 @@ const char* InstallOperationTypeName(InstallOperation::Type op_type) {
       return "PUFFDIFF";
     case InstallOperation::BROTLI_BSDIFF:
       return "BROTLI_BSDIFF";
+    case InstallOperation::TARGET_COPY:
+      return "TARGET_COPY";
+    case InstallOperation::LZ4DIFF_BSDIFF:
+      return "LZ4DIFF_BSDIFF";
+    case InstallOperation::EXECUTABLE_BSDIFF:
+      return "EXECUTABLE_BSDIFF";
 
     case InstallOperation::BSDIFF:
     case InstallOperation::MOVE:
@@ -59,6 +59,26 @@ extern const uint32_t kVerityMinorPayloadVersion;
 // The minor version that allows partial update, e.g. kernel only update.
 extern const uint32_t kPartialUpdateMinorPayloadVersion;
 
+// The minor version that allows packed extents and a compressed manifest.
+extern const uint32_t kPackedExtentsMinorPayloadVersion;
+
+// The minor version that allows the operations of a partition to be stored in
+// the data blobs instead of the manifest.
+extern const uint32_t kStreamedOperationsMinorPayloadVersion;
+
+// The minor version that allows operations to read their source data from
+// another partition.
+extern const uint32_t kCrossPartitionMinorPayloadVersion;
+
+// The minor version that allows the TARGET_COPY operation.
+extern const uint32_t kTargetCopyMinorPayloadVersion;
+
+// The minor version that allows the LZ4DIFF_BSDIFF operation.
+extern const uint32_t kLz4diffMinorPayloadVersion;
+
+// The minor version that allows the EXECUTABLE_BSDIFF operation.
+extern const uint32_t kExecutableDiffMinorPayloadVersion;
+
 // The minimum and maximum supported minor version.
 extern const uint32_t kMinSupportedMinorPayloadVersion;
 extern const uint32_t kMaxSupportedMinorPayloadVersion;
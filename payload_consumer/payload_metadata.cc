@@ -18,19 +18,89 @@
 
 #include <endian.h>
 
+#include <memory>
+
 #include <base/strings/stringprintf.h>
 #include <brillo/data_encoding.h>
 
 #include "update_engine/common/constants.h"
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
+#include "update_engine/payload_consumer/xz_extent_writer.h"
 
+using google::protobuf::RepeatedField;
+using google::protobuf::RepeatedPtrField;
 using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// An ExtentWriter that appends all the data written to a string, to
+// decompress the manifest in memory with the XzExtentWriter.
+class StringExtentWriter : public ExtentWriter {
+ public:
+  explicit StringExtentWriter(string* data) : data_(data) {}
+  ~StringExtentWriter() override = default;
+
+  bool Init(FileDescriptorPtr /* fd */,
+            const RepeatedPtrField<Extent>& /* extents */,
+            uint32_t /* block_size */) override {
+    return true;
+  }
+  bool Write(const void* bytes, size_t count) override {
+    data_->append(reinterpret_cast<const char*>(bytes), count);
+    return true;
+  }
+
+ private:
+  string* data_;
+
+  DISALLOW_COPY_AND_ASSIGN(StringExtentWriter);
+};
+
+// Moves the extents in the |packed| format of update_metadata.proto to
+// |extents|, which must be empty if there are packed extents.
+bool UnpackExtents(RepeatedField<int64_t>* packed,
+                   RepeatedPtrField<Extent>* extents) {
+  if (packed->empty())
+    return true;
+  TEST_AND_RETURN_FALSE(extents->empty());
+  TEST_AND_RETURN_FALSE(packed->size() % 2 == 0);
+  extents->Reserve(packed->size() / 2);
+  uint64_t end_block = 0;
+  for (int i = 0; i < packed->size(); i += 2) {
+    int64_t start_delta = packed->Get(i);
+    int64_t num_blocks = packed->Get(i + 1);
+    // Reject extents starting before block 0 or ending past the last block.
+    TEST_AND_RETURN_FALSE(start_delta >= 0 ||
+                          static_cast<uint64_t>(-(start_delta + 1)) <
+                              end_block);
+    TEST_AND_RETURN_FALSE(num_blocks >= 0);
+    uint64_t start_block = end_block + start_delta;
+    end_block = start_block + num_blocks;
+    TEST_AND_RETURN_FALSE(end_block >= start_block);
+    Extent* extent = extents->Add();
+    extent->set_start_block(start_block);
+    extent->set_num_blocks(num_blocks);
+  }
+  packed->Clear();
+  return true;
+}
+
+// Unpacks both the source and destination extents of |op|.
+bool UnpackOperationExtents(InstallOperation* op) {
+  return UnpackExtents(op->mutable_packed_src_extents(),
+                       op->mutable_src_extents()) &&
+         UnpackExtents(op->mutable_packed_dst_extents(),
+                       op->mutable_dst_extents());
+}
+
+}  // namespace
+
 const uint64_t PayloadMetadata::kDeltaVersionOffset = sizeof(kDeltaMagic);
 const uint64_t PayloadMetadata::kDeltaVersionSize = 8;
 const uint64_t PayloadMetadata::kDeltaManifestSizeOffset =
@@ -149,10 +219,62 @@ bool PayloadMetadata::GetManifest(const unsigned char* payload,
                                   DeltaArchiveManifest* out_manifest) const {
   uint64_t manifest_offset = GetManifestOffset();
   CHECK_GE(size, manifest_offset + manifest_size_);
+  TEST_AND_RETURN_FALSE(
+      out_manifest->ParseFromArray(&payload[manifest_offset], manifest_size_));
+  return DecodeManifest(out_manifest);
+}
+
+bool PayloadMetadata::GetRawManifest(const brillo::Blob& payload,
+                                     DeltaArchiveManifest* out_manifest) const {
+  uint64_t manifest_offset = GetManifestOffset();
+  CHECK_GE(payload.size(), manifest_offset + manifest_size_);
   return out_manifest->ParseFromArray(&payload[manifest_offset],
                                       manifest_size_);
 }
 
+bool PayloadMetadata::DecodeManifest(DeltaArchiveManifest* manifest) {
+  if (manifest->has_compressed_manifest()) {
+    // The metadata signature was already verified, so the compressed data is
+    // trusted like the rest of the manifest.
+    string manifest_data;
+    XzExtentWriter xz_writer(
+        std::make_unique<StringExtentWriter>(&manifest_data));
+    TEST_AND_RETURN_FALSE(
+        xz_writer.Init(nullptr, RepeatedPtrField<Extent>(), 0));
+    const string& compressed_manifest = manifest->compressed_manifest();
+    TEST_AND_RETURN_FALSE(xz_writer.Write(compressed_manifest.data(),
+                                          compressed_manifest.size()));
+    manifest->clear_compressed_manifest();
+    TEST_AND_RETURN_FALSE(manifest->MergeFromString(manifest_data));
+    TEST_AND_RETURN_FALSE(!manifest->has_compressed_manifest());
+  }
+  for (PartitionUpdate& partition : *manifest->mutable_partitions()) {
+    for (InstallOperation& op : *partition.mutable_operations())
+      TEST_AND_RETURN_FALSE(UnpackOperationExtents(&op));
+  }
+  return true;
+}
+
+bool PayloadMetadata::DecodePartitionOperations(
+    const PartitionUpdate& partition,
+    const void* data,
+    size_t size,
+    RepeatedPtrField<InstallOperation>* operations) {
+  PartitionOperations partition_operations;
+  TEST_AND_RETURN_FALSE(partition_operations.ParseFromArray(data, size));
+  if (static_cast<uint64_t>(partition_operations.operations_size()) !=
+      partition.num_operations()) {
+    LOG(ERROR) << "Found " << partition_operations.operations_size()
+               << " operations for partition " << partition.partition_name()
+               << " but the manifest lists " << partition.num_operations();
+    return false;
+  }
+  for (InstallOperation& op : *partition_operations.mutable_operations())
+    TEST_AND_RETURN_FALSE(UnpackOperationExtents(&op));
+  operations->Swap(partition_operations.mutable_operations());
+  return true;
+}
+
 ErrorCode PayloadMetadata::ValidateMetadataSignature(
     const brillo::Blob& payload,
     const string& metadata_signature,
@@ -86,8 +86,8 @@ class PayloadMetadata {
   // yet parsed, returns zero.
   uint32_t GetMetadataSignatureSize() const { return metadata_signature_size_; }
 
-  // Set |*out_manifest| to the manifest in |payload|.
-  // Returns true on success.
+  // Set |*out_manifest| to the manifest in |payload|, decoded with
+  // DecodeManifest(). Returns true on success.
   bool GetManifest(const brillo::Blob& payload,
                    DeltaArchiveManifest* out_manifest) const;
 
@@ -95,6 +95,29 @@ class PayloadMetadata {
                    size_t size,
                    DeltaArchiveManifest* out_manifest) const;
 
+  // Same as GetManifest(), but the manifest is not decoded, so it can be
+  // modified and serialized again as it was stored in |payload|.
+  bool GetRawManifest(const brillo::Blob& payload,
+                      DeltaArchiveManifest* out_manifest) const;
+
+  // Decompresses the |compressed_manifest| of |manifest| and unpacks the
+  // packed extents of its operations in place, so the rest of the code only
+  // deals with the regular fields. Manifests without them are not modified.
+  // Returns true on success.
+  static bool DecodeManifest(DeltaArchiveManifest* manifest);
+
+  // Parses the operations of |partition| stored in the data blobs, see
+  // |PartitionUpdate.operations_data_offset|, from the |size| bytes at
+  // |data| and unpacks their extents. The operations are stored in
+  // |operations|. Returns false if they can't be parsed or their number
+  // doesn't match the one in |partition|. The caller must check the hash of
+  // |data| first.
+  static bool DecodePartitionOperations(
+      const PartitionUpdate& partition,
+      const void* data,
+      size_t size,
+      google::protobuf::RepeatedPtrField<InstallOperation>* operations);
+
   // Parses a payload file |payload_path| and prepares the metadata properties,
   // manifest and metadata signatures. Can be used as an easy to use utility to
   // get the payload information without manually the process.
@@ -59,6 +59,22 @@ bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
                                bool source_may_exist,
                                size_t next_op_index) {
   TEST_AND_RETURN_FALSE(install_plan != nullptr);
+  // The COW device can only copy blocks from the source slot of the
+  // partition.
+  for (const InstallOperation& operation : partition_update_.operations()) {
+    if (ReadsOtherPartition(operation)) {
+      LOG(ERROR) << "Partition " << partition_update_.partition_name()
+                 << " reads from partition " << operation.src_partition_name()
+                 << ", which isn't supported with Virtual A/B compression.";
+      return false;
+    }
+    if (operation.type() == InstallOperation::TARGET_COPY) {
+      LOG(ERROR) << "Partition " << partition_update_.partition_name()
+                 << " has TARGET_COPY operations, which aren't supported with "
+                 << "Virtual A/B compression.";
+      return false;
+    }
+  }
   TEST_AND_RETURN_FALSE(
       OpenSourcePartition(install_plan->source_slot, source_may_exist));
   std::optional<std::string> source_path;
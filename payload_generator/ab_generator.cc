@@ -17,9 +17,13 @@
 #include "update_engine/payload_generator/ab_generator.h"
 
 #include <algorithm>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <utility>
 
 #include <base/strings/stringprintf.h>
+#include <google/protobuf/io/coded_stream.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
@@ -28,6 +32,10 @@
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/generation_report.h"
+#include "update_engine/payload_generator/mapped_image.h"
 
 using chromeos_update_engine::diff_utils::IsAReplaceOperation;
 using std::string;
@@ -35,6 +43,23 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Returns the number of seeks needed to read the source extents of |op| when
+// the previous read ended at block |*position|, and moves |*position| to the
+// end of the last source extent.
+uint64_t CountSourceSeeks(const InstallOperation& op, uint64_t* position) {
+  uint64_t num_seeks = 0;
+  for (const Extent& extent : op.src_extents()) {
+    if (extent.start_block() != *position)
+      num_seeks++;
+    *position = extent.start_block() + extent.num_blocks();
+  }
+  return num_seeks;
+}
+
+}  // namespace
+
 bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
                                      const PartitionConfig& old_part,
                                      const PartitionConfig& new_part,
@@ -54,7 +79,7 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
                                                        new_part,
                                                        hard_chunk_blocks,
                                                        soft_chunk_blocks,
-                                                       config.version,
+                                                       config,
                                                        blob_file));
   LOG(INFO) << "done reading " << new_part.name;
 
@@ -68,13 +93,60 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
     merge_chunk_blocks = hard_chunk_blocks;
   }
 
-  LOG(INFO) << "Merging " << aops->size() << " operations.";
-  TEST_AND_RETURN_FALSE(MergeOperations(
-      aops, config.version, merge_chunk_blocks, new_part.path, blob_file));
-  LOG(INFO) << aops->size() << " operations after merge.";
+  // Compact the operations by merging them and coalescing their extents,
+  // since every operation and extent adds to the metadata to download and
+  // verify before the update can start.
+  auto report_manifest_size = [&](const string& stage) {
+    GenerationReport::ManifestSizeReport manifest_size =
+        MeasureManifestSize(*aops);
+    LOG(INFO) << new_part.name << " has " << manifest_size.num_operations
+              << " operations with " << manifest_size.num_extents
+              << " extents (" << manifest_size.operations_size
+              << " bytes) when " << stage << ".";
+    manifest_size.stage = stage;
+    if (config.report)
+      config.report->AddManifestSizeReport(new_part.name, manifest_size);
+  };
+  report_manifest_size("generated");
+  {
+    ScopedStageTimer timer(config.report, new_part.name, "compact_operations");
+    TEST_AND_RETURN_FALSE(MergeOperations(
+        aops, config.version, merge_chunk_blocks, new_part.path, blob_file));
+    CoalesceExtents(aops);
+  }
+  report_manifest_size("compacted");
 
-  if (config.version.minor >= kOpSrcHashMinorPayloadVersion)
+  if (config.version.minor >= kOpSrcHashMinorPayloadVersion) {
+    ScopedStageTimer timer(config.report, new_part.name, "source_hash");
     TEST_AND_RETURN_FALSE(AddSourceHash(aops, old_part.path));
+  }
+
+  // Estimating the source reads is only needed for the report and to log the
+  // effect of the reordering.
+  size_t window_blocks = config.source_locality_window_size / config.block_size;
+  auto report_source_reads = [&](const string& order) {
+    GenerationReport::SourceReadReport source_reads =
+        EstimateSourceReads(*aops);
+    LOG(INFO) << "Reading the source of " << new_part.name << " in " << order
+              << " order needs " << source_reads.num_seeks << " seeks over "
+              << source_reads.seek_distance_blocks << " blocks for "
+              << source_reads.num_reads << " reads of "
+              << source_reads.read_blocks << " blocks ("
+              << source_reads.unique_read_blocks << " distinct).";
+    source_reads.order = order;
+    if (config.report)
+      config.report->AddSourceReadReport(new_part.name, source_reads);
+  };
+  if (config.report || window_blocks > 0)
+    report_source_reads("destination");
+  if (window_blocks > 0) {
+    {
+      ScopedStageTimer timer(
+          config.report, new_part.name, "source_locality_order");
+      SortOperationsBySourceLocality(aops, window_blocks);
+    }
+    report_source_reads("source_locality");
+  }
 
   return true;
 }
@@ -84,6 +156,93 @@ void ABGenerator::SortOperationsByDestination(
   sort(aops->begin(), aops->end(), diff_utils::CompareAopsByDestination);
 }
 
+void ABGenerator::SortOperationsBySourceLocality(
+    vector<AnnotatedOperation>* aops, size_t window_blocks) {
+  CHECK_GT(window_blocks, 0U);
+  // The operations without destination extents are at the end, in their own
+  // window.
+  auto window = [window_blocks](const AnnotatedOperation& aop) {
+    if (aop.op.dst_extents().empty())
+      return std::numeric_limits<uint64_t>::max();
+    return aop.op.dst_extents(0).start_block() / window_blocks;
+  };
+  auto by_source = [](const AnnotatedOperation& first_aop,
+                      const AnnotatedOperation& second_aop) {
+    if (first_aop.op.src_extents().empty() ||
+        second_aop.op.src_extents().empty()) {
+      return first_aop.op.src_extents().size() <
+             second_aop.op.src_extents().size();
+    }
+    return first_aop.op.src_extents(0).start_block() <
+           second_aop.op.src_extents(0).start_block();
+  };
+
+  uint64_t position = 0;
+  vector<size_t> order;
+  vector<AnnotatedOperation> sorted_aops;
+  auto begin = aops->begin();
+  while (begin != aops->end()) {
+    uint64_t begin_window = window(*begin);
+    auto end = std::find_if(
+        begin, aops->end(), [&](const AnnotatedOperation& aop) {
+          return window(aop) != begin_window;
+        });
+
+    order.resize(end - begin);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return by_source(begin[a], begin[b]);
+    });
+
+    // Keep the window in destination order unless sorting it saves seeks,
+    // since reading an operation with several source extents might need
+    // fewer seeks in the original order.
+    uint64_t original_position = position;
+    uint64_t original_seeks = 0;
+    for (auto it = begin; it != end; ++it)
+      original_seeks += CountSourceSeeks(it->op, &original_position);
+    uint64_t sorted_position = position;
+    uint64_t sorted_seeks = 0;
+    for (size_t index : order)
+      sorted_seeks += CountSourceSeeks(begin[index].op, &sorted_position);
+
+    if (sorted_seeks < original_seeks) {
+      sorted_aops.clear();
+      sorted_aops.reserve(order.size());
+      for (size_t index : order)
+        sorted_aops.push_back(std::move(begin[index]));
+      std::move(sorted_aops.begin(), sorted_aops.end(), begin);
+      position = sorted_position;
+    } else {
+      position = original_position;
+    }
+    begin = end;
+  }
+}
+
+GenerationReport::SourceReadReport ABGenerator::EstimateSourceReads(
+    const vector<AnnotatedOperation>& aops) {
+  GenerationReport::SourceReadReport result;
+  ExtentRanges read_blocks;
+  uint64_t position = 0;
+  for (const AnnotatedOperation& aop : aops) {
+    for (const Extent& extent : aop.op.src_extents()) {
+      result.num_reads++;
+      if (extent.start_block() != position) {
+        result.num_seeks++;
+        result.seek_distance_blocks += extent.start_block() > position
+                                           ? extent.start_block() - position
+                                           : position - extent.start_block();
+      }
+      position = extent.start_block() + extent.num_blocks();
+      result.read_blocks += extent.num_blocks();
+      read_blocks.AddExtent(extent);
+    }
+  }
+  result.unique_read_blocks = read_blocks.blocks();
+  return result;
+}
+
 bool ABGenerator::FragmentOperations(const PayloadVersion& version,
                                      vector<AnnotatedOperation>* aops,
                                      const string& target_part_path,
@@ -223,16 +382,22 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
     bool is_a_replace = IsAReplaceOperation(curr_aop.op.type());
 
     bool is_delta_op = curr_aop.op.type() == InstallOperation::SOURCE_COPY;
-    if (((is_delta_op && (last_aop.op.type() == curr_aop.op.type())) ||
+    // ZERO and DISCARD operations have no source and no data, so they can be
+    // merged like a SOURCE_COPY.
+    bool is_mergeable_op = is_delta_op ||
+                           curr_aop.op.type() == InstallOperation::ZERO ||
+                           curr_aop.op.type() == InstallOperation::DISCARD;
+    if (((is_mergeable_op && (last_aop.op.type() == curr_aop.op.type())) ||
          (is_a_replace && last_is_a_replace)) &&
         last_end_block == curr_start_block &&
         combined_block_count <= chunk_blocks) {
       // If the operations have the same type (which is a type that we can
       // merge), are contiguous, are fragmented to have one destination extent,
       // and their combined block count would be less than chunk size, merge
-      // them.
-      last_aop.name = base::StringPrintf(
-          "%s,%s", last_aop.name.c_str(), curr_aop.name.c_str());
+      // them. Append to the name in place, since a merged operation can have
+      // many names.
+      last_aop.name += ",";
+      last_aop.name += curr_aop.name;
 
       if (is_delta_op) {
         ExtendExtents(last_aop.op.mutable_src_extents(),
@@ -263,22 +428,46 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
   return true;
 }
 
+void ABGenerator::CoalesceExtents(vector<AnnotatedOperation>* aops) {
+  for (AnnotatedOperation& aop : *aops) {
+    NormalizeExtents(aop.op.mutable_src_extents());
+    NormalizeExtents(aop.op.mutable_dst_extents());
+  }
+}
+
+GenerationReport::ManifestSizeReport ABGenerator::MeasureManifestSize(
+    const vector<AnnotatedOperation>& aops) {
+  GenerationReport::ManifestSizeReport manifest_size;
+  manifest_size.num_operations = aops.size();
+  for (const AnnotatedOperation& aop : aops) {
+    manifest_size.num_extents +=
+        aop.op.src_extents_size() + aop.op.dst_extents_size();
+    // Every operation is a length-delimited field of PartitionUpdate, with a
+    // one byte tag.
+    size_t op_size = aop.op.ByteSizeLong();
+    manifest_size.operations_size +=
+        1 + google::protobuf::io::CodedOutputStream::VarintSize64(op_size) +
+        op_size;
+  }
+  return manifest_size;
+}
+
 bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
                                     const PayloadVersion& version,
                                     const string& target_part_path,
                                     BlobFileWriter* blob_file) {
   TEST_AND_RETURN_FALSE(IsAReplaceOperation(aop->op.type()));
 
-  vector<Extent> dst_extents;
-  ExtentsToVector(aop->op.dst_extents(), &dst_extents);
+  vector<Extent> dst_extents(aop->op.dst_extents().begin(),
+                             aop->op.dst_extents().end());
   brillo::Blob data(utils::BlocksInExtents(dst_extents) * kBlockSize);
   TEST_AND_RETURN_FALSE(utils::ReadExtents(
       target_part_path, dst_extents, &data, data.size(), kBlockSize));
 
   brillo::Blob blob;
   InstallOperation::Type op_type;
-  TEST_AND_RETURN_FALSE(
-      diff_utils::GenerateBestFullOperation(data, version, &blob, &op_type));
+  TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
+      data, version, &blob, &op_type, nullptr));
 
   // If the operation doesn't point to a data blob or points to a data blob of
   // a different type then we add it.
@@ -292,20 +481,27 @@ bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
 
 bool ABGenerator::AddSourceHash(vector<AnnotatedOperation>* aops,
                                 const string& source_part_path) {
+  std::unique_ptr<MappedImage> source_image =
+      MappedImage::CreateFromFile(source_part_path);
+  TEST_AND_RETURN_FALSE(source_image);
+  // Reused between operations when the source extents are not contiguous.
+  brillo::Blob scratch;
   for (AnnotatedOperation& aop : *aops) {
     if (aop.op.src_extents_size() == 0)
       continue;
 
-    vector<Extent> src_extents;
+    vector<BlockExtent> src_extents;
     ExtentsToVector(aop.op.src_extents(), &src_extents);
-    brillo::Blob src_data, src_hash;
-    uint64_t src_length =
-        aop.op.has_src_length()
-            ? aop.op.src_length()
-            : utils::BlocksInExtents(aop.op.src_extents()) * kBlockSize;
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(
-        source_part_path, src_extents, &src_data, src_length, kBlockSize));
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(src_data, &src_hash));
+    const uint8_t* src_data;
+    size_t src_size;
+    TEST_AND_RETURN_FALSE(source_image->GetExtentsData(
+        src_extents, kBlockSize, &scratch, &src_data, &src_size));
+    if (aop.op.has_src_length()) {
+      TEST_AND_RETURN_FALSE(aop.op.src_length() == src_size);
+    }
+    brillo::Blob src_hash;
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfBytes(src_data, src_size, &src_hash));
     aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
   }
   return true;
@@ -27,6 +27,7 @@
 #include "update_engine/payload_generator/blob_file_writer.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/generation_report.h"
 #include "update_engine/payload_generator/operations_generator.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
@@ -72,6 +73,22 @@ class ABGenerator : public OperationsGenerator {
   static void SortOperationsByDestination(
       std::vector<AnnotatedOperation>* aops);
 
+  // Takes a vector of AnnotatedOperations |aops| sorted by destination and
+  // reorders them to read the source partition more sequentially. The
+  // operations are grouped in windows of |window_blocks| blocks by their first
+  // destination block, and the operations of each window are sorted by the
+  // first source block they read, with the ones not reading the source first.
+  // The new order of a window is only used if it needs fewer seeks than the
+  // original one, see EstimateSourceReads().
+  static void SortOperationsBySourceLocality(
+      std::vector<AnnotatedOperation>* aops, size_t window_blocks);
+
+  // Returns the estimated cost of reading the source partition when applying
+  // the operations in |aops| in that order. A seek is a source extent that
+  // doesn't start where the previously read one ended, starting at block 0.
+  static GenerationReport::SourceReadReport EstimateSourceReads(
+      const std::vector<AnnotatedOperation>& aops);
+
   // Takes an SOURCE_COPY install operation, |aop|, and adds one operation for
   // each dst extent in |aop| to |ops|. The new operations added to |ops| will
   // have only one dst extent. The src extents are split so the number of blocks
@@ -95,10 +112,10 @@ class ABGenerator : public OperationsGenerator {
                               BlobFileWriter* blob_file);
 
   // Takes a sorted (by first destination extent) vector of operations |aops|
-  // and merges SOURCE_COPY, REPLACE, REPLACE_BZ and REPLACE_XZ, operations in
-  // that vector.
+  // and merges SOURCE_COPY, ZERO, DISCARD, REPLACE, REPLACE_BZ and REPLACE_XZ,
+  // operations in that vector.
   // It will merge two operations if:
-  //   - They are both REPLACE_*, or they are both SOURCE_COPY,
+  //   - They are both REPLACE_*, or they have the same type otherwise,
   //   - Their destination blocks are contiguous.
   //   - Their combined blocks do not exceed |chunk_blocks| blocks.
   // Note that unlike other methods, you can't pass a negative number in
@@ -109,6 +126,15 @@ class ABGenerator : public OperationsGenerator {
                               const std::string& target_part,
                               BlobFileWriter* blob_file);
 
+  // Combines the touching consecutive source and destination extents of every
+  // operation in |aops|, which doesn't change the data they read or write.
+  static void CoalesceExtents(std::vector<AnnotatedOperation>* aops);
+
+  // Returns the number of operations in |aops|, of extents in them, and the
+  // size of the operations once serialized in the manifest.
+  static GenerationReport::ManifestSizeReport MeasureManifestSize(
+      const std::vector<AnnotatedOperation>& aops);
+
   // Takes a vector of AnnotatedOperations |aops|, adds source hash to all
   // operations that have src_extents.
   static bool AddSourceHash(std::vector<AnnotatedOperation>* aops,
@@ -428,6 +428,51 @@ TEST_F(ABGeneratorTest, SortOperationsByDestinationTest) {
   EXPECT_EQ(second_aop.name, aops[2].name);
 }
 
+TEST_F(ABGeneratorTest, SortOperationsBySourceLocalityTest) {
+  vector<AnnotatedOperation> aops;
+  auto add_aop = [&aops](const string& name,
+                         uint64_t dst_block,
+                         vector<Extent> src_extents) {
+    AnnotatedOperation aop;
+    aop.name = name;
+    aop.op.set_type(src_extents.empty() ? InstallOperation::REPLACE
+                                        : InstallOperation::SOURCE_COPY);
+    for (const Extent& extent : src_extents)
+      *aop.op.add_src_extents() = extent;
+    *aop.op.add_dst_extents() = ExtentForRange(dst_block, 1);
+    aops.push_back(aop);
+  };
+  // The first window reads the source in a random order.
+  add_aop("a", 0, {ExtentForRange(22, 1)});
+  add_aop("b", 1, {ExtentForRange(20, 1)});
+  add_aop("c", 2, {});
+  add_aop("d", 3, {ExtentForRange(21, 1)});
+  // Sorting the second window by the first source block would need more
+  // seeks, so it is kept in destination order.
+  add_aop("e", 10, {ExtentForRange(100, 1), ExtentForRange(0, 1)});
+  add_aop("f", 11, {ExtentForRange(1, 1)});
+  add_aop("g", 12, {ExtentForRange(1, 2)});
+
+  GenerationReport::SourceReadReport source_reads =
+      ABGenerator::EstimateSourceReads(aops);
+  EXPECT_EQ(7U, source_reads.num_reads);
+  EXPECT_EQ(5U, source_reads.num_seeks);
+  EXPECT_EQ(22U + 3U + 78U + 101U + 1U, source_reads.seek_distance_blocks);
+
+  ABGenerator::SortOperationsBySourceLocality(&aops, 10);
+  vector<string> names;
+  for (const AnnotatedOperation& aop : aops)
+    names.push_back(aop.name);
+  EXPECT_EQ((vector<string>{"c", "b", "d", "a", "e", "f", "g"}), names);
+
+  source_reads = ABGenerator::EstimateSourceReads(aops);
+  EXPECT_EQ(7U, source_reads.num_reads);
+  EXPECT_EQ(4U, source_reads.num_seeks);
+  EXPECT_EQ(20U + 77U + 101U + 1U, source_reads.seek_distance_blocks);
+  EXPECT_EQ(8U, source_reads.read_blocks);
+  EXPECT_EQ(7U, source_reads.unique_read_blocks);
+}
+
 TEST_F(ABGeneratorTest, MergeSourceCopyOperationsTest) {
   vector<AnnotatedOperation> aops;
   InstallOperation first_op;
@@ -541,6 +586,61 @@ TEST_F(ABGeneratorTest, NoMergeOperationsTest) {
   EXPECT_EQ(4U, aops.size());
 }
 
+TEST_F(ABGeneratorTest, MergeZeroOperationsTest) {
+  vector<AnnotatedOperation> aops;
+  for (uint64_t start_block : {0, 2, 4, 8}) {
+    AnnotatedOperation aop;
+    aop.op.set_type(InstallOperation::ZERO);
+    *aop.op.add_dst_extents() = ExtentForRange(start_block, 2);
+    aop.name = std::to_string(start_block);
+    aops.push_back(aop);
+  }
+
+  BlobFileWriter blob_file(0, nullptr);
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  EXPECT_TRUE(ABGenerator::MergeOperations(&aops, version, 4, "", &blob_file));
+
+  // Only the contiguous operations within the chunk size are merged.
+  ASSERT_EQ(3U, aops.size());
+  EXPECT_EQ("0,2", aops[0].name);
+  EXPECT_EQ(1, aops[0].op.dst_extents_size());
+  EXPECT_TRUE(ExtentEquals(aops[0].op.dst_extents(0), 0, 4));
+  EXPECT_EQ("4", aops[1].name);
+  EXPECT_EQ("8", aops[2].name);
+}
+
+TEST_F(ABGeneratorTest, CoalesceExtentsAndMeasureManifestSizeTest) {
+  vector<AnnotatedOperation> aops(1);
+  aops[0].op.set_type(InstallOperation::SOURCE_BSDIFF);
+  *aops[0].op.add_src_extents() = ExtentForRange(10, 2);
+  *aops[0].op.add_src_extents() = ExtentForRange(12, 3);
+  *aops[0].op.add_src_extents() = ExtentForRange(1, 1);
+  *aops[0].op.add_dst_extents() = ExtentForRange(5, 1);
+  *aops[0].op.add_dst_extents() = ExtentForRange(6, 1);
+
+  GenerationReport::ManifestSizeReport before =
+      ABGenerator::MeasureManifestSize(aops);
+  EXPECT_EQ(1U, before.num_operations);
+  EXPECT_EQ(5U, before.num_extents);
+
+  ABGenerator::CoalesceExtents(&aops);
+  ASSERT_EQ(2, aops[0].op.src_extents_size());
+  EXPECT_TRUE(ExtentEquals(aops[0].op.src_extents(0), 10, 5));
+  EXPECT_TRUE(ExtentEquals(aops[0].op.src_extents(1), 1, 1));
+  ASSERT_EQ(1, aops[0].op.dst_extents_size());
+  EXPECT_TRUE(ExtentEquals(aops[0].op.dst_extents(0), 5, 2));
+
+  GenerationReport::ManifestSizeReport after =
+      ABGenerator::MeasureManifestSize(aops);
+  EXPECT_EQ(1U, after.num_operations);
+  EXPECT_EQ(3U, after.num_extents);
+  EXPECT_LT(after.operations_size, before.operations_size);
+  string serialized_op;
+  ASSERT_TRUE(aops[0].op.SerializeToString(&serialized_op));
+  EXPECT_EQ(2 + serialized_op.size(), after.operations_size);
+}
+
 TEST_F(ABGeneratorTest, AddSourceHashTest) {
   vector<AnnotatedOperation> aops;
   InstallOperation first_op;
@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_EXTENT_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_EXTENT_H_
+
+#include <stdint.h>
+
+#include <ostream>
+#include <type_traits>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A run of |num_blocks| blocks starting at |start_block|. This is the
+// generator's in-memory representation of an Extent: a plain 16-byte value
+// that can be stored in contiguous arrays and copied with memcpy, without the
+// per-message allocation and accessor overhead of the protobuf Extent. The
+// protobuf Extent is only built when the extents are stored in an operation
+// of the manifest, see StoreExtents().
+//
+// It has the same accessors as the protobuf Extent so the code and templates
+// working on extents (like utils::BlocksInExtents()) work on both.
+class BlockExtent {
+ public:
+  BlockExtent() = default;
+  constexpr BlockExtent(uint64_t start_block, uint64_t num_blocks)
+      : start_block_(start_block), num_blocks_(num_blocks) {}
+  // Implicit so the extents of the manifest can be passed where a BlockExtent
+  // is expected.
+  BlockExtent(const Extent& extent)  // NOLINT(runtime/explicit)
+      : start_block_(extent.start_block()), num_blocks_(extent.num_blocks()) {}
+
+  uint64_t start_block() const { return start_block_; }
+  uint64_t num_blocks() const { return num_blocks_; }
+  void set_start_block(uint64_t start_block) { start_block_ = start_block; }
+  void set_num_blocks(uint64_t num_blocks) { num_blocks_ = num_blocks; }
+
+  // Returns the protobuf Extent for this extent.
+  Extent ToExtent() const {
+    Extent extent;
+    extent.set_start_block(start_block_);
+    extent.set_num_blocks(num_blocks_);
+    return extent;
+  }
+
+ private:
+  uint64_t start_block_{0};
+  uint64_t num_blocks_{0};
+};
+
+static_assert(sizeof(BlockExtent) == 16, "BlockExtent must be 16 bytes.");
+static_assert(std::is_trivially_copyable<BlockExtent>::value,
+              "BlockExtent must be trivially copyable.");
+
+inline bool operator==(const BlockExtent& a, const BlockExtent& b) {
+  return a.start_block() == b.start_block() && a.num_blocks() == b.num_blocks();
+}
+
+inline bool operator!=(const BlockExtent& a, const BlockExtent& b) {
+  return !(a == b);
+}
+
+inline std::ostream& operator<<(std::ostream& out, const BlockExtent& extent) {
+  return out << "[" << extent.start_block() << " - "
+             << extent.start_block() + extent.num_blocks() - 1 << "]";
+}
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_EXTENT_H_
@@ -150,6 +150,9 @@ bool CowDryRun(
       case InstallOperation::BROTLI_BSDIFF:
       case InstallOperation::PUFFDIFF:
       case InstallOperation::BSDIFF:
+      case InstallOperation::TARGET_COPY:
+      case InstallOperation::LZ4DIFF_BSDIFF:
+      case InstallOperation::EXECUTABLE_BSDIFF:
         // We might do something special by adding CowBsdiff to CowWriter.
         // For now proceed the same way as normal REPLACE operation.
         TEST_AND_RETURN_FALSE(
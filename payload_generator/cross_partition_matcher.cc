@@ -0,0 +1,197 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/cross_partition_matcher.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns a hash of the |size| bytes of |data|, a multiple of 8 bytes.
+uint64_t HashBlock(const uint8_t* data, size_t size) {
+  uint64_t hash = size;
+  for (size_t offset = 0; offset < size; offset += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + offset, sizeof(word));
+    hash = (hash + word) * 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+bool IsZeroBlock(const uint8_t* data, size_t size) {
+  return std::all_of(data, data + size, [](uint8_t byte) { return !byte; });
+}
+
+}  // namespace
+
+std::unique_ptr<CrossPartitionMatcher> CrossPartitionMatcher::Create(
+    const vector<PartitionConfig>& old_parts, size_t block_size) {
+  std::unique_ptr<CrossPartitionMatcher> matcher(
+      new CrossPartitionMatcher(block_size));
+  for (const PartitionConfig& old_part : old_parts) {
+    if (old_part.path.empty())
+      continue;
+    std::unique_ptr<MappedImage> image =
+        MappedImage::CreateFromFile(old_part.path);
+    if (!image) {
+      LOG(ERROR) << "Unable to map " << old_part.path;
+      return nullptr;
+    }
+    uint32_t partition = matcher->old_parts_.size();
+    for (uint64_t block = 0; block < old_part.size / block_size; block++) {
+      const uint8_t* data = image->GetData(block * block_size, block_size);
+      if (!data) {
+        LOG(ERROR) << "Unable to read block " << block << " of "
+                   << old_part.path;
+        return nullptr;
+      }
+      if (IsZeroBlock(data, block_size))
+        continue;
+      matcher->old_blocks_.emplace(HashBlock(data, block_size),
+                                   BlockLocation{partition, block});
+    }
+    matcher->old_parts_.push_back({old_part.name, std::move(image)});
+  }
+  LOG(INFO) << "Indexed " << matcher->old_blocks_.size()
+            << " distinct blocks of " << matcher->old_parts_.size()
+            << " old partitions.";
+  return matcher;
+}
+
+bool CrossPartitionMatcher::ReplaceFullOperations(
+    const PartitionConfig& new_part,
+    const PayloadVersion& version,
+    ssize_t chunk_blocks,
+    BlobFileWriter* blob_file,
+    vector<AnnotatedOperation>* aops) const {
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part.path);
+  TEST_AND_RETURN_FALSE(new_image);
+
+  vector<AnnotatedOperation> new_aops;
+  uint64_t num_copied_blocks = 0;
+  // Reused between operations when the source extents are not contiguous.
+  brillo::Blob scratch;
+  for (AnnotatedOperation& aop : *aops) {
+    if (!diff_utils::IsAReplaceOperation(aop.op.type())) {
+      new_aops.push_back(std::move(aop));
+      continue;
+    }
+
+    // The source and destination extents of the blocks found in every old
+    // partition, and the extents of the blocks not found.
+    std::map<uint32_t, std::pair<vector<BlockExtent>, vector<BlockExtent>>>
+        copies;
+    vector<BlockExtent> remaining_extents;
+    for (uint64_t block : ExpandExtents(aop.op.dst_extents())) {
+      const uint8_t* data =
+          new_image->GetData(block * block_size_, block_size_);
+      TEST_AND_RETURN_FALSE(data);
+      const BlockLocation* location = FindBlock(data);
+      if (!location) {
+        AppendBlockToExtents(&remaining_extents, block);
+        continue;
+      }
+      auto& copy = copies[location->partition];
+      AppendBlockToExtents(&copy.first, location->block);
+      AppendBlockToExtents(&copy.second, block);
+    }
+    if (copies.empty()) {
+      new_aops.push_back(std::move(aop));
+      continue;
+    }
+
+    for (const auto& [partition, copy] : copies) {
+      const OldPartition& old_part = old_parts_[partition];
+      AnnotatedOperation copy_aop;
+      copy_aop.name = aop.name + ":" + old_part.name;
+      copy_aop.op.set_type(InstallOperation::SOURCE_COPY);
+      if (old_part.name != new_part.name)
+        copy_aop.op.set_src_partition_name(old_part.name);
+      StoreExtents(copy.first, copy_aop.op.mutable_src_extents());
+      StoreExtents(copy.second, copy_aop.op.mutable_dst_extents());
+
+      const uint8_t* src_data;
+      size_t src_size;
+      TEST_AND_RETURN_FALSE(old_part.image->GetExtentsData(
+          copy.first, block_size_, &scratch, &src_data, &src_size));
+      brillo::Blob src_hash;
+      TEST_AND_RETURN_FALSE(
+          HashCalculator::RawHashOfBytes(src_data, src_size, &src_hash));
+      copy_aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+      num_copied_blocks += utils::BlocksInExtents(copy.second);
+      new_aops.push_back(std::move(copy_aop));
+    }
+
+    if (!remaining_extents.empty()) {
+      TEST_AND_RETURN_FALSE(diff_utils::DeltaReadFile(&new_aops,
+                                                      nullptr,  // old_image
+                                                      new_image.get(),
+                                                      {},  // old_extents
+                                                      remaining_extents,
+                                                      {},  // old_deflates
+                                                      {},  // new_deflates
+                                                      nullptr,  // old_lz4_file
+                                                      nullptr,  // new_lz4_file
+                                                      aop.name,
+                                                      chunk_blocks,
+                                                      version,
+                                                      diff_utils::DiffLimits(),
+                                                      nullptr,  // target_cache
+                                                      blob_file,
+                                                      nullptr));
+    }
+  }
+
+  LOG(INFO) << "Copying " << num_copied_blocks << " blocks of "
+            << new_part.name << " from the old partitions instead of "
+            << "replacing them.";
+  *aops = std::move(new_aops);
+  return true;
+}
+
+const CrossPartitionMatcher::BlockLocation* CrossPartitionMatcher::FindBlock(
+    const uint8_t* data) const {
+  auto it = old_blocks_.find(HashBlock(data, block_size_));
+  if (it == old_blocks_.end())
+    return nullptr;
+  const BlockLocation& location = it->second;
+  const uint8_t* old_data = old_parts_[location.partition].image->GetData(
+      location.block * block_size_, block_size_);
+  if (!old_data || memcmp(old_data, data, block_size_) != 0)
+    return nullptr;
+  return &location;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_CROSS_PARTITION_MATCHER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_CROSS_PARTITION_MATCHER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/mapped_image.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+namespace chromeos_update_engine {
+
+// Finds the new data that was stored in another old partition, like files
+// moved from one partition to another or firmware duplicated in several of
+// them. The operations of every partition are generated only from the same old
+// partition, so the data found elsewhere ends up in full operations. Those
+// operations are looked up block by block in all the old partitions and the
+// blocks found are copied from there instead.
+class CrossPartitionMatcher {
+ public:
+  // Indexes the data of all the old partitions in |old_parts| that exist.
+  // Returns nullptr on error.
+  static std::unique_ptr<CrossPartitionMatcher> Create(
+      const std::vector<PartitionConfig>& old_parts, size_t block_size);
+
+  // Replaces the blocks written by the full operations in |aops| of the new
+  // partition |new_part| that are found in an old partition with SOURCE_COPY
+  // operations reading that old partition. The remaining blocks of those
+  // operations are encoded again as full operations of up to |chunk_blocks|
+  // blocks allowed in |version|, with their data written to |blob_file|. This
+  // method is thread safe.
+  bool ReplaceFullOperations(const PartitionConfig& new_part,
+                             const PayloadVersion& version,
+                             ssize_t chunk_blocks,
+                             BlobFileWriter* blob_file,
+                             std::vector<AnnotatedOperation>* aops) const;
+
+ private:
+  // The position of a block in the old partitions.
+  struct BlockLocation {
+    // The index of the partition in |old_parts_|.
+    uint32_t partition;
+    uint64_t block;
+  };
+
+  struct OldPartition {
+    std::string name;
+    std::unique_ptr<MappedImage> image;
+  };
+
+  explicit CrossPartitionMatcher(size_t block_size) : block_size_(block_size) {}
+
+  // Returns the location of an old block with the same content as the
+  // |block_size_| bytes of |data|, or nullptr if there's none.
+  const BlockLocation* FindBlock(const uint8_t* data) const;
+
+  const size_t block_size_;
+
+  std::vector<OldPartition> old_parts_;
+
+  // The first location of the non-zero old blocks, by the hash of their
+  // content. The blocks with the same hash as an earlier block are left out,
+  // so the content has to be compared on every match.
+  std::unordered_map<uint64_t, BlockLocation> old_blocks_;
+
+  DISALLOW_COPY_AND_ASSIGN(CrossPartitionMatcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_CROSS_PARTITION_MATCHER_H_
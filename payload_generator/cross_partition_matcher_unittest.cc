@@ -0,0 +1,174 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/cross_partition_matcher.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kTestBlockSize = 4096;
+constexpr size_t kNumBlocks = 8;
+
+brillo::Blob RandomData(size_t size, uint32_t seed) {
+  std::mt19937 gen(seed);
+  brillo::Blob data(size);
+  for (uint8_t& byte : data)
+    byte = gen();
+  return data;
+}
+
+// Copies the block |src_block| of |src| to the block |dst_block| of |dst|.
+void CopyBlock(const brillo::Blob& src,
+               size_t src_block,
+               brillo::Blob* dst,
+               size_t dst_block) {
+  std::copy(src.begin() + src_block * kTestBlockSize,
+            src.begin() + (src_block + 1) * kTestBlockSize,
+            dst->begin() + dst_block * kTestBlockSize);
+}
+
+vector<BlockExtent> ToVector(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) {
+  vector<BlockExtent> result;
+  ExtentsToVector(extents, &result);
+  return result;
+}
+
+}  // namespace
+
+class CrossPartitionMatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    old_system_.path = old_system_file_.path();
+    old_product_.path = old_product_file_.path();
+    new_product_.path = new_product_file_.path();
+    system_data_ = RandomData(kNumBlocks * kTestBlockSize, 1);
+    product_data_ = RandomData(kNumBlocks * kTestBlockSize, 2);
+    ASSERT_TRUE(SetUpPartition(&old_system_, system_data_));
+    ASSERT_TRUE(SetUpPartition(&old_product_, product_data_));
+  }
+
+  bool SetUpPartition(PartitionConfig* part, const brillo::Blob& data) {
+    part->size = data.size();
+    return test_utils::WriteFileVector(part->path, data);
+  }
+
+  // Returns a REPLACE operation writing all the blocks of |new_part_|.
+  AnnotatedOperation ReplaceAllOperation() {
+    AnnotatedOperation aop;
+    aop.name = "replace";
+    aop.op.set_type(InstallOperation::REPLACE);
+    *aop.op.add_dst_extents() = ExtentForRange(0, kNumBlocks);
+    return aop;
+  }
+
+  ScopedTempFile old_system_file_{"CrossPartitionMatcherTest_system.XXXXXX"};
+  ScopedTempFile old_product_file_{"CrossPartitionMatcherTest_product.XXXXXX"};
+  ScopedTempFile new_product_file_{"CrossPartitionMatcherTest_new.XXXXXX"};
+  ScopedTempFile blob_file_{"CrossPartitionMatcherTest_blob.XXXXXX", true};
+  off_t blob_size_ = 0;
+
+  PartitionConfig old_system_{"system"};
+  PartitionConfig old_product_{"product"};
+  PartitionConfig new_product_{"product"};
+  brillo::Blob system_data_;
+  brillo::Blob product_data_;
+
+  const PayloadVersion version_{kBrilloMajorPayloadVersion,
+                                kCrossPartitionMinorPayloadVersion};
+};
+
+TEST_F(CrossPartitionMatcherTest, CopiesBlocksFromOtherPartitionTest) {
+  // The new product has the old system blocks 5 and 6, the old product block 3
+  // and new data.
+  brillo::Blob new_data = RandomData(kNumBlocks * kTestBlockSize, 3);
+  CopyBlock(system_data_, 5, &new_data, 0);
+  CopyBlock(system_data_, 6, &new_data, 1);
+  CopyBlock(product_data_, 3, &new_data, 4);
+  ASSERT_TRUE(SetUpPartition(&new_product_, new_data));
+
+  vector<PartitionConfig> old_parts;
+  old_parts.push_back(std::move(old_system_));
+  old_parts.push_back(std::move(old_product_));
+  auto matcher = CrossPartitionMatcher::Create(old_parts, kTestBlockSize);
+  ASSERT_NE(nullptr, matcher);
+  vector<AnnotatedOperation> aops = {ReplaceAllOperation()};
+  BlobFileWriter blob_file(blob_file_.fd(), &blob_size_);
+  EXPECT_TRUE(matcher->ReplaceFullOperations(
+      new_product_, version_, -1, &blob_file, &aops));
+
+  ASSERT_EQ(3U, aops.size());
+  const InstallOperation& system_copy = aops[0].op;
+  EXPECT_EQ(InstallOperation::SOURCE_COPY, system_copy.type());
+  EXPECT_EQ("system", system_copy.src_partition_name());
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(5, 2)},
+            ToVector(system_copy.src_extents()));
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(0, 2)},
+            ToVector(system_copy.dst_extents()));
+  EXPECT_TRUE(system_copy.has_src_sha256_hash());
+
+  // Blocks from the same partition don't name it.
+  const InstallOperation& product_copy = aops[1].op;
+  EXPECT_EQ(InstallOperation::SOURCE_COPY, product_copy.type());
+  EXPECT_FALSE(product_copy.has_src_partition_name());
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(3, 1)},
+            ToVector(product_copy.src_extents()));
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(4, 1)},
+            ToVector(product_copy.dst_extents()));
+
+  EXPECT_TRUE(diff_utils::IsAReplaceOperation(aops[2].op.type()));
+  EXPECT_EQ((vector<BlockExtent>{{2, 2}, {5, 3}}),
+            ToVector(aops[2].op.dst_extents()));
+}
+
+TEST_F(CrossPartitionMatcherTest, KeepsOperationsWithoutMatchesTest) {
+  // Zero blocks are never copied.
+  brillo::Blob new_data = RandomData(kNumBlocks * kTestBlockSize, 4);
+  std::fill(new_data.begin(), new_data.begin() + kTestBlockSize, 0);
+  ASSERT_TRUE(SetUpPartition(&new_product_, new_data));
+
+  vector<PartitionConfig> old_parts;
+  old_parts.push_back(std::move(old_system_));
+  auto matcher = CrossPartitionMatcher::Create(old_parts, kTestBlockSize);
+  ASSERT_NE(nullptr, matcher);
+  AnnotatedOperation aop = ReplaceAllOperation();
+  vector<AnnotatedOperation> aops = {aop};
+  BlobFileWriter blob_file(blob_file_.fd(), &blob_size_);
+  EXPECT_TRUE(matcher->ReplaceFullOperations(
+      new_product_, version_, -1, &blob_file, &aops));
+  ASSERT_EQ(1U, aops.size());
+  EXPECT_EQ(aop.op.SerializeAsString(), aops[0].op.SerializeAsString());
+  EXPECT_EQ(0, blob_size_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,136 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/deflate_cache.h"
+
+#include <endian.h>
+#include <stdio.h>
+
+#include <cstring>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/utils.h"
+
+using puffin::BitExtent;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Every entry starts with this magic, followed by the little endian 64-bit
+// number of deflates and then the little endian 64-bit offset and length of
+// each deflate. Bump the version when the format or the way deflates are
+// located changes, so stale entries are ignored.
+const char kDeflateCacheMagic[] = "UEDC0001";
+const size_t kDeflateCacheMagicSize = sizeof(kDeflateCacheMagic) - 1;
+
+void AppendUint64(uint64_t value, brillo::Blob* out) {
+  value = htole64(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out->insert(out->end(), bytes, bytes + sizeof(value));
+}
+
+uint64_t ReadUint64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return le64toh(value);
+}
+
+}  // namespace
+
+std::unique_ptr<DeflateCache> DeflateCache::CreateFromDirectory(
+    const string& dir) {
+  if (!base::CreateDirectory(base::FilePath(dir))) {
+    PLOG(ERROR) << "Unable to create the deflate cache directory " << dir;
+    return nullptr;
+  }
+  return std::unique_ptr<DeflateCache>(new DeflateCache(dir));
+}
+
+string DeflateCache::GetEntryPath(Format format,
+                                  const brillo::Blob& hash) const {
+  const char* prefix = format == Format::kZip ? "zip-" : "gzip-";
+  return dir_ + "/" + prefix + base::HexEncode(hash.data(), hash.size());
+}
+
+bool DeflateCache::Lookup(Format format,
+                          const brillo::Blob& hash,
+                          vector<BitExtent>* deflates) const {
+  brillo::Blob entry;
+  if (!utils::ReadFile(GetEntryPath(format, hash), &entry))
+    return false;
+
+  const size_t kHeaderSize = kDeflateCacheMagicSize + sizeof(uint64_t);
+  if (entry.size() < kHeaderSize ||
+      memcmp(entry.data(), kDeflateCacheMagic, kDeflateCacheMagicSize) != 0) {
+    LOG(WARNING) << "Ignoring invalid deflate cache entry "
+                 << GetEntryPath(format, hash);
+    return false;
+  }
+  uint64_t count = ReadUint64(entry.data() + kDeflateCacheMagicSize);
+  if ((entry.size() - kHeaderSize) / (2 * sizeof(uint64_t)) != count ||
+      (entry.size() - kHeaderSize) % (2 * sizeof(uint64_t)) != 0) {
+    LOG(WARNING) << "Ignoring truncated deflate cache entry "
+                 << GetEntryPath(format, hash);
+    return false;
+  }
+
+  deflates->clear();
+  deflates->reserve(count);
+  const uint8_t* data = entry.data() + kHeaderSize;
+  for (uint64_t i = 0; i < count; i++, data += 2 * sizeof(uint64_t)) {
+    deflates->emplace_back(ReadUint64(data),
+                           ReadUint64(data + sizeof(uint64_t)));
+  }
+  return true;
+}
+
+bool DeflateCache::Store(Format format,
+                         const brillo::Blob& hash,
+                         const vector<BitExtent>& deflates) const {
+  brillo::Blob entry(kDeflateCacheMagic,
+                     kDeflateCacheMagic + kDeflateCacheMagicSize);
+  entry.reserve(entry.size() + (1 + 2 * deflates.size()) * sizeof(uint64_t));
+  AppendUint64(deflates.size(), &entry);
+  for (const BitExtent& deflate : deflates) {
+    AppendUint64(deflate.offset, &entry);
+    AppendUint64(deflate.length, &entry);
+  }
+
+  // Write to a temporary file and rename it so a concurrent Lookup() never sees
+  // a partially written entry.
+  string temp_path;
+  int fd = -1;
+  TEST_AND_RETURN_FALSE(
+      utils::MakeTempFile(dir_ + "/.entry.XXXXXX", &temp_path, &fd));
+  ScopedPathUnlinker unlinker(temp_path);
+  {
+    ScopedFdCloser fd_closer(&fd);
+    TEST_AND_RETURN_FALSE(utils::WriteAll(fd, entry.data(), entry.size()));
+  }
+  TEST_AND_RETURN_FALSE_ERRNO(
+      rename(temp_path.c_str(), GetEntryPath(format, hash).c_str()) == 0);
+  unlinker.set_should_remove(false);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
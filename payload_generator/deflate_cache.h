@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DEFLATE_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_DEFLATE_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+#include <puffin/puffdiff.h>
+
+namespace chromeos_update_engine {
+
+// A persistent cache of the deflate locations found in zip and gzip files. The
+// same APKs are usually part of many builds, so the (expensive) search for
+// deflates is done only once per file content. Every entry is stored in its own
+// file in the cache directory, named after the SHA-256 of the file content, so
+// the cache can be shared by several generators running at the same time. All
+// the methods are thread safe.
+class DeflateCache {
+ public:
+  // The format of the file the deflates were located in. The same content
+  // parsed in a different format results in a different entry.
+  enum class Format {
+    kZip,
+    kGzip,
+  };
+
+  // Opens the cache stored in |dir|, creating the directory if needed. Returns
+  // nullptr on error.
+  static std::unique_ptr<DeflateCache> CreateFromDirectory(
+      const std::string& dir);
+
+  // Looks up the deflates of a file of format |format| with content hash
+  // |hash|. Returns whether an entry was found and stored in |deflates|.
+  bool Lookup(Format format,
+              const brillo::Blob& hash,
+              std::vector<puffin::BitExtent>* deflates) const;
+
+  // Stores the |deflates| of a file of format |format| with content hash
+  // |hash|, replacing any previous entry.
+  bool Store(Format format,
+             const brillo::Blob& hash,
+             const std::vector<puffin::BitExtent>& deflates) const;
+
+ private:
+  explicit DeflateCache(const std::string& dir) : dir_(dir) {}
+
+  // Returns the path of the entry file for |format| and |hash|.
+  std::string GetEntryPath(Format format, const brillo::Blob& hash) const;
+
+  const std::string dir_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeflateCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_DEFLATE_CACHE_H_
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/deflate_cache.h"
+
+#include <string>
+#include <vector>
+
+#include <base/files/scoped_temp_dir.h>
+#include <base/strings/string_number_conversions.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+using puffin::BitExtent;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class DeflateCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    cache_dir_ = temp_dir_.GetPath().Append("cache").value();
+    cache_ = DeflateCache::CreateFromDirectory(cache_dir_);
+    ASSERT_NE(nullptr, cache_);
+    ASSERT_TRUE(HashCalculator::RawHashOfData({1, 2, 3}, &hash_));
+  }
+
+  base::ScopedTempDir temp_dir_;
+  string cache_dir_;
+  std::unique_ptr<DeflateCache> cache_;
+  brillo::Blob hash_;
+};
+
+TEST_F(DeflateCacheTest, LookupMissingEntryTest) {
+  vector<BitExtent> deflates;
+  EXPECT_FALSE(cache_->Lookup(DeflateCache::Format::kZip, hash_, &deflates));
+}
+
+TEST_F(DeflateCacheTest, StoreAndLookupTest) {
+  vector<BitExtent> deflates = {{10, 20}, {40, 1ULL << 40}};
+  EXPECT_TRUE(cache_->Store(DeflateCache::Format::kZip, hash_, deflates));
+
+  vector<BitExtent> result;
+  EXPECT_TRUE(cache_->Lookup(DeflateCache::Format::kZip, hash_, &result));
+  EXPECT_EQ(deflates, result);
+
+  // The same content parsed as a different format is a different entry.
+  EXPECT_FALSE(cache_->Lookup(DeflateCache::Format::kGzip, hash_, &result));
+
+  // A new cache on the same directory sees the entries.
+  auto other_cache = DeflateCache::CreateFromDirectory(cache_dir_);
+  ASSERT_NE(nullptr, other_cache);
+  result.clear();
+  EXPECT_TRUE(other_cache->Lookup(DeflateCache::Format::kZip, hash_, &result));
+  EXPECT_EQ(deflates, result);
+}
+
+TEST_F(DeflateCacheTest, StoreEmptyDeflatesTest) {
+  EXPECT_TRUE(cache_->Store(DeflateCache::Format::kGzip, hash_, {}));
+  vector<BitExtent> result = {{1, 2}};
+  EXPECT_TRUE(cache_->Lookup(DeflateCache::Format::kGzip, hash_, &result));
+  EXPECT_TRUE(result.empty());
+}
+
+TEST_F(DeflateCacheTest, CorruptedEntryIsIgnoredTest) {
+  EXPECT_TRUE(cache_->Store(DeflateCache::Format::kZip, hash_, {{10, 20}}));
+
+  // Truncate the entry.
+  string entry =
+      cache_dir_ + "/zip-" + base::HexEncode(hash_.data(), hash_.size());
+  string data;
+  ASSERT_TRUE(utils::ReadFile(entry, &data));
+  data.resize(data.size() - 1);
+  ASSERT_TRUE(utils::WriteFile(entry.c_str(), data.data(), data.size()));
+
+  vector<BitExtent> result;
+  EXPECT_FALSE(cache_->Lookup(DeflateCache::Format::kZip, hash_, &result));
+}
+
+}  // namespace chromeos_update_engine
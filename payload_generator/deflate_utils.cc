@@ -16,18 +16,27 @@
 
 #include "update_engine/payload_generator/deflate_utils.h"
 
+#include <fcntl.h>
+
 #include <algorithm>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
+#include <base/threading/simple_thread.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/mapped_image.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -43,32 +52,34 @@ namespace {
 // The minimum size for a squashfs image to be processed.
 const uint64_t kMinimumSquashfsImageSize = 1 * 1024 * 1024;  // bytes
 
-// TODO(*): Optimize this so we don't have to read all extents into memory in
-// case it is large.
-bool CopyExtentsToFile(const string& in_path,
-                       const vector<Extent>& extents,
+bool CopyExtentsToFile(const MappedImage& image,
+                       const vector<BlockExtent>& extents,
                        const string& out_path,
                        size_t block_size) {
-  brillo::Blob data(utils::BlocksInExtents(extents) * block_size);
-  TEST_AND_RETURN_FALSE(
-      utils::ReadExtents(in_path, extents, &data, data.size(), block_size));
-  TEST_AND_RETURN_FALSE(
-      utils::WriteFile(out_path.c_str(), data.data(), data.size()));
+  int fd = HANDLE_EINTR(
+      open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  // Write the extents straight from the mapping, one at a time, so we never
+  // need to hold a copy of the whole file in memory.
+  for (const BlockExtent& extent : extents) {
+    const uint8_t* data = image.GetExtentData(extent, block_size);
+    TEST_AND_RETURN_FALSE(data != nullptr);
+    TEST_AND_RETURN_FALSE(
+        utils::WriteAll(fd, data, extent.num_blocks() * block_size));
+  }
   return true;
 }
 
-bool IsSquashfsImage(const string& part_path,
+bool IsSquashfsImage(const MappedImage& image,
                      const FilesystemInterface::File& file) {
   // Only check for files with img postfix.
   if (base::EndsWith(file.name, ".img", base::CompareCase::SENSITIVE) &&
       utils::BlocksInExtents(file.extents) >=
           kMinimumSquashfsImageSize / kBlockSize) {
-    brillo::Blob super_block;
-    TEST_AND_RETURN_FALSE(
-        utils::ReadFileChunk(part_path,
-                             file.extents[0].start_block() * kBlockSize,
-                             100,
-                             &super_block));
+    const uint8_t* data = image.GetExtentData(file.extents[0], kBlockSize);
+    TEST_AND_RETURN_FALSE(data != nullptr);
+    brillo::Blob super_block(data, data + 100);
     return SquashfsFilesystem::IsSquashfsImage(super_block);
   }
   return false;
@@ -105,7 +116,8 @@ bool RealignSplittedFiles(const FilesystemInterface::File& file,
   return true;
 }
 
-bool IsBitExtentInExtent(const Extent& extent, const BitExtent& bit_extent) {
+bool IsBitExtentInExtent(const BlockExtent& extent,
+                         const BitExtent& bit_extent) {
   return (bit_extent.offset / 8) >= (extent.start_block() * kBlockSize) &&
          ((bit_extent.offset + bit_extent.length + 7) / 8) <=
              ((extent.start_block() + extent.num_blocks()) * kBlockSize);
@@ -120,6 +132,145 @@ bool IsFileExtensions(const string& name,
   });
 }
 
+// Locates the deflates in the zip or gzip |data|, using the |deflate_cache| if
+// not null.
+bool LocateDeflates(const brillo::Blob& data,
+                    DeflateCache::Format format,
+                    const DeflateCache* deflate_cache,
+                    vector<BitExtent>* deflates) {
+  brillo::Blob hash;
+  if (deflate_cache) {
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(data, &hash));
+    if (deflate_cache->Lookup(format, hash, deflates))
+      return true;
+  }
+  if (format == DeflateCache::Format::kZip) {
+    TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInZipArchive(data, deflates));
+  } else {
+    TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInGzip(data, deflates));
+  }
+  // Failing to update the cache only makes the next run slower.
+  if (deflate_cache && !deflate_cache->Store(format, hash, *deflates))
+    LOG(WARNING) << "Unable to store the deflates in the cache.";
+  return true;
+}
+
+// Splits the |file| into its files if it is a squashfs image and locates the
+// deflates in it if it is a zip or gzip file, appending the resulting files to
+// |result_files|.
+bool PreprocessFile(const MappedImage& image,
+                    const FilesystemInterface::File& file,
+                    bool extract_deflates,
+                    const DeflateCache* deflate_cache,
+                    vector<FilesystemInterface::File>* result_files) {
+  auto is_regular_file = IsRegularFile(file);
+
+  if (is_regular_file && IsSquashfsImage(image, file)) {
+    // Read the image into a file.
+    base::FilePath path;
+    TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
+    ScopedPathUnlinker old_unlinker(path.value());
+    TEST_AND_RETURN_FALSE(
+        CopyExtentsToFile(image, file.extents, path.value(), kBlockSize));
+    // Test if it is actually a Squashfs file.
+    auto sqfs = SquashfsFilesystem::CreateFromFile(path.value(),
+                                                   extract_deflates,
+                                                   /*load_settings=*/false);
+    if (sqfs) {
+      // It is an squashfs file. Get its files to replace with itself.
+      vector<FilesystemInterface::File> files;
+      sqfs->GetFiles(&files);
+
+      // Replace squashfs file with its files only if |files| has at least two
+      // files or if it has some deflates (since it is better to replace it to
+      // take advantage of the deflates.)
+      if (files.size() > 1 ||
+          (files.size() == 1 && !files[0].deflates.empty())) {
+        TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
+        result_files->insert(result_files->end(), files.begin(), files.end());
+        return true;
+      }
+    } else {
+      LOG(WARNING) << "We thought file: " << file.name
+                   << " was a Squashfs file, but it was not.";
+    }
+  }
+
+  FilesystemInterface::File result_file = file;
+  if (is_regular_file && extract_deflates && !file.is_compressed) {
+    // Search for deflates if the file is in zip or gzip format.
+    // .zvoice files may eventually move out of rootfs. If that happens,
+    // remove ".zvoice" (crbug.com/782918).
+    bool is_zip = IsFileExtensions(
+        file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex"});
+    bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
+    if (is_zip || is_gzip) {
+      brillo::Blob data;
+      TEST_AND_RETURN_FALSE(image.ReadExtents(file.extents, kBlockSize, &data));
+      vector<puffin::BitExtent> deflates;
+      TEST_AND_RETURN_FALSE(LocateDeflates(data,
+                                           is_zip ? DeflateCache::Format::kZip
+                                                  : DeflateCache::Format::kGzip,
+                                           deflate_cache,
+                                           &deflates));
+      // Shift the deflate's extent to the offset starting from the beginning
+      // of the current partition; and the delta processor will align the
+      // extents in a continuous buffer later.
+      TEST_AND_RETURN_FALSE(
+          ShiftBitExtentsOverExtents(file.extents, &deflates));
+      result_file.deflates = std::move(deflates);
+    }
+  }
+
+  result_files->push_back(std::move(result_file));
+  return true;
+}
+
+// This class encapsulates the preprocessing of a single file of a partition,
+// so the files can be processed in parallel.
+class FilePreprocessor : public base::DelegateSimpleThread::Delegate {
+ public:
+  FilePreprocessor(const MappedImage* image,
+                   const FilesystemInterface::File& file,
+                   bool extract_deflates,
+                   const DeflateCache* deflate_cache)
+      : image_(image),
+        file_(file),
+        extract_deflates_(extract_deflates),
+        deflate_cache_(deflate_cache) {}
+  FilePreprocessor(FilePreprocessor&&) noexcept = default;
+  ~FilePreprocessor() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    failed_ = !PreprocessFile(
+        *image_, file_, extract_deflates_, deflate_cache_, &result_files_);
+    if (failed_)
+      LOG(ERROR) << "Failed to preprocess file " << file_.name;
+  }
+
+  // Moves the resulting files to the end of |result_files|.
+  bool MergeFiles(vector<FilesystemInterface::File>* result_files) {
+    if (failed_)
+      return false;
+    std::move(result_files_.begin(),
+              result_files_.end(),
+              std::back_inserter(*result_files));
+    return true;
+  }
+
+ private:
+  const MappedImage* image_;
+  const FilesystemInterface::File& file_;
+  bool extract_deflates_;
+  const DeflateCache* deflate_cache_;
+
+  vector<FilesystemInterface::File> result_files_;
+  bool failed_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(FilePreprocessor);
+};
+
 }  // namespace
 
 ByteExtent ExpandToByteExtent(const BitExtent& extent) {
@@ -128,8 +279,8 @@ ByteExtent ExpandToByteExtent(const BitExtent& extent) {
   return {offset, length};
 }
 
-bool ShiftExtentsOverExtents(const vector<Extent>& base_extents,
-                             vector<Extent>* over_extents) {
+bool ShiftExtentsOverExtents(const vector<BlockExtent>& base_extents,
+                             vector<BlockExtent>* over_extents) {
   if (utils::BlocksInExtents(base_extents) <
       utils::BlocksInExtents(*over_extents)) {
     LOG(ERROR) << "over_extents have more blocks than base_extents! Invalid!";
@@ -155,10 +306,10 @@ bool ShiftExtentsOverExtents(const vector<Extent>& base_extents,
           // |over_ext| spills over this |base_ext|, split it into two.
           auto new_blocks = base_ext.start_block() + base_ext.num_blocks() -
                             over_ext->start_block();
-          vector<Extent> new_extents = {
-              ExtentForRange(gap_blocks + over_ext->start_block(), new_blocks),
-              ExtentForRange(over_ext->start_block() + new_blocks,
-                             over_ext->num_blocks() - new_blocks)};
+          vector<BlockExtent> new_extents = {
+              BlockExtent(gap_blocks + over_ext->start_block(), new_blocks),
+              BlockExtent(over_ext->start_block() + new_blocks,
+                          over_ext->num_blocks() - new_blocks)};
           *over_ext = new_extents[0];
           over_extents->insert(std::next(over_extents->begin(), idx + 1),
                                new_extents[1]);
@@ -170,7 +321,7 @@ bool ShiftExtentsOverExtents(const vector<Extent>& base_extents,
   return true;
 }
 
-bool ShiftBitExtentsOverExtents(const vector<Extent>& base_extents,
+bool ShiftBitExtentsOverExtents(const vector<BlockExtent>& base_extents,
                                 vector<BitExtent>* over_extents) {
   if (over_extents->empty()) {
     return true;
@@ -212,7 +363,7 @@ bool ShiftBitExtentsOverExtents(const vector<Extent>& base_extents,
   return true;
 }
 
-vector<BitExtent> FindDeflates(const vector<Extent>& extents,
+vector<BitExtent> FindDeflates(const vector<BlockExtent>& extents,
                                const vector<BitExtent>& in_deflates) {
   vector<BitExtent> result;
   // TODO(ahassani): Replace this with binary_search style search.
@@ -227,7 +378,7 @@ vector<BitExtent> FindDeflates(const vector<Extent>& extents,
   return result;
 }
 
-bool CompactDeflates(const vector<Extent>& extents,
+bool CompactDeflates(const vector<BlockExtent>& extents,
                      const vector<BitExtent>& in_deflates,
                      vector<BitExtent>* out_deflates) {
   size_t bytes_passed = 0;
@@ -257,7 +408,7 @@ bool CompactDeflates(const vector<Extent>& extents,
   return true;
 }
 
-bool FindAndCompactDeflates(const vector<Extent>& extents,
+bool FindAndCompactDeflates(const vector<BlockExtent>& extents,
                             const vector<BitExtent>& in_deflates,
                             vector<BitExtent>* out_deflates) {
   auto found_deflates = FindDeflates(extents, in_deflates);
@@ -267,78 +418,48 @@ bool FindAndCompactDeflates(const vector<Extent>& extents,
 
 bool PreprocessPartitionFiles(const PartitionConfig& part,
                               vector<FilesystemInterface::File>* result_files,
-                              bool extract_deflates) {
+                              bool extract_deflates,
+                              const DeflateCache* deflate_cache) {
+  return PreprocessPartitionFiles(part,
+                                  result_files,
+                                  extract_deflates,
+                                  deflate_cache,
+                                  diff_utils::GetMaxThreads());
+}
+
+bool PreprocessPartitionFiles(const PartitionConfig& part,
+                              vector<FilesystemInterface::File>* result_files,
+                              bool extract_deflates,
+                              const DeflateCache* deflate_cache,
+                              size_t num_threads) {
   // Get the file system files.
   vector<FilesystemInterface::File> tmp_files;
   part.fs_interface->GetFiles(&tmp_files);
-  result_files->reserve(tmp_files.size());
 
-  for (auto& file : tmp_files) {
-    auto is_regular_file = IsRegularFile(file);
-
-    if (is_regular_file && IsSquashfsImage(part.path, file)) {
-      // Read the image into a file.
-      base::FilePath path;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
-      ScopedPathUnlinker old_unlinker(path.value());
-      TEST_AND_RETURN_FALSE(
-          CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
-      // Test if it is actually a Squashfs file.
-      auto sqfs = SquashfsFilesystem::CreateFromFile(path.value(),
-                                                     extract_deflates,
-                                                     /*load_settings=*/false);
-      if (sqfs) {
-        // It is an squashfs file. Get its files to replace with itself.
-        vector<FilesystemInterface::File> files;
-        sqfs->GetFiles(&files);
-
-        // Replace squashfs file with its files only if |files| has at least two
-        // files or if it has some deflates (since it is better to replace it to
-        // take advantage of the deflates.)
-        if (files.size() > 1 ||
-            (files.size() == 1 && !files[0].deflates.empty())) {
-          TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
-          result_files->insert(result_files->end(), files.begin(), files.end());
-          continue;
-        }
-      } else {
-        LOG(WARNING) << "We thought file: " << file.name
-                     << " was a Squashfs file, but it was not.";
-      }
-    }
+  std::unique_ptr<MappedImage> image = MappedImage::CreateFromFile(part.path);
+  TEST_AND_RETURN_FALSE(image);
+
+  // Process the files in parallel. Every processor produces the list of files
+  // replacing its input file, which are put back together in the original
+  // order afterwards.
+  vector<FilePreprocessor> file_preprocessors;
+  file_preprocessors.reserve(tmp_files.size());
+  for (const FilesystemInterface::File& file : tmp_files) {
+    file_preprocessors.emplace_back(
+        image.get(), file, extract_deflates, deflate_cache);
+  }
 
-    if (is_regular_file && extract_deflates && !file.is_compressed) {
-      // Search for deflates if the file is in zip or gzip format.
-      // .zvoice files may eventually move out of rootfs. If that happens,
-      // remove ".zvoice" (crbug.com/782918).
-      bool is_zip = IsFileExtensions(
-          file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex"});
-      bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
-      if (is_zip || is_gzip) {
-        brillo::Blob data;
-        TEST_AND_RETURN_FALSE(utils::ReadExtents(
-            part.path,
-            file.extents,
-            &data,
-            kBlockSize * utils::BlocksInExtents(file.extents),
-            kBlockSize));
-        vector<puffin::BitExtent> deflates;
-        if (is_zip) {
-          TEST_AND_RETURN_FALSE(
-              puffin::LocateDeflatesInZipArchive(data, &deflates));
-        } else if (is_gzip) {
-          TEST_AND_RETURN_FALSE(puffin::LocateDeflatesInGzip(data, &deflates));
-        }
-        // Shift the deflate's extent to the offset starting from the beginning
-        // of the current partition; and the delta processor will align the
-        // extents in a continuous buffer later.
-        TEST_AND_RETURN_FALSE(
-            ShiftBitExtentsOverExtents(file.extents, &deflates));
-        file.deflates = std::move(deflates);
-      }
-    }
+  base::DelegateSimpleThreadPool thread_pool("deflate-preprocessor",
+                                             num_threads);
+  thread_pool.Start();
+  for (auto& processor : file_preprocessors) {
+    thread_pool.AddWork(&processor);
+  }
+  thread_pool.JoinAll();
 
-    result_files->push_back(file);
+  result_files->reserve(tmp_files.size());
+  for (auto& processor : file_preprocessors) {
+    TEST_AND_RETURN_FALSE(processor.MergeFiles(result_files));
   }
   return true;
 }
@@ -20,19 +20,30 @@
 #include <puffin/puffdiff.h>
 #include <vector>
 
+#include "update_engine/payload_generator/deflate_cache.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 
 namespace chromeos_update_engine {
 namespace deflate_utils {
 
-// Gets the files from the partition and processes all its files. Processing
-// includes:
+// Gets the files from the partition and processes all its files in parallel.
+// Processing includes:
 //  - splitting large Squashfs containers into its smaller files.
 //  - extracting deflates in zip and gzip files.
+// If |deflate_cache| is not null, it is used to avoid searching again for the
+// deflates of the zip and gzip files already seen in a previous run.
 bool PreprocessPartitionFiles(const PartitionConfig& part,
                               std::vector<FilesystemInterface::File>* result,
-                              bool extract_deflates);
+                              bool extract_deflates,
+                              const DeflateCache* deflate_cache);
+
+// Same as above, but processes the files with at most |num_threads| threads.
+bool PreprocessPartitionFiles(const PartitionConfig& part,
+                              std::vector<FilesystemInterface::File>* result,
+                              bool extract_deflates,
+                              const DeflateCache* deflate_cache,
+                              size_t num_threads);
 
 // Spreads all extents in |over_extents| over |base_extents|. Here we assume the
 // |over_extents| are non-overlapping and sorted by their offset.
@@ -44,8 +55,8 @@ bool PreprocessPartitionFiles(const PartitionConfig& part,
 // |over_extents| is transforms to:
 // |                 ==========  ====    =        ======         ===  ======
 //
-bool ShiftExtentsOverExtents(const std::vector<Extent>& base_extents,
-                             std::vector<Extent>* over_extents);
+bool ShiftExtentsOverExtents(const std::vector<BlockExtent>& base_extents,
+                             std::vector<BlockExtent>* over_extents);
 
 // Spreads all extents in |over_extents| over |base_extents|. Here we assume the
 // |over_extents| are non-overlapping and sorted by their offset. An item in
@@ -59,13 +70,13 @@ bool ShiftExtentsOverExtents(const std::vector<Extent>& base_extents,
 // |over_extents| is transforms to:
 // |                 ==========  ====                                 ======
 //
-bool ShiftBitExtentsOverExtents(const std::vector<Extent>& base_extents,
+bool ShiftBitExtentsOverExtents(const std::vector<BlockExtent>& base_extents,
                                 std::vector<puffin::BitExtent>* over_extents);
 
 // Finds all deflate locations in |deflates| that are inside an Extent in
 // |extents|. This function should not change the order of deflates.
 std::vector<puffin::BitExtent> FindDeflates(
-    const std::vector<Extent>& extents,
+    const std::vector<BlockExtent>& extents,
     const std::vector<puffin::BitExtent>& deflates);
 
 // Creates a new list of deflate locations (|out_deflates|) from |in_deflates|
@@ -81,12 +92,12 @@ std::vector<puffin::BitExtent> FindDeflates(
 // |out_deflates|:
 // |    ========  ====      ====  ======
 //
-bool CompactDeflates(const std::vector<Extent>& extents,
+bool CompactDeflates(const std::vector<BlockExtent>& extents,
                      const std::vector<puffin::BitExtent>& in_deflates,
                      std::vector<puffin::BitExtent>* out_deflates);
 
 // Combines |FindDeflates| and |CompcatDeflates| for ease of use.
-bool FindAndCompactDeflates(const std::vector<Extent>& extents,
+bool FindAndCompactDeflates(const std::vector<BlockExtent>& extents,
                             const std::vector<puffin::BitExtent>& in_deflates,
                             std::vector<puffin::BitExtent>* out_deflates);
 
@@ -19,18 +19,26 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include <base/files/scoped_temp_dir.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/deflate_cache.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
 
 using puffin::BitExtent;
 using puffin::ByteExtent;
+using std::string;
 using std::vector;
 
 namespace chromeos_update_engine {
@@ -46,27 +54,71 @@ vector<BitExtent> ByteToBitExtent(const vector<ByteExtent>& byte_extents) {
   return bit_extents;
 }
 
+namespace {
+
+// "The quick brown fox jumps over the lazy dog. " 20 times, gzipped.
+const uint8_t kGzipData[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x0b, 0xc9,
+    0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f,
+    0xcf, 0x53, 0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a, 0xcd, 0x2d, 0x28, 0x56,
+    0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28, 0x01, 0x4a, 0xe7, 0x24, 0x56, 0x55,
+    0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0x8c, 0x2a, 0x1e, 0x55, 0x3c,
+    0xaa, 0x98, 0xda, 0x8a, 0x01, 0xe6, 0x4a, 0x66, 0xb0, 0x84, 0x03, 0x00,
+    0x00};
+
+// A filesystem with regular files at given extents.
+class RegularFilesFilesystem : public FilesystemInterface {
+ public:
+  explicit RegularFilesFilesystem(uint64_t block_count)
+      : block_count_(block_count) {}
+
+  size_t GetBlockSize() const override { return kBlockSize; }
+  size_t GetBlockCount() const override { return block_count_; }
+  bool GetFiles(vector<File>* files) const override {
+    *files = files_;
+    return true;
+  }
+  bool LoadSettings(brillo::KeyValueStore* store) const override {
+    return false;
+  }
+
+  void AddFile(const string& name, const vector<BlockExtent>& extents) {
+    File file;
+    file.name = name;
+    file.extents = extents;
+    file.file_stat.st_ino = files_.size() + 1;
+    file.file_stat.st_mode = S_IFREG;
+    files_.push_back(file);
+  }
+
+ private:
+  uint64_t block_count_;
+  vector<File> files_;
+};
+
+}  // namespace
+
 TEST(DeflateUtilsTest, ExtentsShiftTest) {
-  vector<Extent> base_extents = {ExtentForRange(10, 10),
-                                 ExtentForRange(70, 10),
-                                 ExtentForRange(50, 10),
-                                 ExtentForRange(30, 10),
-                                 ExtentForRange(90, 10)};
-  vector<Extent> over_extents = {ExtentForRange(2, 2),
-                                 ExtentForRange(5, 2),
-                                 ExtentForRange(7, 3),
-                                 ExtentForRange(13, 10),
-                                 ExtentForRange(25, 20),
-                                 ExtentForRange(47, 3)};
-  vector<Extent> out_over_extents = {ExtentForRange(12, 2),
-                                     ExtentForRange(15, 2),
-                                     ExtentForRange(17, 3),
-                                     ExtentForRange(73, 7),
-                                     ExtentForRange(50, 3),
-                                     ExtentForRange(55, 5),
-                                     ExtentForRange(30, 10),
-                                     ExtentForRange(90, 5),
-                                     ExtentForRange(97, 3)};
+  vector<BlockExtent> base_extents = {ExtentForRange(10, 10),
+                                      ExtentForRange(70, 10),
+                                      ExtentForRange(50, 10),
+                                      ExtentForRange(30, 10),
+                                      ExtentForRange(90, 10)};
+  vector<BlockExtent> over_extents = {ExtentForRange(2, 2),
+                                      ExtentForRange(5, 2),
+                                      ExtentForRange(7, 3),
+                                      ExtentForRange(13, 10),
+                                      ExtentForRange(25, 20),
+                                      ExtentForRange(47, 3)};
+  vector<BlockExtent> out_over_extents = {ExtentForRange(12, 2),
+                                          ExtentForRange(15, 2),
+                                          ExtentForRange(17, 3),
+                                          ExtentForRange(73, 7),
+                                          ExtentForRange(50, 3),
+                                          ExtentForRange(55, 5),
+                                          ExtentForRange(30, 10),
+                                          ExtentForRange(90, 5),
+                                          ExtentForRange(97, 3)};
   EXPECT_TRUE(ShiftExtentsOverExtents(base_extents, &over_extents));
   EXPECT_EQ(over_extents, out_over_extents);
 
@@ -77,11 +129,11 @@ TEST(DeflateUtilsTest, ExtentsShiftTest) {
 }
 
 TEST(DeflateUtilsTest, ShiftBitExtentsOverExtentsTest) {
-  vector<Extent> base_extents = {ExtentForRange(3, 1),
-                                 ExtentForRange(1, 1),
-                                 ExtentForRange(5, 1),
-                                 ExtentForRange(7, 1),
-                                 ExtentForRange(9, 1)};
+  vector<BlockExtent> base_extents = {ExtentForRange(3, 1),
+                                      ExtentForRange(1, 1),
+                                      ExtentForRange(5, 1),
+                                      ExtentForRange(7, 1),
+                                      ExtentForRange(9, 1)};
   vector<BitExtent> over_extents =
       ByteToBitExtent({{0, 0}, {100, 2000}, {4096, 0}, {5000, 5000}});
   vector<BitExtent> out_over_extents =
@@ -91,7 +143,7 @@ TEST(DeflateUtilsTest, ShiftBitExtentsOverExtentsTest) {
 }
 
 TEST(DeflateUtilsTest, ShiftBitExtentsOverExtentsBoundaryTest) {
-  vector<Extent> base_extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> base_extents = {ExtentForRange(1, 1)};
   vector<BitExtent> over_extents = ByteToBitExtent({{2, 4096}});
   vector<BitExtent> out_over_extents = {};
   EXPECT_FALSE(ShiftBitExtentsOverExtents(base_extents, &over_extents));
@@ -122,7 +174,7 @@ TEST(DeflateUtilsTest, ShiftBitExtentsOverExtentsBoundaryTest) {
 }
 
 TEST(DeflateUtilsTest, FindDeflatesTest) {
-  vector<Extent> extents = {
+  vector<BlockExtent> extents = {
       ExtentForRange(1, 1), ExtentForRange(3, 1), ExtentForRange(5, 1)};
   vector<BitExtent> in_deflates = ByteToBitExtent({{0, 0},
                                                    {10, 400},
@@ -142,7 +194,7 @@ TEST(DeflateUtilsTest, FindDeflatesTest) {
 }
 
 TEST(DeflateUtilsTest, FindDeflatesBoundaryTest) {
-  vector<Extent> extents = {};
+  vector<BlockExtent> extents = {};
   vector<BitExtent> in_deflates = ByteToBitExtent({{0, 0}, {8100, 93}});
   vector<BitExtent> expected_out_deflates = {};
   vector<BitExtent> out_deflates;
@@ -156,7 +208,7 @@ TEST(DeflateUtilsTest, FindDeflatesBoundaryTest) {
 }
 
 TEST(DeflateUtilsTest, CompactTest) {
-  vector<Extent> extents = {
+  vector<BlockExtent> extents = {
       ExtentForRange(1, 1), ExtentForRange(5, 1), ExtentForRange(3, 1)};
   vector<BitExtent> in_deflates =
       ByteToBitExtent({{4096, 0}, {12288, 4096}, {4096, 100}, {20480, 100}});
@@ -168,7 +220,7 @@ TEST(DeflateUtilsTest, CompactTest) {
 }
 
 TEST(DeflateUtilsTest, CompactBoundaryTest) {
-  vector<Extent> extents = {};
+  vector<BlockExtent> extents = {};
   vector<BitExtent> in_deflates = ByteToBitExtent({{4096, 0}});
   vector<BitExtent> expected_out_deflates = {};
   vector<BitExtent> out_deflates;
@@ -186,5 +238,58 @@ TEST(DeflateUtilsTest, CompactBoundaryTest) {
   EXPECT_EQ(out_deflates, expected_out_deflates);
 }
 
+TEST(DeflateUtilsTest, PreprocessPartitionFilesTest) {
+  // Gzip files spread over the partition, some of them fragmented, mixed with
+  // files without deflates.
+  const uint64_t kNumBlocks = 64;
+  ScopedTempFile part_file("DeflateUtilsTest_part.XXXXXX");
+  brillo::Blob part_data(kNumBlocks * kBlockSize);
+  auto fs = std::make_unique<RegularFilesFilesystem>(kNumBlocks);
+  for (uint64_t i = 0; i < 16; i++) {
+    // The fragmented files start in their third block.
+    bool fragmented = i % 4 == 2;
+    uint64_t block = i * 4 + (fragmented ? 2 : 0);
+    std::copy(std::begin(kGzipData),
+              std::end(kGzipData),
+              part_data.begin() + block * kBlockSize);
+    string name = "/file" + std::to_string(i) + (i % 4 == 0 ? "" : ".gz");
+    if (fragmented) {
+      fs->AddFile(name, {ExtentForRange(block, 1), ExtentForRange(i * 4, 2)});
+    } else {
+      fs->AddFile(name, {ExtentForRange(block, 2)});
+    }
+  }
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file.path(), part_data));
+  PartitionConfig part("system");
+  part.path = part_file.path();
+  part.size = part_data.size();
+  part.fs_interface = std::move(fs);
+
+  vector<FilesystemInterface::File> serial_files;
+  ASSERT_TRUE(PreprocessPartitionFiles(part, &serial_files, true, nullptr, 1));
+  ASSERT_EQ(16U, serial_files.size());
+  for (size_t i = 0; i < serial_files.size(); i++)
+    EXPECT_EQ(i % 4 != 0, !serial_files[i].deflates.empty());
+
+  // The parallel preprocessing keeps the order of the files, with or without
+  // cache hits.
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  std::unique_ptr<DeflateCache> cache =
+      DeflateCache::CreateFromDirectory(cache_dir.GetPath().value());
+  ASSERT_NE(nullptr, cache);
+  for (const DeflateCache* deflate_cache :
+       {static_cast<DeflateCache*>(nullptr), cache.get(), cache.get()}) {
+    vector<FilesystemInterface::File> files;
+    ASSERT_TRUE(PreprocessPartitionFiles(part, &files, true, deflate_cache, 8));
+    ASSERT_EQ(serial_files.size(), files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+      EXPECT_EQ(serial_files[i].name, files[i].name);
+      EXPECT_EQ(serial_files[i].extents, files[i].extents);
+      EXPECT_EQ(serial_files[i].deflates, files[i].deflates);
+    }
+  }
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
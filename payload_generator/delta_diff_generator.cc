@@ -39,10 +39,13 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/blob_file_writer.h"
 #include "update_engine/payload_generator/cow_size_estimator.h"
+#include "update_engine/payload_generator/cross_partition_matcher.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/full_update_generator.h"
+#include "update_engine/payload_generator/generation_report.h"
 #include "update_engine/payload_generator/merge_sequence_generator.h"
 #include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/target_copy_utils.h"
 #include "update_engine/update_metadata.pb.h"
 
 using std::string;
@@ -91,8 +94,13 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
   void Run() override {
     LOG(INFO) << "Started an async task to process partition "
               << new_part_.name;
-    bool success = strategy_->GenerateOperations(
-        config_, old_part_, new_part_, file_writer_, aops_);
+    bool success;
+    {
+      ScopedStageTimer timer(
+          config_.report, new_part_.name, "generate_operations");
+      success = strategy_->GenerateOperations(
+          config_, old_part_, new_part_, file_writer_, aops_);
+    }
     if (!success) {
       // ABORT the entire process, so that developer can look
       // at recent logs and diagnose what happened
@@ -111,6 +119,7 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
       return;
     }
     if (!old_part_.path.empty()) {
+      ScopedStageTimer timer(config_.report, new_part_.name, "merge_sequence");
       auto generator = MergeSequenceGenerator::Create(*aops_);
       if (!generator || !generator->Generate(cow_merge_sequence_)) {
         LOG(FATAL) << "Failed to generate merge sequence";
@@ -118,6 +127,7 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
     }
 
     LOG(INFO) << "Estimating COW size for partition: " << new_part_.name;
+    ScopedStageTimer timer(config_.report, new_part_.name, "cow_estimation");
     // Need the contents of source/target image bytes when doing
     // dry run.
     FileDescriptorPtr source_fd{new EintrSafeFileDescriptor()};
@@ -226,12 +236,61 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                                    &all_cow_sizes[i],
                                                    std::move(strategy)));
     }
-    thread_pool.Start();
-    for (auto& processor : partition_tasks) {
-      thread_pool.AddWork(&processor);
+    {
+      ScopedStageTimer timer(config.report, "", "partitions");
+      thread_pool.Start();
+      for (auto& processor : partition_tasks) {
+        thread_pool.AddWork(&processor);
+      }
+      thread_pool.JoinAll();
+    }
+
+    // The full operations generated for every partition are replaced with
+    // copies where possible. Virtual A/B compression only copies blocks from
+    // the source slot of the same partition, so it's skipped there.
+    const auto& dynamic_metadata = config.target.dynamic_partition_metadata;
+    bool vabc_enabled = dynamic_metadata &&
+                        dynamic_metadata->snapshot_enabled() &&
+                        dynamic_metadata->vabc_enabled();
+    // The new full operations are as large as the merged ones.
+    ssize_t chunk_blocks = config.soft_chunk_size / config.block_size;
+    if (config.hard_chunk_size != -1 &&
+        static_cast<size_t>(config.hard_chunk_size) < config.soft_chunk_size) {
+      chunk_blocks = config.hard_chunk_size / config.block_size;
+    }
+
+    // The data moved between partitions can only be found once the operations
+    // of all of them are generated.
+    if (config.is_delta &&
+        config.version.minor >= kCrossPartitionMinorPayloadVersion &&
+        !vabc_enabled) {
+      ScopedStageTimer timer(config.report, "", "cross_partition_matching");
+      auto matcher = CrossPartitionMatcher::Create(config.source.partitions,
+                                                   config.block_size);
+      TEST_AND_RETURN_FALSE(matcher);
+      for (size_t i = 0; i < config.target.partitions.size(); i++) {
+        TEST_AND_RETURN_FALSE(
+            matcher->ReplaceFullOperations(config.target.partitions[i],
+                                           config.version,
+                                           chunk_blocks,
+                                           &blob_file,
+                                           &all_aops[i]));
+      }
+    }
+
+    // The TARGET_COPY operations depend on the order of the operations, so
+    // they are added last.
+    if (config.version.OperationAllowed(InstallOperation::TARGET_COPY) &&
+        !vabc_enabled) {
+      for (size_t i = 0; i < config.target.partitions.size(); i++) {
+        const PartitionConfig& new_part = config.target.partitions[i];
+        ScopedStageTimer timer(config.report, new_part.name, "target_copy");
+        TEST_AND_RETURN_FALSE(target_copy_utils::AddTargetCopyOperations(
+            new_part, config.version, chunk_blocks, &blob_file, &all_aops[i]));
+      }
     }
-    thread_pool.JoinAll();
 
+    ScopedStageTimer timer(config.report, "", "add_partitions");
     for (size_t i = 0; i < config.target.partitions.size(); i++) {
       const PartitionConfig& old_part =
           config.is_delta ? config.source.partitions[i] : empty_part;
@@ -247,9 +306,12 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
   data_file.CloseFd();
 
   LOG(INFO) << "Writing payload file...";
-  // Write payload file to disk.
-  TEST_AND_RETURN_FALSE(payload.WritePayload(
-      output_path, data_file.path(), private_key_path, metadata_size));
+  {
+    // Write payload file to disk.
+    ScopedStageTimer timer(config.report, "", "finalization");
+    TEST_AND_RETURN_FALSE(payload.WritePayload(
+        output_path, data_file.path(), private_key_path, metadata_size));
+  }
 
   LOG(INFO) << "All done. Successfully created delta file with "
             << "metadata size = " << *metadata_size;
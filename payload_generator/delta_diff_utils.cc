@@ -26,18 +26,22 @@
 #if defined(__clang__)
 #pragma clang diagnostic pop
 #endif
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <cstring>
 #include <functional>
 #include <list>
 #include <map>
 #include <memory>
-#include <numeric>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/format_macros.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <base/threading/simple_thread.h>
@@ -45,6 +49,7 @@
 #include <brillo/data_encoding.h>
 #include <bsdiff/bsdiff.h>
 #include <bsdiff/patch_writer_factory.h>
+#include <bsdiff/patch_writer_interface.h>
 #include <puffin/utils.h>
 
 #include "update_engine/common/hash_calculator.h"
@@ -54,10 +59,15 @@
 #include "update_engine/payload_generator/ab_generator.h"
 #include "update_engine/payload_generator/block_mapping.h"
 #include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/deflate_cache.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/executable_diff.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/file_name_index.h"
+#include "update_engine/payload_generator/lz4diff.h"
+#include "update_engine/payload_generator/region_matcher.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
 #include "update_engine/payload_generator/xz.h"
 
@@ -69,20 +79,28 @@ using std::vector;
 namespace chromeos_update_engine {
 namespace {
 
-// The maximum destination size allowed for bsdiff. In general, bsdiff should
-// work for arbitrary big files, but the payload generation and payload
-// application requires a significant amount of RAM. We put a hard-limit of
-// 200 MiB that should not affect any released board, but will limit the
-// Chrome binary in ASan builders.
+// The maximum destination size allowed for bsdiff when no apply memory budget
+// is set. In general, bsdiff should work for arbitrary big files, but the
+// payload generation and payload application requires a significant amount of
+// RAM. We put a hard-limit of 200 MiB that should not affect any released
+// board, but will limit the Chrome binary in ASan builders.
 const uint64_t kMaxBsdiffDestinationSize = 200 * 1024 * 1024;  // bytes
 
-// The maximum destination size allowed for puffdiff. In general, puffdiff
-// should work for arbitrary big files, but the payload application is quite
-// memory intensive, so we limit these operations to 150 MiB.
+// The maximum destination size allowed for puffdiff when no apply memory
+// budget is set. In general, puffdiff should work for arbitrary big files, but
+// the payload application is quite memory intensive, so we limit these
+// operations to 150 MiB.
 const uint64_t kMaxPuffdiffDestinationSize = 150 * 1024 * 1024;  // bytes
 
+// The cache size puffpatch uses when applying a PUFFDIFF operation, see
+// PartitionWriter::PerformPuffDiffOperation().
+const uint64_t kPuffpatchCacheSize = 5 * 1024 * 1024;  // bytes
+
 const int kBrotliCompressionQuality = 11;
 
+// How often a diff running in a child process is checked for having exited.
+const int64_t kDiffWorkerPollIntervalMs = 100;
+
 // Storing a diff operation has more overhead over replace operation in the
 // manifest, we need to store an additional src_sha256_hash which is 32 bytes
 // and not compressible, and also src_extents which could use anywhere from a
@@ -111,25 +129,277 @@ bool IsDiffOperationBetter(const InstallOperation& op,
          old_blob_size;
 }
 
-// Returns the levenshtein distance between string |a| and |b|.
-// https://en.wikipedia.org/wiki/Levenshtein_distance
-int LevenshteinDistance(const string& a, const string& b) {
-  vector<int> distances(a.size() + 1);
-  std::iota(distances.begin(), distances.end(), 0);
-
-  for (size_t i = 1; i <= b.size(); i++) {
-    distances[0] = i;
-    int previous_distance = i - 1;
-    for (size_t j = 1; j <= a.size(); j++) {
-      int new_distance =
-          std::min({distances[j] + 1,
-                    distances[j - 1] + 1,
-                    previous_distance + (a[j - 1] == b[i - 1] ? 0 : 1)});
-      previous_distance = distances[j];
-      distances[j] = new_distance;
-    }
-  }
-  return distances.back();
+// A bsdiff patch writer that forwards everything to |writer| and accumulates
+// the time spent in it in |time|. The patch writers compress the patch streams
+// as they are written, so this measures the patch compression time.
+class TimedPatchWriter : public bsdiff::PatchWriterInterface {
+ public:
+  TimedPatchWriter(bsdiff::PatchWriterInterface* writer, base::TimeDelta* time)
+      : writer_(writer), time_(time) {}
+
+  bool Init(size_t new_size) override {
+    return Timed([&] { return writer_->Init(new_size); });
+  }
+  bool WriteDiffStream(const uint8_t* data, size_t size) override {
+    return Timed([&] { return writer_->WriteDiffStream(data, size); });
+  }
+  bool WriteExtraStream(const uint8_t* data, size_t size) override {
+    return Timed([&] { return writer_->WriteExtraStream(data, size); });
+  }
+  bool AddControlEntry(const bsdiff::ControlEntry& entry) override {
+    return Timed([&] { return writer_->AddControlEntry(entry); });
+  }
+  bool Close() override {
+    return Timed([&] { return writer_->Close(); });
+  }
+
+ private:
+  bool Timed(const std::function<bool()>& function) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    bool result = function();
+    *time_ += base::TimeTicks::Now() - start;
+    return result;
+  }
+
+  bsdiff::PatchWriterInterface* writer_;
+  base::TimeDelta* time_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimedPatchWriter);
+};
+
+// Returns whether the LZ4 |blocks| of |file| take exactly its |extents|, in
+// whole blocks, so its chunks can be diffed uncompressed.
+bool HasLz4Layout(const FilesystemInterface::File* file,
+                  const vector<BlockExtent>& extents) {
+  if (!file || file->lz4_blocks.empty())
+    return false;
+  uint64_t size = 0;
+  for (const Lz4Block& block : file->lz4_blocks) {
+    if (block.compressed_length() % kBlockSize != 0)
+      return false;
+    size += block.compressed_length();
+  }
+  return size == utils::BlocksInExtents(extents) * kBlockSize;
+}
+
+// Returns the number of blocks of the chunk starting at the block
+// |block_offset| of a file with the LZ4 |blocks|, at most |chunk_blocks|
+// unless the LZ4 block at |block_offset| is bigger. Chunks always start and
+// end at the boundaries of the LZ4 blocks.
+uint64_t Lz4ChunkBlocks(const vector<Lz4Block>& blocks,
+                        uint64_t block_offset,
+                        uint64_t chunk_blocks) {
+  uint64_t end = block_offset;
+  uint64_t offset = 0;
+  for (const Lz4Block& block : blocks) {
+    offset += block.compressed_length() / kBlockSize;
+    if (offset <= block_offset)
+      continue;
+    if (end > block_offset && offset > block_offset + chunk_blocks)
+      break;
+    end = offset;
+  }
+  return end - block_offset;
+}
+
+// Returns the LZ4 |blocks| stored entirely in the |num_blocks| blocks starting
+// at the block |block_offset|, with their uncompressed offsets relative to the
+// first one. The block offset of the first returned block is stored in
+// |first_block|.
+vector<Lz4Block> Lz4BlocksInRange(const vector<Lz4Block>& blocks,
+                                  uint64_t block_offset,
+                                  uint64_t num_blocks,
+                                  uint64_t* first_block) {
+  vector<Lz4Block> result;
+  uint64_t offset = 0;
+  uint64_t first_uncompressed_offset = 0;
+  for (const Lz4Block& block : blocks) {
+    uint64_t block_blocks = block.compressed_length() / kBlockSize;
+    if (offset >= block_offset &&
+        offset + block_blocks <= block_offset + num_blocks) {
+      if (result.empty()) {
+        *first_block = offset;
+        first_uncompressed_offset = block.uncompressed_offset();
+      }
+      result.push_back(block);
+      result.back().set_uncompressed_offset(block.uncompressed_offset() -
+                                            first_uncompressed_offset);
+    }
+    offset += block_blocks;
+  }
+  return result;
+}
+
+// Returns the |size| bytes at |data| as a blob, for the diff algorithms that
+// only take blobs. That's |scratch| when the data was gathered in it,
+// otherwise the data is copied once to |copy|.
+const brillo::Blob& GetBlob(const uint8_t* data,
+                            size_t size,
+                            const brillo::Blob& scratch,
+                            brillo::Blob* copy) {
+  if (data == scratch.data() && size == scratch.size())
+    return scratch;
+  if (copy->size() != size)
+    copy->assign(data, data + size);
+  return *copy;
+}
+
+// Returns whether the |deadline| passed. A null deadline never passes.
+bool IsPast(base::TimeTicks deadline) {
+  return !deadline.is_null() && base::TimeTicks::Now() >= deadline;
+}
+
+// Returns the time after which the diffs of a chunk starting at |start| are
+// cancelled, given the |limits|.
+base::TimeTicks ChunkDeadline(const diff_utils::DiffLimits& limits,
+                              base::TimeTicks start) {
+  base::TimeTicks deadline = limits.deadline;
+  if (!limits.chunk_time_budget.is_zero()) {
+    base::TimeTicks chunk_deadline = start + limits.chunk_time_budget;
+    if (deadline.is_null() || chunk_deadline < deadline)
+      deadline = chunk_deadline;
+  }
+  return deadline;
+}
+
+// Returns whether an operation of type |type| with the given sizes fits in
+// the |apply_memory_budget|, see EstimateApplyMemory(). Without a budget, the
+// bsdiff and puffdiff operations are limited by the size of the data they
+// read, and LZ4DIFF_BSDIFF by the size of the data it writes, to
+// kMaxBsdiffDestinationSize and kMaxPuffdiffDestinationSize.
+bool FitsApplyMemory(InstallOperation::Type type,
+                     uint64_t src_size,
+                     uint64_t dst_size,
+                     uint64_t blob_size,
+                     uint64_t apply_memory_budget) {
+  if (apply_memory_budget > 0) {
+    return diff_utils::EstimateApplyMemory(
+               type, src_size, dst_size, blob_size) <= apply_memory_budget;
+  }
+  switch (type) {
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+    case InstallOperation::EXECUTABLE_BSDIFF:
+      return src_size <= kMaxBsdiffDestinationSize;
+    case InstallOperation::LZ4DIFF_BSDIFF:
+      return dst_size <= kMaxBsdiffDestinationSize;
+    case InstallOperation::PUFFDIFF:
+      return src_size <= kMaxPuffdiffDestinationSize;
+    default:
+      return true;
+  }
+}
+
+// Replaces the operation |op| with blob |data| writing the chunk of
+// |new_extents| at the block |block_offset| of a file with the LZ4 layout of
+// |new_file| with a LZ4DIFF_BSDIFF operation, if it's better. The source is
+// the LZ4 blocks at the same position of the file with |old_extents| and the
+// LZ4 layout of |old_file|. The operation must fit in the memory budget of the
+// |limits|, and the diff is cancelled at their deadline.
+bool TryLz4diffOperation(const MappedImage* old_image,
+                         const MappedImage* new_image,
+                         const vector<BlockExtent>& old_extents,
+                         const vector<BlockExtent>& new_extents,
+                         const FilesystemInterface::File& old_file,
+                         const FilesystemInterface::File& new_file,
+                         uint64_t block_offset,
+                         const diff_utils::DiffLimits& limits,
+                         brillo::Blob* data,
+                         InstallOperation* op,
+                         GenerationReport::ChunkReport* chunk_report) {
+  uint64_t num_blocks = utils::BlocksInExtents(new_extents);
+  uint64_t new_first_block = 0;
+  vector<Lz4Block> new_blocks = Lz4BlocksInRange(
+      new_file.lz4_blocks, block_offset, num_blocks, &new_first_block);
+  uint64_t old_first_block = 0;
+  vector<Lz4Block> old_blocks = Lz4BlocksInRange(
+      old_file.lz4_blocks, block_offset, num_blocks, &old_first_block);
+  if (old_blocks.empty() || new_blocks.empty())
+    return true;
+  if (IsPast(limits.deadline)) {
+    if (chunk_report)
+      chunk_report->diff_timed_out = true;
+    return true;
+  }
+  // The chunks are aligned to the new LZ4 blocks.
+  TEST_AND_RETURN_FALSE(new_first_block == block_offset);
+  uint64_t old_uncompressed_size = old_blocks.back().uncompressed_offset() +
+                                   old_blocks.back().uncompressed_length();
+  uint64_t new_uncompressed_size = new_blocks.back().uncompressed_offset() +
+                                   new_blocks.back().uncompressed_length();
+  if (!FitsApplyMemory(InstallOperation::LZ4DIFF_BSDIFF,
+                       old_uncompressed_size,
+                       new_uncompressed_size,
+                       0,
+                       limits.apply_memory_budget)) {
+    return true;
+  }
+
+  uint64_t old_num_blocks = 0;
+  for (const Lz4Block& block : old_blocks)
+    old_num_blocks += block.compressed_length() / kBlockSize;
+  vector<BlockExtent> src_extents =
+      ExtentsSublist(old_extents, old_first_block, old_num_blocks);
+  NormalizeExtents(&src_extents);
+
+  brillo::Blob old_data, new_data;
+  TEST_AND_RETURN_FALSE(
+      old_image->ReadExtents(src_extents, kBlockSize, &old_data));
+  TEST_AND_RETURN_FALSE(
+      new_image->ReadExtents(new_extents, kBlockSize, &new_data));
+  base::TimeTicks start = base::TimeTicks::Now();
+  diff_utils::DiffOutput lz4diff_output;
+  bool timed_out = false;
+  bool diffed = diff_utils::RunDiffBeforeDeadline(
+      [&](diff_utils::DiffOutput* output) {
+        return Lz4Diff(old_data,
+                       old_blocks,
+                       old_file.lz4_zero_padding,
+                       new_data,
+                       new_blocks,
+                       new_file.lz4_zero_padding,
+                       &output->patch);
+      },
+      limits.deadline,
+      &lz4diff_output,
+      &timed_out);
+  brillo::Blob& patch = lz4diff_output.patch;
+  if (timed_out) {
+    LOG(WARNING) << "lz4diff of " << new_data.size() << " bytes cancelled "
+                 << "after " << (base::TimeTicks::Now() - start);
+  }
+  if (chunk_report) {
+    chunk_report->lz4diff_time = base::TimeTicks::Now() - start;
+    chunk_report->lz4diff_size = patch.size();
+    chunk_report->diff_timed_out = chunk_report->diff_timed_out || timed_out;
+  }
+  if (!diffed ||
+      !IsDiffOperationBetter(
+          *op, data->size(), patch.size(), src_extents.size()) ||
+      !FitsApplyMemory(InstallOperation::LZ4DIFF_BSDIFF,
+                       old_uncompressed_size,
+                       new_uncompressed_size,
+                       patch.size(),
+                       limits.apply_memory_budget)) {
+    return true;
+  }
+  op->set_type(InstallOperation::LZ4DIFF_BSDIFF);
+  op->clear_src_length();
+  op->clear_dst_length();
+  op->clear_src_extents();
+  StoreExtents(src_extents, op->mutable_src_extents());
+  *data = std::move(patch);
+  if (chunk_report) {
+    chunk_report->type = op->type();
+    chunk_report->data_size = data->size();
+    chunk_report->apply_memory =
+        diff_utils::EstimateApplyMemory(op->type(),
+                                        old_uncompressed_size,
+                                        new_uncompressed_size,
+                                        data->size());
+  }
+  return true;
 }
 }  // namespace
 
@@ -140,17 +410,24 @@ namespace diff_utils {
 // and write the compressed delta to the blob.
 class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
  public:
-  FileDeltaProcessor(const string& old_part,
+  FileDeltaProcessor(const MappedImage* old_image,
+                     const MappedImage* new_image,
                      const string& new_part,
                      const PayloadVersion& version,
-                     const vector<Extent>& old_extents,
-                     const vector<Extent>& new_extents,
+                     const vector<BlockExtent>& old_extents,
+                     const vector<BlockExtent>& new_extents,
                      const vector<puffin::BitExtent>& old_deflates,
                      const vector<puffin::BitExtent>& new_deflates,
+                     const FilesystemInterface::File* old_lz4_file,
+                     const FilesystemInterface::File* new_lz4_file,
                      const string& name,
                      ssize_t chunk_blocks,
-                     BlobFileWriter* blob_file)
-      : old_part_(old_part),
+                     const DiffLimits& limits,
+                     TargetCache* target_cache,
+                     BlobFileWriter* blob_file,
+                     bool collect_chunk_reports)
+      : old_image_(old_image),
+        new_image_(new_image),
         new_part_(new_part),
         version_(version),
         old_extents_(old_extents),
@@ -158,9 +435,14 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
         new_extents_blocks_(utils::BlocksInExtents(new_extents)),
         old_deflates_(old_deflates),
         new_deflates_(new_deflates),
+        old_lz4_file_(old_lz4_file),
+        new_lz4_file_(new_lz4_file),
         name_(name),
         chunk_blocks_(chunk_blocks),
-        blob_file_(blob_file) {}
+        limits_(limits),
+        target_cache_(target_cache),
+        blob_file_(blob_file),
+        collect_chunk_reports_(collect_chunk_reports) {}
 
   bool operator>(const FileDeltaProcessor& other) const {
     return new_extents_blocks_ > other.new_extents_blocks_;
@@ -176,25 +458,41 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   // Merge each file processor's ops list to aops.
   bool MergeOperation(vector<AnnotatedOperation>* aops);
 
+  // The statistics of the diffed chunks, if collected.
+  vector<GenerationReport::ChunkReport>* chunk_reports() {
+    return &chunk_reports_;
+  }
+
  private:
-  const string& old_part_;  // NOLINT(runtime/member_string_references)
+  // The images shared between all the processors of the same partition.
+  const MappedImage* old_image_;
+  const MappedImage* new_image_;
   const string& new_part_;  // NOLINT(runtime/member_string_references)
   const PayloadVersion& version_;
 
   // The block ranges of the old/new file within the src/tgt image
-  const vector<Extent> old_extents_;
-  const vector<Extent> new_extents_;
+  const vector<BlockExtent> old_extents_;
+  const vector<BlockExtent> new_extents_;
   const size_t new_extents_blocks_;
   const vector<puffin::BitExtent> old_deflates_;
   const vector<puffin::BitExtent> new_deflates_;
+  // The old/new file if its LZ4 blocks take exactly the old/new extents, or
+  // null.
+  const FilesystemInterface::File* old_lz4_file_;
+  const FilesystemInterface::File* new_lz4_file_;
   const string name_;
   // Block limit of one aop.
   const ssize_t chunk_blocks_;
+  const DiffLimits limits_;
+  TargetCache* target_cache_;
   BlobFileWriter* blob_file_;
+  const bool collect_chunk_reports_;
 
   // The list of ops to reach the new file from the old file.
   vector<AnnotatedOperation> file_aops_;
 
+  vector<GenerationReport::ChunkReport> chunk_reports_;
+
   bool failed_ = false;
 
   DISALLOW_COPY_AND_ASSIGN(FileDeltaProcessor);
@@ -205,16 +503,21 @@ void FileDeltaProcessor::Run() {
   base::TimeTicks start = base::TimeTicks::Now();
 
   if (!DeltaReadFile(&file_aops_,
-                     old_part_,
-                     new_part_,
+                     old_image_,
+                     new_image_,
                      old_extents_,
                      new_extents_,
                      old_deflates_,
                      new_deflates_,
+                     old_lz4_file_,
+                     new_lz4_file_,
                      name_,
                      chunk_blocks_,
                      version_,
-                     blob_file_)) {
+                     limits_,
+                     target_cache_,
+                     blob_file_,
+                     collect_chunk_reports_ ? &chunk_reports_ : nullptr)) {
     LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
                << new_extents_blocks_ << " blocks)";
     failed_ = true;
@@ -240,8 +543,39 @@ bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
   return true;
 }
 
+// This class looks up the old file to use as the source of a new file, so the
+// lookups of all the new files can run in parallel.
+class OldFileMatcher : public base::DelegateSimpleThread::Delegate {
+ public:
+  OldFileMatcher(const map<string, FilesystemInterface::File>& old_files_map,
+                 const FileNameIndex& old_files_index,
+                 const string& new_file_name)
+      : old_files_map_(old_files_map),
+        old_files_index_(old_files_index),
+        new_file_name_(new_file_name) {}
+  OldFileMatcher(OldFileMatcher&&) noexcept = default;
+  ~OldFileMatcher() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    old_file_ = GetOldFile(old_files_map_, old_files_index_, new_file_name_);
+  }
+
+  const FilesystemInterface::File& old_file() const { return old_file_; }
+
+ private:
+  const map<string, FilesystemInterface::File>& old_files_map_;
+  const FileNameIndex& old_files_index_;
+  const string& new_file_name_;  // NOLINT(runtime/member_string_references)
+
+  FilesystemInterface::File old_file_;
+
+  DISALLOW_COPY_AND_ASSIGN(OldFileMatcher);
+};
+
 FilesystemInterface::File GetOldFile(
     const map<string, FilesystemInterface::File>& old_files_map,
+    const FileNameIndex& old_files_index,
     const string& new_file_name) {
   if (old_files_map.empty())
     return {};
@@ -254,18 +588,21 @@ FilesystemInterface::File GetOldFile(
   // shortest levenshtein distance instead.
   // This works great if the file has version number in it, but even for
   // a completely new file, using a similar file can still help.
-  int min_distance =
-      LevenshteinDistance(new_file_name, old_files_map.begin()->first);
-  const FilesystemInterface::File* old_file = &old_files_map.begin()->second;
-  for (const auto& pair : old_files_map) {
-    int distance = LevenshteinDistance(new_file_name, pair.first);
-    if (distance < min_distance) {
-      min_distance = distance;
-      old_file = &pair.second;
-    }
-  }
-  LOG(INFO) << "Using " << old_file->name << " as source for " << new_file_name;
-  return *old_file;
+  size_t index = old_files_index.FindClosest(new_file_name);
+  CHECK_NE(index, FileNameIndex::kNotFound);
+  old_file_iter = old_files_map.find(old_files_index.name(index));
+  CHECK(old_file_iter != old_files_map.end());
+  LOG(INFO) << "Using " << old_file_iter->first << " as source for "
+            << new_file_name;
+  return old_file_iter->second;
+}
+
+DiffLimits GetDiffLimits(const PayloadGenerationConfig& config) {
+  DiffLimits limits;
+  limits.apply_memory_budget = config.apply_memory_budget;
+  limits.chunk_time_budget = config.chunk_diff_time_budget;
+  limits.deadline = config.diff_deadline;
+  return limits;
 }
 
 bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
@@ -273,8 +610,11 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                         const PartitionConfig& new_part,
                         ssize_t hard_chunk_blocks,
                         size_t soft_chunk_blocks,
-                        const PayloadVersion& version,
+                        const PayloadGenerationConfig& config,
                         BlobFileWriter* blob_file) {
+  const PayloadVersion& version = config.version;
+  GenerationReport* report = config.report;
+  const DiffLimits limits = GetDiffLimits(config);
   ExtentRanges old_visited_blocks;
   ExtentRanges new_visited_blocks;
 
@@ -291,32 +631,63 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   }
 
   ExtentRanges old_zero_blocks;
-  TEST_AND_RETURN_FALSE(DeltaMovedAndZeroBlocks(aops,
-                                                old_part.path,
-                                                new_part.path,
-                                                old_part.size / kBlockSize,
-                                                new_part.size / kBlockSize,
-                                                soft_chunk_blocks,
-                                                version,
-                                                blob_file,
-                                                &old_visited_blocks,
-                                                &new_visited_blocks,
-                                                &old_zero_blocks));
+  {
+    ScopedStageTimer timer(report, new_part.name, "block_mapping");
+    TEST_AND_RETURN_FALSE(DeltaMovedAndZeroBlocks(aops,
+                                                  old_part.path,
+                                                  new_part.path,
+                                                  old_part.size / kBlockSize,
+                                                  new_part.size / kBlockSize,
+                                                  soft_chunk_blocks,
+                                                  version,
+                                                  blob_file,
+                                                  &old_visited_blocks,
+                                                  &new_visited_blocks,
+                                                  &old_zero_blocks));
+  }
 
-  bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
-  map<string, FilesystemInterface::File> old_files_map;
-  if (old_part.fs_interface) {
-    vector<FilesystemInterface::File> old_files;
-    TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
-        old_part, &old_files, puffdiff_allowed));
-    for (const FilesystemInterface::File& file : old_files)
-      old_files_map[file.name] = file;
+  // Map the images once for all the processors, instead of opening and reading
+  // the partition files for every chunk.
+  std::unique_ptr<MappedImage> old_image;
+  if (!old_part.path.empty()) {
+    old_image = MappedImage::CreateFromFile(old_part.path);
+    TEST_AND_RETURN_FALSE(old_image);
   }
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part.path);
+  TEST_AND_RETURN_FALSE(new_image);
 
-  TEST_AND_RETURN_FALSE(new_part.fs_interface);
+  bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
+  std::unique_ptr<DeflateCache> deflate_cache;
+  if (puffdiff_allowed && !config.deflate_cache_dir.empty()) {
+    deflate_cache = DeflateCache::CreateFromDirectory(config.deflate_cache_dir);
+    TEST_AND_RETURN_FALSE(deflate_cache);
+  }
+  map<string, FilesystemInterface::File> old_files_map;
+  // All the blocks used by files in the old partition.
+  ExtentRanges old_file_blocks;
   vector<FilesystemInterface::File> new_files;
-  TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
-      new_part, &new_files, puffdiff_allowed));
+  {
+    ScopedStageTimer timer(report, new_part.name, "deflate_preprocessing");
+    if (old_part.fs_interface) {
+      vector<FilesystemInterface::File> old_files;
+      TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
+          old_part, &old_files, puffdiff_allowed, deflate_cache.get()));
+      for (FilesystemInterface::File& file : old_files) {
+        old_file_blocks.AddExtents(file.extents);
+        old_files_map[file.name] = std::move(file);
+      }
+    }
+
+    TEST_AND_RETURN_FALSE(new_part.fs_interface);
+    if (config.target_cache) {
+      TEST_AND_RETURN_FALSE(config.target_cache->GetPartitionFiles(
+          new_part, puffdiff_allowed, deflate_cache.get(), &new_files));
+    } else {
+      TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
+          new_part, &new_files, puffdiff_allowed, deflate_cache.get()));
+    }
+  }
 
   list<FileDeltaProcessor> file_delta_processors;
 
@@ -325,74 +696,148 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   // based on the file with the same name in the old filesystem, if any.
   // Files with overlapping data blocks (like hardlinks or filesystems with tail
   // packing or compression where the blocks store more than one file) are only
-  // generated once in the new image, but are also used only once from the old
-  // image due to some simplifications (see below).
+  // generated once in the new image. The old partition is only read while
+  // applying an A/B payload, so the same old blocks can be used as the source
+  // of any number of new files, for example when a file is copied or split in
+  // the new image.
+  vector<const FilesystemInterface::File*> changed_new_files;
+  vector<vector<BlockExtent>> changed_new_files_extents;
   for (const FilesystemInterface::File& new_file : new_files) {
     // Ignore the files in the new filesystem without blocks. Symlinks with
     // data blocks (for example, symlinks bigger than 60 bytes in ext2) are
     // handled as normal files. We also ignore blocks that were already
     // processed by a previous file.
-    vector<Extent> new_file_extents =
+    vector<BlockExtent> new_file_extents =
         FilterExtentRanges(new_file.extents, new_visited_blocks);
     new_visited_blocks.AddExtents(new_file_extents);
 
     if (new_file_extents.empty())
       continue;
+    changed_new_files.push_back(&new_file);
+    changed_new_files_extents.push_back(std::move(new_file_extents));
+  }
 
-    // We can't visit each dst image inode more than once, as that would
-    // duplicate work. Here, we avoid visiting each source image inode
-    // more than once. Technically, we could have multiple operations
-    // that read the same blocks from the source image for diffing, but
-    // we choose not to avoid complexity. Eventually we will move away
-    // from using a graph/cycle detection/etc to generate diffs, and at that
-    // time, it will be easy (non-complex) to have many operations read
-    // from the same source blocks. At that time, this code can die. -adlr
-    FilesystemInterface::File old_file =
-        GetOldFile(old_files_map, new_file.name);
+  // Find the old file to use as the source of every new file. The old file may
+  // already be the source of other new files or of the blocks found by
+  // DeltaMovedAndZeroBlocks(); reading it again is fine.
+  vector<OldFileMatcher> old_file_matchers;
+  {
+    ScopedStageTimer timer(report, new_part.name, "file_matching");
+    vector<string> old_file_names;
+    old_file_names.reserve(old_files_map.size());
+    for (const auto& name_file : old_files_map)
+      old_file_names.push_back(name_file.first);
+    FileNameIndex old_files_index(std::move(old_file_names));
+
+    old_file_matchers.reserve(changed_new_files.size());
+    for (const FilesystemInterface::File* new_file : changed_new_files) {
+      old_file_matchers.emplace_back(
+          old_files_map, old_files_index, new_file->name);
+    }
+    base::DelegateSimpleThreadPool thread_pool("old-file-matcher",
+                                               GetMaxThreads());
+    thread_pool.Start();
+    for (auto& matcher : old_file_matchers) {
+      thread_pool.AddWork(&matcher);
+    }
+    thread_pool.JoinAll();
+  }
+
+  for (size_t i = 0; i < changed_new_files.size(); i++) {
+    const FilesystemInterface::File& new_file = *changed_new_files[i];
+    const FilesystemInterface::File& old_file = old_file_matchers[i].old_file();
     auto old_file_extents =
         FilterExtentRanges(old_file.extents, old_zero_blocks);
-    old_visited_blocks.AddExtents(old_file_extents);
+    // The LZ4 blocks only describe the whole data of the files.
+    bool old_lz4_layout = old_file_extents == old_file.extents;
+    bool new_lz4_layout = changed_new_files_extents[i] == new_file.extents;
 
-    file_delta_processors.emplace_back(old_part.path,
+    file_delta_processors.emplace_back(old_image.get(),
+                                       new_image.get(),
                                        new_part.path,
                                        version,
                                        std::move(old_file_extents),
-                                       std::move(new_file_extents),
+                                       std::move(changed_new_files_extents[i]),
                                        old_file.deflates,
                                        new_file.deflates,
+                                       old_lz4_layout ? &old_file : nullptr,
+                                       new_lz4_layout ? &new_file : nullptr,
                                        new_file.name,  // operation name
                                        hard_chunk_blocks,
-                                       blob_file);
+                                       limits,
+                                       config.target_cache,
+                                       blob_file,
+                                       report != nullptr);
   }
-  // Process all the blocks not included in any file. We provided all the unused
-  // blocks in the old partition as available data.
-  vector<Extent> new_unvisited = {
-      ExtentForRange(0, new_part.size / kBlockSize)};
+  // Process all the blocks not included in any file. We provide the blocks of
+  // the old partition not included in any old file either and not already used
+  // by DeltaMovedAndZeroBlocks() as available data. The old and new blocks are
+  // diffed in the same chunks, so leaving out the old file data keeps the old
+  // and new filesystem metadata aligned.
+  vector<BlockExtent> new_unvisited = {
+      BlockExtent(0, new_part.size / kBlockSize)};
   new_unvisited = FilterExtentRanges(new_unvisited, new_visited_blocks);
   if (!new_unvisited.empty()) {
-    vector<Extent> old_unvisited;
+    vector<BlockExtent> old_unvisited;
     if (old_part.fs_interface) {
-      old_unvisited.push_back(ExtentForRange(0, old_part.size / kBlockSize));
+      old_unvisited.emplace_back(0, old_part.size / kBlockSize);
+      old_unvisited = FilterExtentRanges(old_unvisited, old_file_blocks);
       old_unvisited = FilterExtentRanges(old_unvisited, old_visited_blocks);
     }
 
-    LOG(INFO) << "Scanning " << utils::BlocksInExtents(new_unvisited)
+    uint64_t new_unvisited_blocks = utils::BlocksInExtents(new_unvisited);
+    LOG(INFO) << "Scanning " << new_unvisited_blocks
               << " unwritten blocks using chunk size of " << soft_chunk_blocks
               << " blocks.";
     // We use the soft_chunk_blocks limit for the <non-file-data> as we don't
     // really know the structure of this data and we should not expect it to
-    // have redundancy between partitions.
-    file_delta_processors.emplace_back(
-        old_part.path,
-        new_part.path,
-        version,
-        std::move(old_unvisited),
-        std::move(new_unvisited),
-        vector<puffin::BitExtent>{},  // old_deflates,
-        vector<puffin::BitExtent>{},  // new_deflates
-        "<non-file-data>",            // operation name
-        soft_chunk_blocks,
-        blob_file);
+    // have redundancy between partitions. Every chunk is diffed against the
+    // old blocks with most content in common with it, which are the ones at
+    // the same position in |old_unvisited| unless the data moved.
+    std::unique_ptr<RegionMatcher> region_matcher;
+    if (!old_unvisited.empty()) {
+      ScopedStageTimer timer(report, new_part.name, "region_matching");
+      region_matcher =
+          RegionMatcher::Create(*old_image, old_unvisited, kBlockSize);
+      TEST_AND_RETURN_FALSE(region_matcher);
+    }
+    brillo::Blob scratch;
+    for (uint64_t block_offset = 0; block_offset < new_unvisited_blocks;
+         block_offset += soft_chunk_blocks) {
+      vector<BlockExtent> new_extents_chunk =
+          ExtentsSublist(new_unvisited, block_offset, soft_chunk_blocks);
+      vector<BlockExtent> old_extents_chunk;
+      if (region_matcher) {
+        ScopedStageTimer timer(report, new_part.name, "region_matching");
+        const uint8_t* data;
+        size_t size;
+        TEST_AND_RETURN_FALSE(new_image->GetExtentsData(
+            new_extents_chunk, kBlockSize, &scratch, &data, &size));
+        old_extents_chunk = region_matcher->FindSource(
+            data, block_offset, size / kBlockSize);
+      }
+      string name = "<non-file-data>";
+      if (soft_chunk_blocks < new_unvisited_blocks) {
+        name += base::StringPrintf(":%" PRIu64,
+                                   block_offset / soft_chunk_blocks);
+      }
+      file_delta_processors.emplace_back(old_image.get(),
+                                         new_image.get(),
+                                         new_part.path,
+                                         version,
+                                         std::move(old_extents_chunk),
+                                         std::move(new_extents_chunk),
+                                         vector<puffin::BitExtent>{},
+                                         vector<puffin::BitExtent>{},
+                                         nullptr,  // old_lz4_file
+                                         nullptr,  // new_lz4_file
+                                         name,  // operation name
+                                         soft_chunk_blocks,
+                                         limits,
+                                         config.target_cache,
+                                         blob_file,
+                                         report != nullptr);
+    }
   }
 
   size_t max_threads = GetMaxThreads();
@@ -403,16 +848,28 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     file_delta_processors.sort(std::greater<FileDeltaProcessor>());
   }
 
-  base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
-                                             max_threads);
-  thread_pool.Start();
-  for (auto& processor : file_delta_processors) {
-    thread_pool.AddWork(&processor);
+  {
+    ScopedStageTimer timer(report, new_part.name, "diffing");
+    base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
+                                               max_threads);
+    thread_pool.Start();
+    for (auto& processor : file_delta_processors) {
+      thread_pool.AddWork(&processor);
+    }
+    thread_pool.JoinAll();
+  }
+  if (IsPast(limits.deadline)) {
+    LOG(WARNING) << "The generation deadline passed while diffing "
+                 << new_part.name << ", only full operations were generated "
+                 << "for the remaining chunks.";
   }
-  thread_pool.JoinAll();
 
   for (auto& processor : file_delta_processors) {
     TEST_AND_RETURN_FALSE(processor.MergeOperation(aops));
+    if (report) {
+      report->AddChunkReports(new_part.name,
+                              std::move(*processor.chunk_reports()));
+    }
   }
 
   return true;
@@ -444,8 +901,10 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   // is a block from the new partition.
   map<BlockMapping::BlockId, vector<uint64_t>> old_blocks_map;
 
+  // The old partition is not modified while applying the payload, so blocks
+  // already in |old_visited_blocks| can be read again.
   for (uint64_t block = old_num_blocks; block-- > 0;) {
-    if (old_block_ids[block] != 0 && !old_visited_blocks->ContainsBlock(block))
+    if (old_block_ids[block] != 0)
       old_blocks_map[old_block_ids[block]].push_back(block);
 
     // Mark all zeroed blocks in the old image as "used" since it doesn't make
@@ -462,10 +921,10 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   // to optimize it using REPLACE_BZ operations. The blob for a REPLACE_BZ of
   // just zeros is so small that it doesn't make sense to spend the I/O reading
   // zeros from the old partition.
-  vector<Extent> new_zeros;
+  vector<BlockExtent> new_zeros;
 
-  vector<Extent> old_identical_blocks;
-  vector<Extent> new_identical_blocks;
+  vector<BlockExtent> old_identical_blocks;
+  vector<BlockExtent> new_identical_blocks;
 
   for (uint64_t block = 0; block < new_num_blocks; block++) {
     // Only produce operations for blocks that were not yet visited.
@@ -493,7 +952,13 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   // Produce operations for the zero blocks split per output extent.
   size_t num_ops = aops->size();
   new_visited_blocks->AddExtents(new_zeros);
-  for (const Extent& extent : new_zeros) {
+  std::unique_ptr<MappedImage> new_image;
+  if (!new_zeros.empty() &&
+      !version.OperationAllowed(InstallOperation::ZERO)) {
+    new_image = MappedImage::CreateFromFile(new_part);
+    TEST_AND_RETURN_FALSE(new_image);
+  }
+  for (const BlockExtent& extent : new_zeros) {
     if (version.OperationAllowed(InstallOperation::ZERO)) {
       for (uint64_t offset = 0; offset < extent.num_blocks();
            offset += chunk_blocks) {
@@ -508,16 +973,21 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
       }
     } else {
       TEST_AND_RETURN_FALSE(DeltaReadFile(aops,
-                                          "",
-                                          new_part,
+                                          nullptr,  // old_image
+                                          new_image.get(),
                                           {},        // old_extents
                                           {extent},  // new_extents
                                           {},        // old_deflates
                                           {},        // new_deflates
+                                          nullptr,   // old_lz4_file
+                                          nullptr,   // new_lz4_file
                                           "<zeros>",
                                           chunk_blocks,
                                           version,
-                                          blob_file));
+                                          DiffLimits(),
+                                          nullptr,  // target_cache
+                                          blob_file,
+                                          nullptr));  // chunk_reports
     }
   }
   LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
@@ -528,7 +998,7 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   uint64_t used_blocks = 0;
   old_visited_blocks->AddExtents(old_identical_blocks);
   new_visited_blocks->AddExtents(new_identical_blocks);
-  for (const Extent& extent : new_identical_blocks) {
+  for (const BlockExtent& extent : new_identical_blocks) {
     // We split the operation at the extent boundary or when bigger than
     // chunk_blocks.
     for (uint64_t op_block_offset = 0; op_block_offset < extent.num_blocks();
@@ -554,7 +1024,7 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
       op_dst_extent->set_start_block(extent.start_block() + op_block_offset);
       op_dst_extent->set_num_blocks(chunk_num_blocks);
       CHECK(
-          vector<Extent>{*op_dst_extent} ==  // NOLINT(whitespace/braces)
+          vector<BlockExtent>{*op_dst_extent} ==  // NOLINT(whitespace/braces)
           ExtentsSublist(new_identical_blocks, used_blocks, chunk_num_blocks));
 
       used_blocks += chunk_num_blocks;
@@ -567,18 +1037,24 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
 }
 
 bool DeltaReadFile(vector<AnnotatedOperation>* aops,
-                   const string& old_part,
-                   const string& new_part,
-                   const vector<Extent>& old_extents,
-                   const vector<Extent>& new_extents,
+                   const MappedImage* old_image,
+                   const MappedImage* new_image,
+                   const vector<BlockExtent>& old_extents,
+                   const vector<BlockExtent>& new_extents,
                    const vector<puffin::BitExtent>& old_deflates,
                    const vector<puffin::BitExtent>& new_deflates,
+                   const FilesystemInterface::File* old_lz4_file,
+                   const FilesystemInterface::File* new_lz4_file,
                    const string& name,
                    ssize_t chunk_blocks,
                    const PayloadVersion& version,
-                   BlobFileWriter* blob_file) {
+                   const DiffLimits& limits,
+                   TargetCache* target_cache,
+                   BlobFileWriter* blob_file,
+                   vector<GenerationReport::ChunkReport>* chunk_reports) {
   brillo::Blob data;
   InstallOperation operation;
+  DiffScratch scratch;
 
   uint64_t total_blocks = utils::BlocksInExtents(new_extents);
   if (chunk_blocks == 0) {
@@ -589,28 +1065,90 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
   if (chunk_blocks == -1)
     chunk_blocks = total_blocks;
 
-  for (uint64_t block_offset = 0; block_offset < total_blocks;
-       block_offset += chunk_blocks) {
+  // Split the file in chunks that can be diffed within the memory budget
+  // instead of falling back to a full operation for the whole file. The chunks
+  // are the largest power of two number of blocks that fits, assuming the old
+  // chunks are as big as the new ones.
+  if (limits.apply_memory_budget > 0 && !old_extents.empty()) {
+    // The doubling stops at the chunk size, so a huge budget can't overflow
+    // the sizes.
+    uint64_t chunk_limit =
+        std::min(static_cast<uint64_t>(chunk_blocks), total_blocks);
+    uint64_t max_chunk_blocks = 1;
+    while (max_chunk_blocks < chunk_limit &&
+           FitsApplyMemory(InstallOperation::SOURCE_BSDIFF,
+                           2 * max_chunk_blocks * kBlockSize,
+                           2 * max_chunk_blocks * kBlockSize,
+                           0,
+                           limits.apply_memory_budget)) {
+      max_chunk_blocks *= 2;
+    }
+    if (max_chunk_blocks < chunk_limit) {
+      LOG(INFO) << "Splitting " << name << " in chunks of " << max_chunk_blocks
+                << " blocks to fit in the apply memory budget.";
+      chunk_blocks = max_chunk_blocks;
+    }
+  }
+
+  bool lz4diff_allowed =
+      version.OperationAllowed(InstallOperation::LZ4DIFF_BSDIFF) &&
+      HasLz4Layout(old_lz4_file, old_extents) &&
+      HasLz4Layout(new_lz4_file, new_extents);
+
+  uint64_t num_blocks = chunk_blocks;
+  for (uint64_t block_offset = 0, chunk = 0; block_offset < total_blocks;
+       block_offset += num_blocks, chunk++) {
     // Split the old/new file in the same chunks. Note that this could drop
     // some information from the old file used for the new chunk. If the old
     // file is smaller (or even empty when there's no old file) the chunk will
-    // also be empty.
-    vector<Extent> old_extents_chunk =
-        ExtentsSublist(old_extents, block_offset, chunk_blocks);
-    vector<Extent> new_extents_chunk =
-        ExtentsSublist(new_extents, block_offset, chunk_blocks);
+    // also be empty. The chunks of LZ4 compressed files don't split their LZ4
+    // blocks.
+    if (lz4diff_allowed) {
+      num_blocks = Lz4ChunkBlocks(
+          new_lz4_file->lz4_blocks, block_offset, chunk_blocks);
+    }
+    vector<BlockExtent> old_extents_chunk =
+        ExtentsSublist(old_extents, block_offset, num_blocks);
+    vector<BlockExtent> new_extents_chunk =
+        ExtentsSublist(new_extents, block_offset, num_blocks);
     NormalizeExtents(&old_extents_chunk);
     NormalizeExtents(&new_extents_chunk);
 
-    TEST_AND_RETURN_FALSE(ReadExtentsToDiff(old_part,
-                                            new_part,
-                                            old_extents_chunk,
-                                            new_extents_chunk,
-                                            old_deflates,
-                                            new_deflates,
-                                            version,
-                                            &data,
-                                            &operation));
+    // The time budget of the chunk counts from here for all its diffs.
+    DiffLimits chunk_limits = limits;
+    chunk_limits.deadline = ChunkDeadline(limits, base::TimeTicks::Now());
+    chunk_limits.chunk_time_budget = base::TimeDelta();
+
+    GenerationReport::ChunkReport chunk_report;
+    TEST_AND_RETURN_FALSE(
+        ReadExtentsToDiff(old_image,
+                          new_image,
+                          old_extents_chunk,
+                          new_extents_chunk,
+                          old_deflates,
+                          new_deflates,
+                          version,
+                          chunk_limits,
+                          target_cache,
+                          &scratch,
+                          &data,
+                          &operation,
+                          chunk_reports ? &chunk_report : nullptr));
+    if (lz4diff_allowed &&
+        operation.type() != InstallOperation::SOURCE_COPY) {
+      TEST_AND_RETURN_FALSE(
+          TryLz4diffOperation(old_image,
+                              new_image,
+                              old_extents,
+                              new_extents_chunk,
+                              *old_lz4_file,
+                              *new_lz4_file,
+                              block_offset,
+                              chunk_limits,
+                              &data,
+                              &operation,
+                              chunk_reports ? &chunk_report : nullptr));
+    }
 
     // Check if the operation writes nothing.
     if (operation.dst_extents_size() == 0) {
@@ -622,11 +1160,15 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
     AnnotatedOperation aop;
     aop.name = name;
     if (static_cast<uint64_t>(chunk_blocks) < total_blocks) {
-      aop.name = base::StringPrintf(
-          "%s:%" PRIu64, name.c_str(), block_offset / chunk_blocks);
+      aop.name = base::StringPrintf("%s:%" PRIu64, name.c_str(), chunk);
     }
     aop.op = operation;
 
+    if (chunk_reports) {
+      chunk_report.name = aop.name;
+      chunk_reports->push_back(std::move(chunk_report));
+    }
+
     // Write the data
     TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file));
     aops->emplace_back(aop);
@@ -637,7 +1179,8 @@ bool DeltaReadFile(vector<AnnotatedOperation>* aops,
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
-                               InstallOperation::Type* out_type) {
+                               InstallOperation::Type* out_type,
+                               GenerationReport::ChunkReport* chunk_report) {
   if (new_data.empty())
     return false;
 
@@ -656,7 +1199,13 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
   // Try compressing |new_data| with xz first.
   if (version.OperationAllowed(InstallOperation::REPLACE_XZ)) {
     brillo::Blob new_data_xz;
-    if (XzCompress(new_data, &new_data_xz) && !new_data_xz.empty()) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    bool xz_compressed = XzCompress(new_data, &new_data_xz);
+    if (chunk_report) {
+      chunk_report->xz_time = base::TimeTicks::Now() - start;
+      chunk_report->xz_size = new_data_xz.size();
+    }
+    if (xz_compressed && !new_data_xz.empty()) {
       *out_type = InstallOperation::REPLACE_XZ;
       *out_blob = std::move(new_data_xz);
       out_blob_set = true;
@@ -668,7 +1217,13 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
     brillo::Blob new_data_bz;
     // TODO(deymo): Implement some heuristic to determine if it is worth trying
     // to compress the blob with bzip2 if we already have a good REPLACE_XZ.
-    if (BzipCompress(new_data, &new_data_bz) && !new_data_bz.empty() &&
+    base::TimeTicks start = base::TimeTicks::Now();
+    bool bz_compressed = BzipCompress(new_data, &new_data_bz);
+    if (chunk_report) {
+      chunk_report->bz2_time = base::TimeTicks::Now() - start;
+      chunk_report->bz2_size = new_data_bz.size();
+    }
+    if (bz_compressed && !new_data_bz.empty() &&
         (!out_blob_set || out_blob->size() > new_data_bz.size())) {
       // A REPLACE_BZ is better or nothing else was set.
       *out_type = InstallOperation::REPLACE_BZ;
@@ -690,69 +1245,169 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
 
 bool ReadExtentsToDiff(const string& old_part,
                        const string& new_part,
-                       const vector<Extent>& old_extents,
-                       const vector<Extent>& new_extents,
+                       const vector<BlockExtent>& old_extents,
+                       const vector<BlockExtent>& new_extents,
                        const vector<puffin::BitExtent>& old_deflates,
                        const vector<puffin::BitExtent>& new_deflates,
                        const PayloadVersion& version,
+                       const DiffLimits& limits,
                        brillo::Blob* out_data,
                        InstallOperation* out_op) {
+  std::unique_ptr<MappedImage> old_image;
+  if (!old_part.empty()) {
+    old_image = MappedImage::CreateFromFile(old_part);
+    TEST_AND_RETURN_FALSE(old_image);
+  }
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part);
+  TEST_AND_RETURN_FALSE(new_image);
+  return ReadExtentsToDiff(old_image.get(),
+                           new_image.get(),
+                           old_extents,
+                           new_extents,
+                           old_deflates,
+                           new_deflates,
+                           version,
+                           limits,
+                           nullptr,  // target_cache
+                           nullptr,  // scratch
+                           out_data,
+                           out_op,
+                           nullptr);  // chunk_report
+}
+
+bool ReadExtentsToDiff(const MappedImage* old_image,
+                       const MappedImage* new_image,
+                       const vector<BlockExtent>& old_extents,
+                       const vector<BlockExtent>& new_extents,
+                       const vector<puffin::BitExtent>& old_deflates,
+                       const vector<puffin::BitExtent>& new_deflates,
+                       const PayloadVersion& version,
+                       const DiffLimits& limits,
+                       TargetCache* target_cache,
+                       DiffScratch* scratch,
+                       brillo::Blob* out_data,
+                       InstallOperation* out_op,
+                       GenerationReport::ChunkReport* chunk_report) {
+  // The time budget of the chunk counts from here, reading its data included.
+  base::TimeTicks deadline = ChunkDeadline(limits, base::TimeTicks::Now());
   InstallOperation operation;
+  DiffScratch local_scratch;
+  if (!scratch)
+    scratch = &local_scratch;
 
   // We read blocks from old_extents and write blocks to new_extents.
   uint64_t blocks_to_read = utils::BlocksInExtents(old_extents);
   uint64_t blocks_to_write = utils::BlocksInExtents(new_extents);
 
-  // Disable bsdiff, and puffdiff when the data is too big.
+  // Disable bsdiff, puffdiff and the executable diff when applying them would
+  // need more memory than the budget, even with an empty patch.
+  uint64_t src_size = blocks_to_read * kBlockSize;
+  uint64_t dst_size = blocks_to_write * kBlockSize;
   bool bsdiff_allowed =
       version.OperationAllowed(InstallOperation::SOURCE_BSDIFF);
-  if (bsdiff_allowed &&
-      blocks_to_read * kBlockSize > kMaxBsdiffDestinationSize) {
-    LOG(INFO) << "bsdiff ignored, data too big: " << blocks_to_read * kBlockSize
-              << " bytes";
+  if (bsdiff_allowed && !FitsApplyMemory(InstallOperation::SOURCE_BSDIFF,
+                                         src_size,
+                                         dst_size,
+                                         0,
+                                         limits.apply_memory_budget)) {
+    LOG(INFO) << "bsdiff ignored, data too big: " << src_size << " bytes";
     bsdiff_allowed = false;
   }
 
   bool puffdiff_allowed = version.OperationAllowed(InstallOperation::PUFFDIFF);
-  if (puffdiff_allowed &&
-      blocks_to_read * kBlockSize > kMaxPuffdiffDestinationSize) {
-    LOG(INFO) << "puffdiff ignored, data too big: "
-              << blocks_to_read * kBlockSize << " bytes";
+  if (puffdiff_allowed && !FitsApplyMemory(InstallOperation::PUFFDIFF,
+                                           src_size,
+                                           dst_size,
+                                           0,
+                                           limits.apply_memory_budget)) {
+    LOG(INFO) << "puffdiff ignored, data too big: " << src_size << " bytes";
     puffdiff_allowed = false;
   }
 
+  bool executable_diff_allowed =
+      version.OperationAllowed(InstallOperation::EXECUTABLE_BSDIFF) &&
+      FitsApplyMemory(InstallOperation::EXECUTABLE_BSDIFF,
+                      src_size,
+                      dst_size,
+                      0,
+                      limits.apply_memory_budget);
+
   // Make copies of the extents so we can modify them.
-  vector<Extent> src_extents = old_extents;
-  vector<Extent> dst_extents = new_extents;
-
-  // Read in bytes from new data.
-  brillo::Blob new_data;
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(new_part,
-                                           new_extents,
-                                           &new_data,
-                                           kBlockSize * blocks_to_write,
-                                           kBlockSize));
-  TEST_AND_RETURN_FALSE(!new_data.empty());
+  vector<BlockExtent> src_extents = old_extents;
+  vector<BlockExtent> dst_extents = new_extents;
+
+  // Read in bytes from new data. Only the diff algorithms taking a blob need
+  // a copy of data contiguous in the image, see GetBlob().
+  base::TimeTicks read_start = base::TimeTicks::Now();
+  const uint8_t* new_data = nullptr;
+  size_t new_size = 0;
+  brillo::Blob new_copy;
+  TEST_AND_RETURN_FALSE(new_image != nullptr);
+  TEST_AND_RETURN_FALSE(new_image->GetExtentsData(
+      new_extents, kBlockSize, &scratch->new_data, &new_data, &new_size));
+  TEST_AND_RETURN_FALSE(new_size == kBlockSize * blocks_to_write);
+  TEST_AND_RETURN_FALSE(new_size > 0);
+  if (chunk_report) {
+    chunk_report->src_blocks = blocks_to_read;
+    chunk_report->dst_blocks = blocks_to_write;
+    chunk_report->read_time = base::TimeTicks::Now() - read_start;
+  }
 
   // Data blob that will be written to delta file.
   brillo::Blob data_blob;
 
   // Try generating a full operation for the given new data, regardless of the
-  // old_data.
+  // old_data. The same new data is compressed only once for all the payloads
+  // sharing the |target_cache|.
   InstallOperation::Type op_type;
-  TEST_AND_RETURN_FALSE(
-      GenerateBestFullOperation(new_data, version, &data_blob, &op_type));
+  brillo::Blob new_data_hash;
+  if (target_cache) {
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfBytes(new_data, new_size, &new_data_hash));
+  }
+  if (!target_cache || !target_cache->LookupFullOperation(
+                           new_data_hash, version, &data_blob, &op_type)) {
+    TEST_AND_RETURN_FALSE(GenerateBestFullOperation(
+        GetBlob(new_data, new_size, scratch->new_data, &new_copy),
+        version,
+        &data_blob,
+        &op_type,
+        chunk_report));
+    if (target_cache) {
+      TEST_AND_RETURN_FALSE(target_cache->StoreFullOperation(
+          new_data_hash, version, data_blob, op_type));
+    }
+  } else if (chunk_report) {
+    // Only the chosen full operation is known, the sizes of the other
+    // candidates are left to 0 as if they weren't tried.
+    chunk_report->full_operation_cached = true;
+    if (op_type == InstallOperation::REPLACE_XZ)
+      chunk_report->xz_size = data_blob.size();
+    else if (op_type == InstallOperation::REPLACE_BZ)
+      chunk_report->bz2_size = data_blob.size();
+  }
   operation.set_type(op_type);
+  if (chunk_report) {
+    chunk_report->type = op_type;
+    chunk_report->data_size = data_blob.size();
+    chunk_report->apply_memory =
+        EstimateApplyMemory(op_type, 0, new_size, data_blob.size());
+  }
 
-  brillo::Blob old_data;
+  const uint8_t* old_data = nullptr;
+  size_t old_size = 0;
+  brillo::Blob old_copy;
+  bool diff_timed_out = false;
   if (blocks_to_read > 0) {
     // Read old data.
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(old_part,
-                                             src_extents,
-                                             &old_data,
-                                             kBlockSize * blocks_to_read,
-                                             kBlockSize));
-    if (old_data == new_data) {
+    read_start = base::TimeTicks::Now();
+    TEST_AND_RETURN_FALSE(old_image != nullptr);
+    TEST_AND_RETURN_FALSE(old_image->GetExtentsData(
+        src_extents, kBlockSize, &scratch->old_data, &old_data, &old_size));
+    if (chunk_report)
+      chunk_report->read_time += base::TimeTicks::Now() - read_start;
+    if (old_size == new_size && memcmp(old_data, new_data, new_size) == 0) {
       // No change in data.
       operation.set_type(InstallOperation::SOURCE_COPY);
       data_blob = brillo::Blob();
@@ -760,42 +1415,78 @@ bool ReadExtentsToDiff(const string& old_part,
                    operation, data_blob.size(), 0, src_extents.size())) {
       // No point in trying diff if zero blob size diff operation is
       // still worse than replace.
-      if (bsdiff_allowed) {
+      diff_timed_out = IsPast(deadline);
+      if (bsdiff_allowed && !diff_timed_out) {
         base::FilePath patch;
         TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch));
         ScopedPathUnlinker unlinker(patch.value());
 
-        std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
         InstallOperation::Type operation_type = InstallOperation::SOURCE_BSDIFF;
-        if (version.OperationAllowed(InstallOperation::BROTLI_BSDIFF)) {
-          bsdiff_patch_writer =
-              bsdiff::CreateBSDF2PatchWriter(patch.value(),
-                                             bsdiff::CompressorType::kBrotli,
-                                             kBrotliCompressionQuality);
+        if (version.OperationAllowed(InstallOperation::BROTLI_BSDIFF))
           operation_type = InstallOperation::BROTLI_BSDIFF;
+
+        DiffOutput bsdiff_output;
+        base::TimeTicks start = base::TimeTicks::Now();
+        bool diffed = RunDiffBeforeDeadline(
+            [&](DiffOutput* output) {
+              std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
+              if (operation_type == InstallOperation::BROTLI_BSDIFF) {
+                bsdiff_patch_writer = bsdiff::CreateBSDF2PatchWriter(
+                    patch.value(),
+                    bsdiff::CompressorType::kBrotli,
+                    kBrotliCompressionQuality);
+              } else {
+                bsdiff_patch_writer =
+                    bsdiff::CreateBsdiffPatchWriter(patch.value());
+              }
+              TimedPatchWriter timed_patch_writer(
+                  bsdiff_patch_writer.get(), &output->patch_compression_time);
+              TEST_AND_RETURN_FALSE(bsdiff::bsdiff(old_data,
+                                                   old_size,
+                                                   new_data,
+                                                   new_size,
+                                                   &timed_patch_writer,
+                                                   nullptr) == 0);
+              TEST_AND_RETURN_FALSE(
+                  utils::ReadFile(patch.value(), &output->patch));
+              return !output->patch.empty();
+            },
+            deadline,
+            &bsdiff_output,
+            &diff_timed_out);
+        if (diff_timed_out) {
+          LOG(WARNING) << "bsdiff from " << old_size << " to " << new_size
+                       << " bytes cancelled after "
+                       << (base::TimeTicks::Now() - start);
         } else {
-          bsdiff_patch_writer = bsdiff::CreateBsdiffPatchWriter(patch.value());
+          TEST_AND_RETURN_FALSE(diffed);
         }
-
-        brillo::Blob bsdiff_delta;
-        TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data.data(),
-                                                  old_data.size(),
-                                                  new_data.data(),
-                                                  new_data.size(),
-                                                  bsdiff_patch_writer.get(),
-                                                  nullptr));
-
-        TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), &bsdiff_delta));
-        CHECK_GT(bsdiff_delta.size(), static_cast<brillo::Blob::size_type>(0));
-        if (IsDiffOperationBetter(operation,
+        if (chunk_report) {
+          chunk_report->bsdiff_time = base::TimeTicks::Now() - start;
+          chunk_report->patch_compression_time =
+              bsdiff_output.patch_compression_time;
+          chunk_report->bsdiff_size = bsdiff_output.patch.size();
+        }
+        if (diffed &&
+            IsDiffOperationBetter(operation,
                                   data_blob.size(),
-                                  bsdiff_delta.size(),
-                                  src_extents.size())) {
+                                  bsdiff_output.patch.size(),
+                                  src_extents.size()) &&
+            FitsApplyMemory(operation_type,
+                            src_size,
+                            dst_size,
+                            bsdiff_output.patch.size(),
+                            limits.apply_memory_budget)) {
           operation.set_type(operation_type);
-          data_blob = std::move(bsdiff_delta);
+          data_blob = std::move(bsdiff_output.patch);
         }
       }
-      if (puffdiff_allowed) {
+      diff_timed_out = diff_timed_out || IsPast(deadline);
+      if (puffdiff_allowed && !diff_timed_out) {
+        const brillo::Blob& old_blob =
+            GetBlob(old_data, old_size, scratch->old_data, &old_copy);
+        const brillo::Blob& new_blob =
+            GetBlob(new_data, new_size, scratch->new_data, &new_copy);
         // Find all deflate positions inside the given extents and then put all
         // deflates together because we have already read all the extents into
         // one buffer.
@@ -807,36 +1498,108 @@ bool ReadExtentsToDiff(const string& old_part,
         TEST_AND_RETURN_FALSE(deflate_utils::FindAndCompactDeflates(
             dst_extents, new_deflates, &dst_deflates));
 
-        puffin::RemoveEqualBitExtents(
-            old_data, new_data, &src_deflates, &dst_deflates);
-
-        // See crbug.com/915559.
-        if (version.minor <= kPuffdiffMinorPayloadVersion) {
-          TEST_AND_RETURN_FALSE(puffin::RemoveDeflatesWithBadDistanceCaches(
-              old_data, &src_deflates));
-
-          TEST_AND_RETURN_FALSE(puffin::RemoveDeflatesWithBadDistanceCaches(
-              new_data, &dst_deflates));
+        // The temporary file is created here so it's removed even when the
+        // diff is cancelled.
+        ScopedTempFile temp_file("puffdiff-delta.XXXXXX");
+        DiffOutput puffdiff_output;
+        base::TimeTicks start = base::TimeTicks::Now();
+        // An empty patch means there was nothing to puffdiff.
+        bool diffed = RunDiffBeforeDeadline(
+            [&](DiffOutput* output) {
+              puffin::RemoveEqualBitExtents(
+                  old_blob, new_blob, &src_deflates, &dst_deflates);
+
+              // See crbug.com/915559.
+              if (version.minor <= kPuffdiffMinorPayloadVersion) {
+                TEST_AND_RETURN_FALSE(
+                    puffin::RemoveDeflatesWithBadDistanceCaches(
+                        old_blob, &src_deflates));
+
+                TEST_AND_RETURN_FALSE(
+                    puffin::RemoveDeflatesWithBadDistanceCaches(
+                        new_blob, &dst_deflates));
+              }
+
+              // Only Puffdiff if both files have at least one deflate left.
+              if (src_deflates.empty() || dst_deflates.empty())
+                return true;
+              TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_blob,
+                                                     new_blob,
+                                                     src_deflates,
+                                                     dst_deflates,
+                                                     temp_file.path(),
+                                                     &output->patch));
+              return !output->patch.empty();
+            },
+            deadline,
+            &puffdiff_output,
+            &diff_timed_out);
+        if (diff_timed_out) {
+          LOG(WARNING) << "puffdiff from " << old_size << " to " << new_size
+                       << " bytes cancelled after "
+                       << (base::TimeTicks::Now() - start);
+        } else {
+          TEST_AND_RETURN_FALSE(diffed);
         }
-
-        // Only Puffdiff if both files have at least one deflate left.
-        if (!src_deflates.empty() && !dst_deflates.empty()) {
-          brillo::Blob puffdiff_delta;
-          ScopedTempFile temp_file("puffdiff-delta.XXXXXX");
-          // Perform PuffDiff operation.
-          TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data,
-                                                 new_data,
-                                                 src_deflates,
-                                                 dst_deflates,
-                                                 temp_file.path(),
-                                                 &puffdiff_delta));
-          TEST_AND_RETURN_FALSE(puffdiff_delta.size() > 0);
+        const brillo::Blob& puffdiff_delta = puffdiff_output.patch;
+        if (chunk_report && (diff_timed_out || !puffdiff_delta.empty())) {
+          chunk_report->puffdiff_time = base::TimeTicks::Now() - start;
+          chunk_report->puffdiff_size = puffdiff_delta.size();
+        }
+        if (diffed && !puffdiff_delta.empty() &&
+            IsDiffOperationBetter(operation,
+                                  data_blob.size(),
+                                  puffdiff_delta.size(),
+                                  src_extents.size()) &&
+            FitsApplyMemory(InstallOperation::PUFFDIFF,
+                            src_size,
+                            dst_size,
+                            puffdiff_delta.size(),
+                            limits.apply_memory_budget)) {
+          operation.set_type(InstallOperation::PUFFDIFF);
+          data_blob = std::move(puffdiff_output.patch);
+        }
+      }
+      diff_timed_out = diff_timed_out || IsPast(deadline);
+      if (executable_diff_allowed && !diff_timed_out) {
+        // Only executables with the same architecture on both sides produce
+        // a patch, any other data is rejected early.
+        const brillo::Blob& old_blob =
+            GetBlob(old_data, old_size, scratch->old_data, &old_copy);
+        const brillo::Blob& new_blob =
+            GetBlob(new_data, new_size, scratch->new_data, &new_copy);
+        DiffOutput executable_output;
+        base::TimeTicks start = base::TimeTicks::Now();
+        bool diffed = RunDiffBeforeDeadline(
+            [&](DiffOutput* output) {
+              return ExecutableDiff(old_blob, new_blob, &output->patch);
+            },
+            deadline,
+            &executable_output,
+            &diff_timed_out);
+        if (diff_timed_out) {
+          LOG(WARNING) << "Executable diff from " << old_size << " to "
+                       << new_size << " bytes cancelled after "
+                       << (base::TimeTicks::Now() - start);
+        }
+        if (diffed) {
+          if (chunk_report) {
+            chunk_report->executable_diff_time =
+                base::TimeTicks::Now() - start;
+            chunk_report->executable_diff_size =
+                executable_output.patch.size();
+          }
           if (IsDiffOperationBetter(operation,
                                     data_blob.size(),
-                                    puffdiff_delta.size(),
-                                    src_extents.size())) {
-            operation.set_type(InstallOperation::PUFFDIFF);
-            data_blob = std::move(puffdiff_delta);
+                                    executable_output.patch.size(),
+                                    src_extents.size()) &&
+              FitsApplyMemory(InstallOperation::EXECUTABLE_BSDIFF,
+                              src_size,
+                              dst_size,
+                              executable_output.patch.size(),
+                              limits.apply_memory_budget)) {
+            operation.set_type(InstallOperation::EXECUTABLE_BSDIFF);
+            data_blob = std::move(executable_output.patch);
           }
         }
       }
@@ -851,8 +1614,8 @@ bool ReadExtentsToDiff(const string& old_part,
   // parameters for those minor versions, the delta payloads will be invalid.
   if (operation.type() == InstallOperation::SOURCE_BSDIFF &&
       version.minor <= kOpSrcHashMinorPayloadVersion) {
-    operation.set_src_length(old_data.size());
-    operation.set_dst_length(new_data.size());
+    operation.set_src_length(old_size);
+    operation.set_dst_length(new_size);
   }
 
   // Embed extents in the operation. Replace (all variants), zero and discard
@@ -863,11 +1626,166 @@ bool ReadExtentsToDiff(const string& old_part,
   // All operations have dst_extents.
   StoreExtents(dst_extents, operation.mutable_dst_extents());
 
+  if (chunk_report) {
+    chunk_report->type = operation.type();
+    chunk_report->data_size = data_blob.size();
+    chunk_report->apply_memory = EstimateApplyMemory(
+        operation.type(), old_size, new_size, data_blob.size());
+    chunk_report->diff_timed_out = diff_timed_out;
+  }
   *out_data = std::move(data_blob);
   *out_op = operation;
   return true;
 }
 
+uint64_t EstimateApplyMemory(InstallOperation::Type type,
+                             uint64_t src_size,
+                             uint64_t dst_size,
+                             uint64_t blob_size) {
+  switch (type) {
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      return blob_size + src_size + dst_size;
+    case InstallOperation::PUFFDIFF:
+      return blob_size + src_size + dst_size + kPuffpatchCacheSize;
+    case InstallOperation::LZ4DIFF_BSDIFF:
+      // The compressed data is at most as big as the uncompressed data.
+      return blob_size + 2 * (src_size + dst_size);
+    case InstallOperation::EXECUTABLE_BSDIFF:
+      return blob_size + 2 * src_size + dst_size;
+    default:
+      // The other operations stream the data to the target partition.
+      return blob_size;
+  }
+}
+
+bool GenerateBrotliBsdiff(const uint8_t* old_data,
+                          size_t old_size,
+                          const uint8_t* new_data,
+                          size_t new_size,
+                          brillo::Blob* patch) {
+  base::FilePath patch_path;
+  TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch_path));
+  ScopedPathUnlinker unlinker(patch_path.value());
+  std::unique_ptr<bsdiff::PatchWriterInterface> patch_writer =
+      bsdiff::CreateBSDF2PatchWriter(patch_path.value(),
+                                     bsdiff::CompressorType::kBrotli,
+                                     kBrotliCompressionQuality);
+  TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data,
+                                            old_size,
+                                            new_data,
+                                            new_size,
+                                            patch_writer.get(),
+                                            nullptr));
+  TEST_AND_RETURN_FALSE(utils::ReadFile(patch_path.value(), patch));
+  return true;
+}
+
+bool RunDiffBeforeDeadline(const std::function<bool(DiffOutput*)>& diff,
+                           base::TimeTicks deadline,
+                           DiffOutput* output,
+                           bool* timed_out) {
+  *timed_out = false;
+  if (deadline.is_null())
+    return diff(output);
+  if (IsPast(deadline)) {
+    *timed_out = true;
+    return false;
+  }
+
+  int fds[2];
+  TEST_AND_RETURN_FALSE_ERRNO(pipe(fds) == 0);
+  ScopedFdCloser read_fd_closer(&fds[0]);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The child only runs the diff and writes the size of the patch, the
+    // patch compression time and the patch to the pipe.
+    close(fds[0]);
+    DiffOutput child_output;
+    bool result = diff(&child_output);
+    if (result) {
+      uint64_t header[2] = {
+          child_output.patch.size(),
+          static_cast<uint64_t>(
+              child_output.patch_compression_time.InMicroseconds())};
+      result = utils::WriteAll(fds[1], header, sizeof(header)) &&
+               utils::WriteAll(fds[1],
+                               child_output.patch.data(),
+                               child_output.patch.size());
+    }
+    _exit(result ? 0 : 1);
+  }
+  close(fds[1]);
+  TEST_AND_RETURN_FALSE_ERRNO(pid > 0);
+
+  // The output is read as it's written, the child blocks on a full pipe.
+  // Other children forked meanwhile by other threads may hold the write end of
+  // the pipe too, so the exit of the child is checked with waitpid() instead
+  // of waiting for the end of the pipe.
+  const size_t kHeaderSize = 2 * sizeof(uint64_t);
+  brillo::Blob received;
+  size_t expected = kHeaderSize;
+  bool exited = false;
+  int status = 0;
+  while (received.size() < expected) {
+    base::TimeDelta remaining = deadline - base::TimeTicks::Now();
+    if (remaining <= base::TimeDelta()) {
+      *timed_out = true;
+      break;
+    }
+    // What an exited child wrote is still read from the pipe.
+    int timeout_ms = exited ? 0
+                            : std::min(remaining.InMilliseconds() + 1,
+                                       kDiffWorkerPollIntervalMs);
+    struct pollfd poll_fd = {fds[0], POLLIN, 0};
+    int ready = HANDLE_EINTR(poll(&poll_fd, 1, timeout_ms));
+    if (ready < 0) {
+      PLOG(ERROR) << "Failed to wait for the diff process " << pid;
+      break;
+    }
+    if (ready == 0) {
+      if (exited)
+        break;
+      exited = HANDLE_EINTR(waitpid(pid, &status, WNOHANG)) == pid;
+      continue;
+    }
+    size_t offset = received.size();
+    received.resize(expected);
+    ssize_t bytes_read = HANDLE_EINTR(
+        read(fds[0], received.data() + offset, expected - offset));
+    received.resize(offset + std::max(bytes_read, static_cast<ssize_t>(0)));
+    if (bytes_read <= 0) {
+      if (bytes_read < 0)
+        PLOG(ERROR) << "Failed to read from the diff process " << pid;
+      break;
+    }
+    if (offset < kHeaderSize && received.size() == kHeaderSize) {
+      uint64_t patch_size;
+      memcpy(&patch_size, received.data(), sizeof(patch_size));
+      expected += patch_size;
+    }
+  }
+  if (!exited) {
+    // A child that wrote all its output exits on its own.
+    if (received.size() < expected)
+      kill(pid, SIGKILL);
+    HANDLE_EINTR(waitpid(pid, &status, 0));
+  }
+  if (*timed_out || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return false;
+  TEST_AND_RETURN_FALSE(received.size() == expected);
+
+  int64_t patch_compression_us;
+  memcpy(&patch_compression_us,
+         received.data() + sizeof(uint64_t),
+         sizeof(patch_compression_us));
+  output->patch_compression_time =
+      base::TimeDelta::FromMicroseconds(patch_compression_us);
+  output->patch.assign(received.begin() + kHeaderSize, received.end());
+  return true;
+}
+
 bool IsAReplaceOperation(InstallOperation::Type op_type) {
   return (op_type == InstallOperation::REPLACE ||
           op_type == InstallOperation::REPLACE_BZ ||
@@ -17,15 +17,20 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DELTA_DIFF_UTILS_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_DELTA_DIFF_UTILS_H_
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
 
+#include <base/time/time.h>
 #include <brillo/secure_blob.h>
 #include <puffin/puffdiff.h>
 
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/file_name_index.h"
+#include "update_engine/payload_generator/generation_report.h"
+#include "update_engine/payload_generator/mapped_image.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -33,6 +38,35 @@ namespace chromeos_update_engine {
 
 namespace diff_utils {
 
+// The limits applied to the diff operations generated for every chunk of data.
+struct DiffLimits {
+  // The maximum estimated memory to apply an operation on the device, see
+  // PayloadGenerationConfig::apply_memory_budget. 0 keeps the fixed size
+  // limits of bsdiff and puffdiff instead.
+  uint64_t apply_memory_budget = 0;
+
+  // The maximum time spent on a single chunk, counting from the start of the
+  // chunk, so reading its data and generating its full operation count too.
+  // The diffs running past it are cancelled, see RunDiffBeforeDeadline().
+  // Zero means no limit.
+  base::TimeDelta chunk_time_budget;
+
+  // The time after which no chunk is diffed anymore, a null time means no
+  // limit. It bounds the diff time of the whole generation.
+  base::TimeTicks deadline;
+};
+
+// Returns the DiffLimits set in |config|.
+DiffLimits GetDiffLimits(const PayloadGenerationConfig& config);
+
+// The buffers used by ReadExtentsToDiff() to gather the old and new data of
+// extents that aren't contiguous on disk. Reusing them for all the chunks of a
+// file avoids reallocating them for every chunk.
+struct DiffScratch {
+  brillo::Blob old_data;
+  brillo::Blob new_data;
+};
+
 // Create operations in |aops| to produce all the blocks in the |new_part|
 // partition using the filesystem opened in that PartitionConfig.
 // It uses the files reported by the filesystem in |old_part| and the data
@@ -43,12 +77,14 @@ namespace diff_utils {
 // is used to split MOVE and SOURCE_COPY operations and REPLACE_BZ of zeroed
 // blocks, while the hard limit is used to split a file when generating other
 // operations. A value of -1 in |hard_chunk_blocks| means whole files.
+// The allowed operations, the deflate cache and the report collecting the
+// statistics of every stage and diffed chunk are taken from |config|.
 bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
                         const PartitionConfig& old_part,
                         const PartitionConfig& new_part,
                         ssize_t hard_chunk_blocks,
                         size_t soft_chunk_blocks,
-                        const PayloadVersion& version,
+                        const PayloadGenerationConfig& config,
                         BlobFileWriter* blob_file);
 
 // Create operations in |aops| for identical blocks that moved around in the old
@@ -58,9 +94,10 @@ bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
 // |chunk_blocks| blocks, or unlimited if |chunk_blocks| is -1. The blobs of the
 // produced operations are stored in the |blob_file|.
 // The collections |old_visited_blocks| and |new_visited_blocks| state what
-// blocks already have operations reading or writing them and only operations
-// for unvisited blocks are produced by this function updating both collections
-// with the used blocks.
+// blocks already have operations reading or writing them. Only operations for
+// unvisited new blocks are produced by this function, but they may read old
+// blocks that were already visited. Both collections are updated with the used
+// blocks.
 bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
                              const std::string& old_part,
                              const std::string& new_part,
@@ -74,52 +111,131 @@ bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
                              ExtentRanges* old_zero_blocks);
 
 // For a given file |name| append operations to |aops| to produce it in the
-// |new_part|. The file will be split in chunks of |chunk_blocks| blocks each
+// |new_image|. The file will be split in chunks of |chunk_blocks| blocks each
 // or treated as a single chunk if |chunk_blocks| is -1. The file data is
-// stored in |new_part| in the blocks described by |new_extents| and, if it
-// exists, the old version exists in |old_part| in the blocks described by
-// |old_extents|. The operations added to |aops| reference the data blob
-// in the |blob_file|. |old_deflates| and |new_deflates| are all deflate
-// locations in |old_part| and |new_part|. Returns true on success.
+// stored in |new_image| in the blocks described by |new_extents| and, if it
+// exists, the old version exists in |old_image| in the blocks described by
+// |old_extents|. |old_image| may be null if |old_extents| is empty. The
+// operations added to |aops| reference the data blob in the |blob_file|.
+// |old_deflates| and |new_deflates| are all deflate locations in |old_image|
+// and |new_image|. If |old_lz4_file| and |new_lz4_file| are not null, their
+// LZ4 blocks take exactly |old_extents| and |new_extents|, so the chunks are
+// split at the boundaries of the new LZ4 blocks and diffed uncompressed with
+// LZ4DIFF_BSDIFF if allowed. The diff operations are bound by the |limits|
+// and, if there's old data, the chunks are made small enough to be diffed
+// within its memory budget. If |target_cache| is not null, it is used to reuse
+// the full operations of the new data. If |chunk_reports| is not null, the
+// statistics of every chunk are appended to it. Returns true on success.
 bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
-                   const std::string& old_part,
-                   const std::string& new_part,
-                   const std::vector<Extent>& old_extents,
-                   const std::vector<Extent>& new_extents,
+                   const MappedImage* old_image,
+                   const MappedImage* new_image,
+                   const std::vector<BlockExtent>& old_extents,
+                   const std::vector<BlockExtent>& new_extents,
                    const std::vector<puffin::BitExtent>& old_deflates,
                    const std::vector<puffin::BitExtent>& new_deflates,
+                   const FilesystemInterface::File* old_lz4_file,
+                   const FilesystemInterface::File* new_lz4_file,
                    const std::string& name,
                    ssize_t chunk_blocks,
                    const PayloadVersion& version,
-                   BlobFileWriter* blob_file);
+                   const DiffLimits& limits,
+                   TargetCache* target_cache,
+                   BlobFileWriter* blob_file,
+                   std::vector<GenerationReport::ChunkReport>* chunk_reports);
 
-// Reads the blocks |old_extents| from |old_part| (if it exists) and the
-// |new_extents| from |new_part| and determines the smallest way to encode
+// Reads the blocks |old_extents| from |old_image| (if it exists) and the
+// |new_extents| from |new_image| and determines the smallest way to encode
 // this |new_extents| for the diff. It stores necessary data in |out_data| and
 // fills in |out_op|. If there's no change in old and new files, it creates a
 // MOVE or SOURCE_COPY operation. If there is a change, the smallest of the
 // operations allowed in the given |version| (REPLACE, REPLACE_BZ, BSDIFF,
-// SOURCE_BSDIFF, or PUFFDIFF) wins.
-// |new_extents| must not be empty. |old_deflates| and |new_deflates| are all
-// the deflate locations in |old_part| and |new_part|. Returns true on success.
+// SOURCE_BSDIFF, PUFFDIFF or EXECUTABLE_BSDIFF) wins, leaving out the
+// operations that exceed the memory budget of the |limits|. A diff that runs
+// past the time limits of the |limits| is cancelled or not started, and the
+// best operation found until then is used; the chunk time budget counts from
+// the call. |new_extents| must not be empty.
+// |old_deflates| and |new_deflates| are all the deflate locations in
+// |old_image| and |new_image|. If |target_cache| is not null, the best full
+// operation of the new data is looked up and stored in it. The data of
+// extents contiguous on disk is diffed in place in the images, other extents
+// are gathered in |scratch| if not null. If |chunk_report| is not null, the
+// time spent on each candidate operation and its size are stored in it.
+// Returns true on success.
+bool ReadExtentsToDiff(const MappedImage* old_image,
+                       const MappedImage* new_image,
+                       const std::vector<BlockExtent>& old_extents,
+                       const std::vector<BlockExtent>& new_extents,
+                       const std::vector<puffin::BitExtent>& old_deflates,
+                       const std::vector<puffin::BitExtent>& new_deflates,
+                       const PayloadVersion& version,
+                       const DiffLimits& limits,
+                       TargetCache* target_cache,
+                       DiffScratch* scratch,
+                       brillo::Blob* out_data,
+                       InstallOperation* out_op,
+                       GenerationReport::ChunkReport* chunk_report);
+
+// Same as above, but maps the images from the |old_part| and |new_part| paths.
+// |old_part| may be empty if |old_extents| is empty.
 bool ReadExtentsToDiff(const std::string& old_part,
                        const std::string& new_part,
-                       const std::vector<Extent>& old_extents,
-                       const std::vector<Extent>& new_extents,
+                       const std::vector<BlockExtent>& old_extents,
+                       const std::vector<BlockExtent>& new_extents,
                        const std::vector<puffin::BitExtent>& old_deflates,
                        const std::vector<puffin::BitExtent>& new_deflates,
                        const PayloadVersion& version,
+                       const DiffLimits& limits,
                        brillo::Blob* out_data,
                        InstallOperation* out_op);
 
 // Generates the best allowed full operation to produce |new_data|. The allowed
 // operations are based on |payload_version|. The operation blob will be stored
 // in |out_blob| and the resulting operation type in |out_type|. Returns whether
-// a valid full operation was generated.
+// a valid full operation was generated. If |chunk_report| is not null, the
+// compression times and sizes of the candidates are stored in it.
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
-                               InstallOperation::Type* out_type);
+                               InstallOperation::Type* out_type,
+                               GenerationReport::ChunkReport* chunk_report);
+
+// Returns an estimate of the peak memory in bytes the device uses to apply an
+// operation of type |type| reading |src_size| bytes, writing |dst_size| bytes
+// and with a blob of |blob_size| bytes. The blob is always held in memory.
+// bspatch also holds the source and target data, puffpatch adds its cache,
+// and the operations transforming the data before bspatch hold a transformed
+// copy of it; for LZ4DIFF_BSDIFF |src_size| and |dst_size| are the
+// uncompressed sizes.
+uint64_t EstimateApplyMemory(InstallOperation::Type type,
+                             uint64_t src_size,
+                             uint64_t dst_size,
+                             uint64_t blob_size);
+
+// Generates a BROTLI_BSDIFF patch from the |old_size| bytes at |old_data| to
+// the |new_size| bytes at |new_data| and stores it in |patch|. Used for the
+// inner patches of the operations that transform the data before diffing it.
+bool GenerateBrotliBsdiff(const uint8_t* old_data,
+                          size_t old_size,
+                          const uint8_t* new_data,
+                          size_t new_size,
+                          brillo::Blob* patch);
+
+// The patch generated by a diff algorithm run by RunDiffBeforeDeadline().
+struct DiffOutput {
+  brillo::Blob patch;
+  // The part of the diff time spent compressing the patch, if measured.
+  base::TimeDelta patch_compression_time;
+};
+
+// Runs |diff| and stores what it generates in |output|. With a non null
+// |deadline|, |diff| runs in a forked child process that is killed if it
+// doesn't finish before the |deadline|, in which case |timed_out| is set. The
+// child process only runs |diff| and sends its output back. Returns whether
+// |diff| succeeded in time.
+bool RunDiffBeforeDeadline(const std::function<bool(DiffOutput*)>& diff,
+                           base::TimeTicks deadline,
+                           DiffOutput* output,
+                           bool* timed_out);
 
 // Returns whether |op_type| is one of the REPLACE full operations.
 bool IsAReplaceOperation(InstallOperation::Type op_type);
@@ -143,10 +259,12 @@ bool IsExtFilesystem(const std::string& device);
 // Returns the max number of threads to process the files(chunks) in parallel.
 size_t GetMaxThreads();
 
-// Returns the old file which file name has the shortest levenshtein distance to
-// |new_file_name|.
+// Returns the old file named |new_file_name| or, if there isn't one, the old
+// file which file name has the shortest levenshtein distance to
+// |new_file_name|. |old_files_index| must index the names in |old_files_map|.
 FilesystemInterface::File GetOldFile(
     const std::map<std::string, FilesystemInterface::File>& old_files_map,
+    const FileNameIndex& old_files_index,
     const std::string& new_file_name);
 
 }  // namespace diff_utils
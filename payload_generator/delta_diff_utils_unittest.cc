@@ -16,7 +16,11 @@
 
 #include "update_engine/payload_generator/delta_diff_utils.h"
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <limits>
+#include <memory>
 #include <random>
 #include <string>
 #include <vector>
@@ -32,6 +36,8 @@
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/fake_filesystem.h"
+#include "update_engine/payload_generator/mapped_image.h"
+#include "update_engine/payload_generator/target_cache.h"
 
 using std::string;
 using std::vector;
@@ -44,14 +50,14 @@ namespace {
 // |part_path|. The |data| size could be smaller than the size of the blocks
 // passed.
 bool WriteExtents(const string& part_path,
-                  const vector<Extent>& extents,
+                  const vector<BlockExtent>& extents,
                   off_t block_size,
                   const brillo::Blob& data) {
   uint64_t offset = 0;
   base::ScopedFILE fp(fopen(part_path.c_str(), "r+"));
   TEST_AND_RETURN_FALSE(fp.get());
 
-  for (const Extent& extent : extents) {
+  for (const BlockExtent& extent : extents) {
     if (offset >= data.size())
       break;
     TEST_AND_RETURN_FALSE(
@@ -163,16 +169,12 @@ TEST_F(DeltaDiffUtilsTest, SkipVerityExtentsTest) {
   new_part_.verity.hash_tree_extent = ExtentForRange(20, 30);
   new_part_.verity.fec_extent = ExtentForRange(40, 50);
 
+  PayloadGenerationConfig config;
+  config.version = PayloadVersion(kMaxSupportedMajorPayloadVersion,
+                                  kVerityMinorPayloadVersion);
   BlobFileWriter blob_file(tmp_blob_file_.fd(), &blob_size_);
   EXPECT_TRUE(diff_utils::DeltaReadPartition(
-      &aops_,
-      old_part_,
-      new_part_,
-      -1,
-      -1,
-      PayloadVersion(kMaxSupportedMajorPayloadVersion,
-                     kVerityMinorPayloadVersion),
-      &blob_file));
+      &aops_, old_part_, new_part_, -1, -1, config, &blob_file));
   for (const auto& aop : aops_) {
     new_visited_blocks_.AddRepeatedExtents(aop.op.dst_extents());
   }
@@ -186,8 +188,8 @@ TEST_F(DeltaDiffUtilsTest, SkipVerityExtentsTest) {
 
 TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
   // The old file is on a different block than the new one.
-  vector<Extent> old_extents = {ExtentForRange(1, 1)};
-  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+  vector<BlockExtent> old_extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> new_extents = {ExtentForRange(2, 1)};
 
   // Make a blob that's just 1's that will compress well.
   brillo::Blob ones(kBlockSize, 1);
@@ -216,6 +218,7 @@ TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
         {},  // old_deflates
         {},  // new_deflates
         PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+        {},  // limits
         &data,
         &op));
     EXPECT_FALSE(data.empty());
@@ -242,8 +245,8 @@ TEST_F(DeltaDiffUtilsTest, SourceCopyTest) {
   test_utils::FillWithData(&data_blob);
 
   // The old file is on a different block than the new one.
-  vector<Extent> old_extents = {ExtentForRange(11, 1)};
-  vector<Extent> new_extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> old_extents = {ExtentForRange(11, 1)};
+  vector<BlockExtent> new_extents = {ExtentForRange(1, 1)};
 
   EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, data_blob));
   EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, data_blob));
@@ -258,6 +261,7 @@ TEST_F(DeltaDiffUtilsTest, SourceCopyTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+      {},  // limits
       &data,
       &op));
   EXPECT_TRUE(data.empty());
@@ -274,8 +278,8 @@ TEST_F(DeltaDiffUtilsTest, SourceBsdiffTest) {
   test_utils::FillWithData(&data_blob);
 
   // The old file is on a different block than the new one.
-  vector<Extent> old_extents = {ExtentForRange(1, 1)};
-  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+  vector<BlockExtent> old_extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> new_extents = {ExtentForRange(2, 1)};
 
   EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, data_blob));
   // Modify one byte in the new file.
@@ -292,6 +296,7 @@ TEST_F(DeltaDiffUtilsTest, SourceBsdiffTest) {
       {},  // old_deflates
       {},  // new_deflates
       PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+      {},  // limits
       &data,
       &op));
 
@@ -300,9 +305,152 @@ TEST_F(DeltaDiffUtilsTest, SourceBsdiffTest) {
   EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, op.type());
 }
 
+TEST_F(DeltaDiffUtilsTest, ApplyMemoryBudgetDisablesBsdiffTest) {
+  brillo::Blob data_blob(kBlockSize);
+  test_utils::FillWithData(&data_blob);
+  vector<BlockExtent> old_extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> new_extents = {ExtentForRange(2, 1)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, data_blob));
+  data_blob[0]++;
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, data_blob));
+
+  // Applying a bsdiff of one block needs more than one block of memory.
+  diff_utils::DiffLimits limits;
+  limits.apply_memory_budget = kBlockSize;
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+      limits,
+      &data,
+      &op));
+  EXPECT_TRUE(diff_utils::IsAReplaceOperation(op.type()));
+}
+
+TEST_F(DeltaDiffUtilsTest, PassedDeadlineDisablesBsdiffTest) {
+  brillo::Blob data_blob(kBlockSize);
+  test_utils::FillWithData(&data_blob);
+  vector<BlockExtent> old_extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> new_extents = {ExtentForRange(2, 1)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, data_blob));
+  data_blob[0]++;
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, data_blob));
+
+  diff_utils::DiffLimits limits;
+  limits.deadline = base::TimeTicks::Now();
+  brillo::Blob data;
+  InstallOperation op;
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+      limits,
+      &data,
+      &op));
+  EXPECT_TRUE(diff_utils::IsAReplaceOperation(op.type()));
+
+  // The chunk time budget doesn't disable bsdiff when it's long enough.
+  limits.deadline = base::TimeTicks();
+  limits.chunk_time_budget = base::TimeDelta::FromMinutes(1);
+  EXPECT_TRUE(diff_utils::ReadExtentsToDiff(
+      old_part_.path,
+      new_part_.path,
+      old_extents,
+      new_extents,
+      {},  // old_deflates
+      {},  // new_deflates
+      PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+      limits,
+      &data,
+      &op));
+  EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, op.type());
+}
+
+TEST_F(DeltaDiffUtilsTest, RunDiffBeforeDeadlineTest) {
+  // The patch is bigger than a pipe buffer.
+  brillo::Blob patch(1024 * 1024);
+  test_utils::FillWithData(&patch);
+  auto generate_patch = [&](diff_utils::DiffOutput* output) {
+    output->patch = patch;
+    output->patch_compression_time = base::TimeDelta::FromMilliseconds(5);
+    return true;
+  };
+  base::TimeTicks deadline =
+      base::TimeTicks::Now() + base::TimeDelta::FromMinutes(1);
+
+  // The output of a diff run in a child process is sent back.
+  diff_utils::DiffOutput output;
+  bool timed_out = true;
+  EXPECT_TRUE(diff_utils::RunDiffBeforeDeadline(
+      generate_patch, deadline, &output, &timed_out));
+  EXPECT_FALSE(timed_out);
+  EXPECT_EQ(patch, output.patch);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(5),
+            output.patch_compression_time);
+
+  // Without deadline the diff runs in place.
+  diff_utils::DiffOutput in_place_output;
+  EXPECT_TRUE(diff_utils::RunDiffBeforeDeadline(
+      generate_patch, base::TimeTicks(), &in_place_output, &timed_out));
+  EXPECT_FALSE(timed_out);
+  EXPECT_EQ(patch, in_place_output.patch);
+
+  // A failed diff isn't a timeout.
+  diff_utils::DiffOutput failed_output;
+  EXPECT_FALSE(diff_utils::RunDiffBeforeDeadline(
+      [](diff_utils::DiffOutput* output) { return false; },
+      deadline,
+      &failed_output,
+      &timed_out));
+  EXPECT_FALSE(timed_out);
+
+  // A diff still running at the deadline is killed.
+  base::TimeTicks start = base::TimeTicks::Now();
+  diff_utils::DiffOutput slow_output;
+  EXPECT_FALSE(diff_utils::RunDiffBeforeDeadline(
+      [](diff_utils::DiffOutput* output) {
+        while (true)
+          sleep(1);
+        return true;
+      },
+      start + base::TimeDelta::FromMilliseconds(100),
+      &slow_output,
+      &timed_out));
+  EXPECT_TRUE(timed_out);
+  EXPECT_TRUE(slow_output.patch.empty());
+  EXPECT_LT(base::TimeTicks::Now() - start, base::TimeDelta::FromSeconds(10));
+}
+
+TEST_F(DeltaDiffUtilsTest, EstimateApplyMemoryTest) {
+  const uint64_t kSize = 1024 * 1024;
+  // Full operations only buffer their blob.
+  EXPECT_EQ(100U,
+            diff_utils::EstimateApplyMemory(
+                InstallOperation::REPLACE_XZ, 0, kSize, 100));
+  uint64_t bsdiff_memory = diff_utils::EstimateApplyMemory(
+      InstallOperation::SOURCE_BSDIFF, kSize, kSize, 100);
+  EXPECT_LE(2 * kSize + 100, bsdiff_memory);
+  EXPECT_LT(bsdiff_memory,
+            diff_utils::EstimateApplyMemory(
+                InstallOperation::PUFFDIFF, kSize, kSize, 100));
+  EXPECT_LT(bsdiff_memory,
+            diff_utils::EstimateApplyMemory(
+                InstallOperation::EXECUTABLE_BSDIFF, kSize, kSize, 100));
+}
+
 TEST_F(DeltaDiffUtilsTest, PreferReplaceTest) {
   brillo::Blob data_blob(kBlockSize);
-  vector<Extent> extents = {ExtentForRange(1, 1)};
+  vector<BlockExtent> extents = {ExtentForRange(1, 1)};
 
   // Write something in the first 50 bytes so that REPLACE_BZ will be slightly
   // larger than BROTLI_BSDIFF.
@@ -323,6 +471,7 @@ TEST_F(DeltaDiffUtilsTest, PreferReplaceTest) {
       {},  // new_deflates
       PayloadVersion(kMaxSupportedMajorPayloadVersion,
                      kMaxSupportedMinorPayloadVersion),
+      {},  // limits
       &data,
       &op));
 
@@ -331,6 +480,145 @@ TEST_F(DeltaDiffUtilsTest, PreferReplaceTest) {
   EXPECT_EQ(InstallOperation::REPLACE_BZ, op.type());
 }
 
+TEST_F(DeltaDiffUtilsTest, ScratchIsReusedBetweenChunksTest) {
+  // Fragmented and contiguous chunks give the same operations with and
+  // without a reused scratch.
+  brillo::Blob data_blob(4 * kBlockSize);
+  test_utils::FillWithData(&data_blob);
+  vector<vector<BlockExtent>> chunks = {
+      {ExtentForRange(10, 1), ExtentForRange(5, 2), ExtentForRange(20, 1)},
+      {ExtentForRange(30, 4)},
+      {ExtentForRange(40, 1), ExtentForRange(50, 1)}};
+  for (const auto& extents : chunks) {
+    EXPECT_TRUE(WriteExtents(old_part_.path, extents, kBlockSize, data_blob));
+    data_blob[kBlockSize]++;
+    EXPECT_TRUE(WriteExtents(new_part_.path, extents, kBlockSize, data_blob));
+  }
+  std::unique_ptr<MappedImage> old_image =
+      MappedImage::CreateFromFile(old_part_.path);
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part_.path);
+  ASSERT_TRUE(old_image && new_image);
+
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  diff_utils::DiffScratch scratch;
+  for (const auto& extents : chunks) {
+    brillo::Blob data, expected_data;
+    InstallOperation op, expected_op;
+    EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_image.get(),
+                                              new_image.get(),
+                                              extents,
+                                              extents,
+                                              {},  // old_deflates
+                                              {},  // new_deflates
+                                              version,
+                                              {},       // limits
+                                              nullptr,  // target_cache
+                                              &scratch,
+                                              &data,
+                                              &op,
+                                              nullptr));  // chunk_report
+    EXPECT_TRUE(diff_utils::ReadExtentsToDiff(old_image.get(),
+                                              new_image.get(),
+                                              extents,
+                                              extents,
+                                              {},  // old_deflates
+                                              {},  // new_deflates
+                                              version,
+                                              {},       // limits
+                                              nullptr,  // target_cache
+                                              nullptr,  // scratch
+                                              &expected_data,
+                                              &expected_op,
+                                              nullptr));  // chunk_report
+    EXPECT_EQ(expected_op.SerializeAsString(), op.SerializeAsString());
+    EXPECT_EQ(expected_data, data);
+  }
+}
+
+TEST_F(DeltaDiffUtilsTest, TargetCacheHitFillsChunkReportTest) {
+  brillo::Blob data_blob(4 * kBlockSize);
+  std::iota(data_blob.begin(), data_blob.begin() + 100, 0);
+  vector<BlockExtent> new_extents = {ExtentForRange(3, 4)};
+  EXPECT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, data_blob));
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part_.path);
+  ASSERT_NE(nullptr, new_image);
+
+  TargetCache target_cache;
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kSourceMinorPayloadVersion);
+  GenerationReport::ChunkReport reports[2];
+  for (GenerationReport::ChunkReport& report : reports) {
+    brillo::Blob data;
+    InstallOperation op;
+    EXPECT_TRUE(diff_utils::ReadExtentsToDiff(nullptr,  // old_image
+                                              new_image.get(),
+                                              {},  // old_extents
+                                              new_extents,
+                                              {},  // old_deflates
+                                              {},  // new_deflates
+                                              version,
+                                              {},  // limits
+                                              &target_cache,
+                                              nullptr,  // scratch
+                                              &data,
+                                              &op,
+                                              &report));
+    EXPECT_EQ(op.type(), report.type);
+    EXPECT_EQ(data.size(), report.data_size);
+  }
+  EXPECT_FALSE(reports[0].full_operation_cached);
+  EXPECT_TRUE(reports[1].full_operation_cached);
+  EXPECT_EQ(reports[0].type, reports[1].type);
+  EXPECT_EQ(reports[0].data_size, reports[1].data_size);
+  EXPECT_EQ(reports[0].apply_memory, reports[1].apply_memory);
+  EXPECT_LT(0U, reports[1].apply_memory);
+  if (reports[0].type == InstallOperation::REPLACE_XZ) {
+    EXPECT_EQ(reports[0].xz_size, reports[1].xz_size);
+  } else if (reports[0].type == InstallOperation::REPLACE_BZ) {
+    EXPECT_EQ(reports[0].bz2_size, reports[1].bz2_size);
+  }
+}
+
+TEST_F(DeltaDiffUtilsTest, HugeApplyMemoryBudgetTest) {
+  brillo::Blob data_blob(4 * kBlockSize);
+  test_utils::FillWithData(&data_blob);
+  vector<BlockExtent> extents = {ExtentForRange(1, 4)};
+  EXPECT_TRUE(WriteExtents(old_part_.path, extents, kBlockSize, data_blob));
+  data_blob[0]++;
+  EXPECT_TRUE(WriteExtents(new_part_.path, extents, kBlockSize, data_blob));
+  std::unique_ptr<MappedImage> old_image =
+      MappedImage::CreateFromFile(old_part_.path);
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part_.path);
+  ASSERT_TRUE(old_image && new_image);
+
+  // A budget that fits any chunk doesn't split the file.
+  diff_utils::DiffLimits limits;
+  limits.apply_memory_budget = std::numeric_limits<uint64_t>::max();
+  BlobFileWriter blob_file(tmp_blob_file_.fd(), &blob_size_);
+  EXPECT_TRUE(diff_utils::DeltaReadFile(
+      &aops_,
+      old_image.get(),
+      new_image.get(),
+      extents,
+      extents,
+      {},       // old_deflates
+      {},       // new_deflates
+      nullptr,  // old_lz4_file
+      nullptr,  // new_lz4_file
+      "file",
+      -1,  // chunk_blocks
+      PayloadVersion(kBrilloMajorPayloadVersion, kSourceMinorPayloadVersion),
+      limits,
+      nullptr,  // target_cache
+      &blob_file,
+      nullptr));  // chunk_reports
+  EXPECT_EQ(1U, aops_.size());
+}
+
 // Test the simple case where all the blocks are different and no new blocks are
 // zeroed.
 TEST_F(DeltaDiffUtilsTest, NoZeroedOrUniqueBlocksDetected) {
@@ -357,13 +645,13 @@ TEST_F(DeltaDiffUtilsTest, IdenticalBlocksAreCopiedFromSource) {
   InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42);
 
   // Mark some of the blocks as already visited.
-  vector<Extent> already_visited = {ExtentForRange(5, 5),
-                                    ExtentForRange(25, 7)};
+  vector<BlockExtent> already_visited = {ExtentForRange(5, 5),
+                                         ExtentForRange(25, 7)};
   old_visited_blocks_.AddExtents(already_visited);
   new_visited_blocks_.AddExtents(already_visited);
 
   // Override some of the old blocks with different data.
-  vector<Extent> different_blocks = {ExtentForRange(40, 5)};
+  vector<BlockExtent> different_blocks = {ExtentForRange(40, 5)};
   EXPECT_TRUE(WriteExtents(old_part_.path,
                            different_blocks,
                            kBlockSize,
@@ -383,7 +671,7 @@ TEST_F(DeltaDiffUtilsTest, IdenticalBlocksAreCopiedFromSource) {
   // We expect all the blocks that we didn't override with |different_blocks|
   // and that we didn't mark as visited in |already_visited| to match and have a
   // SOURCE_COPY operation chunked at 10 blocks.
-  vector<Extent> expected_op_extents = {
+  vector<BlockExtent> expected_op_extents = {
       ExtentForRange(0, 5),
       ExtentForRange(10, 10),
       ExtentForRange(20, 5),
@@ -403,6 +691,33 @@ TEST_F(DeltaDiffUtilsTest, IdenticalBlocksAreCopiedFromSource) {
   }
 }
 
+// Test that old blocks already used by other operations can still be the
+// source of identical new blocks.
+TEST_F(DeltaDiffUtilsTest, VisitedOldBlocksAreReused) {
+  // We use a smaller partition for this test.
+  old_part_.size = kBlockSize * 20;
+  new_part_.size = kBlockSize * 20;
+
+  InitializePartitionWithUniqueBlocks(old_part_, block_size_, 42);
+  InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42);
+
+  // All the old blocks were already used as the source of other operations.
+  old_visited_blocks_.AddExtent(ExtentForRange(0, 20));
+
+  EXPECT_TRUE(RunDeltaMovedAndZeroBlocks(-1,  // chunk_blocks
+                                         kSourceMinorPayloadVersion));
+
+  EXPECT_EQ(20U, new_visited_blocks_.blocks());
+  ASSERT_EQ(1U, aops_.size());
+  const AnnotatedOperation& aop = aops_[0];
+  EXPECT_EQ(InstallOperation::SOURCE_COPY, aop.op.type());
+  ASSERT_EQ(1, aop.op.src_extents_size());
+  EXPECT_EQ(ExtentForRange(0, 20), aop.op.src_extents(0));
+  ASSERT_EQ(1, aop.op.dst_extents_size());
+  EXPECT_EQ(ExtentForRange(0, 20), aop.op.dst_extents(0));
+  EXPECT_EQ(0, blob_size_);
+}
+
 TEST_F(DeltaDiffUtilsTest, IdenticalBlocksAreCopiedInOder) {
   // We use a smaller partition for this test.
   old_part_.size = block_size_ * 50;
@@ -452,7 +767,7 @@ TEST_F(DeltaDiffUtilsTest, ZeroBlocksUseReplaceBz) {
   // We set four ranges of blocks with zeros: a single block, a range that fits
   // in the chunk size, a range that doesn't and finally a range of zeros that
   // was also zeros in the old image.
-  vector<Extent> new_zeros = {
+  vector<BlockExtent> new_zeros = {
       ExtentForRange(10, 1),
       ExtentForRange(20, 4),
       // The last range is split since the old image has zeros in part of it.
@@ -462,7 +777,7 @@ TEST_F(DeltaDiffUtilsTest, ZeroBlocksUseReplaceBz) {
                           '\0');
   EXPECT_TRUE(WriteExtents(new_part_.path, new_zeros, block_size_, zeros_data));
 
-  vector<Extent> old_zeros = vector<Extent>{ExtentForRange(43, 7)};
+  vector<BlockExtent> old_zeros = vector<BlockExtent>{ExtentForRange(43, 7)};
   EXPECT_TRUE(WriteExtents(old_part_.path, old_zeros, block_size_, zeros_data));
 
   EXPECT_TRUE(RunDeltaMovedAndZeroBlocks(5,  // chunk_blocks
@@ -478,7 +793,7 @@ TEST_F(DeltaDiffUtilsTest, ZeroBlocksUseReplaceBz) {
             new_visited_blocks_.GetExtentsForBlockCount(
                 new_visited_blocks_.blocks()));
 
-  vector<Extent> expected_op_extents = {
+  vector<BlockExtent> expected_op_extents = {
       ExtentForRange(10, 1),
       ExtentForRange(20, 4),
       // This range should be split.
@@ -502,7 +817,7 @@ TEST_F(DeltaDiffUtilsTest, ZeroBlocksUseReplaceBz) {
 
 TEST_F(DeltaDiffUtilsTest, ShuffledBlocksAreTracked) {
   vector<uint64_t> permutation = {0, 1, 5, 6, 7, 2, 3, 4, 9, 10, 11, 12, 8};
-  vector<Extent> perm_extents;
+  vector<BlockExtent> perm_extents;
   for (uint64_t x : permutation)
     AppendBlockToExtents(&perm_extents, x);
 
@@ -529,7 +844,7 @@ TEST_F(DeltaDiffUtilsTest, ShuffledBlocksAreTracked) {
   EXPECT_EQ(1U, aops_.size());
   const AnnotatedOperation& aop = aops_[0];
   EXPECT_EQ(InstallOperation::SOURCE_COPY, aop.op.type());
-  vector<Extent> aop_src_extents;
+  vector<BlockExtent> aop_src_extents;
   ExtentsToVector(aop.op.src_extents(), &aop_src_extents);
   EXPECT_EQ(perm_extents, aop_src_extents);
 
@@ -547,7 +862,9 @@ TEST_F(DeltaDiffUtilsTest, IsExtFilesystemTest) {
 }
 
 TEST_F(DeltaDiffUtilsTest, GetOldFileEmptyTest) {
-  EXPECT_TRUE(diff_utils::GetOldFile({}, "filename").name.empty());
+  FileNameIndex old_files_index({});
+  EXPECT_TRUE(
+      diff_utils::GetOldFile({}, old_files_index, "filename").name.empty());
 }
 
 TEST_F(DeltaDiffUtilsTest, GetOldFileTest) {
@@ -566,27 +883,28 @@ TEST_F(DeltaDiffUtilsTest, GetOldFileTest) {
     file.name = name;
     old_files_map.emplace(name, file);
   }
+  vector<string> old_file_names;
+  for (const auto& name_file : old_files_map)
+    old_file_names.push_back(name_file.first);
+  FileNameIndex old_files_index(std::move(old_file_names));
+  auto get_old_file = [&](const string& new_file_name) {
+    return diff_utils::GetOldFile(
+        old_files_map, old_files_index, new_file_name);
+  };
 
   // Always return exact match if possible.
   for (const auto& name : file_list)
-    EXPECT_EQ(diff_utils::GetOldFile(old_files_map, name).name, name);
-
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "file_name").name,
-            "filename");
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "filename_new.zip").name,
-            "filename.zip");
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "version1.2").name,
-            "version1.1");
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "version3.0").name,
-            "version2.0");
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "_version").name, "version");
-  EXPECT_EQ(
-      diff_utils::GetOldFile(old_files_map, "update_engine_unittest").name,
-      "update_engine");
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "bin/delta_generator").name,
-            "delta_generator");
+    EXPECT_EQ(get_old_file(name).name, name);
+
+  EXPECT_EQ(get_old_file("file_name").name, "filename");
+  EXPECT_EQ(get_old_file("filename_new.zip").name, "filename.zip");
+  EXPECT_EQ(get_old_file("version1.2").name, "version1.1");
+  EXPECT_EQ(get_old_file("version3.0").name, "version2.0");
+  EXPECT_EQ(get_old_file("_version").name, "version");
+  EXPECT_EQ(get_old_file("update_engine_unittest").name, "update_engine");
+  EXPECT_EQ(get_old_file("bin/delta_generator").name, "delta_generator");
   // Check file name with minimum size.
-  EXPECT_EQ(diff_utils::GetOldFile(old_files_map, "a").name, "filename");
+  EXPECT_EQ(get_old_file("a").name, "filename");
 }
 
 }  // namespace chromeos_update_engine
@@ -0,0 +1,672 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/erofs_filesystem.h"
+
+#include <endian.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/lz4patch.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Super block layout, see erofs_fs.h.
+constexpr uint64_t kSuperBlockOffset = 1024;
+constexpr size_t kSuperBlockSize = 128;
+constexpr uint32_t kErofsMagic = 0xE0F5E1E2;
+constexpr uint32_t kFeatureIncompatZeroPadding = 0x1;
+
+// The inodes are addressed in 32 bytes slots from the start of the metadata
+// area. Compact inodes take one slot and extended inodes two.
+constexpr uint32_t kInodeSlotBits = 5;
+constexpr size_t kCompactInodeSize = 32;
+constexpr size_t kExtendedInodeSize = 64;
+constexpr size_t kXattrHeaderSize = 12;
+constexpr size_t kXattrEntrySize = 4;
+
+// Data layouts.
+constexpr uint8_t kFlatPlain = 0;
+constexpr uint8_t kCompressedFull = 1;
+constexpr uint8_t kFlatInline = 2;
+constexpr uint8_t kCompressedCompact = 3;
+constexpr uint8_t kChunkBased = 4;
+
+constexpr uint32_t kNullAddress = 0xFFFFFFFF;
+
+// Chunk based inodes.
+constexpr uint16_t kChunkFormatBlockBitsMask = 0x1F;
+constexpr uint16_t kChunkFormatIndexes = 0x20;
+
+// Compressed inodes: the map header and the logical cluster types.
+constexpr size_t kMapHeaderSize = 8;
+constexpr uint16_t kAdviseCompacted2B = 0x1;
+constexpr uint16_t kAdviseBigPcluster1 = 0x2;
+constexpr uint16_t kAdviseBigPcluster2 = 0x4;
+constexpr uint16_t kAdviseInlinePcluster = 0x8;
+constexpr uint16_t kAdviseFragmentPcluster = 0x20;
+constexpr uint8_t kFragmentInodeBit = 0x80;
+constexpr uint8_t kLz4Algorithm = 0;
+constexpr uint8_t kLclusterTypePlain = 0;
+constexpr uint8_t kLclusterTypeHead1 = 1;
+constexpr uint8_t kLclusterTypeNonHead = 2;
+constexpr uint16_t kD0CompressedBlockCount = 1 << 11;
+constexpr size_t kFullIndexSize = 8;
+
+// Directory entries.
+constexpr size_t kDirentSize = 12;
+constexpr size_t kMaxDirectoryDepth = 256;
+
+constexpr char kUpdateEngineConf[] = "/etc/update_engine.conf";
+
+uint16_t ReadLE16(const uint8_t* data) {
+  uint16_t value;
+  memcpy(&value, data, sizeof(value));
+  return le16toh(value);
+}
+
+uint32_t ReadLE32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return le32toh(value);
+}
+
+uint64_t ReadLE64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return le64toh(value);
+}
+
+uint64_t RoundUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Decodes the logical cluster |index| of a pack of compact indexes |pack|,
+// where every index takes |encode_bits| bits: |lo_bits| bits of value followed
+// by the 2 bits of the type.
+uint32_t DecodeCompactIndex(const uint8_t* pack,
+                            uint32_t lo_bits,
+                            uint32_t encode_bits,
+                            int index,
+                            uint8_t* type) {
+  uint32_t pos = encode_bits * index;
+  uint32_t value = ReadLE32(pack + pos / 8) >> (pos % 8);
+  *type = (value >> lo_bits) & 3;
+  return value & ((1U << lo_bits) - 1);
+}
+
+}  // namespace
+
+unique_ptr<ErofsFilesystem> ErofsFilesystem::CreateFromFile(
+    const string& filename) {
+  auto image = MappedImage::CreateFromFile(filename);
+  if (!image)
+    return nullptr;
+  const uint8_t* super_block =
+      image->GetData(kSuperBlockOffset, kSuperBlockSize);
+  if (!super_block || ReadLE32(super_block) != kErofsMagic)
+    return nullptr;
+
+  unique_ptr<ErofsFilesystem> result(new ErofsFilesystem(std::move(image)));
+  if (!result->Init()) {
+    LOG(ERROR) << "Unable to parse the EROFS image " << filename;
+    return nullptr;
+  }
+  return result;
+}
+
+bool ErofsFilesystem::IsErofsImage(const brillo::Blob& data) {
+  return data.size() >= kSuperBlockOffset + kSuperBlockSize &&
+         ReadLE32(data.data() + kSuperBlockOffset) == kErofsMagic;
+}
+
+size_t ErofsFilesystem::GetBlockSize() const {
+  return 1 << block_size_bits_;
+}
+
+size_t ErofsFilesystem::GetBlockCount() const {
+  return block_count_;
+}
+
+bool ErofsFilesystem::GetFiles(vector<File>* files) const {
+  files->insert(files->end(), files_.begin(), files_.end());
+  return true;
+}
+
+bool ErofsFilesystem::LoadSettings(brillo::KeyValueStore* store) const {
+  if (update_engine_config_.empty())
+    return false;
+  if (!store->LoadFromString(update_engine_config_)) {
+    LOG(ERROR) << "Failed to load the settings with config: "
+               << update_engine_config_;
+    return false;
+  }
+  return true;
+}
+
+bool ErofsFilesystem::Init() {
+  const uint8_t* super_block =
+      image_->GetData(kSuperBlockOffset, kSuperBlockSize);
+  TEST_AND_RETURN_FALSE(super_block);
+  block_size_bits_ = super_block[12];
+  TEST_AND_RETURN_FALSE(block_size_bits_ >= 9 && block_size_bits_ <= 16);
+  root_nid_ = ReadLE16(super_block + 14);
+  meta_offset_ = static_cast<uint64_t>(ReadLE32(super_block + 40))
+                 << block_size_bits_;
+  zero_padding_ =
+      ReadLE32(super_block + 80) & kFeatureIncompatZeroPadding;
+  // The data of images with extra devices may be stored in other files.
+  TEST_AND_RETURN_FALSE(ReadLE16(super_block + 86) == 0);
+  block_count_ = image_->size() >> block_size_bits_;
+
+  Inode root;
+  TEST_AND_RETURN_FALSE(ReadInode(root_nid_, &root));
+  TEST_AND_RETURN_FALSE(S_ISDIR(root.mode));
+  visited_nids_.insert(root_nid_);
+  TEST_AND_RETURN_FALSE(AddFile(root, "/"));
+  TEST_AND_RETURN_FALSE(ReadDirectory(root, "", 0));
+
+  // The super block, the inodes, the inline data and everything else that
+  // isn't a file data block.
+  vector<BlockExtent> metadata_extents =
+      FilterExtentRanges({ExtentForRange(0, block_count_)}, used_blocks_);
+  if (!metadata_extents.empty()) {
+    File file;
+    file.name = "<metadata>";
+    file.extents = std::move(metadata_extents);
+    files_.push_back(std::move(file));
+  }
+  return true;
+}
+
+bool ErofsFilesystem::ReadInode(uint64_t nid, Inode* inode) const {
+  uint64_t offset = meta_offset_ + (nid << kInodeSlotBits);
+  const uint8_t* data = image_->GetData(offset, kCompactInodeSize);
+  TEST_AND_RETURN_FALSE(data);
+  uint16_t format = ReadLE16(data);
+  uint16_t xattr_count = ReadLE16(data + 2);
+  size_t inode_size = kCompactInodeSize;
+  inode->nid = nid;
+  inode->layout = (format >> 1) & 7;
+  inode->mode = ReadLE16(data + 4);
+  if (format & 1) {
+    inode_size = kExtendedInodeSize;
+    data = image_->GetData(offset, kExtendedInodeSize);
+    TEST_AND_RETURN_FALSE(data);
+    inode->size = ReadLE64(data + 8);
+  } else {
+    inode->size = ReadLE32(data + 8);
+  }
+  inode->raw_blkaddr = ReadLE32(data + 16);
+  size_t xattr_size =
+      xattr_count ? kXattrHeaderSize + (xattr_count - 1) * kXattrEntrySize : 0;
+  inode->data_offset = offset + inode_size + xattr_size;
+  return true;
+}
+
+bool ErofsFilesystem::GetSegments(const Inode& inode,
+                                  vector<Segment>* segments) const {
+  segments->clear();
+  if (inode.size == 0)
+    return true;
+  uint64_t block_size = GetBlockSize();
+  switch (inode.layout) {
+    case kFlatPlain:
+      segments->push_back({Segment::Type::kRaw,
+                           0,
+                           inode.size,
+                           inode.raw_blkaddr,
+                           RoundUp(inode.size, block_size) / block_size,
+                           0});
+      return true;
+
+    case kFlatInline: {
+      // All the blocks but the last one are stored in the data blocks, and
+      // the last one right after the inode.
+      uint64_t tail_offset =
+          (RoundUp(inode.size, block_size) / block_size - 1) * block_size;
+      if (tail_offset > 0) {
+        segments->push_back({Segment::Type::kRaw,
+                             0,
+                             tail_offset,
+                             inode.raw_blkaddr,
+                             tail_offset / block_size,
+                             0});
+      }
+      segments->push_back({Segment::Type::kInline,
+                           tail_offset,
+                           inode.size - tail_offset,
+                           0,
+                           0,
+                           inode.data_offset});
+      return true;
+    }
+
+    case kChunkBased:
+      return GetChunkSegments(inode, segments);
+
+    case kCompressedFull:
+    case kCompressedCompact:
+      return GetCompressedSegments(inode, segments);
+  }
+  LOG(ERROR) << "Unsupported data layout " << static_cast<int>(inode.layout)
+             << " of inode " << inode.nid;
+  return false;
+}
+
+bool ErofsFilesystem::GetChunkSegments(const Inode& inode,
+                                       vector<Segment>* segments) const {
+  uint16_t format = inode.raw_blkaddr & 0xFFFF;
+  uint32_t chunk_bits =
+      block_size_bits_ + (format & kChunkFormatBlockBitsMask);
+  TEST_AND_RETURN_FALSE(chunk_bits < 48);
+  uint64_t chunk_size = 1ULL << chunk_bits;
+  uint64_t num_chunks = RoundUp(inode.size, chunk_size) / chunk_size;
+  // Chunks are described either by the block address of every chunk or by
+  // full indexes, which also hold the device of the chunk.
+  bool indexes = format & kChunkFormatIndexes;
+  size_t entry_size = indexes ? 8 : 4;
+  const uint8_t* table = image_->GetData(
+      RoundUp(inode.data_offset, entry_size), num_chunks * entry_size);
+  TEST_AND_RETURN_FALSE(table);
+
+  uint64_t block_size = GetBlockSize();
+  for (uint64_t i = 0; i < num_chunks; i++) {
+    const uint8_t* entry = table + i * entry_size;
+    uint32_t address = ReadLE32(indexes ? entry + 4 : entry);
+    if (indexes)
+      TEST_AND_RETURN_FALSE(ReadLE16(entry + 2) == 0);
+    uint64_t offset = i * chunk_size;
+    uint64_t length = std::min(chunk_size, inode.size - offset);
+    if (address == kNullAddress) {
+      segments->push_back({Segment::Type::kHole, offset, length, 0, 0, 0});
+    } else {
+      segments->push_back({Segment::Type::kRaw,
+                           offset,
+                           length,
+                           address,
+                           RoundUp(length, block_size) / block_size,
+                           0});
+    }
+  }
+  return true;
+}
+
+bool ErofsFilesystem::GetCompressedSegments(const Inode& inode,
+                                            vector<Segment>* segments) const {
+  uint64_t header_offset = RoundUp(inode.data_offset, 8);
+  const uint8_t* header = image_->GetData(header_offset, kMapHeaderSize);
+  TEST_AND_RETURN_FALSE(header);
+  CompressionMap map;
+  map.advise = ReadLE16(header + 4);
+  map.algorithms = header[6];
+  uint8_t cluster_bits = header[7];
+  if (cluster_bits & kFragmentInodeBit) {
+    // The whole file is stored in the packed inode.
+    segments->push_back({Segment::Type::kPacked, 0, inode.size, 0, 0, 0});
+    return true;
+  }
+  map.lcluster_bits = block_size_bits_ + (cluster_bits & 7);
+  map.num_lclusters = RoundUp(inode.size, 1ULL << map.lcluster_bits) >>
+                      map.lcluster_bits;
+  bool full = inode.layout == kCompressedFull;
+  map.indexes_offset = header_offset + kMapHeaderSize + (full ? 8 : 0);
+  // The kernel only supports compact indexes of one block lclusters.
+  TEST_AND_RETURN_FALSE(full || map.lcluster_bits == block_size_bits_);
+
+  auto load = [this, &map, full](uint64_t lcn, Lcluster* lcluster) {
+    return full ? LoadFullLcluster(map, lcn, lcluster)
+                : LoadCompactLcluster(map, lcn, lcluster);
+  };
+  uint64_t lcluster_blocks = 1ULL << (map.lcluster_bits - block_size_bits_);
+  for (uint64_t lcn = 0; lcn < map.num_lclusters; lcn++) {
+    Lcluster lcluster;
+    TEST_AND_RETURN_FALSE(load(lcn, &lcluster));
+    if (lcluster.type == kLclusterTypeNonHead)
+      continue;
+
+    // A new pcluster starts in this lcluster.
+    Segment segment;
+    segment.offset = (lcn << map.lcluster_bits) + lcluster.cluster_offset;
+    TEST_AND_RETURN_FALSE(segment.offset < inode.size);
+    TEST_AND_RETURN_FALSE(segments->empty() ? segment.offset == 0
+                                            : segment.offset >
+                                                  segments->back().offset);
+    bool big_pcluster;
+    if (lcluster.type == kLclusterTypePlain) {
+      segment.type = Segment::Type::kPlain;
+      big_pcluster = map.advise & kAdviseBigPcluster2;
+    } else {
+      bool head1 = lcluster.type == kLclusterTypeHead1;
+      uint8_t algorithm = head1 ? map.algorithms & 0xF : map.algorithms >> 4;
+      segment.type = algorithm == kLz4Algorithm ? Segment::Type::kLz4
+                                                : Segment::Type::kOther;
+      big_pcluster =
+          map.advise & (head1 ? kAdviseBigPcluster1 : kAdviseBigPcluster2);
+    }
+    segment.start_block = lcluster.block;
+    segment.num_blocks = lcluster_blocks;
+    // The size of big pclusters is stored in the next lcluster, unless the
+    // pcluster is a single lcluster.
+    if (big_pcluster && lcn + 1 < map.num_lclusters) {
+      Lcluster next;
+      TEST_AND_RETURN_FALSE(load(lcn + 1, &next));
+      if (next.type == kLclusterTypeNonHead) {
+        TEST_AND_RETURN_FALSE(next.compressed_blocks > 0);
+        segment.num_blocks = next.compressed_blocks;
+      }
+    }
+    segment.inline_offset = 0;
+    if (!segments->empty())
+      segments->back().length = segment.offset - segments->back().offset;
+    segments->push_back(segment);
+  }
+  TEST_AND_RETURN_FALSE(!segments->empty());
+  segments->back().length = inode.size - segments->back().offset;
+
+  // The last pcluster may be stored inline after the indexes or in the packed
+  // inode instead of its own blocks.
+  if (map.advise & (kAdviseInlinePcluster | kAdviseFragmentPcluster)) {
+    segments->back().type = Segment::Type::kPacked;
+    segments->back().num_blocks = 0;
+  }
+  return true;
+}
+
+bool ErofsFilesystem::LoadFullLcluster(const CompressionMap& map,
+                                       uint64_t lcn,
+                                       Lcluster* lcluster) const {
+  const uint8_t* index = image_->GetData(
+      map.indexes_offset + lcn * kFullIndexSize, kFullIndexSize);
+  TEST_AND_RETURN_FALSE(index);
+  lcluster->type = ReadLE16(index) & 3;
+  lcluster->cluster_offset = 0;
+  lcluster->block = 0;
+  lcluster->compressed_blocks = 0;
+  if (lcluster->type == kLclusterTypeNonHead) {
+    uint16_t delta0 = ReadLE16(index + 4);
+    if (delta0 & kD0CompressedBlockCount) {
+      TEST_AND_RETURN_FALSE(map.advise &
+                            (kAdviseBigPcluster1 | kAdviseBigPcluster2));
+      lcluster->compressed_blocks = delta0 & ~kD0CompressedBlockCount;
+    }
+  } else {
+    lcluster->cluster_offset = ReadLE16(index + 2);
+    lcluster->block = ReadLE32(index + 4);
+  }
+  return true;
+}
+
+bool ErofsFilesystem::LoadCompactLcluster(const CompressionMap& map,
+                                          uint64_t lcn,
+                                          Lcluster* lcluster) const {
+  // The indexes are stored in packs of 2 indexes in 8 bytes (4B) or 16
+  // indexes in 32 bytes (2B), each pack ending with the block address of its
+  // first pcluster. A few 4B packs align the 2B packs to 32 bytes, and the
+  // indexes not filling a whole 2B pack are stored in 4B packs at the end.
+  uint64_t initial_4b = (32 - map.indexes_offset % 32) / 4;
+  if (initial_4b == 32 / 4)
+    initial_4b = 0;
+  uint64_t compacted_2b = 0;
+  if ((map.advise & kAdviseCompacted2B) && initial_4b < map.num_lclusters)
+    compacted_2b = (map.num_lclusters - initial_4b) / 16 * 16;
+
+  uint64_t pos = map.indexes_offset;
+  uint32_t amortized_shift = 2;
+  if (lcn >= initial_4b) {
+    pos += initial_4b * 4;
+    lcn -= initial_4b;
+    if (lcn < compacted_2b) {
+      amortized_shift = 1;
+    } else {
+      pos += compacted_2b * 2;
+      lcn -= compacted_2b;
+    }
+  }
+  pos += lcn << amortized_shift;
+
+  uint32_t num_indexes;
+  if (amortized_shift == 2 && map.lcluster_bits <= 14) {
+    num_indexes = 2;
+  } else if (amortized_shift == 1 && map.lcluster_bits <= 12) {
+    num_indexes = 16;
+  } else {
+    LOG(ERROR) << "Unsupported compact indexes";
+    return false;
+  }
+  uint32_t pack_size = num_indexes << amortized_shift;
+  uint32_t lo_bits = std::max(map.lcluster_bits, 12U);
+  uint32_t encode_bits = (pack_size - sizeof(uint32_t)) * 8 / num_indexes;
+  uint64_t pack_offset = pos - pos % pack_size;
+  const uint8_t* pack = image_->GetData(pack_offset, pack_size);
+  TEST_AND_RETURN_FALSE(pack);
+  int i = (pos - pack_offset) >> amortized_shift;
+
+  uint8_t type;
+  uint32_t lo = DecodeCompactIndex(pack, lo_bits, encode_bits, i, &type);
+  lcluster->type = type;
+  lcluster->cluster_offset = 0;
+  lcluster->block = 0;
+  lcluster->compressed_blocks = 0;
+  bool big_pcluster = map.advise & kAdviseBigPcluster1;
+  if (type == kLclusterTypeNonHead) {
+    if (lo & kD0CompressedBlockCount) {
+      TEST_AND_RETURN_FALSE(big_pcluster);
+      lcluster->compressed_blocks = lo & ~kD0CompressedBlockCount;
+    }
+    return true;
+  }
+  lcluster->cluster_offset = lo;
+
+  // Only the block address of the first pcluster of the pack is stored, so
+  // count the blocks of the pclusters before this one.
+  uint32_t num_blocks = big_pcluster ? 0 : 1;
+  while (i > 0) {
+    --i;
+    lo = DecodeCompactIndex(pack, lo_bits, encode_bits, i, &type);
+    if (!big_pcluster) {
+      if (type == kLclusterTypeNonHead)
+        i -= lo;
+      if (i >= 0)
+        ++num_blocks;
+    } else if (type == kLclusterTypeNonHead) {
+      if (lo & kD0CompressedBlockCount) {
+        --i;
+        num_blocks += lo & ~kD0CompressedBlockCount;
+      } else {
+        TEST_AND_RETURN_FALSE(lo > 1);
+        i -= lo - 2;
+      }
+    } else {
+      ++num_blocks;
+    }
+  }
+  lcluster->block =
+      ReadLE32(pack + pack_size - sizeof(uint32_t)) + num_blocks;
+  return true;
+}
+
+bool ErofsFilesystem::ReadInodeData(const Inode& inode,
+                                    brillo::Blob* data) const {
+  vector<Segment> segments;
+  TEST_AND_RETURN_FALSE(GetSegments(inode, &segments));
+  data->assign(inode.size, 0);
+  brillo::Blob uncompressed;
+  for (const Segment& segment : segments) {
+    const uint8_t* segment_data = nullptr;
+    uint64_t stored_size = segment.num_blocks << block_size_bits_;
+    switch (segment.type) {
+      case Segment::Type::kRaw:
+        segment_data = image_->GetData(
+            segment.start_block << block_size_bits_, segment.length);
+        break;
+      case Segment::Type::kInline:
+        segment_data = image_->GetData(segment.inline_offset, segment.length);
+        break;
+      case Segment::Type::kLz4:
+      case Segment::Type::kPlain: {
+        Lz4Block block;
+        block.set_uncompressed_offset(0);
+        block.set_uncompressed_length(segment.length);
+        block.set_compressed_length(stored_size);
+        block.set_plain(segment.type == Segment::Type::kPlain);
+        const uint8_t* compressed = image_->GetData(
+            segment.start_block << block_size_bits_, stored_size);
+        TEST_AND_RETURN_FALSE(compressed);
+        TEST_AND_RETURN_FALSE(Lz4DecompressBlocks(
+            compressed, stored_size, {block}, zero_padding_, &uncompressed));
+        segment_data = uncompressed.data();
+        break;
+      }
+      case Segment::Type::kHole:
+        continue;
+      case Segment::Type::kPacked:
+      case Segment::Type::kOther:
+        LOG(ERROR) << "Unable to read the data of inode " << inode.nid;
+        return false;
+    }
+    TEST_AND_RETURN_FALSE(segment_data);
+    std::copy(segment_data,
+              segment_data + segment.length,
+              data->begin() + segment.offset);
+  }
+  return true;
+}
+
+bool ErofsFilesystem::ReadDirectory(const Inode& dir,
+                                    const string& prefix,
+                                    size_t depth) {
+  TEST_AND_RETURN_FALSE(depth < kMaxDirectoryDepth);
+  brillo::Blob data;
+  TEST_AND_RETURN_FALSE(ReadInodeData(dir, &data));
+
+  // Every directory block starts with the entries, followed by their names.
+  // The names aren't null terminated, except maybe the last one.
+  size_t block_size = GetBlockSize();
+  for (size_t start = 0; start < data.size(); start += block_size) {
+    const uint8_t* block = data.data() + start;
+    size_t size = std::min(block_size, data.size() - start);
+    TEST_AND_RETURN_FALSE(size >= kDirentSize);
+    size_t names_start = ReadLE16(block + 8);
+    TEST_AND_RETURN_FALSE(names_start >= kDirentSize &&
+                          names_start % kDirentSize == 0 &&
+                          names_start <= size);
+    size_t num_entries = names_start / kDirentSize;
+    for (size_t i = 0; i < num_entries; i++) {
+      const uint8_t* entry = block + i * kDirentSize;
+      uint64_t nid = ReadLE64(entry);
+      size_t name_start = ReadLE16(entry + 8);
+      size_t name_end = i + 1 < num_entries
+                            ? ReadLE16(entry + kDirentSize + 8)
+                            : size;
+      TEST_AND_RETURN_FALSE(name_start <= name_end && name_end <= size);
+      string name(block + name_start, block + name_end);
+      name.resize(strnlen(name.c_str(), name.size()));
+      if (name == "." || name == "..")
+        continue;
+      TEST_AND_RETURN_FALSE(!name.empty());
+
+      if (!visited_nids_.insert(nid).second)
+        continue;
+      Inode inode;
+      TEST_AND_RETURN_FALSE(ReadInode(nid, &inode));
+      string path = prefix + "/" + name;
+      TEST_AND_RETURN_FALSE(AddFile(inode, path));
+      if (S_ISDIR(inode.mode)) {
+        TEST_AND_RETURN_FALSE(ReadDirectory(inode, path, depth + 1));
+      } else if (S_ISREG(inode.mode) && path == kUpdateEngineConf) {
+        brillo::Blob config;
+        if (ReadInodeData(inode, &config)) {
+          update_engine_config_.assign(config.begin(), config.end());
+        } else {
+          LOG(WARNING) << "Failed to read " << kUpdateEngineConf;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool ErofsFilesystem::AddFile(const Inode& inode, const string& name) {
+  vector<Segment> segments;
+  TEST_AND_RETURN_FALSE(GetSegments(inode, &segments));
+
+  File file;
+  file.name = name;
+  file.file_stat.st_ino = inode.nid;
+  file.file_stat.st_mode = inode.mode;
+  file.file_stat.st_size = inode.size;
+  // The LZ4 layout is only kept if the extents hold all the pclusters and
+  // nothing else.
+  bool lz4_layout = true;
+  for (const Segment& segment : segments) {
+    if (segment.num_blocks == 0)
+      continue;
+    BlockExtent extent =
+        ExtentForRange(segment.start_block, segment.num_blocks);
+    TEST_AND_RETURN_FALSE(segment.start_block + segment.num_blocks <=
+                          block_count_);
+    // Skip the blocks shared with other files or with previous data of this
+    // file, like deduplicated pclusters.
+    vector<BlockExtent> new_extents =
+        FilterExtentRanges({extent}, used_blocks_);
+    used_blocks_.AddExtents(new_extents);
+    for (const BlockExtent& new_extent : new_extents) {
+      for (uint64_t block = new_extent.start_block();
+           block < new_extent.start_block() + new_extent.num_blocks();
+           block++) {
+        AppendBlockToExtents(&file.extents, block);
+      }
+    }
+
+    if ((segment.type != Segment::Type::kLz4 &&
+         segment.type != Segment::Type::kPlain) ||
+        new_extents != vector<BlockExtent>{extent}) {
+      lz4_layout = false;
+      continue;
+    }
+    Lz4Block block;
+    block.set_uncompressed_offset(segment.offset);
+    block.set_uncompressed_length(segment.length);
+    block.set_compressed_length(segment.num_blocks << block_size_bits_);
+    block.set_plain(segment.type == Segment::Type::kPlain);
+    file.lz4_blocks.push_back(std::move(block));
+  }
+  if (file.extents.empty())
+    return true;
+  if (lz4_layout) {
+    file.lz4_zero_padding = zero_padding_;
+  } else {
+    file.lz4_blocks.clear();
+  }
+  files_.push_back(std::move(file));
+  return true;
+}
+
+}  // namespace chromeos_update_engine
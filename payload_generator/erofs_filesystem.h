@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_EROFS_FILESYSTEM_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_EROFS_FILESYSTEM_H_
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/mapped_image.h"
+
+namespace chromeos_update_engine {
+
+// A FilesystemInterface for EROFS images, parsed in-process from a memory
+// mapping of the image using the on-disk format described in
+// fs/erofs/erofs_fs.h in the kernel tree. Uncompressed (plain, inline and
+// chunk based) and LZ4 compressed files with full or compact indexes are
+// supported. The LZ4 pclusters of every compressed file are reported in
+// |File::lz4_blocks|, so the files can be diffed uncompressed.
+class ErofsFilesystem : public FilesystemInterface {
+ public:
+  ~ErofsFilesystem() override = default;
+
+  // Creates the filesystem from the EROFS image |filename|. Returns nullptr
+  // if the file is not an EROFS image or it can't be parsed.
+  static std::unique_ptr<ErofsFilesystem> CreateFromFile(
+      const std::string& filename);
+
+  // FilesystemInterface overrides.
+  size_t GetBlockSize() const override;
+  size_t GetBlockCount() const override;
+
+  // Returns a File for every inode with data blocks, named after its first
+  // path, with the blocks in the order of its data. The data stored inline in
+  // the metadata blocks or in the fragments of the packed inode is left out,
+  // as are the blocks shared with a file returned before. All the other blocks
+  // are returned in the "<metadata>" pseudo-file.
+  bool GetFiles(std::vector<File>* files) const override;
+
+  // Loads the settings from /etc/update_engine.conf.
+  bool LoadSettings(brillo::KeyValueStore* store) const override;
+
+  // Returns whether |data|, the first bytes of an image, has the super block
+  // of an EROFS image.
+  static bool IsErofsImage(const brillo::Blob& data);
+
+ private:
+  // The fields of an on-disk inode we care about.
+  struct Inode {
+    uint64_t nid;
+    uint16_t mode;
+    uint64_t size;
+    uint8_t layout;
+    uint32_t raw_blkaddr;
+    // The byte offset in the image right after the inode and its xattrs,
+    // where the inline data or the compression indexes start.
+    uint64_t data_offset;
+  };
+
+  // A contiguous part of the data of an inode and where it is stored.
+  struct Segment {
+    enum class Type {
+      kRaw,      // Uncompressed in |num_blocks| blocks.
+      kHole,     // Not stored, reads as zeros.
+      kInline,   // Uncompressed at the byte |inline_offset| of the image.
+      kLz4,      // A LZ4 pcluster of |num_blocks| blocks.
+      kPlain,    // A pcluster of |num_blocks| blocks stored uncompressed.
+      kPacked,   // In a pcluster stored inline or in the packed inode.
+      kOther,    // A pcluster of |num_blocks| blocks compressed with another
+                 // algorithm.
+    };
+    Type type;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t start_block;
+    uint64_t num_blocks;
+    uint64_t inline_offset;
+  };
+
+  // A logical cluster index of a compressed inode.
+  struct Lcluster {
+    uint8_t type;
+    uint32_t cluster_offset;
+    uint32_t block;
+    // The number of compressed blocks of the pcluster, stored in the first
+    // non-head lcluster of big pclusters, or 0.
+    uint32_t compressed_blocks;
+  };
+
+  // The fields of the compression map header of a compressed inode.
+  struct CompressionMap {
+    uint16_t advise;
+    uint8_t algorithms;
+    uint32_t lcluster_bits;
+    uint64_t num_lclusters;
+    // The byte offset of the first index.
+    uint64_t indexes_offset;
+  };
+
+  explicit ErofsFilesystem(std::unique_ptr<MappedImage> image)
+      : image_(std::move(image)) {}
+
+  // Parses the super block and lists the files.
+  bool Init();
+
+  // Reads the inode |nid|.
+  bool ReadInode(uint64_t nid, Inode* inode) const;
+
+  // Stores where the data of |inode| is stored in |segments|, in order.
+  bool GetSegments(const Inode& inode, std::vector<Segment>* segments) const;
+  bool GetChunkSegments(const Inode& inode,
+                        std::vector<Segment>* segments) const;
+  bool GetCompressedSegments(const Inode& inode,
+                             std::vector<Segment>* segments) const;
+
+  // Loads the logical cluster |lcn| of a compressed inode with the
+  // compression map |map|, stored in full or compact indexes.
+  bool LoadFullLcluster(const CompressionMap& map,
+                        uint64_t lcn,
+                        Lcluster* lcluster) const;
+  bool LoadCompactLcluster(const CompressionMap& map,
+                           uint64_t lcn,
+                           Lcluster* lcluster) const;
+
+  // Reads the whole data of |inode| into |data|, decompressing it if needed.
+  bool ReadInodeData(const Inode& inode, brillo::Blob* data) const;
+
+  // Adds the inodes in the directory |dir| and its subdirectories to
+  // |files_|, prefixing their names with |prefix|.
+  bool ReadDirectory(const Inode& dir, const std::string& prefix, size_t depth);
+
+  // Adds the file |name| with the data of |inode| to |files_|.
+  bool AddFile(const Inode& inode, const std::string& name);
+
+  std::unique_ptr<MappedImage> image_;
+
+  // Super block fields.
+  uint32_t block_size_bits_{0};
+  uint64_t block_count_{0};
+  uint64_t meta_offset_{0};
+  uint64_t root_nid_{0};
+  bool zero_padding_{false};
+
+  // The inodes already listed, to list hard links and directories only once.
+  std::set<uint64_t> visited_nids_;
+  // The blocks used by the files in |files_|.
+  ExtentRanges used_blocks_;
+
+  // All the files in the filesystem.
+  std::vector<File> files_;
+
+  // The content of /etc/update_engine.conf, if any.
+  std::string update_engine_config_;
+
+  DISALLOW_COPY_AND_ASSIGN(ErofsFilesystem);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_EROFS_FILESYSTEM_H_
@@ -0,0 +1,242 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/erofs_filesystem.h"
+
+#include <endian.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <brillo/key_value_store.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/lz4patch.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kTestBlockSize = 4096;
+constexpr size_t kTestNumBlocks = 8;
+constexpr uint64_t kMetaOffset = kTestBlockSize;
+
+// The inodes of the test image, stored in the metadata block 1.
+constexpr uint64_t kRootNid = 0;
+constexpr uint64_t kPlainNid = 4;
+constexpr uint64_t kEtcNid = 6;
+constexpr uint64_t kConfNid = 8;
+constexpr uint64_t kLz4Nid = 12;
+
+constexpr char kConfContent[] = "PAYLOAD_MINOR_VERSION=1234\n";
+
+void WriteLE16(brillo::Blob* image, uint64_t offset, uint16_t value) {
+  value = htole16(value);
+  memcpy(image->data() + offset, &value, sizeof(value));
+}
+
+void WriteLE32(brillo::Blob* image, uint64_t offset, uint32_t value) {
+  value = htole32(value);
+  memcpy(image->data() + offset, &value, sizeof(value));
+}
+
+void WriteLE64(brillo::Blob* image, uint64_t offset, uint64_t value) {
+  value = htole64(value);
+  memcpy(image->data() + offset, &value, sizeof(value));
+}
+
+// Writes a compact inode |nid| with the data |layout| and returns the offset
+// right after it.
+uint64_t WriteInode(brillo::Blob* image,
+                    uint64_t nid,
+                    uint16_t mode,
+                    uint8_t layout,
+                    uint32_t size,
+                    uint32_t raw_blkaddr) {
+  uint64_t offset = kMetaOffset + nid * 32;
+  WriteLE16(image, offset, layout << 1);
+  WriteLE16(image, offset + 4, mode);
+  WriteLE32(image, offset + 8, size);
+  WriteLE32(image, offset + 16, raw_blkaddr);
+  return offset + 32;
+}
+
+// Returns the data of a directory with the entries |entries|, sorted by name.
+brillo::Blob DirectoryData(const map<string, uint64_t>& entries) {
+  brillo::Blob data(entries.size() * 12);
+  uint64_t offset = 0;
+  for (const auto& name_nid : entries) {
+    WriteLE64(&data, offset, name_nid.second);
+    WriteLE16(&data, offset + 8, data.size());
+    data.insert(data.end(), name_nid.first.begin(), name_nid.first.end());
+    offset += 12;
+  }
+  return data;
+}
+
+}  // namespace
+
+class ErofsFilesystemTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    image_.resize(kTestNumBlocks * kTestBlockSize);
+    // Super block with 4 KiB blocks, the metadata in the block 1 and the
+    // 0padding feature.
+    WriteLE32(&image_, 1024, 0xE0F5E1E2);
+    image_[1024 + 12] = 12;
+    WriteLE16(&image_, 1024 + 14, kRootNid);
+    WriteLE32(&image_, 1024 + 36, kTestNumBlocks);
+    WriteLE32(&image_, 1024 + 40, kMetaOffset / kTestBlockSize);
+    WriteLE32(&image_, 1024 + 80, 1);
+
+    // The root directory, stored inline.
+    brillo::Blob root = DirectoryData({{".", kRootNid},
+                                       {"..", kRootNid},
+                                       {"etc", kEtcNid},
+                                       {"lz4", kLz4Nid},
+                                       {"plain", kPlainNid}});
+    uint64_t offset =
+        WriteInode(&image_, kRootNid, S_IFDIR | 0755, 2, root.size(), 0);
+    std::copy(root.begin(), root.end(), image_.begin() + offset);
+
+    // A plain file in the blocks 3 and 4.
+    WriteInode(
+        &image_, kPlainNid, S_IFREG | 0644, 0, 2 * kTestBlockSize - 100, 3);
+    std::fill(image_.begin() + 3 * kTestBlockSize,
+              image_.begin() + 5 * kTestBlockSize,
+              'p');
+
+    // The /etc directory in the block 5, with the inline config file.
+    brillo::Blob etc = DirectoryData(
+        {{".", kEtcNid}, {"..", kRootNid}, {"update_engine.conf", kConfNid}});
+    WriteInode(&image_, kEtcNid, S_IFDIR | 0755, 0, etc.size(), 5);
+    std::copy(etc.begin(), etc.end(), image_.begin() + 5 * kTestBlockSize);
+    offset = WriteInode(
+        &image_, kConfNid, S_IFREG | 0644, 2, strlen(kConfContent), 0);
+    std::copy(kConfContent,
+              kConfContent + strlen(kConfContent),
+              image_.begin() + offset);
+
+    // A LZ4 compressed file with full indexes, with two pclusters in the
+    // blocks 6 and 7.
+    lz4_data_.resize(2 * kTestBlockSize);
+    for (size_t i = 0; i < lz4_data_.size(); i++)
+      lz4_data_[i] = "update_engine"[i % 13] + i / 1000;
+    offset = WriteInode(
+        &image_, kLz4Nid, S_IFREG | 0644, 1, lz4_data_.size(), 0);
+    for (uint32_t lcn = 0; lcn < 2; lcn++) {
+      uint64_t index = offset + 16 + lcn * 8;
+      WriteLE16(&image_, index, 1);  // HEAD1
+      WriteLE32(&image_, index + 4, 6 + lcn);
+      Lz4Block block;
+      block.set_uncompressed_offset(lcn * kTestBlockSize);
+      block.set_uncompressed_length(kTestBlockSize);
+      block.set_compressed_length(kTestBlockSize);
+      lz4_blocks_.push_back(block);
+    }
+    brillo::Blob compressed;
+    ASSERT_TRUE(Lz4CompressBlocks(
+        lz4_data_.data(), lz4_data_.size(), lz4_blocks_, true, 0, &compressed));
+    std::copy(compressed.begin(),
+              compressed.end(),
+              image_.begin() + 6 * kTestBlockSize);
+
+    ASSERT_TRUE(test_utils::WriteFileVector(image_file_.path(), image_));
+  }
+
+  map<string, FilesystemInterface::File> GetFilesByName(
+      const ErofsFilesystem& fs) {
+    vector<FilesystemInterface::File> files;
+    EXPECT_TRUE(fs.GetFiles(&files));
+    map<string, FilesystemInterface::File> result;
+    for (const FilesystemInterface::File& file : files)
+      result[file.name] = file;
+    return result;
+  }
+
+  ScopedTempFile image_file_{"ErofsFilesystemTest.XXXXXX"};
+  brillo::Blob image_;
+  brillo::Blob lz4_data_;
+  vector<Lz4Block> lz4_blocks_;
+};
+
+TEST_F(ErofsFilesystemTest, InvalidFilesystemTest) {
+  ASSERT_TRUE(test_utils::WriteFileVector(
+      image_file_.path(), brillo::Blob(kTestNumBlocks * kTestBlockSize)));
+  EXPECT_EQ(nullptr, ErofsFilesystem::CreateFromFile(image_file_.path()));
+  EXPECT_FALSE(ErofsFilesystem::IsErofsImage(brillo::Blob(4096)));
+  EXPECT_TRUE(ErofsFilesystem::IsErofsImage(image_));
+}
+
+TEST_F(ErofsFilesystemTest, ParseFilesTest) {
+  auto fs = ErofsFilesystem::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, fs);
+  EXPECT_EQ(kTestBlockSize, fs->GetBlockSize());
+  EXPECT_EQ(kTestNumBlocks, fs->GetBlockCount());
+
+  map<string, FilesystemInterface::File> files = GetFilesByName(*fs);
+  // The files with inline data only have no blocks.
+  EXPECT_EQ(0U, files.count("/"));
+  EXPECT_EQ(0U, files.count("/etc/update_engine.conf"));
+  ASSERT_EQ(4U, files.size());
+  EXPECT_EQ((vector<BlockExtent>{{0, 3}}), files["<metadata>"].extents);
+  EXPECT_EQ((vector<BlockExtent>{{3, 2}}), files["/plain"].extents);
+  EXPECT_TRUE(files["/plain"].lz4_blocks.empty());
+  EXPECT_EQ((vector<BlockExtent>{{5, 1}}), files["/etc"].extents);
+  EXPECT_TRUE(S_ISDIR(files["/etc"].file_stat.st_mode));
+}
+
+TEST_F(ErofsFilesystemTest, Lz4BlocksTest) {
+  auto fs = ErofsFilesystem::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, fs);
+  map<string, FilesystemInterface::File> files = GetFilesByName(*fs);
+  const FilesystemInterface::File& file = files["/lz4"];
+  EXPECT_EQ((vector<BlockExtent>{{6, 2}}), file.extents);
+  EXPECT_TRUE(file.lz4_zero_padding);
+  ASSERT_EQ(2U, file.lz4_blocks.size());
+
+  // The blocks decompress to the file data.
+  brillo::Blob uncompressed;
+  ASSERT_TRUE(Lz4DecompressBlocks(image_.data() + 6 * kTestBlockSize,
+                                  2 * kTestBlockSize,
+                                  file.lz4_blocks,
+                                  file.lz4_zero_padding,
+                                  &uncompressed));
+  EXPECT_EQ(lz4_data_, uncompressed);
+}
+
+TEST_F(ErofsFilesystemTest, LoadSettingsTest) {
+  auto fs = ErofsFilesystem::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, fs);
+  brillo::KeyValueStore store;
+  EXPECT_TRUE(fs->LoadSettings(&store));
+  string minor_version;
+  EXPECT_TRUE(store.GetString("PAYLOAD_MINOR_VERSION", &minor_version));
+  EXPECT_EQ("1234", minor_version);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,200 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/executable_diff.h"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/executable_patch.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The fields of the ELF64 file header and section headers used here.
+constexpr size_t kElfHeaderSize = 64;
+constexpr uint8_t kElfMagic[] = {0x7F, 'E', 'L', 'F'};
+constexpr size_t kElfClassOffset = 4;
+constexpr uint8_t kElfClass64 = 2;
+constexpr size_t kElfDataOffset = 5;
+constexpr uint8_t kElfDataLittleEndian = 1;
+constexpr size_t kElfMachineOffset = 18;
+constexpr uint16_t kElfMachineX86_64 = 62;
+constexpr uint16_t kElfMachineArm64 = 183;
+constexpr size_t kElfShoffOffset = 0x28;
+constexpr size_t kElfShentsizeOffset = 0x3A;
+constexpr size_t kElfShnumOffset = 0x3C;
+
+constexpr size_t kSectionHeaderSize = 64;
+constexpr size_t kSectionTypeOffset = 4;
+constexpr uint32_t kSectionTypeProgbits = 1;
+constexpr size_t kSectionFlagsOffset = 8;
+constexpr uint64_t kSectionFlagExecinstr = 0x4;
+constexpr size_t kSectionAddrOffset = 16;
+constexpr size_t kSectionOffsetOffset = 24;
+constexpr size_t kSectionSizeOffset = 32;
+
+template <typename T>
+T ReadLE(const uint8_t* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  switch (sizeof(T)) {
+    case 2:
+      return le16toh(value);
+    case 4:
+      return le32toh(value);
+    default:
+      return le64toh(value);
+  }
+}
+
+}  // namespace
+
+bool GetExecutableRegions(const uint8_t* data,
+                          size_t size,
+                          vector<ExecutableRegion>* regions) {
+  regions->clear();
+  if (size < kElfHeaderSize ||
+      memcmp(data, kElfMagic, sizeof(kElfMagic)) != 0 ||
+      data[kElfClassOffset] != kElfClass64 ||
+      data[kElfDataOffset] != kElfDataLittleEndian) {
+    return false;
+  }
+  ExecutableRegion::Architecture architecture;
+  switch (ReadLE<uint16_t>(data + kElfMachineOffset)) {
+    case kElfMachineX86_64:
+      architecture = ExecutableRegion::X86_64;
+      break;
+    case kElfMachineArm64:
+      architecture = ExecutableRegion::ARM64;
+      break;
+    default:
+      return false;
+  }
+
+  uint64_t shoff = ReadLE<uint64_t>(data + kElfShoffOffset);
+  uint16_t shentsize = ReadLE<uint16_t>(data + kElfShentsizeOffset);
+  uint16_t shnum = ReadLE<uint16_t>(data + kElfShnumOffset);
+  // The section headers are usually at the end of the file, so they are out
+  // of bounds when only the first chunk of a big file is diffed.
+  if (shentsize < kSectionHeaderSize || shoff > size ||
+      static_cast<uint64_t>(shentsize) * shnum > size - shoff) {
+    return false;
+  }
+  for (uint16_t i = 0; i < shnum; i++) {
+    const uint8_t* section = data + shoff + i * shentsize;
+    if (ReadLE<uint32_t>(section + kSectionTypeOffset) !=
+            kSectionTypeProgbits ||
+        !(ReadLE<uint64_t>(section + kSectionFlagsOffset) &
+          kSectionFlagExecinstr)) {
+      continue;
+    }
+    uint64_t offset = ReadLE<uint64_t>(section + kSectionOffsetOffset);
+    uint64_t length = ReadLE<uint64_t>(section + kSectionSizeOffset);
+    if (offset >= size)
+      continue;
+    length = std::min(length, size - offset);
+    ExecutableRegion region;
+    region.set_offset(offset);
+    region.set_length(length);
+    region.set_address(ReadLE<uint64_t>(section + kSectionAddrOffset));
+    region.set_architecture(architecture);
+    regions->push_back(region);
+  }
+
+  // The sections of a valid file don't overlap, but the regions of an
+  // EXECUTABLE_BSDIFF operation must not, so only the first of overlapping
+  // sections is kept.
+  std::sort(regions->begin(),
+            regions->end(),
+            [](const ExecutableRegion& a, const ExecutableRegion& b) {
+              return a.offset() < b.offset();
+            });
+  uint64_t end = 0;
+  auto overlapping = std::remove_if(
+      regions->begin(), regions->end(), [&end](const ExecutableRegion& region) {
+        if (region.offset() < end)
+          return true;
+        end = region.offset() + region.length();
+        return false;
+      });
+  if (overlapping != regions->end()) {
+    LOG(WARNING) << "Ignoring " << regions->end() - overlapping
+                 << " overlapping executable sections.";
+    regions->erase(overlapping, regions->end());
+  }
+  return !regions->empty();
+}
+
+bool ExecutableDiff(const brillo::Blob& old_data,
+                    const brillo::Blob& new_data,
+                    brillo::Blob* patch) {
+  ExecutableDiffHeader header;
+  vector<ExecutableRegion> old_regions, new_regions;
+  if (!GetExecutableRegions(old_data.data(), old_data.size(), &old_regions) ||
+      !GetExecutableRegions(new_data.data(), new_data.size(), &new_regions)) {
+    return false;
+  }
+  for (const ExecutableRegion& region : old_regions)
+    *header.add_src_regions() = region;
+  for (const ExecutableRegion& region : new_regions)
+    *header.add_dst_regions() = region;
+
+  brillo::Blob old_converted = old_data;
+  brillo::Blob new_converted = new_data;
+  TEST_AND_RETURN_FALSE(ConvertBranchTargets(
+      old_converted.data(), old_converted.size(), old_regions, true));
+  TEST_AND_RETURN_FALSE(ConvertBranchTargets(
+      new_converted.data(), new_converted.size(), new_regions, true));
+  brillo::Blob inner_patch;
+  TEST_AND_RETURN_FALSE(
+      diff_utils::GenerateBrotliBsdiff(old_converted.data(),
+                                       old_converted.size(),
+                                       new_converted.data(),
+                                       new_converted.size(),
+                                       &inner_patch));
+
+  std::string header_data;
+  TEST_AND_RETURN_FALSE(header.SerializeToString(&header_data));
+  uint32_t header_size = header_data.size();
+  patch->assign(kExecutableDiffMagic,
+                kExecutableDiffMagic + sizeof(kExecutableDiffMagic));
+  for (int shift = 24; shift >= 0; shift -= 8)
+    patch->push_back((header_size >> shift) & 0xFF);
+  patch->insert(patch->end(), header_data.begin(), header_data.end());
+  patch->insert(patch->end(), inner_patch.begin(), inner_patch.end());
+
+  brillo::Blob patched;
+  TEST_AND_RETURN_FALSE(
+      ExecutablePatch(old_data, patch->data(), patch->size(), &patched));
+  if (patched != new_data) {
+    LOG(WARNING) << "The executable diff doesn't reproduce the new data.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,52 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_EXECUTABLE_DIFF_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_EXECUTABLE_DIFF_H_
+
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Stores in |regions| the executable sections of the little endian ELF64
+// file for x86-64 or ARM64 of |size| bytes at |data|, which may be only the
+// start of the file; the sections are cut at |size|. Returns false if |data|
+// isn't such a file, its section headers are out of bounds or it has no
+// executable section. The regions are sorted by offset and only the first of
+// overlapping sections is kept.
+bool GetExecutableRegions(const uint8_t* data,
+                          size_t size,
+                          std::vector<ExecutableRegion>* regions);
+
+// Generates the blob of an EXECUTABLE_BSDIFF operation from the executable
+// |old_data| to the executable |new_data|. The branch targets in the code of
+// both files are converted to absolute addresses before diffing them with
+// bsdiff, so the many branches that only moved because code was inserted or
+// removed in between are equal in both files. The patch is verified with
+// ExecutablePatch() before returning it. Returns false if one of the files
+// isn't a supported executable or the patch can't be generated, in which case
+// another operation should be used.
+bool ExecutableDiff(const brillo::Blob& old_data,
+                    const brillo::Blob& new_data,
+                    brillo::Blob* patch);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_EXECUTABLE_DIFF_H_
@@ -0,0 +1,201 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/executable_diff.h"
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/executable_patch.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kTextOffset = 0x100;
+constexpr uint64_t kTextAddress = 0x401000;
+
+void WriteLE(brillo::Blob* data, size_t offset, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    (*data)[offset + i] = (value >> (8 * i)) & 0xFF;
+}
+
+// Returns a minimal ELF64 file for the machine |machine| with the executable
+// section |text| and a section header table with a null section and the
+// section of |text|.
+brillo::Blob MakeElf(uint16_t machine, const brillo::Blob& text) {
+  brillo::Blob elf(kTextOffset);
+  elf[0] = 0x7F;
+  elf[1] = 'E';
+  elf[2] = 'L';
+  elf[3] = 'F';
+  elf[4] = 2;  // ELFCLASS64
+  elf[5] = 1;  // ELFDATA2LSB
+  WriteLE(&elf, 18, machine, 2);
+  elf.insert(elf.end(), text.begin(), text.end());
+  uint64_t shoff = elf.size();
+  WriteLE(&elf, 0x28, shoff, 8);
+  WriteLE(&elf, 0x3A, 64, 2);
+  WriteLE(&elf, 0x3C, 2, 2);
+  elf.resize(shoff + 2 * 64);
+  size_t section = shoff + 64;
+  WriteLE(&elf, section + 4, 1, 4);    // SHT_PROGBITS
+  WriteLE(&elf, section + 8, 0x6, 8);  // SHF_ALLOC | SHF_EXECINSTR
+  WriteLE(&elf, section + 16, kTextAddress, 8);
+  WriteLE(&elf, section + 24, kTextOffset, 8);
+  WriteLE(&elf, section + 32, text.size(), 8);
+  return elf;
+}
+
+// Returns x86-64 code with random bytes and |num_calls| CALL instructions to
+// the absolute address |target|, every |spacing| bytes after |first_call|.
+brillo::Blob MakeX86Code(size_t size,
+                         size_t first_call,
+                         size_t spacing,
+                         uint64_t target) {
+  std::mt19937 gen(42);
+  brillo::Blob code(size);
+  for (uint8_t& byte : code)
+    byte = gen() % 0xE0;
+  for (size_t i = first_call; i + 5 <= size; i += spacing) {
+    code[i] = 0xE8;
+    WriteLE(&code, i + 1, target - (kTextAddress + i + 5), 4);
+  }
+  return code;
+}
+
+}  // namespace
+
+class ExecutableDiffTest : public ::testing::Test {};
+
+TEST_F(ExecutableDiffTest, GetExecutableRegionsTest) {
+  brillo::Blob text(64, 0x90);
+  brillo::Blob elf = MakeElf(62, text);
+  vector<ExecutableRegion> regions;
+  ASSERT_TRUE(GetExecutableRegions(elf.data(), elf.size(), &regions));
+  ASSERT_EQ(1U, regions.size());
+  EXPECT_EQ(kTextOffset, regions[0].offset());
+  EXPECT_EQ(text.size(), regions[0].length());
+  EXPECT_EQ(kTextAddress, regions[0].address());
+  EXPECT_EQ(ExecutableRegion::X86_64, regions[0].architecture());
+
+  elf = MakeElf(183, text);
+  ASSERT_TRUE(GetExecutableRegions(elf.data(), elf.size(), &regions));
+  ASSERT_EQ(1U, regions.size());
+  EXPECT_EQ(ExecutableRegion::ARM64, regions[0].architecture());
+}
+
+TEST_F(ExecutableDiffTest, GetExecutableRegionsRejectsOtherDataTest) {
+  vector<ExecutableRegion> regions;
+  brillo::Blob data(4096, 0x7F);
+  EXPECT_FALSE(GetExecutableRegions(data.data(), data.size(), &regions));
+  // Unsupported machine.
+  brillo::Blob elf = MakeElf(40, brillo::Blob(64, 0));
+  EXPECT_FALSE(GetExecutableRegions(elf.data(), elf.size(), &regions));
+  // The section headers are cut off.
+  elf = MakeElf(62, brillo::Blob(64, 0));
+  EXPECT_FALSE(GetExecutableRegions(elf.data(), elf.size() - 1, &regions));
+}
+
+TEST_F(ExecutableDiffTest, GetExecutableRegionsDropsOverlappingTest) {
+  brillo::Blob elf = MakeElf(62, brillo::Blob(64, 0x90));
+  // Add a copy of the executable section, moved by 16 bytes.
+  uint64_t shoff = elf.size() - 2 * 64;
+  brillo::Blob section(elf.begin() + shoff + 64, elf.end());
+  WriteLE(&section, 24, kTextOffset + 16, 8);
+  elf.insert(elf.end(), section.begin(), section.end());
+  WriteLE(&elf, 0x3C, 3, 2);
+
+  vector<ExecutableRegion> regions;
+  ASSERT_TRUE(GetExecutableRegions(elf.data(), elf.size(), &regions));
+  ASSERT_EQ(1U, regions.size());
+  EXPECT_EQ(kTextOffset, regions[0].offset());
+}
+
+TEST_F(ExecutableDiffTest, ConvertBranchTargetsRoundTripTest) {
+  std::mt19937 gen(7);
+  brillo::Blob data(8192);
+  for (uint8_t& byte : data)
+    byte = gen();
+  ExecutableRegion x86_region;
+  x86_region.set_offset(0);
+  x86_region.set_length(4096);
+  x86_region.set_address(0x1000);
+  x86_region.set_architecture(ExecutableRegion::X86_64);
+  ExecutableRegion arm64_region;
+  arm64_region.set_offset(4096);
+  arm64_region.set_length(4096);
+  arm64_region.set_address(0x2002);
+  arm64_region.set_architecture(ExecutableRegion::ARM64);
+  vector<ExecutableRegion> regions = {x86_region, arm64_region};
+
+  brillo::Blob converted = data;
+  ASSERT_TRUE(
+      ConvertBranchTargets(converted.data(), converted.size(), regions, true));
+  EXPECT_NE(data, converted);
+  ASSERT_TRUE(ConvertBranchTargets(
+      converted.data(), converted.size(), regions, false));
+  EXPECT_EQ(data, converted);
+
+  // Regions out of bounds are rejected.
+  x86_region.set_length(8193);
+  EXPECT_FALSE(ConvertBranchTargets(
+      converted.data(), converted.size(), {x86_region}, true));
+}
+
+TEST_F(ExecutableDiffTest, ConvertMakesMovedCallsEqualTest) {
+  // The same calls to the same target, 3 bytes apart.
+  brillo::Blob code = MakeX86Code(64, 0, 32, 0x500000);
+  brillo::Blob moved(3, 0x90);
+  moved.insert(moved.end(), code.begin(), code.end() - 3);
+  moved[3] = 0xE8;
+  WriteLE(&moved, 4, 0x500000 - (kTextAddress + 3 + 5), 4);
+  EXPECT_NE(brillo::Blob(code.begin() + 1, code.begin() + 5),
+            brillo::Blob(moved.begin() + 4, moved.begin() + 8));
+
+  ExecutableRegion region;
+  region.set_length(code.size());
+  region.set_address(kTextAddress);
+  region.set_architecture(ExecutableRegion::X86_64);
+  ASSERT_TRUE(ConvertBranchTargets(code.data(), code.size(), {region}, true));
+  ASSERT_TRUE(
+      ConvertBranchTargets(moved.data(), moved.size(), {region}, true));
+  EXPECT_EQ(brillo::Blob(code.begin() + 1, code.begin() + 5),
+            brillo::Blob(moved.begin() + 4, moved.begin() + 8));
+}
+
+TEST_F(ExecutableDiffTest, DiffAndPatchTest) {
+  brillo::Blob old_text = MakeX86Code(4096, 10, 40, 0x480000);
+  brillo::Blob new_text(16, 0x90);
+  new_text.insert(new_text.end(), old_text.begin(), old_text.end() - 16);
+  brillo::Blob old_elf = MakeElf(62, old_text);
+  brillo::Blob new_elf = MakeElf(62, new_text);
+
+  brillo::Blob patch;
+  ASSERT_TRUE(ExecutableDiff(old_elf, new_elf, &patch));
+  brillo::Blob patched;
+  ASSERT_TRUE(ExecutablePatch(old_elf, patch.data(), patch.size(), &patched));
+  EXPECT_EQ(new_elf, patched);
+
+  // Data that isn't an executable isn't diffed.
+  EXPECT_FALSE(ExecutableDiff(old_elf, brillo::Blob(4096, 1), &patch));
+}
+
+}  // namespace chromeos_update_engine
@@ -55,7 +55,7 @@ int ProcessInodeAllBlocks(ext2_filsys fs,
                           blk_t ref_blk,
                           int ref_offset,
                           void* priv) {
-  vector<Extent>* extents = static_cast<vector<Extent>*>(priv);
+  vector<BlockExtent>* extents = static_cast<vector<BlockExtent>*>(priv);
   AppendBlockToExtents(extents, *blocknr);
   return 0;
 }
@@ -345,7 +345,7 @@ bool Ext2Filesystem::LoadSettings(brillo::KeyValueStore* store) const {
     return false;
 
   // Load the list of blocks and then the contents of the inodes.
-  vector<Extent> extents;
+  vector<BlockExtent> extents;
   err = ext2fs_block_iterate2(filsys_,
                               ino_num,
                               BLOCK_FLAG_DATA_ONLY,
@@ -360,8 +360,11 @@ bool Ext2Filesystem::LoadSettings(brillo::KeyValueStore* store) const {
   // Sparse holes in the settings file are not supported.
   if (EXT2_I_SIZE(&ino_data) > physical_size)
     return false;
+  vector<Extent> proto_extents;
+  for (const BlockExtent& extent : extents)
+    proto_extents.push_back(extent.ToExtent());
   if (!utils::ReadExtents(
-          filename_, extents, &blob, physical_size, filsys_->blocksize))
+          filename_, proto_extents, &blob, physical_size, filsys_->blocksize))
     return false;
 
   string text(blob.begin(), blob.begin() + EXT2_I_SIZE(&ino_data));
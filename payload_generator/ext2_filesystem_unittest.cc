@@ -50,8 +50,9 @@ size_t kDefaultFilesystemBlockCount = 1024;
 size_t kDefaultFilesystemBlockSize = 4096;
 
 // Checks that all the blocks in |extents| are in the range [0, total_blocks).
-void ExpectBlocksInRange(const vector<Extent>& extents, uint64_t total_blocks) {
-  for (const Extent& extent : extents) {
+void ExpectBlocksInRange(const vector<BlockExtent>& extents,
+                         uint64_t total_blocks) {
+  for (const BlockExtent& extent : extents) {
     EXPECT_LE(0U, extent.start_block());
     EXPECT_LE(extent.start_block() + extent.num_blocks(), total_blocks);
   }
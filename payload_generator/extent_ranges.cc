@@ -31,7 +31,8 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
-bool ExtentRanges::ExtentsOverlapOrTouch(const Extent& a, const Extent& b) {
+bool ExtentRanges::ExtentsOverlapOrTouch(const BlockExtent& a,
+                                         const BlockExtent& b) {
   if (a.start_block() == b.start_block())
     return true;
   if (a.start_block() == kSparseHole || b.start_block() == kSparseHole)
@@ -43,7 +44,7 @@ bool ExtentRanges::ExtentsOverlapOrTouch(const Extent& a, const Extent& b) {
   }
 }
 
-bool ExtentRanges::ExtentsOverlap(const Extent& a, const Extent& b) {
+bool ExtentRanges::ExtentsOverlap(const BlockExtent& a, const BlockExtent& b) {
   if (a.start_block() == b.start_block())
     return true;
   if (a.start_block() == kSparseHole || b.start_block() == kSparseHole)
@@ -56,27 +57,28 @@ bool ExtentRanges::ExtentsOverlap(const Extent& a, const Extent& b) {
 }
 
 void ExtentRanges::AddBlock(uint64_t block) {
-  AddExtent(ExtentForRange(block, 1));
+  AddExtent(BlockExtent(block, 1));
 }
 
 void ExtentRanges::SubtractBlock(uint64_t block) {
-  SubtractExtent(ExtentForRange(block, 1));
+  SubtractExtent(BlockExtent(block, 1));
 }
 
 namespace {
 
-Extent UnionOverlappingExtents(const Extent& first, const Extent& second) {
+BlockExtent UnionOverlappingExtents(const BlockExtent& first,
+                                    const BlockExtent& second) {
   CHECK_NE(kSparseHole, first.start_block());
   CHECK_NE(kSparseHole, second.start_block());
   uint64_t start = std::min(first.start_block(), second.start_block());
   uint64_t end = std::max(first.start_block() + first.num_blocks(),
                           second.start_block() + second.num_blocks());
-  return ExtentForRange(start, end - start);
+  return BlockExtent(start, end - start);
 }
 
 }  // namespace
 
-void ExtentRanges::AddExtent(Extent extent) {
+void ExtentRanges::AddExtent(BlockExtent extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
@@ -104,23 +106,23 @@ void ExtentRanges::AddExtent(Extent extent) {
 
 namespace {
 // Returns base - subtractee (set subtraction).
-ExtentRanges::ExtentSet SubtractOverlappingExtents(const Extent& base,
-                                                   const Extent& subtractee) {
+ExtentRanges::ExtentSet SubtractOverlappingExtents(
+    const BlockExtent& base, const BlockExtent& subtractee) {
   ExtentRanges::ExtentSet ret;
   if (subtractee.start_block() > base.start_block()) {
-    ret.insert(ExtentForRange(base.start_block(),
-                              subtractee.start_block() - base.start_block()));
+    ret.insert(BlockExtent(base.start_block(),
+                           subtractee.start_block() - base.start_block()));
   }
   uint64_t base_end = base.start_block() + base.num_blocks();
   uint64_t subtractee_end = subtractee.start_block() + subtractee.num_blocks();
   if (base_end > subtractee_end) {
-    ret.insert(ExtentForRange(subtractee_end, base_end - subtractee_end));
+    ret.insert(BlockExtent(subtractee_end, base_end - subtractee_end));
   }
   return ret;
 }
 }  // namespace
 
-void ExtentRanges::SubtractExtent(const Extent& extent) {
+void ExtentRanges::SubtractExtent(const BlockExtent& extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
@@ -172,20 +174,14 @@ void ExtentRanges::SubtractRanges(const ExtentRanges& ranges) {
   }
 }
 
-void ExtentRanges::AddExtents(const vector<Extent>& extents) {
-  for (vector<Extent>::const_iterator it = extents.begin(), e = extents.end();
-       it != e;
-       ++it) {
-    AddExtent(*it);
-  }
+void ExtentRanges::AddExtents(const vector<BlockExtent>& extents) {
+  for (const BlockExtent& extent : extents)
+    AddExtent(extent);
 }
 
-void ExtentRanges::SubtractExtents(const vector<Extent>& extents) {
-  for (vector<Extent>::const_iterator it = extents.begin(), e = extents.end();
-       it != e;
-       ++it) {
-    SubtractExtent(*it);
-  }
+void ExtentRanges::SubtractExtents(const vector<BlockExtent>& extents) {
+  for (const BlockExtent& extent : extents)
+    SubtractExtent(extent);
 }
 
 void ExtentRanges::AddRepeatedExtents(
@@ -202,7 +198,7 @@ void ExtentRanges::SubtractRepeatedExtents(
   }
 }
 
-bool ExtentRanges::OverlapsWithExtent(const Extent& extent) const {
+bool ExtentRanges::OverlapsWithExtent(const BlockExtent& extent) const {
   for (const auto& entry : extent_set_) {
     if (ExtentsOverlap(entry, extent)) {
       return true;
@@ -212,13 +208,13 @@ bool ExtentRanges::OverlapsWithExtent(const Extent& extent) const {
 }
 
 bool ExtentRanges::ContainsBlock(uint64_t block) const {
-  auto lower = extent_set_.lower_bound(ExtentForRange(block, 1));
+  auto lower = extent_set_.lower_bound(BlockExtent(block, 1));
   // The block could be on the extent before the one in |lower|.
   if (lower != extent_set_.begin())
     lower--;
   // Any extent starting at block+1 or later is not interesting, so this is the
   // upper limit.
-  auto upper = extent_set_.lower_bound(ExtentForRange(block + 1, 0));
+  auto upper = extent_set_.lower_bound(BlockExtent(block + 1, 0));
   for (auto iter = lower; iter != upper; ++iter) {
     if (iter->start_block() <= block &&
         block < iter->start_block() + iter->num_blocks()) {
@@ -253,8 +249,9 @@ Extent ExtentForBytes(uint64_t block_size,
   return ExtentForRange(start_block, end_block - start_block);
 }
 
-vector<Extent> ExtentRanges::GetExtentsForBlockCount(uint64_t count) const {
-  vector<Extent> out;
+vector<BlockExtent> ExtentRanges::GetExtentsForBlockCount(
+    uint64_t count) const {
+  vector<BlockExtent> out;
   if (count == 0)
     return out;
   uint64_t out_blocks = 0;
@@ -264,7 +261,7 @@ vector<Extent> ExtentRanges::GetExtentsForBlockCount(uint64_t count) const {
        it != e;
        ++it) {
     const uint64_t blocks_needed = count - out_blocks;
-    const Extent& extent = *it;
+    const BlockExtent& extent = *it;
     out.push_back(extent);
     out_blocks += extent.num_blocks();
     if (extent.num_blocks() < blocks_needed)
@@ -281,11 +278,12 @@ vector<Extent> ExtentRanges::GetExtentsForBlockCount(uint64_t count) const {
   return out;
 }
 
-vector<Extent> FilterExtentRanges(const vector<Extent>& extents,
-                                  const ExtentRanges& ranges) {
-  vector<Extent> result;
+vector<BlockExtent> FilterExtentRanges(const vector<BlockExtent>& extents,
+                                       const ExtentRanges& ranges) {
+  vector<BlockExtent> result;
+  result.reserve(extents.size());
   const ExtentRanges::ExtentSet& extent_set = ranges.extent_set();
-  for (Extent extent : extents) {
+  for (BlockExtent extent : extents) {
     // The extents are sorted by the start_block. We want to iterate all the
     // Extents in the ExtentSet possibly overlapping the current |extent|. This
     // is achieved by looking from the extent whose start_block is *lower* than
@@ -297,7 +295,7 @@ vector<Extent> FilterExtentRanges(const vector<Extent>& extents,
     if (lower != extent_set.begin())
       lower--;
     auto upper = extent_set.lower_bound(
-        ExtentForRange(extent.start_block() + extent.num_blocks(), 0));
+        BlockExtent(extent.start_block() + extent.num_blocks(), 0));
     for (auto iter = lower; iter != upper; ++iter) {
       if (!ExtentRanges::ExtentsOverlap(extent, *iter))
         continue;
@@ -309,20 +307,20 @@ vector<Extent> FilterExtentRanges(const vector<Extent>& extents,
           extent.set_num_blocks(0);
           break;
         }
-        extent = ExtentForRange(extent.start_block() + cut_blocks,
-                                extent.num_blocks() - cut_blocks);
+        extent = BlockExtent(extent.start_block() + cut_blocks,
+                             extent.num_blocks() - cut_blocks);
       } else {
         // We need to cut blocks on the middle of the extent, possible up to the
         // end of it.
-        result.push_back(ExtentForRange(
-            extent.start_block(), iter->start_block() - extent.start_block()));
+        result.emplace_back(extent.start_block(),
+                            iter->start_block() - extent.start_block());
         uint64_t new_start = iter->start_block() + iter->num_blocks();
         uint64_t old_end = extent.start_block() + extent.num_blocks();
         if (new_start >= old_end) {
           extent.set_num_blocks(0);
           break;
         }
-        extent = ExtentForRange(new_start, old_end - new_start);
+        extent = BlockExtent(new_start, old_end - new_start);
       }
     }
     if (extent.num_blocks() > 0)
@@ -23,6 +23,7 @@
 
 #include <base/macros.h>
 
+#include "update_engine/payload_generator/block_extent.h"
 #include "update_engine/update_metadata.pb.h"
 
 // An ExtentRanges object represents an unordered collection of extents (and
@@ -35,7 +36,7 @@
 namespace chromeos_update_engine {
 
 struct ExtentLess {
-  bool operator()(const Extent& x, const Extent& y) const {
+  bool operator()(const BlockExtent& x, const BlockExtent& y) const {
     return x.start_block() < y.start_block();
   }
 };
@@ -47,15 +48,15 @@ Extent ExtentForBytes(uint64_t block_size,
 
 class ExtentRanges {
  public:
-  typedef std::set<Extent, ExtentLess> ExtentSet;
+  typedef std::set<BlockExtent, ExtentLess> ExtentSet;
 
   ExtentRanges() : blocks_(0) {}
   void AddBlock(uint64_t block);
   void SubtractBlock(uint64_t block);
-  void AddExtent(Extent extent);
-  void SubtractExtent(const Extent& extent);
-  void AddExtents(const std::vector<Extent>& extents);
-  void SubtractExtents(const std::vector<Extent>& extents);
+  void AddExtent(BlockExtent extent);
+  void SubtractExtent(const BlockExtent& extent);
+  void AddExtents(const std::vector<BlockExtent>& extents);
+  void SubtractExtents(const std::vector<BlockExtent>& extents);
   void AddRepeatedExtents(
       const ::google::protobuf::RepeatedPtrField<Extent>& exts);
   void SubtractRepeatedExtents(
@@ -64,13 +65,14 @@ class ExtentRanges {
   void SubtractRanges(const ExtentRanges& ranges);
 
   // Returns true if the input extent overlaps with the current ExtentRanges.
-  bool OverlapsWithExtent(const Extent& extent) const;
+  bool OverlapsWithExtent(const BlockExtent& extent) const;
 
   // Returns whether the block |block| is in this ExtentRange.
   bool ContainsBlock(uint64_t block) const;
 
-  static bool ExtentsOverlapOrTouch(const Extent& a, const Extent& b);
-  static bool ExtentsOverlap(const Extent& a, const Extent& b);
+  static bool ExtentsOverlapOrTouch(const BlockExtent& a,
+                                    const BlockExtent& b);
+  static bool ExtentsOverlap(const BlockExtent& a, const BlockExtent& b);
 
   // Dumps contents to the log file. Useful for debugging.
   void Dump() const;
@@ -82,7 +84,7 @@ class ExtentRanges {
   // using extents in extent_set_. The returned extents are not
   // removed from extent_set_. |count| must be less than or equal to
   // the number of blocks in this extent set.
-  std::vector<Extent> GetExtentsForBlockCount(uint64_t count) const;
+  std::vector<BlockExtent> GetExtentsForBlockCount(uint64_t count) const;
 
  private:
   ExtentSet extent_set_;
@@ -92,8 +94,8 @@ class ExtentRanges {
 // Filters out from the passed list of extents |extents| all the blocks in the
 // ExtentRanges set. Note that the order of the blocks in |extents| is preserved
 // omitting blocks present in the ExtentRanges |ranges|.
-std::vector<Extent> FilterExtentRanges(const std::vector<Extent>& extents,
-                                       const ExtentRanges& ranges);
+std::vector<BlockExtent> FilterExtentRanges(
+    const std::vector<BlockExtent>& extents, const ExtentRanges& ranges);
 
 }  // namespace chromeos_update_engine
 
@@ -220,27 +220,28 @@ TEST(ExtentRangesTest, MultipleRanges) {
 
 TEST(ExtentRangesTest, GetExtentsForBlockCountTest) {
   ExtentRanges ranges;
-  ranges.AddExtents(vector<Extent>(1, ExtentForRange(10, 30)));
+  ranges.AddExtents(vector<BlockExtent>(1, ExtentForRange(10, 30)));
   {
-    vector<Extent> zero_extents = ranges.GetExtentsForBlockCount(0);
+    vector<BlockExtent> zero_extents = ranges.GetExtentsForBlockCount(0);
     EXPECT_TRUE(zero_extents.empty());
   }
   ::google::protobuf::RepeatedPtrField<Extent> rep_field;
   *rep_field.Add() = ExtentForRange(30, 40);
   ranges.AddRepeatedExtents(rep_field);
-  ranges.SubtractExtents(vector<Extent>(1, ExtentForRange(20, 10)));
+  ranges.SubtractExtents(vector<BlockExtent>(1, ExtentForRange(20, 10)));
   *rep_field.Mutable(0) = ExtentForRange(50, 10);
   ranges.SubtractRepeatedExtents(rep_field);
   EXPECT_EQ(40U, ranges.blocks());
 
   for (int i = 0; i < 2; i++) {
-    vector<Extent> expected(2);
+    vector<BlockExtent> expected(2);
     expected[0] = ExtentForRange(10, 10);
     expected[1] = ExtentForRange(30, i == 0 ? 10 : 20);
-    vector<Extent> actual =
+    vector<BlockExtent> actual =
         ranges.GetExtentsForBlockCount(10 + expected[1].num_blocks());
     EXPECT_EQ(expected.size(), actual.size());
-    for (vector<Extent>::size_type j = 0, e = expected.size(); j != e; ++j) {
+    for (vector<BlockExtent>::size_type j = 0, e = expected.size(); j != e;
+         ++j) {
       EXPECT_EQ(expected[j].start_block(), actual[j].start_block())
           << "j = " << j;
       EXPECT_EQ(expected[j].num_blocks(), actual[j].num_blocks())
@@ -270,20 +271,23 @@ TEST(ExtentRangesTest, ContainsBlockTest) {
 
 TEST(ExtentRangesTest, FilterExtentRangesEmptyRanges) {
   ExtentRanges ranges;
-  EXPECT_EQ(vector<Extent>(), FilterExtentRanges(vector<Extent>(), ranges));
-  EXPECT_EQ(vector<Extent>{ExtentForRange(50, 10)},
-            FilterExtentRanges(vector<Extent>{ExtentForRange(50, 10)}, ranges));
+  EXPECT_EQ(vector<BlockExtent>(),
+            FilterExtentRanges(vector<BlockExtent>(), ranges));
+  EXPECT_EQ(
+      vector<BlockExtent>{ExtentForRange(50, 10)},
+      FilterExtentRanges(vector<BlockExtent>{ExtentForRange(50, 10)}, ranges));
   // Check that the empty Extents are ignored.
-  EXPECT_EQ((vector<Extent>{ExtentForRange(10, 10), ExtentForRange(20, 10)}),
-            FilterExtentRanges(vector<Extent>{ExtentForRange(10, 10),
-                                              ExtentForRange(3, 0),
-                                              ExtentForRange(20, 10)},
-                               ranges));
+  EXPECT_EQ(
+      (vector<BlockExtent>{ExtentForRange(10, 10), ExtentForRange(20, 10)}),
+      FilterExtentRanges(vector<BlockExtent>{ExtentForRange(10, 10),
+                                             ExtentForRange(3, 0),
+                                             ExtentForRange(20, 10)},
+                         ranges));
 }
 
 TEST(ExtentRangesTest, FilterExtentRangesMultipleRanges) {
   // Two overlapping extents, with three ranges to remove.
-  vector<Extent> extents{ExtentForRange(10, 100), ExtentForRange(30, 100)};
+  vector<BlockExtent> extents{ExtentForRange(10, 100), ExtentForRange(30, 100)};
   ExtentRanges ranges;
   // This overlaps the beginning of the second extent.
   ranges.AddExtent(ExtentForRange(28, 3));
@@ -291,16 +295,16 @@ TEST(ExtentRangesTest, FilterExtentRangesMultipleRanges) {
   ranges.AddExtent(ExtentForRange(70, 10));
   // This overlaps the end of the second extent.
   ranges.AddExtent(ExtentForRange(108, 6));
-  EXPECT_EQ((vector<Extent>{// For the first extent:
-                            ExtentForRange(10, 18),
-                            ExtentForRange(31, 19),
-                            ExtentForRange(60, 10),
-                            ExtentForRange(80, 28),
-                            // For the second extent:
-                            ExtentForRange(31, 19),
-                            ExtentForRange(60, 10),
-                            ExtentForRange(80, 28),
-                            ExtentForRange(114, 16)}),
+  EXPECT_EQ((vector<BlockExtent>{// For the first extent:
+                                 ExtentForRange(10, 18),
+                                 ExtentForRange(31, 19),
+                                 ExtentForRange(60, 10),
+                                 ExtentForRange(80, 28),
+                                 // For the second extent:
+                                 ExtentForRange(31, 19),
+                                 ExtentForRange(60, 10),
+                                 ExtentForRange(80, 28),
+                                 ExtentForRange(114, 16)}),
             FilterExtentRanges(extents, ranges));
 }
 
@@ -309,10 +313,10 @@ TEST(ExtentRangesTest, FilterExtentRangesOvelapping) {
   ranges.AddExtent(ExtentForRange(10, 3));
   ranges.AddExtent(ExtentForRange(20, 5));
   // Requested extent overlaps with one of the ranges.
-  EXPECT_EQ(vector<Extent>(),
-            FilterExtentRanges(
-                vector<Extent>{ExtentForRange(10, 1), ExtentForRange(22, 1)},
-                ranges));
+  EXPECT_EQ(vector<BlockExtent>(),
+            FilterExtentRanges(vector<BlockExtent>{ExtentForRange(10, 1),
+                                                   ExtentForRange(22, 1)},
+                               ranges));
 }
 
 }  // namespace chromeos_update_engine
@@ -35,10 +35,10 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
-void AppendBlockToExtents(vector<Extent>* extents, uint64_t block) {
+void AppendBlockToExtents(vector<BlockExtent>* extents, uint64_t block) {
   // First try to extend the last extent in |extents|, if any.
   if (!extents->empty()) {
-    Extent& extent = extents->back();
+    BlockExtent& extent = extents->back();
     uint64_t next_block = extent.start_block() == kSparseHole
                               ? kSparseHole
                               : extent.start_block() + extent.num_blocks();
@@ -48,17 +48,14 @@ void AppendBlockToExtents(vector<Extent>* extents, uint64_t block) {
     }
   }
   // If unable to extend the last extent, append a new single-block extent.
-  Extent new_extent;
-  new_extent.set_start_block(block);
-  new_extent.set_num_blocks(1);
-  extents->push_back(new_extent);
+  extents->emplace_back(block, 1);
 }
 
 void ExtendExtents(
     google::protobuf::RepeatedPtrField<Extent>* extents,
     const google::protobuf::RepeatedPtrField<Extent>& extents_to_add) {
-  vector<Extent> extents_vector;
-  vector<Extent> extents_to_add_vector;
+  vector<BlockExtent> extents_vector;
+  vector<BlockExtent> extents_to_add_vector;
   ExtentsToVector(*extents, &extents_vector);
   ExtentsToVector(extents_to_add, &extents_to_add_vector);
   extents_vector.insert(extents_vector.end(),
@@ -70,61 +67,76 @@ void ExtendExtents(
 }
 
 // Stores all Extents in 'extents' into 'out'.
-void StoreExtents(const vector<Extent>& extents,
+void StoreExtents(const vector<BlockExtent>& extents,
                   google::protobuf::RepeatedPtrField<Extent>* out) {
-  for (const Extent& extent : extents) {
+  out->Reserve(out->size() + extents.size());
+  for (const BlockExtent& extent : extents) {
     Extent* new_extent = out->Add();
-    *new_extent = extent;
+    new_extent->set_start_block(extent.start_block());
+    new_extent->set_num_blocks(extent.num_blocks());
   }
 }
 
 // Stores all extents in |extents| into |out_vector|.
 void ExtentsToVector(const google::protobuf::RepeatedPtrField<Extent>& extents,
-                     vector<Extent>* out_vector) {
-  out_vector->clear();
-  for (int i = 0; i < extents.size(); i++) {
-    out_vector->push_back(extents.Get(i));
-  }
+                     vector<BlockExtent>* out_vector) {
+  out_vector->assign(extents.begin(), extents.end());
 }
 
-string ExtentsToString(const vector<Extent>& extents) {
+string ExtentsToString(const vector<BlockExtent>& extents) {
   string ext_str;
-  for (const Extent& e : extents)
+  for (const BlockExtent& e : extents)
     ext_str += base::StringPrintf("[%" PRIu64 ", %" PRIu64 "] ",
                                   static_cast<uint64_t>(e.start_block()),
                                   static_cast<uint64_t>(e.num_blocks()));
   return ext_str;
 }
 
-void NormalizeExtents(vector<Extent>* extents) {
-  vector<Extent> new_extents;
-  for (const Extent& curr_ext : *extents) {
-    if (new_extents.empty()) {
-      new_extents.push_back(curr_ext);
-      continue;
-    }
-    Extent& last_ext = new_extents.back();
-    if (last_ext.start_block() + last_ext.num_blocks() ==
-        curr_ext.start_block()) {
+void NormalizeExtents(vector<BlockExtent>* extents) {
+  if (extents->empty())
+    return;
+  // Merge the extents in place: |last| is the last extent of the already
+  // normalized prefix of |extents|.
+  auto last = extents->begin();
+  for (auto curr = last + 1; curr != extents->end(); ++curr) {
+    if (last->start_block() + last->num_blocks() == curr->start_block()) {
       // If the extents are touching, we want to combine them.
-      last_ext.set_num_blocks(last_ext.num_blocks() + curr_ext.num_blocks());
+      last->set_num_blocks(last->num_blocks() + curr->num_blocks());
     } else {
       // Otherwise just include the extent as is.
-      new_extents.push_back(curr_ext);
+      *++last = *curr;
+    }
+  }
+  extents->erase(last + 1, extents->end());
+}
+
+void NormalizeExtents(google::protobuf::RepeatedPtrField<Extent>* extents) {
+  if (extents->empty())
+    return;
+  int last = 0;
+  for (int curr = 1; curr < extents->size(); curr++) {
+    Extent* last_extent = extents->Mutable(last);
+    const Extent& curr_extent = extents->Get(curr);
+    if (last_extent->start_block() + last_extent->num_blocks() ==
+        curr_extent.start_block()) {
+      last_extent->set_num_blocks(last_extent->num_blocks() +
+                                  curr_extent.num_blocks());
+    } else if (++last != curr) {
+      *extents->Mutable(last) = curr_extent;
     }
   }
-  *extents = new_extents;
+  extents->DeleteSubrange(last + 1, extents->size() - last - 1);
 }
 
-vector<Extent> ExtentsSublist(const vector<Extent>& extents,
-                              uint64_t block_offset,
-                              uint64_t block_count) {
-  vector<Extent> result;
+vector<BlockExtent> ExtentsSublist(const vector<BlockExtent>& extents,
+                                   uint64_t block_offset,
+                                   uint64_t block_count) {
+  vector<BlockExtent> result;
   uint64_t scanned_blocks = 0;
   if (block_count == 0)
     return result;
   uint64_t end_block_offset = block_offset + block_count;
-  for (const Extent& extent : extents) {
+  for (const BlockExtent& extent : extents) {
     // The loop invariant is that if |extents| has enough blocks, there's
     // still some extent to add to |result|. This implies that at the beginning
     // of the loop scanned_blocks < block_offset + block_count.
@@ -142,7 +154,7 @@ vector<Extent> ExtentsSublist(const vector<Extent>& extents,
         new_num_blocks -= block_offset - scanned_blocks;
         new_start += block_offset - scanned_blocks;
       }
-      result.push_back(ExtentForRange(new_start, new_num_blocks));
+      result.emplace_back(new_start, new_num_blocks);
     }
     scanned_blocks += extent.num_blocks();
     if (scanned_blocks >= end_block_offset)
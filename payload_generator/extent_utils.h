@@ -23,6 +23,7 @@
 #include <base/logging.h>
 
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/block_extent.h"
 #include "update_engine/update_metadata.pb.h"
 
 // Utility functions for manipulating Extents and lists of blocks.
@@ -32,9 +33,9 @@ namespace chromeos_update_engine {
 // |block| must either be the next block in the last extent or a block
 // in the next extent. This function will not handle inserting block
 // into an arbitrary place in the extents.
-void AppendBlockToExtents(std::vector<Extent>* extents, uint64_t block);
+void AppendBlockToExtents(std::vector<BlockExtent>* extents, uint64_t block);
 
-// Takes a collection (vector or RepeatedPtrField) of Extent and
+// Takes a collection (vector or RepeatedPtrField) of extents and
 // returns a vector of the blocks referenced, in order.
 template <typename T>
 std::vector<uint64_t> ExpandExtents(const T& extents) {
@@ -53,16 +54,17 @@ std::vector<uint64_t> ExpandExtents(const T& extents) {
   return ret;
 }
 
-// Stores all Extents in 'extents' into 'out'.
-void StoreExtents(const std::vector<Extent>& extents,
+// Stores all Extents in 'extents' into 'out'. This is where the extents of an
+// operation are converted to protobuf messages.
+void StoreExtents(const std::vector<BlockExtent>& extents,
                   google::protobuf::RepeatedPtrField<Extent>* out);
 
 // Stores all extents in |extents| into |out_vector|.
 void ExtentsToVector(const google::protobuf::RepeatedPtrField<Extent>& extents,
-                     std::vector<Extent>* out_vector);
+                     std::vector<BlockExtent>* out_vector);
 
 // Returns a string representing all extents in |extents|.
-std::string ExtentsToString(const std::vector<Extent>& extents);
+std::string ExtentsToString(const std::vector<BlockExtent>& extents);
 
 // Takes a pointer to extents |extents| and extents |extents_to_add|, and
 // merges them by adding |extents_to_add| to |extents| and normalizing.
@@ -73,15 +75,19 @@ void ExtendExtents(
 // Takes a vector of extents and normalizes those extents. Expects the extents
 // to be sorted by start block. E.g. if |extents| is [(1, 2), (3, 5), (10, 2)]
 // then |extents| will be changed to [(1, 7), (10, 2)].
-void NormalizeExtents(std::vector<Extent>* extents);
+void NormalizeExtents(std::vector<BlockExtent>* extents);
+
+// Same as above, but for the extents of an operation. Only consecutive
+// extents are combined, so the order of the blocks doesn't change.
+void NormalizeExtents(google::protobuf::RepeatedPtrField<Extent>* extents);
 
 // Return a subsequence of the list of blocks passed. Both the passed list of
-// blocks |extents| and the return value are expressed as a list of Extent, not
-// blocks. The returned list skips the first |block_offset| blocks from the
+// blocks |extents| and the return value are expressed as a list of extents,
+// not blocks. The returned list skips the first |block_offset| blocks from the
 // |extents| and cotains |block_count| blocks (or less if |extents| is shorter).
-std::vector<Extent> ExtentsSublist(const std::vector<Extent>& extents,
-                                   uint64_t block_offset,
-                                   uint64_t block_count);
+std::vector<BlockExtent> ExtentsSublist(const std::vector<BlockExtent>& extents,
+                                        uint64_t block_offset,
+                                        uint64_t block_count);
 
 bool operator==(const Extent& a, const Extent& b);
 
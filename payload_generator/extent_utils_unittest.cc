@@ -32,7 +32,7 @@ namespace chromeos_update_engine {
 class ExtentUtilsTest : public ::testing::Test {};
 
 TEST(ExtentUtilsTest, AppendSparseToExtentsTest) {
-  vector<Extent> extents;
+  vector<BlockExtent> extents;
 
   EXPECT_EQ(0U, extents.size());
   AppendBlockToExtents(&extents, kSparseHole);
@@ -53,7 +53,7 @@ TEST(ExtentUtilsTest, AppendSparseToExtentsTest) {
 
 TEST(ExtentUtilsTest, BlocksInExtentsTest) {
   {
-    vector<Extent> extents;
+    vector<BlockExtent> extents;
     EXPECT_EQ(0U, utils::BlocksInExtents(extents));
     extents.push_back(ExtentForRange(0, 1));
     EXPECT_EQ(1U, utils::BlocksInExtents(extents));
@@ -84,17 +84,32 @@ TEST(ExtentUtilsTest, ExtendExtentsTest) {
   *(second_op.add_src_extents()) = ExtentForRange(8, 2);
 
   ExtendExtents(first_op.mutable_src_extents(), second_op.src_extents());
-  vector<Extent> first_op_vec;
+  vector<BlockExtent> first_op_vec;
   ExtentsToVector(first_op.src_extents(), &first_op_vec);
   EXPECT_EQ(
-      (vector<Extent>{
+      (vector<BlockExtent>{
           ExtentForRange(1, 1), ExtentForRange(3, 3), ExtentForRange(8, 2)}),
       first_op_vec);
 }
 
+TEST(ExtentUtilsTest, StoreExtentsTest) {
+  vector<BlockExtent> extents = {ExtentForRange(10, 2), ExtentForRange(1, 1)};
+  InstallOperation op;
+  StoreExtents(extents, op.mutable_dst_extents());
+  ASSERT_EQ(2, op.dst_extents_size());
+  EXPECT_EQ(10U, op.dst_extents(0).start_block());
+  EXPECT_EQ(2U, op.dst_extents(0).num_blocks());
+  EXPECT_EQ(1U, op.dst_extents(1).start_block());
+  EXPECT_EQ(1U, op.dst_extents(1).num_blocks());
+
+  vector<BlockExtent> result;
+  ExtentsToVector(op.dst_extents(), &result);
+  EXPECT_EQ(extents, result);
+}
+
 TEST(ExtentUtilsTest, NormalizeExtentsSimpleList) {
   // Make sure it works when there's just one extent.
-  vector<Extent> extents;
+  vector<BlockExtent> extents;
   NormalizeExtents(&extents);
   EXPECT_EQ(0U, extents.size());
 
@@ -105,12 +120,12 @@ TEST(ExtentUtilsTest, NormalizeExtentsSimpleList) {
 }
 
 TEST(ExtentUtilsTest, NormalizeExtentsTest) {
-  vector<Extent> extents = {ExtentForRange(0, 3),
-                            ExtentForRange(3, 2),
-                            ExtentForRange(5, 1),
-                            ExtentForRange(8, 4),
-                            ExtentForRange(13, 1),
-                            ExtentForRange(14, 2)};
+  vector<BlockExtent> extents = {ExtentForRange(0, 3),
+                                 ExtentForRange(3, 2),
+                                 ExtentForRange(5, 1),
+                                 ExtentForRange(8, 4),
+                                 ExtentForRange(13, 1),
+                                 ExtentForRange(14, 2)};
   NormalizeExtents(&extents);
   EXPECT_EQ(3U, extents.size());
   EXPECT_EQ(ExtentForRange(0, 6), extents[0]);
@@ -118,23 +133,47 @@ TEST(ExtentUtilsTest, NormalizeExtentsTest) {
   EXPECT_EQ(ExtentForRange(13, 3), extents[2]);
 }
 
+TEST(ExtentUtilsTest, NormalizeOperationExtentsTest) {
+  InstallOperation op;
+  NormalizeExtents(op.mutable_src_extents());
+  EXPECT_EQ(0, op.src_extents_size());
+
+  for (const Extent& extent : {ExtentForRange(10, 2),
+                               ExtentForRange(12, 1),
+                               ExtentForRange(0, 3),
+                               ExtentForRange(3, 2),
+                               ExtentForRange(20, 1),
+                               ExtentForRange(21, 4)}) {
+    *op.add_src_extents() = extent;
+  }
+  NormalizeExtents(op.mutable_src_extents());
+  vector<BlockExtent> result;
+  ExtentsToVector(op.src_extents(), &result);
+  // The extents are not sorted.
+  EXPECT_EQ((vector<BlockExtent>{ExtentForRange(10, 3),
+                                 ExtentForRange(0, 5),
+                                 ExtentForRange(20, 5)}),
+            result);
+}
+
 TEST(ExtentUtilsTest, ExtentsSublistTest) {
-  vector<Extent> extents = {
+  vector<BlockExtent> extents = {
       ExtentForRange(10, 10), ExtentForRange(30, 10), ExtentForRange(50, 10)};
 
   // Simple empty result cases.
-  EXPECT_EQ(vector<Extent>(), ExtentsSublist(extents, 1000, 20));
-  EXPECT_EQ(vector<Extent>(), ExtentsSublist(extents, 5, 0));
-  EXPECT_EQ(vector<Extent>(), ExtentsSublist(extents, 30, 1));
+  EXPECT_EQ(vector<BlockExtent>(), ExtentsSublist(extents, 1000, 20));
+  EXPECT_EQ(vector<BlockExtent>(), ExtentsSublist(extents, 5, 0));
+  EXPECT_EQ(vector<BlockExtent>(), ExtentsSublist(extents, 30, 1));
 
   // Normal test cases.
-  EXPECT_EQ(vector<Extent>{ExtentForRange(13, 2)},
+  EXPECT_EQ(vector<BlockExtent>{ExtentForRange(13, 2)},
             ExtentsSublist(extents, 3, 2));
-  EXPECT_EQ(vector<Extent>{ExtentForRange(15, 5)},
+  EXPECT_EQ(vector<BlockExtent>{ExtentForRange(15, 5)},
             ExtentsSublist(extents, 5, 5));
-  EXPECT_EQ((vector<Extent>{ExtentForRange(15, 5), ExtentForRange(30, 5)}),
-            ExtentsSublist(extents, 5, 10));
-  EXPECT_EQ((vector<Extent>{
+  EXPECT_EQ(
+      (vector<BlockExtent>{ExtentForRange(15, 5), ExtentForRange(30, 5)}),
+      ExtentsSublist(extents, 5, 10));
+  EXPECT_EQ((vector<BlockExtent>{
                 ExtentForRange(13, 7),
                 ExtentForRange(30, 10),
                 ExtentForRange(50, 3),
@@ -142,16 +181,17 @@ TEST(ExtentUtilsTest, ExtentsSublistTest) {
             ExtentsSublist(extents, 3, 20));
 
   // Extact match case.
-  EXPECT_EQ(vector<Extent>{ExtentForRange(30, 10)},
+  EXPECT_EQ(vector<BlockExtent>{ExtentForRange(30, 10)},
             ExtentsSublist(extents, 10, 10));
-  EXPECT_EQ(vector<Extent>{ExtentForRange(50, 10)},
+  EXPECT_EQ(vector<BlockExtent>{ExtentForRange(50, 10)},
             ExtentsSublist(extents, 20, 10));
 
   // Cases where the requested num_blocks is too big.
-  EXPECT_EQ(vector<Extent>{ExtentForRange(53, 7)},
+  EXPECT_EQ(vector<BlockExtent>{ExtentForRange(53, 7)},
             ExtentsSublist(extents, 23, 100));
-  EXPECT_EQ((vector<Extent>{ExtentForRange(34, 6), ExtentForRange(50, 10)}),
-            ExtentsSublist(extents, 14, 100));
+  EXPECT_EQ(
+      (vector<BlockExtent>{ExtentForRange(34, 6), ExtentForRange(50, 10)}),
+      ExtentsSublist(extents, 14, 100));
 }
 
 }  // namespace chromeos_update_engine
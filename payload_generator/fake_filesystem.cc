@@ -37,11 +37,11 @@ bool FakeFilesystem::GetFiles(std::vector<File>* files) const {
 }
 
 void FakeFilesystem::AddFile(const std::string& filename,
-                             const std::vector<Extent>& extents) {
+                             const std::vector<BlockExtent>& extents) {
   File file;
   file.name = filename;
   file.extents = extents;
-  for (const Extent& extent : extents) {
+  for (const BlockExtent& extent : extents) {
     EXPECT_LE(0U, extent.start_block());
     EXPECT_LE(extent.start_block() + extent.num_blocks(), block_count_);
   }
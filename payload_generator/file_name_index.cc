@@ -0,0 +1,213 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/file_name_index.h"
+
+#include <algorithm>
+#include <numeric>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The number of characters in a trigram, and the number of padding characters
+// added at each end of a name so every character is in three trigrams.
+constexpr size_t kGramSize = 3;
+constexpr size_t kPadding = kGramSize - 1;
+
+// Trigrams present in more than this many names, or in more than
+// 1/|kFrequentNamesDivisor| of the names, are not indexed.
+constexpr size_t kMinFrequentNames = 128;
+constexpr size_t kFrequentNamesDivisor = 32;
+
+// The number of (padded) trigrams of a name of |length| characters.
+size_t NumTrigrams(size_t length) {
+  return length + kPadding;
+}
+
+// Returns a lower bound of the Levenshtein distance between two names of
+// |length_a| and |length_b| characters with at most |shared| trigrams in
+// common. Every edit operation removes at most |kGramSize| of the trigrams
+// the names have in common.
+size_t DistanceLowerBound(size_t length_a, size_t length_b, size_t shared) {
+  size_t length_diff =
+      length_a > length_b ? length_a - length_b : length_b - length_a;
+  size_t num_trigrams = NumTrigrams(std::max(length_a, length_b));
+  size_t gram_bound = 0;
+  if (num_trigrams > shared)
+    gram_bound = (num_trigrams - shared + kGramSize - 1) / kGramSize;
+  return std::max(length_diff, gram_bound);
+}
+
+}  // namespace
+
+FileNameIndex::FileNameIndex(vector<string> names) : names_(std::move(names)) {
+  vector<TrigramCounts> trigrams;
+  trigrams.reserve(names_.size());
+  std::unordered_map<uint32_t, size_t> num_names;
+  for (const string& name : names_) {
+    trigrams.push_back(GetTrigrams(name));
+    for (const auto& trigram_count : trigrams.back())
+      num_names[trigram_count.first]++;
+  }
+
+  size_t max_names =
+      std::max(kMinFrequentNames, names_.size() / kFrequentNamesDivisor);
+  for (const auto& trigram_names : num_names) {
+    if (trigram_names.second > max_names)
+      frequent_trigrams_.insert(trigram_names.first);
+  }
+
+  for (size_t i = 0; i < trigrams.size(); i++) {
+    for (const auto& trigram_count : trigrams[i]) {
+      if (frequent_trigrams_.count(trigram_count.first) == 0) {
+        postings_[trigram_count.first].emplace_back(i, trigram_count.second);
+      }
+    }
+  }
+}
+
+size_t FileNameIndex::FindClosest(const string& name) const {
+  if (names_.empty())
+    return kNotFound;
+
+  // Count the trigrams every indexed name has in common with |name|. The
+  // frequent trigrams of |name| might be shared with any name.
+  std::unordered_map<uint32_t, uint32_t> shared;
+  uint32_t num_frequent = 0;
+  for (const auto& trigram_count : GetTrigrams(name)) {
+    if (frequent_trigrams_.count(trigram_count.first)) {
+      num_frequent += trigram_count.second;
+      continue;
+    }
+    auto postings_it = postings_.find(trigram_count.first);
+    if (postings_it == postings_.end())
+      continue;
+    for (const auto& name_count : postings_it->second) {
+      shared[name_count.first] +=
+          std::min(name_count.second, trigram_count.second);
+    }
+  }
+
+  // Check the candidates in increasing order of their distance lower bound,
+  // and in order of appearance for the same bound.
+  vector<std::pair<size_t, uint32_t>> candidates;
+  candidates.reserve(shared.size());
+  for (const auto& name_shared : shared) {
+    candidates.emplace_back(
+        DistanceLowerBound(name.size(),
+                           names_[name_shared.first].size(),
+                           name_shared.second + num_frequent),
+        name_shared.first);
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  size_t best_distance = SIZE_MAX;
+  size_t best_index = kNotFound;
+  // Returns whether the name at |index| with a distance of at least
+  // |lower_bound| could be a better match than the current one.
+  auto could_improve = [&](size_t lower_bound, size_t index) {
+    return lower_bound < best_distance ||
+           (lower_bound == best_distance && index < best_index);
+  };
+  auto check = [&](size_t index) {
+    size_t distance = LevenshteinDistance(name, names_[index], best_distance);
+    if (could_improve(distance, index)) {
+      best_distance = distance;
+      best_index = index;
+    }
+  };
+
+  for (const auto& candidate : candidates) {
+    if (!could_improve(candidate.first, candidate.second))
+      break;
+    check(candidate.second);
+  }
+
+  // The names without any indexed trigram in common with |name| can only share
+  // the frequent ones, so they are checked only if that could be enough.
+  size_t others_lower_bound =
+      DistanceLowerBound(name.size(), name.size(), num_frequent);
+  if (shared.size() == names_.size() || others_lower_bound > best_distance)
+    return best_index;
+
+  candidates.clear();
+  for (size_t i = 0; i < names_.size(); i++) {
+    size_t lower_bound =
+        DistanceLowerBound(name.size(), names_[i].size(), num_frequent);
+    if (shared.count(i) == 0 && could_improve(lower_bound, i))
+      candidates.emplace_back(lower_bound, i);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  for (const auto& candidate : candidates) {
+    if (!could_improve(candidate.first, candidate.second))
+      break;
+    check(candidate.second);
+  }
+  return best_index;
+}
+
+size_t FileNameIndex::LevenshteinDistance(const string& a,
+                                          const string& b,
+                                          size_t max_distance) {
+  vector<size_t> distances(a.size() + 1);
+  std::iota(distances.begin(), distances.end(), 0);
+
+  for (size_t i = 1; i <= b.size(); i++) {
+    distances[0] = i;
+    size_t previous_distance = i - 1;
+    size_t row_min = distances[0];
+    for (size_t j = 1; j <= a.size(); j++) {
+      size_t new_distance =
+          std::min({distances[j] + 1,
+                    distances[j - 1] + 1,
+                    previous_distance + (a[j - 1] == b[i - 1] ? 0 : 1)});
+      previous_distance = distances[j];
+      distances[j] = new_distance;
+      row_min = std::min(row_min, new_distance);
+    }
+    // The distance can't decrease in the following rows.
+    if (row_min > max_distance)
+      return row_min;
+  }
+  return distances.back();
+}
+
+FileNameIndex::TrigramCounts FileNameIndex::GetTrigrams(const string& name) {
+  string padded = string(kPadding, '\0') + name + string(kPadding, '\0');
+  vector<uint32_t> trigrams;
+  trigrams.reserve(NumTrigrams(name.size()));
+  for (size_t i = 0; i + kGramSize <= padded.size(); i++) {
+    trigrams.push_back(static_cast<uint8_t>(padded[i]) << 16 |
+                       static_cast<uint8_t>(padded[i + 1]) << 8 |
+                       static_cast<uint8_t>(padded[i + 2]));
+  }
+  std::sort(trigrams.begin(), trigrams.end());
+
+  TrigramCounts result;
+  for (uint32_t trigram : trigrams) {
+    if (!result.empty() && result.back().first == trigram)
+      result.back().second++;
+    else
+      result.emplace_back(trigram, 1);
+  }
+  return result;
+}
+
+}  // namespace chromeos_update_engine
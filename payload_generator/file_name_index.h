@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_FILE_NAME_INDEX_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_FILE_NAME_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// An index over a list of file names to find the name with the shortest
+// Levenshtein distance to a given one without computing the distance to every
+// name in the list.
+//
+// Every name is split in its trigrams. The number of trigrams two names have in
+// common gives a lower bound of their distance, since every edit operation
+// changes at most three trigrams. The candidates are checked in increasing
+// order of that bound, so only the names that could be closer than the best
+// match found so far are compared. Trigrams present in a large fraction of the
+// names (like the ones in "/system/") are not indexed, they only weaken the
+// bound.
+//
+// The index is immutable once built and FindClosest() can be called from
+// several threads at the same time.
+class FileNameIndex {
+ public:
+  // Returned by FindClosest() when the index is empty.
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+  explicit FileNameIndex(std::vector<std::string> names);
+  ~FileNameIndex() = default;
+
+  // Returns the position in the list of names of the name with the shortest
+  // Levenshtein distance to |name|, or |kNotFound| if there are no names. If
+  // several names are at the same distance, the first one is returned.
+  size_t FindClosest(const std::string& name) const;
+
+  const std::string& name(size_t index) const { return names_[index]; }
+  size_t size() const { return names_.size(); }
+
+  // Returns the Levenshtein distance between |a| and |b|. If the distance is
+  // bigger than |max_distance| the computation may stop early and return any
+  // value bigger than |max_distance|.
+  static size_t LevenshteinDistance(const std::string& a,
+                                    const std::string& b,
+                                    size_t max_distance = SIZE_MAX);
+
+ private:
+  // The trigrams of a name and the number of times each of them appears.
+  using TrigramCounts = std::vector<std::pair<uint32_t, uint32_t>>;
+
+  static TrigramCounts GetTrigrams(const std::string& name);
+
+  std::vector<std::string> names_;
+
+  // For every indexed trigram, the names containing it and how many times.
+  std::unordered_map<uint32_t, std::vector<std::pair<uint32_t, uint32_t>>>
+      postings_;
+
+  // The trigrams present in too many names to be indexed.
+  std::unordered_set<uint32_t> frequent_trigrams_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileNameIndex);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_FILE_NAME_INDEX_H_
@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/file_name_index.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns the position of the first name in |names| with the shortest
+// Levenshtein distance to |name|, comparing it with every name.
+size_t FindClosestSlow(const vector<string>& names, const string& name) {
+  size_t best_index = FileNameIndex::kNotFound;
+  size_t best_distance = SIZE_MAX;
+  for (size_t i = 0; i < names.size(); i++) {
+    size_t distance = FileNameIndex::LevenshteinDistance(name, names[i]);
+    if (distance < best_distance) {
+      best_distance = distance;
+      best_index = i;
+    }
+  }
+  return best_index;
+}
+
+}  // namespace
+
+class FileNameIndexTest : public ::testing::Test {};
+
+TEST_F(FileNameIndexTest, LevenshteinDistanceTest) {
+  EXPECT_EQ(0U, FileNameIndex::LevenshteinDistance("", ""));
+  EXPECT_EQ(3U, FileNameIndex::LevenshteinDistance("abc", ""));
+  EXPECT_EQ(3U, FileNameIndex::LevenshteinDistance("", "abc"));
+  EXPECT_EQ(3U, FileNameIndex::LevenshteinDistance("kitten", "sitting"));
+  EXPECT_EQ(1U, FileNameIndex::LevenshteinDistance("version1", "version2"));
+  // The computation can stop once the distance is known to be too big.
+  EXPECT_LT(2U, FileNameIndex::LevenshteinDistance("aaaaaa", "bbbbbb", 2));
+}
+
+TEST_F(FileNameIndexTest, EmptyIndexTest) {
+  FileNameIndex index({});
+  EXPECT_EQ(FileNameIndex::kNotFound, index.FindClosest("filename"));
+}
+
+TEST_F(FileNameIndexTest, FindClosestTest) {
+  FileNameIndex index({"/system/app/Foo/Foo.apk",
+                       "/system/app/Bar/Bar.apk",
+                       "/system/lib/libfoo.so",
+                       "/vendor/etc/foo.conf"});
+  EXPECT_EQ(0U, index.FindClosest("/system/app/Foo/Foo.apk"));
+  EXPECT_EQ(0U, index.FindClosest("/system/app/Foo2/Foo2.apk"));
+  EXPECT_EQ(1U, index.FindClosest("/system/app/Bar/Bar2.apk"));
+  EXPECT_EQ(2U, index.FindClosest("/system/lib/libfoo2.so"));
+  EXPECT_EQ(3U, index.FindClosest("/vendor/etc/foo2.conf"));
+  // Names without any trigram in common still find the closest one.
+  EXPECT_EQ(3U, index.FindClosest("x"));
+}
+
+TEST_F(FileNameIndexTest, SameDistancePicksFirstTest) {
+  FileNameIndex index({"ab", "cb", "ab"});
+  EXPECT_EQ(0U, index.FindClosest("xb"));
+  EXPECT_EQ(1U, index.FindClosest("cb"));
+}
+
+// Compare the results of the index with the exhaustive search on many similar
+// names, so some trigrams are too frequent to be indexed.
+TEST_F(FileNameIndexTest, MatchesExhaustiveSearchTest) {
+  std::mt19937 gen(42);
+  const vector<string> dirs = {
+      "/system/app/", "/system/priv-app/", "/system/lib64/", "/vendor/etc/"};
+  auto random_name = [&]() {
+    string name = dirs[gen() % dirs.size()];
+    size_t length = 1 + gen() % 12;
+    for (size_t i = 0; i < length; i++)
+      name += "abcdefgh._-0123"[gen() % 15];
+    return name;
+  };
+
+  vector<string> names;
+  for (size_t i = 0; i < 500; i++)
+    names.push_back(random_name());
+  FileNameIndex index(names);
+
+  for (size_t i = 0; i < 200; i++) {
+    string name = random_name();
+    EXPECT_EQ(FindClosestSlow(names, name), index.FindClosest(name)) << name;
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -35,6 +35,7 @@
 #include <brillo/key_value_store.h>
 #include <puffin/utils.h>
 
+#include "update_engine/payload_generator/block_extent.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -60,7 +61,7 @@ class FilesystemInterface {
     // the same order as the logical data. All the block numbers shall be
     // between 0 and GetBlockCount() - 1. The blocks are encoded in extents,
     // indicating the starting block, and the number of consecutive blocks.
-    std::vector<Extent> extents;
+    std::vector<BlockExtent> extents;
 
     // If true, the file is already compressed on the disk, so we don't need to
     // parse it again for deflates. For example, image .gz files inside a
@@ -72,6 +73,16 @@ class FilesystemInterface {
     // All the deflate locations in the file. These locations are not relative
     // to the extents. They are relative to the file system itself.
     std::vector<puffin::BitExtent> deflates;
+
+    // For files compressed by the filesystem in independent LZ4 blocks, like
+    // the pclusters of EROFS, the layout of those blocks, stored back-to-back
+    // in |extents|. Empty if the file isn't compressed this way or |extents|
+    // hold any other data.
+    std::vector<Lz4Block> lz4_blocks;
+
+    // Whether the compressed data of the |lz4_blocks| is stored at the end of
+    // the blocks instead of the start.
+    bool lz4_zero_padding = false;
   };
 
   virtual ~FilesystemInterface() = default;
@@ -101,7 +101,7 @@ bool ChunkProcessor::ProcessChunk() {
 
   InstallOperation::Type op_type;
   TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
-      buffer_in_, version_, &op_blob, &op_type));
+      buffer_in_, version_, &op_blob, &op_type, nullptr));
 
   aop_->op.set_type(op_type);
   TEST_AND_RETURN_FALSE(aop_->SetOperationBlob(op_blob, blob_file_));
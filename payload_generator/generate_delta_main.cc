@@ -14,7 +14,9 @@
 // limitations under the License.
 //
 
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -25,6 +27,7 @@
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
+#include <base/time/time.h>
 #include <brillo/flag_helper.h>
 #include <brillo/key_value_store.h>
 #include <brillo/message_loops/base_message_loop.h>
@@ -40,9 +43,11 @@
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/generation_report.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/payload_generator/payload_properties.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/target_cache.h"
 #include "update_engine/payload_generator/xz.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -303,6 +308,37 @@ bool ParsePerPartitionTimestamps(const string& partition_timestamps,
   return true;
 }
 
+// Replaces the source image of |config| with the partitions in
+// |old_partitions|, named as |partition_names|, and their optional
+// |old_mapfiles|.
+void SetSourcePartitions(const vector<string>& partition_names,
+                         const vector<string>& old_partitions,
+                         const vector<string>& old_mapfiles,
+                         PayloadGenerationConfig* config) {
+  config->source = ImageConfig();
+  for (size_t i = 0; i < partition_names.size(); i++) {
+    config->source.partitions.emplace_back(partition_names[i]);
+    config->source.partitions.back().path = old_partitions[i];
+    if (i < old_mapfiles.size())
+      config->source.partitions.back().mapfile_path = old_mapfiles[i];
+  }
+}
+
+// Splits the comma separated list of output files |flag| of a flag named
+// |flag_name|, which must have one file per payload, out of |num_payloads|.
+// An empty |flag| results in no files.
+vector<string> SplitOutputFilesFlag(const string& flag,
+                                    const string& flag_name,
+                                    size_t num_payloads) {
+  if (flag.empty())
+    return {};
+  vector<string> files = base::SplitString(
+      flag, ",", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
+  LOG_IF(FATAL, files.size() != num_payloads)
+      << "--" << flag_name << " must have one file per source image.";
+  return files;
+}
+
 int Main(int argc, char** argv) {
   DEFINE_string(old_image, "", "Path to the old rootfs");
   DEFINE_string(new_image, "", "Path to the new rootfs");
@@ -313,7 +349,10 @@ int Main(int argc, char** argv) {
                 "Path to the old partitions. To pass multiple partitions, use "
                 "a single argument with a colon between paths, e.g. "
                 "/path/to/part:/path/to/part2::/path/to/last_part . Path can "
-                "be empty, but it has to match the order of partition_names.");
+                "be empty, but it has to match the order of partition_names. "
+                "To generate one payload from each of several source images "
+                "to the same target image, separate the sets of old "
+                "partitions with a comma and pass as many --out_file.");
   DEFINE_string(new_partitions,
                 "",
                 "Path to the new partitions. To pass multiple partitions, use "
@@ -326,7 +365,8 @@ int Main(int argc, char** argv) {
                 "in the old partition. The .map file is normally generated "
                 "when creating the image in Android builds. Only recommended "
                 "for unsupported filesystem. Pass multiple files separated by "
-                "a colon as with -old_partitions.");
+                "a colon and multiple source images separated by a comma as "
+                "with -old_partitions.");
   DEFINE_string(new_mapfiles,
                 "",
                 "Path to the .map files associated with the partition files "
@@ -341,12 +381,18 @@ int Main(int argc, char** argv) {
                 "",
                 "Path to input delta payload file used to hash/sign payloads "
                 "and apply delta over old_image (for debugging)");
-  DEFINE_string(out_file, "", "Path to output delta payload file");
+  DEFINE_string(out_file,
+                "",
+                "Path to output delta payload file. Pass one path per source "
+                "image separated by a comma when generating several payloads, "
+                "see --old_partitions.");
   DEFINE_string(out_hash_file, "", "Path to output hash file");
   DEFINE_string(
       out_metadata_hash_file, "", "Path to output metadata hash file");
-  DEFINE_string(
-      out_metadata_size_file, "", "Path to output metadata size file");
+  DEFINE_string(out_metadata_size_file,
+                "",
+                "Path to output metadata size file, or one path per payload "
+                "separated by a comma as with --out_file.");
   DEFINE_string(private_key, "", "Path to private key in .pem format");
   DEFINE_string(public_key, "", "Path to public key in .pem format");
   DEFINE_int32(
@@ -425,8 +471,58 @@ int Main(int argc, char** argv) {
       disable_vabc,
       false,
       "Whether to disable Virtual AB Compression when installing the OTA");
+  DEFINE_bool(pack_extents,
+              false,
+              "Store the extents of the operations in the manifest in the "
+              "packed format. Requires a minor version with packed extents. "
+              "The payload tools in scripts/update_payload can't read these "
+              "payloads.");
+  DEFINE_bool(compress_manifest,
+              false,
+              "Compress the manifest with xz. Requires --pack_extents.");
+  DEFINE_bool(stream_operations,
+              false,
+              "Store the operations of every partition right before its data "
+              "instead of the manifest, so they can be applied before the "
+              "operations of the next partitions are downloaded. Requires a "
+              "minor version with streamed operations, and Virtual A/B "
+              "compression if snapshots are enabled.");
   DEFINE_string(
       apex_info_file, "", "Path to META/apex_info.pb found in target build");
+  DEFINE_string(deflate_cache_dir,
+                "",
+                "Directory where the deflate locations found in zip and gzip "
+                "files are cached, so they are not searched again by later "
+                "runs using the same files.");
+  DEFINE_uint64(source_locality_window_size,
+                0,
+                "If not 0, reorder the operations writing to every window of "
+                "this many bytes of the target partitions by the source "
+                "blocks they read, so the source partitions are read more "
+                "sequentially when applying the payload. Must be a multiple "
+                "of the block size.");
+  DEFINE_uint64(apply_memory_budget,
+                kDefaultApplyMemoryBudget,
+                "The maximum memory in bytes the target devices may use to "
+                "apply a single operation. Diff operations needing more are "
+                "not generated and big files are diffed in smaller chunks. "
+                "Set it for the device with the least RAM; 0 keeps the fixed "
+                "limits of 200 MiB for bsdiff and 150 MiB for puffdiff.");
+  DEFINE_uint64(chunk_diff_time_budget,
+                0,
+                "If not 0, the maximum time in seconds spent diffing a single "
+                "chunk of data. The diffs still running then are killed and "
+                "the chunk gets the best operation found until then.");
+  DEFINE_uint64(generation_time_budget,
+                0,
+                "If not 0, the time in seconds after which no more data is "
+                "diffed, counted from the start of delta_generator. The "
+                "remaining data gets full operations.");
+  DEFINE_string(out_report_file,
+                "",
+                "Path to output a JSON report with the time spent in every "
+                "stage of the generation and in diffing every file, or one "
+                "path per payload separated by a comma as with --out_file.");
 
   brillo::FlagHelper::Init(
       argc,
@@ -436,6 +532,8 @@ int Main(int argc, char** argv) {
       "image is provided. It also provides debugging options to apply, sign\n"
       "and verify payloads.");
   Terminator::Init();
+  // The --generation_time_budget counts from here.
+  base::TimeTicks start_time = base::TimeTicks::Now();
 
   logging::LoggingSettings log_settings;
 #if BASE_VER < 780000
@@ -513,13 +611,9 @@ int Main(int argc, char** argv) {
   // A payload generation was requested. Convert the flags to a
   // PayloadGenerationConfig.
   PayloadGenerationConfig payload_config;
-  vector<string> partition_names, old_partitions, new_partitions;
-  vector<string> old_mapfiles, new_mapfiles;
+  vector<string> partition_names, new_partitions;
+  vector<string> new_mapfiles;
 
-  if (!FLAGS_old_mapfiles.empty()) {
-    old_mapfiles = base::SplitString(
-        FLAGS_old_mapfiles, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
-  }
   if (!FLAGS_new_mapfiles.empty()) {
     new_mapfiles = base::SplitString(
         FLAGS_new_mapfiles, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL);
@@ -576,31 +670,51 @@ int Main(int argc, char** argv) {
       payload_config.target.partitions.back().mapfile_path = new_mapfiles[i];
   }
 
+  // Every set of old partitions is a source image to generate a payload from.
+  vector<vector<string>> old_partitions_sets;
+  vector<vector<string>> old_mapfiles_sets;
   if (payload_config.is_delta) {
     if (!FLAGS_old_partitions.empty()) {
-      old_partitions = base::SplitString(FLAGS_old_partitions,
-                                         ":",
-                                         base::TRIM_WHITESPACE,
-                                         base::SPLIT_WANT_ALL);
-      CHECK(old_partitions.size() == new_partitions.size());
+      for (const string& old_partitions :
+           base::SplitString(FLAGS_old_partitions,
+                             ",",
+                             base::TRIM_WHITESPACE,
+                             base::SPLIT_WANT_ALL)) {
+        old_partitions_sets.push_back(base::SplitString(
+            old_partitions, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL));
+        CHECK(old_partitions_sets.back().size() == new_partitions.size());
+      }
     } else {
-      old_partitions = {FLAGS_old_image, FLAGS_old_kernel};
+      old_partitions_sets = {{FLAGS_old_image, FLAGS_old_kernel}};
       LOG(WARNING) << "--old_partitions is empty, using deprecated --old_image "
                    << "and --old_kernel flags.";
     }
-    for (size_t i = 0; i < partition_names.size(); i++) {
-      payload_config.source.partitions.emplace_back(partition_names[i]);
-      payload_config.source.partitions.back().path = old_partitions[i];
-      if (i < old_mapfiles.size())
-        payload_config.source.partitions.back().mapfile_path = old_mapfiles[i];
+    if (!FLAGS_old_mapfiles.empty()) {
+      for (const string& old_mapfiles :
+           base::SplitString(FLAGS_old_mapfiles,
+                             ",",
+                             base::TRIM_WHITESPACE,
+                             base::SPLIT_WANT_ALL)) {
+        old_mapfiles_sets.push_back(base::SplitString(
+            old_mapfiles, ":", base::TRIM_WHITESPACE, base::SPLIT_WANT_ALL));
+      }
+      CHECK(old_mapfiles_sets.size() == old_partitions_sets.size());
+    } else {
+      old_mapfiles_sets.resize(old_partitions_sets.size());
     }
+    SetSourcePartitions(partition_names,
+                        old_partitions_sets[0],
+                        old_mapfiles_sets[0],
+                        &payload_config);
   }
+  size_t num_payloads = std::max<size_t>(old_partitions_sets.size(), 1);
 
   if (FLAGS_is_partial_update) {
     payload_config.is_partial_update = true;
   }
 
   if (!FLAGS_in_file.empty()) {
+    CHECK_EQ(num_payloads, 1U) << "Only one source image can be applied.";
     return ApplyPayload(FLAGS_in_file, payload_config) ? 0 : 1;
   }
 
@@ -613,12 +727,18 @@ int Main(int argc, char** argv) {
   // Use the default soft_chunk_size defined in the config.
   payload_config.hard_chunk_size = FLAGS_chunk_size;
   payload_config.block_size = kBlockSize;
+  payload_config.source_locality_window_size =
+      FLAGS_source_locality_window_size;
+  payload_config.apply_memory_budget = FLAGS_apply_memory_budget;
+  payload_config.chunk_diff_time_budget =
+      base::TimeDelta::FromSeconds(FLAGS_chunk_diff_time_budget);
+  if (FLAGS_generation_time_budget) {
+    payload_config.diff_deadline =
+        start_time + base::TimeDelta::FromSeconds(FLAGS_generation_time_budget);
+  }
 
   // The partition size is never passed to the delta_generator, so we
   // need to detect those from the provided files.
-  if (payload_config.is_delta) {
-    CHECK(payload_config.source.LoadImageSize());
-  }
   CHECK(payload_config.target.LoadImageSize());
 
   if (!FLAGS_dynamic_partition_info_file.empty()) {
@@ -635,88 +755,132 @@ int Main(int argc, char** argv) {
   }
 
   CHECK(!FLAGS_out_file.empty());
+  vector<string> out_files =
+      SplitOutputFilesFlag(FLAGS_out_file, "out_file", num_payloads);
+  vector<string> out_metadata_size_files = SplitOutputFilesFlag(
+      FLAGS_out_metadata_size_file, "out_metadata_size_file", num_payloads);
+  vector<string> out_report_files = SplitOutputFilesFlag(
+      FLAGS_out_report_file, "out_report_file", num_payloads);
 
   payload_config.rootfs_partition_size = FLAGS_rootfs_partition_size;
+  payload_config.deflate_cache_dir = FLAGS_deflate_cache_dir;
 
   if (payload_config.is_delta) {
     // Avoid opening the filesystem interface for full payloads.
     for (PartitionConfig& part : payload_config.target.partitions)
       CHECK(part.OpenFilesystem());
-    for (PartitionConfig& part : payload_config.source.partitions)
-      CHECK(part.OpenFilesystem());
   }
 
   payload_config.version.major = FLAGS_major_version;
   LOG(INFO) << "Using provided major_version=" << FLAGS_major_version;
 
-  if (FLAGS_minor_version == -1) {
-    // Autodetect minor_version by looking at the update_engine.conf in the old
-    // image.
+  payload_config.max_timestamp = FLAGS_max_timestamp;
+  payload_config.pack_extents = FLAGS_pack_extents;
+  payload_config.compress_manifest = FLAGS_compress_manifest;
+  payload_config.stream_operations = FLAGS_stream_operations;
+  if (!FLAGS_partition_timestamps.empty()) {
+    CHECK(ParsePerPartitionTimestamps(FLAGS_partition_timestamps,
+                                      &payload_config));
+  }
+
+  // The payloads from every source image share the work that only depends on
+  // the target image.
+  std::unique_ptr<TargetCache> target_cache;
+  if (num_payloads > 1) {
+    target_cache.reset(new TargetCache());
+    payload_config.target_cache = target_cache.get();
+  }
+
+  for (size_t i = 0; i < num_payloads; i++) {
     if (payload_config.is_delta) {
-      brillo::KeyValueStore store;
-      uint32_t minor_version;
-      bool minor_version_found = false;
-      for (const PartitionConfig& part : payload_config.source.partitions) {
-        if (part.fs_interface && part.fs_interface->LoadSettings(&store) &&
-            utils::GetMinorVersion(store, &minor_version)) {
-          payload_config.version.minor = minor_version;
-          minor_version_found = true;
-          LOG(INFO) << "Auto-detected minor_version="
-                    << payload_config.version.minor;
-          break;
+      SetSourcePartitions(partition_names,
+                          old_partitions_sets[i],
+                          old_mapfiles_sets[i],
+                          &payload_config);
+      CHECK(payload_config.source.LoadImageSize());
+      for (PartitionConfig& part : payload_config.source.partitions)
+        CHECK(part.OpenFilesystem());
+    }
+
+    uint32_t previous_minor_version = payload_config.version.minor;
+    if (FLAGS_minor_version == -1) {
+      // Autodetect minor_version by looking at the update_engine.conf in the
+      // old image.
+      if (payload_config.is_delta) {
+        brillo::KeyValueStore store;
+        uint32_t minor_version;
+        bool minor_version_found = false;
+        for (const PartitionConfig& part : payload_config.source.partitions) {
+          if (part.fs_interface && part.fs_interface->LoadSettings(&store) &&
+              utils::GetMinorVersion(store, &minor_version)) {
+            payload_config.version.minor = minor_version;
+            minor_version_found = true;
+            LOG(INFO) << "Auto-detected minor_version="
+                      << payload_config.version.minor;
+            break;
+          }
         }
-      }
-      if (!minor_version_found) {
-        LOG(FATAL) << "Failed to detect the minor version.";
-        return 1;
+        if (!minor_version_found) {
+          LOG(FATAL) << "Failed to detect the minor version.";
+          return 1;
+        }
+      } else {
+        payload_config.version.minor = kFullPayloadMinorVersion;
+        LOG(INFO) << "Using non-delta minor_version="
+                  << payload_config.version.minor;
       }
     } else {
-      payload_config.version.minor = kFullPayloadMinorVersion;
-      LOG(INFO) << "Using non-delta minor_version="
-                << payload_config.version.minor;
+      payload_config.version.minor = FLAGS_minor_version;
+      LOG(INFO) << "Using provided minor_version=" << FLAGS_minor_version;
     }
-  } else {
-    payload_config.version.minor = FLAGS_minor_version;
-    LOG(INFO) << "Using provided minor_version=" << FLAGS_minor_version;
-  }
 
-  if (payload_config.version.minor != kFullPayloadMinorVersion &&
-      (payload_config.version.minor < kMinSupportedMinorPayloadVersion ||
-       payload_config.version.minor > kMaxSupportedMinorPayloadVersion)) {
-    LOG(FATAL) << "Unsupported minor version " << payload_config.version.minor;
-    return 1;
-  }
+    if (payload_config.version.minor != kFullPayloadMinorVersion &&
+        (payload_config.version.minor < kMinSupportedMinorPayloadVersion ||
+         payload_config.version.minor > kMaxSupportedMinorPayloadVersion)) {
+      LOG(FATAL) << "Unsupported minor version "
+                 << payload_config.version.minor;
+      return 1;
+    }
+    // The target image config, like the verity config, depends on the minor
+    // version.
+    if (i > 0 && payload_config.version.minor != previous_minor_version) {
+      LOG(FATAL) << "All the source images must have the same minor version, "
+                 << "found " << previous_minor_version << " and "
+                 << payload_config.version.minor;
+      return 1;
+    }
 
-  payload_config.max_timestamp = FLAGS_max_timestamp;
-  if (!FLAGS_partition_timestamps.empty()) {
-    CHECK(ParsePerPartitionTimestamps(FLAGS_partition_timestamps,
-                                      &payload_config));
-  }
+    if (i == 0 && payload_config.is_delta &&
+        payload_config.version.minor >= kVerityMinorPayloadVersion &&
+        !FLAGS_disable_verity_computation)
+      CHECK(payload_config.target.LoadVerityConfig());
 
-  if (payload_config.is_delta &&
-      payload_config.version.minor >= kVerityMinorPayloadVersion &&
-      !FLAGS_disable_verity_computation)
-    CHECK(payload_config.target.LoadVerityConfig());
+    LOG(INFO) << "Generating " << (payload_config.is_delta ? "delta" : "full")
+              << " update " << out_files[i];
 
-  LOG(INFO) << "Generating " << (payload_config.is_delta ? "delta" : "full")
-            << " update";
+    // From this point, all the options have been parsed.
+    if (!payload_config.Validate()) {
+      LOG(ERROR) << "Invalid options passed. See errors above.";
+      return 1;
+    }
 
-  // From this point, all the options have been parsed.
-  if (!payload_config.Validate()) {
-    LOG(ERROR) << "Invalid options passed. See errors above.";
-    return 1;
-  }
+    GenerationReport report;
+    payload_config.report = out_report_files.empty() ? nullptr : &report;
 
-  uint64_t metadata_size;
-  if (!GenerateUpdatePayloadFile(
-          payload_config, FLAGS_out_file, FLAGS_private_key, &metadata_size)) {
-    return 1;
-  }
-  if (!FLAGS_out_metadata_size_file.empty()) {
-    string metadata_size_string = std::to_string(metadata_size);
-    CHECK(utils::WriteFile(FLAGS_out_metadata_size_file.c_str(),
-                           metadata_size_string.data(),
-                           metadata_size_string.size()));
+    uint64_t metadata_size;
+    if (!GenerateUpdatePayloadFile(
+            payload_config, out_files[i], FLAGS_private_key, &metadata_size)) {
+      return 1;
+    }
+    payload_config.report = nullptr;
+    if (!out_report_files.empty())
+      CHECK(report.WriteToFile(out_report_files[i]));
+    if (!out_metadata_size_files.empty()) {
+      string metadata_size_string = std::to_string(metadata_size);
+      CHECK(utils::WriteFile(out_metadata_size_files[i].c_str(),
+                             metadata_size_string.data(),
+                             metadata_size_string.size()));
+    }
   }
   return 0;
 }
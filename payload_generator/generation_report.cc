@@ -0,0 +1,234 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/generation_report.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <base/json/json_writer.h>
+#include <base/logging.h>
+#include <base/values.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// base::Value only holds 32-bit integers, so the 64-bit counters are stored as
+// doubles, which are exact up to 2^53. They are written without a fractional
+// part.
+void SetUint64(base::DictionaryValue* value,
+               const string& path,
+               uint64_t number) {
+  value->SetDouble(path, static_cast<double>(number));
+}
+
+std::unique_ptr<base::ListValue> StageTimesToValue(
+    const vector<std::pair<string, base::TimeDelta>>& stages) {
+  auto list = std::make_unique<base::ListValue>();
+  for (const auto& stage : stages) {
+    auto value = std::make_unique<base::DictionaryValue>();
+    value->SetString("name", stage.first);
+    value->SetDouble("time_ms", stage.second.InMillisecondsF());
+    list->Append(std::move(value));
+  }
+  return list;
+}
+
+std::unique_ptr<base::DictionaryValue> ChunkReportToValue(
+    const GenerationReport::ChunkReport& chunk) {
+  auto value = std::make_unique<base::DictionaryValue>();
+  value->SetString("name", chunk.name);
+  SetUint64(value.get(), "src_blocks", chunk.src_blocks);
+  SetUint64(value.get(), "dst_blocks", chunk.dst_blocks);
+  value->SetDouble("read_ms", chunk.read_time.InMillisecondsF());
+  value->SetDouble("xz_ms", chunk.xz_time.InMillisecondsF());
+  value->SetDouble("bz2_ms", chunk.bz2_time.InMillisecondsF());
+  value->SetBoolean("full_operation_cached", chunk.full_operation_cached);
+  value->SetDouble("bsdiff_ms", chunk.bsdiff_time.InMillisecondsF());
+  value->SetDouble("patch_compression_ms",
+                   chunk.patch_compression_time.InMillisecondsF());
+  value->SetDouble("puffdiff_ms", chunk.puffdiff_time.InMillisecondsF());
+  value->SetDouble("lz4diff_ms", chunk.lz4diff_time.InMillisecondsF());
+  value->SetDouble("executable_diff_ms",
+                   chunk.executable_diff_time.InMillisecondsF());
+  SetUint64(value.get(), "xz_size", chunk.xz_size);
+  SetUint64(value.get(), "bz2_size", chunk.bz2_size);
+  SetUint64(value.get(), "bsdiff_size", chunk.bsdiff_size);
+  SetUint64(value.get(), "puffdiff_size", chunk.puffdiff_size);
+  SetUint64(value.get(), "lz4diff_size", chunk.lz4diff_size);
+  SetUint64(value.get(), "executable_diff_size", chunk.executable_diff_size);
+  value->SetString("type", InstallOperationTypeName(chunk.type));
+  SetUint64(value.get(), "data_size", chunk.data_size);
+  SetUint64(value.get(), "apply_memory", chunk.apply_memory);
+  value->SetBoolean("diff_timed_out", chunk.diff_timed_out);
+  return value;
+}
+
+std::unique_ptr<base::DictionaryValue> SourceReadReportToValue(
+    const GenerationReport::SourceReadReport& source_reads) {
+  auto value = std::make_unique<base::DictionaryValue>();
+  value->SetString("order", source_reads.order);
+  SetUint64(value.get(), "num_reads", source_reads.num_reads);
+  SetUint64(value.get(), "num_seeks", source_reads.num_seeks);
+  SetUint64(value.get(),
+            "seek_distance_blocks",
+            source_reads.seek_distance_blocks);
+  SetUint64(value.get(), "read_blocks", source_reads.read_blocks);
+  SetUint64(
+      value.get(), "unique_read_blocks", source_reads.unique_read_blocks);
+  value->SetDouble("read_amplification",
+                   source_reads.unique_read_blocks
+                       ? static_cast<double>(source_reads.read_blocks) /
+                             source_reads.unique_read_blocks
+                       : 1.0);
+  return value;
+}
+
+std::unique_ptr<base::DictionaryValue> ManifestSizeReportToValue(
+    const GenerationReport::ManifestSizeReport& manifest_size) {
+  auto value = std::make_unique<base::DictionaryValue>();
+  value->SetString("stage", manifest_size.stage);
+  SetUint64(value.get(), "num_operations", manifest_size.num_operations);
+  SetUint64(value.get(), "num_extents", manifest_size.num_extents);
+  SetUint64(value.get(), "operations_size", manifest_size.operations_size);
+  return value;
+}
+
+}  // namespace
+
+void GenerationReport::AddToStageTimes(const string& stage,
+                                       base::TimeDelta time,
+                                       StageTimes* stages) {
+  auto it = std::find_if(
+      stages->begin(),
+      stages->end(),
+      [&stage](const std::pair<string, base::TimeDelta>& stage_time) {
+        return stage_time.first == stage;
+      });
+  if (it == stages->end())
+    stages->emplace_back(stage, time);
+  else
+    it->second += time;
+}
+
+void GenerationReport::AddStageTime(const string& partition,
+                                    const string& stage,
+                                    base::TimeDelta time) {
+  base::AutoLock lock(lock_);
+  if (partition.empty())
+    AddToStageTimes(stage, time, &stages_);
+  else
+    AddToStageTimes(stage, time, &partitions_[partition].stages);
+}
+
+void GenerationReport::AddChunkReports(const string& partition,
+                                       vector<ChunkReport> chunks) {
+  base::AutoLock lock(lock_);
+  vector<ChunkReport>* partition_chunks = &partitions_[partition].chunks;
+  partition_chunks->insert(partition_chunks->end(),
+                           std::make_move_iterator(chunks.begin()),
+                           std::make_move_iterator(chunks.end()));
+}
+
+void GenerationReport::AddSourceReadReport(const string& partition,
+                                           SourceReadReport source_reads) {
+  base::AutoLock lock(lock_);
+  partitions_[partition].source_reads.push_back(std::move(source_reads));
+}
+
+void GenerationReport::AddManifestSizeReport(const string& partition,
+                                             ManifestSizeReport manifest_size) {
+  base::AutoLock lock(lock_);
+  partitions_[partition].manifest_sizes.push_back(std::move(manifest_size));
+}
+
+bool GenerationReport::GetAsJson(string* json) const {
+  base::AutoLock lock(lock_);
+  base::DictionaryValue report;
+
+  // ru_maxrss is reported in KiB on Linux.
+  struct rusage usage;
+  TEST_AND_RETURN_FALSE_ERRNO(getrusage(RUSAGE_SELF, &usage) == 0);
+  SetUint64(&report, "peak_memory_kib", usage.ru_maxrss);
+  report.Set("stages", StageTimesToValue(stages_));
+
+  auto partitions = std::make_unique<base::ListValue>();
+  for (const auto& it : partitions_) {
+    auto partition = std::make_unique<base::DictionaryValue>();
+    partition->SetString("name", it.first);
+    partition->Set("stages", StageTimesToValue(it.second.stages));
+    auto chunks = std::make_unique<base::ListValue>();
+    uint64_t max_apply_memory = 0;
+    uint64_t num_diffs_timed_out = 0;
+    for (const ChunkReport& chunk : it.second.chunks) {
+      chunks->Append(ChunkReportToValue(chunk));
+      max_apply_memory = std::max(max_apply_memory, chunk.apply_memory);
+      num_diffs_timed_out += chunk.diff_timed_out;
+    }
+    partition->Set("chunks", std::move(chunks));
+    SetUint64(partition.get(), "max_apply_memory", max_apply_memory);
+    SetUint64(partition.get(), "num_diffs_timed_out", num_diffs_timed_out);
+    auto source_reads = std::make_unique<base::ListValue>();
+    for (const SourceReadReport& source_read : it.second.source_reads)
+      source_reads->Append(SourceReadReportToValue(source_read));
+    partition->Set("source_reads", std::move(source_reads));
+    auto manifest_sizes = std::make_unique<base::ListValue>();
+    for (const ManifestSizeReport& manifest_size : it.second.manifest_sizes)
+      manifest_sizes->Append(ManifestSizeReportToValue(manifest_size));
+    partition->Set("manifest_sizes", std::move(manifest_sizes));
+    partitions->Append(std::move(partition));
+  }
+  report.Set("partitions", std::move(partitions));
+
+  return base::JSONWriter::WriteWithOptions(
+      report,
+      base::JSONWriter::OPTIONS_PRETTY_PRINT |
+          base::JSONWriter::OPTIONS_OMIT_DOUBLE_TYPE_PRESERVATION,
+      json);
+}
+
+bool GenerationReport::WriteToFile(const string& path) const {
+  string json;
+  TEST_AND_RETURN_FALSE(GetAsJson(&json));
+  TEST_AND_RETURN_FALSE(
+      utils::WriteFile(path.c_str(), json.data(), json.size()));
+  LOG(INFO) << "Generation report written to " << path;
+  return true;
+}
+
+ScopedStageTimer::ScopedStageTimer(GenerationReport* report,
+                                   const string& partition,
+                                   const string& stage)
+    : report_(report),
+      partition_(partition),
+      stage_(stage),
+      start_(base::TimeTicks::Now()) {}
+
+ScopedStageTimer::~ScopedStageTimer() {
+  if (report_)
+    report_->AddStageTime(partition_, stage_, base::TimeTicks::Now() - start_);
+}
+
+}  // namespace chromeos_update_engine
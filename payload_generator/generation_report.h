@@ -0,0 +1,182 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_REPORT_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_REPORT_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/time/time.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Collects where the time goes while generating a payload: the timings and
+// candidate sizes of every diffed chunk and the time spent in each stage of
+// every partition. The report can be written as JSON to track pathological
+// files and generator regressions. All the methods are thread safe.
+class GenerationReport {
+ public:
+  // The statistics of generating the operation for a single chunk of a file.
+  struct ChunkReport {
+    // The name of the operation, including the chunk number if any.
+    std::string name;
+    uint64_t src_blocks = 0;
+    uint64_t dst_blocks = 0;
+
+    // Time spent reading the source and target data of the chunk.
+    base::TimeDelta read_time;
+    // Time spent compressing the target data for the REPLACE_* candidates.
+    // They are 0 when the best full operation was taken from the TargetCache.
+    base::TimeDelta xz_time;
+    base::TimeDelta bz2_time;
+    bool full_operation_cached = false;
+    // Time spent in bsdiff. It includes the |patch_compression_time|, the time
+    // spent compressing the patch (with brotli for BROTLI_BSDIFF).
+    base::TimeDelta bsdiff_time;
+    base::TimeDelta patch_compression_time;
+    base::TimeDelta puffdiff_time;
+    base::TimeDelta lz4diff_time;
+    base::TimeDelta executable_diff_time;
+
+    // The sizes of the candidate blobs, or 0 if the candidate wasn't tried.
+    uint64_t xz_size = 0;
+    uint64_t bz2_size = 0;
+    uint64_t bsdiff_size = 0;
+    uint64_t puffdiff_size = 0;
+    uint64_t lz4diff_size = 0;
+    uint64_t executable_diff_size = 0;
+
+    // The chosen operation, the size of its blob and the estimated peak memory
+    // to apply it on the device, see diff_utils::EstimateApplyMemory().
+    InstallOperation::Type type = InstallOperation::REPLACE;
+    uint64_t data_size = 0;
+    uint64_t apply_memory = 0;
+    // Whether a diff was cancelled or skipped because of the time limits.
+    bool diff_timed_out = false;
+  };
+
+  // The estimated cost of reading the source partition when applying the
+  // operations of a partition in a given order, see
+  // ABGenerator::EstimateSourceReads().
+  struct SourceReadReport {
+    // The order of the operations, like "destination".
+    std::string order;
+    // The number of contiguous reads (source extents), and how many of them
+    // don't start where the previous one ended.
+    uint64_t num_reads = 0;
+    uint64_t num_seeks = 0;
+    // The total distance of the seeks.
+    uint64_t seek_distance_blocks = 0;
+    // The number of blocks read and of distinct blocks read. Their ratio is
+    // the read amplification.
+    uint64_t read_blocks = 0;
+    uint64_t unique_read_blocks = 0;
+  };
+
+  // The size in the manifest of the operations of a partition at a given
+  // stage, see ABGenerator::MeasureManifestSize().
+  struct ManifestSizeReport {
+    // The stage of the generation, like "generated".
+    std::string stage;
+    uint64_t num_operations = 0;
+    // The number of source and destination extents of all the operations.
+    uint64_t num_extents = 0;
+    // The size of the serialized operations, in bytes.
+    uint64_t operations_size = 0;
+  };
+
+  GenerationReport() = default;
+
+  // Adds |time| to the stage named |stage| of the partition |partition|. An
+  // empty |partition| refers to a payload-wide stage. Stages are reported in
+  // the order they were first added.
+  void AddStageTime(const std::string& partition,
+                    const std::string& stage,
+                    base::TimeDelta time);
+
+  // Appends the |chunks| to the ones of the partition |partition|.
+  void AddChunkReports(const std::string& partition,
+                       std::vector<ChunkReport> chunks);
+
+  // Adds the |source_reads| estimation to the partition |partition|.
+  void AddSourceReadReport(const std::string& partition,
+                           SourceReadReport source_reads);
+
+  // Adds the |manifest_size| measure to the partition |partition|.
+  void AddManifestSizeReport(const std::string& partition,
+                             ManifestSizeReport manifest_size);
+
+  // Serializes the report, together with the peak memory usage of the process
+  // so far, as JSON in |json|.
+  bool GetAsJson(std::string* json) const;
+
+  // Writes the JSON report to the file |path|.
+  bool WriteToFile(const std::string& path) const;
+
+ private:
+  using StageTimes = std::vector<std::pair<std::string, base::TimeDelta>>;
+
+  struct PartitionReport {
+    StageTimes stages;
+    std::vector<ChunkReport> chunks;
+    std::vector<SourceReadReport> source_reads;
+    std::vector<ManifestSizeReport> manifest_sizes;
+  };
+
+  static void AddToStageTimes(const std::string& stage,
+                              base::TimeDelta time,
+                              StageTimes* stages);
+
+  mutable base::Lock lock_;
+
+  // The payload-wide stages.
+  StageTimes stages_;
+
+  // The per partition reports, keyed by partition name.
+  std::map<std::string, PartitionReport> partitions_;
+
+  DISALLOW_COPY_AND_ASSIGN(GenerationReport);
+};
+
+// Adds the time elapsed between its construction and destruction to the stage
+// |stage| of the partition |partition| in |report|. Does nothing if |report| is
+// null.
+class ScopedStageTimer {
+ public:
+  ScopedStageTimer(GenerationReport* report,
+                   const std::string& partition,
+                   const std::string& stage);
+  ~ScopedStageTimer();
+
+ private:
+  GenerationReport* report_;
+  const std::string partition_;
+  const std::string stage_;
+  const base::TimeTicks start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedStageTimer);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_REPORT_H_
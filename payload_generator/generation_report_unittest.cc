@@ -0,0 +1,169 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/generation_report.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+class GenerationReportTest : public ::testing::Test {
+ protected:
+  // Returns the JSON report.
+  string GetJson() {
+    string json;
+    EXPECT_TRUE(report_.GetAsJson(&json));
+    return json;
+  }
+
+  GenerationReport report_;
+};
+
+TEST_F(GenerationReportTest, EmptyReportTest) {
+  string json = GetJson();
+  EXPECT_NE(string::npos, json.find("\"peak_memory_kib\""));
+  EXPECT_NE(string::npos, json.find("\"partitions\""));
+  EXPECT_EQ(string::npos, json.find("\"chunks\""));
+}
+
+TEST_F(GenerationReportTest, StageTimesAreAccumulatedTest) {
+  report_.AddStageTime("system", "diffing", base::TimeDelta::FromSeconds(1));
+  report_.AddStageTime("system", "merge", base::TimeDelta::FromSeconds(3));
+  report_.AddStageTime("system", "diffing", base::TimeDelta::FromSeconds(2));
+  report_.AddStageTime("", "finalization", base::TimeDelta::FromSeconds(4));
+  string json = GetJson();
+
+  // Stages keep the order in which they were first added.
+  size_t diffing = json.find("\"diffing\"");
+  size_t merge = json.find("\"merge\"");
+  ASSERT_NE(string::npos, diffing);
+  ASSERT_NE(string::npos, merge);
+  EXPECT_LT(diffing, merge);
+  EXPECT_EQ(string::npos, json.find("\"diffing\"", diffing + 1));
+  EXPECT_NE(string::npos, json.find("\"finalization\""));
+  EXPECT_NE(string::npos, json.find("\"system\""));
+}
+
+TEST_F(GenerationReportTest, ChunkReportsTest) {
+  GenerationReport::ChunkReport chunk;
+  chunk.name = "/bin/foo:1";
+  chunk.dst_blocks = 10;
+  chunk.xz_size = 1234;
+  chunk.bsdiff_size = 100;
+  chunk.type = InstallOperation::SOURCE_BSDIFF;
+  chunk.data_size = 100;
+  report_.AddChunkReports("system", {chunk});
+  string json = GetJson();
+
+  EXPECT_NE(string::npos, json.find("\"/bin/foo:1\""));
+  EXPECT_NE(string::npos, json.find("\"SOURCE_BSDIFF\""));
+  EXPECT_NE(string::npos, json.find("\"xz_size\": 1234"));
+  EXPECT_NE(string::npos, json.find("\"data_size\": 100"));
+}
+
+TEST_F(GenerationReportTest, LargeCountersTest) {
+  // The counters don't fit in a 32-bit integer.
+  GenerationReport::ChunkReport chunk;
+  chunk.dst_blocks = 3000000000;
+  chunk.data_size = 5 * (1ULL << 30);
+  report_.AddChunkReports("system", {chunk});
+  GenerationReport::ManifestSizeReport manifest_size;
+  manifest_size.operations_size = 1ULL << 40;
+  report_.AddManifestSizeReport("system", manifest_size);
+  string json = GetJson();
+
+  EXPECT_NE(string::npos, json.find("\"dst_blocks\": 3000000000,"));
+  EXPECT_NE(string::npos, json.find("\"data_size\": 5368709120,"));
+  EXPECT_NE(string::npos, json.find("\"operations_size\": 1099511627776"));
+}
+
+TEST_F(GenerationReportTest, MaxApplyMemoryTest) {
+  GenerationReport::ChunkReport chunk;
+  chunk.apply_memory = 300;
+  GenerationReport::ChunkReport other_chunk;
+  other_chunk.apply_memory = 200;
+  report_.AddChunkReports("system", {chunk, other_chunk});
+  string json = GetJson();
+
+  EXPECT_NE(string::npos, json.find("\"apply_memory\": 200"));
+  EXPECT_NE(string::npos, json.find("\"max_apply_memory\": 300"));
+}
+
+TEST_F(GenerationReportTest, DiffsTimedOutTest) {
+  GenerationReport::ChunkReport chunk;
+  chunk.diff_timed_out = true;
+  report_.AddChunkReports("system", {chunk, GenerationReport::ChunkReport()});
+  string json = GetJson();
+
+  EXPECT_NE(string::npos, json.find("\"diff_timed_out\": true"));
+  EXPECT_NE(string::npos, json.find("\"num_diffs_timed_out\": 1"));
+}
+
+TEST_F(GenerationReportTest, SourceReadReportsTest) {
+  GenerationReport::SourceReadReport source_reads;
+  source_reads.order = "destination";
+  source_reads.num_reads = 3;
+  source_reads.num_seeks = 2;
+  source_reads.read_blocks = 30;
+  source_reads.unique_read_blocks = 20;
+  report_.AddSourceReadReport("system", source_reads);
+  string json = GetJson();
+
+  EXPECT_NE(string::npos, json.find("\"destination\""));
+  EXPECT_NE(string::npos, json.find("\"num_seeks\": 2"));
+  EXPECT_NE(string::npos, json.find("\"read_amplification\": 1.5"));
+}
+
+TEST_F(GenerationReportTest, ManifestSizeReportsTest) {
+  GenerationReport::ManifestSizeReport manifest_size;
+  manifest_size.stage = "compacted";
+  manifest_size.num_operations = 12;
+  manifest_size.num_extents = 34;
+  manifest_size.operations_size = 567;
+  report_.AddManifestSizeReport("system", manifest_size);
+  string json = GetJson();
+
+  EXPECT_NE(string::npos, json.find("\"compacted\""));
+  EXPECT_NE(string::npos, json.find("\"num_extents\": 34"));
+  EXPECT_NE(string::npos, json.find("\"operations_size\": 567"));
+}
+
+TEST_F(GenerationReportTest, ScopedStageTimerTest) {
+  {
+    ScopedStageTimer timer(&report_, "system", "diffing");
+  }
+  EXPECT_NE(string::npos, GetJson().find("\"diffing\""));
+
+  // A null report is allowed and ignored.
+  ScopedStageTimer timer(nullptr, "system", "diffing");
+}
+
+TEST_F(GenerationReportTest, WriteToFileTest) {
+  ScopedTempFile report_file("GenerationReportTest.XXXXXX");
+  report_.AddStageTime("", "finalization", base::TimeDelta::FromSeconds(1));
+  EXPECT_TRUE(report_.WriteToFile(report_file.path()));
+  string json;
+  EXPECT_TRUE(utils::ReadFile(report_file.path(), &json));
+  EXPECT_NE(string::npos, json.find("\"finalization\""));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,179 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/lz4diff.h"
+
+#include <lz4.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include <base/logging.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/lz4patch.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The LZ4HC levels tried to compress the new blocks again, besides the
+// default LZ4 compressor. 9 is the default LZ4HC level and 12 the maximum.
+const uint32_t kLz4hcLevels[] = {9, 12};
+
+// Returns the number of |blocks| stored equally in |a| and |b|.
+size_t CountEqualBlocks(const brillo::Blob& a,
+                        const brillo::Blob& b,
+                        const vector<Lz4Block>& blocks) {
+  size_t count = 0;
+  size_t offset = 0;
+  for (const Lz4Block& block : blocks) {
+    size_t size = block.compressed_length();
+    count += std::equal(a.begin() + offset,
+                        a.begin() + offset + size,
+                        b.begin() + offset);
+    offset += size;
+  }
+  return count;
+}
+
+}  // namespace
+
+bool Lz4Diff(const brillo::Blob& old_data,
+             const vector<Lz4Block>& old_blocks,
+             bool old_zero_padding,
+             const brillo::Blob& new_data,
+             const vector<Lz4Block>& new_blocks,
+             bool new_zero_padding,
+             brillo::Blob* patch) {
+  if (old_blocks.empty() || new_blocks.empty())
+    return false;
+  brillo::Blob old_uncompressed, new_uncompressed;
+  if (!Lz4DecompressBlocks(old_data.data(),
+                           old_data.size(),
+                           old_blocks,
+                           old_zero_padding,
+                           &old_uncompressed) ||
+      !Lz4DecompressBlocks(new_data.data(),
+                           new_data.size(),
+                           new_blocks,
+                           new_zero_padding,
+                           &new_uncompressed)) {
+    LOG(WARNING) << "Unable to decompress the LZ4 blocks, skipping lz4diff.";
+    return false;
+  }
+
+  // Pick the compressor that reproduces the most new blocks.
+  Lz4diffHeader header;
+  header.set_src_zero_padding(old_zero_padding);
+  header.set_dst_zero_padding(new_zero_padding);
+  brillo::Blob recompressed;
+  TEST_AND_RETURN_FALSE(Lz4CompressBlocks(new_uncompressed.data(),
+                                          new_uncompressed.size(),
+                                          new_blocks,
+                                          new_zero_padding,
+                                          0,
+                                          &recompressed));
+  size_t num_equal = CountEqualBlocks(new_data, recompressed, new_blocks);
+  for (uint32_t level : kLz4hcLevels) {
+    if (num_equal == new_blocks.size())
+      break;
+    brillo::Blob hc_recompressed;
+    TEST_AND_RETURN_FALSE(Lz4CompressBlocks(new_uncompressed.data(),
+                                            new_uncompressed.size(),
+                                            new_blocks,
+                                            new_zero_padding,
+                                            level,
+                                            &hc_recompressed));
+    size_t hc_num_equal =
+        CountEqualBlocks(new_data, hc_recompressed, new_blocks);
+    if (hc_num_equal > num_equal) {
+      num_equal = hc_num_equal;
+      header.set_lz4hc_level(level);
+      recompressed = std::move(hc_recompressed);
+    }
+  }
+
+  // Lets the client detect a LZ4 library that compresses differently before
+  // applying the postfix patches.
+  brillo::Blob recompressed_hash;
+  TEST_AND_RETURN_FALSE(
+      HashCalculator::RawHashOfData(recompressed, &recompressed_hash));
+  header.set_recompressed_sha256_hash(recompressed_hash.data(),
+                                      recompressed_hash.size());
+  header.set_lz4_version(LZ4_versionNumber());
+
+  for (const Lz4Block& block : old_blocks)
+    *header.add_src_blocks() = block;
+  size_t offset = 0;
+  for (const Lz4Block& block : new_blocks) {
+    Lz4Block* dst_block = header.add_dst_blocks();
+    *dst_block = block;
+    size_t size = block.compressed_length();
+    if (!std::equal(new_data.begin() + offset,
+                    new_data.begin() + offset + size,
+                    recompressed.begin() + offset)) {
+      brillo::Blob postfix_patch;
+      TEST_AND_RETURN_FALSE(
+          diff_utils::GenerateBrotliBsdiff(recompressed.data() + offset,
+                                           size,
+                                           new_data.data() + offset,
+                                           size,
+                                           &postfix_patch));
+      dst_block->set_postfix_patch(postfix_patch.data(), postfix_patch.size());
+    }
+    offset += size;
+  }
+  if (num_equal < new_blocks.size()) {
+    LOG(INFO) << "The LZ4 compressor reproduced " << num_equal << " of "
+              << new_blocks.size() << " blocks.";
+  }
+
+  brillo::Blob inner_patch;
+  TEST_AND_RETURN_FALSE(
+      diff_utils::GenerateBrotliBsdiff(old_uncompressed.data(),
+                                       old_uncompressed.size(),
+                                       new_uncompressed.data(),
+                                       new_uncompressed.size(),
+                                       &inner_patch));
+  std::string header_data;
+  TEST_AND_RETURN_FALSE(header.SerializeToString(&header_data));
+  uint32_t header_size = header_data.size();
+  patch->assign(kLz4diffMagic, kLz4diffMagic + sizeof(kLz4diffMagic));
+  for (int shift = 24; shift >= 0; shift -= 8)
+    patch->push_back((header_size >> shift) & 0xFF);
+  patch->insert(patch->end(), header_data.begin(), header_data.end());
+  patch->insert(patch->end(), inner_patch.begin(), inner_patch.end());
+
+  // Apply the patch as done on the device, to catch any block the compressor
+  // doesn't handle the same way.
+  brillo::Blob patched;
+  TEST_AND_RETURN_FALSE(
+      Lz4Patch(
+          old_data, patch->data(), patch->size(), new_data.size(), &patched));
+  if (patched != new_data) {
+    LOG(WARNING) << "The LZ4 diff doesn't reproduce the new data.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
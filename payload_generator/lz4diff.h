@@ -0,0 +1,47 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_LZ4DIFF_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_LZ4DIFF_H_
+
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Generates the blob of a LZ4DIFF_BSDIFF operation from the |old_data| stored
+// in the LZ4 blocks |old_blocks| to the |new_data| stored in the LZ4 blocks
+// |new_blocks|, see Lz4DecompressBlocks() for the meaning of the blocks and
+// the zero padding. The uncompressed data is diffed with bsdiff, and the new
+// blocks are compressed again with the LZ4 compressor that reproduces most of
+// them; a postfix patch is added for every block it doesn't reproduce. The
+// patch is verified with Lz4Patch() before returning it. Returns false if the
+// data can't be decompressed or the patch can't be generated, in which case
+// another operation should be used.
+bool Lz4Diff(const brillo::Blob& old_data,
+             const std::vector<Lz4Block>& old_blocks,
+             bool old_zero_padding,
+             const brillo::Blob& new_data,
+             const std::vector<Lz4Block>& new_blocks,
+             bool new_zero_padding,
+             brillo::Blob* patch);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_LZ4DIFF_H_
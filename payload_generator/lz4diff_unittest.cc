@@ -0,0 +1,169 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/lz4diff.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/lz4patch.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kTestBlockSize = 4096;
+
+// Returns compressible data of |size| bytes that depends on |seed|.
+brillo::Blob TestData(size_t size, uint8_t seed) {
+  brillo::Blob data(size);
+  for (size_t i = 0; i < size; i++)
+    data[i] = "lz4diff"[i % 7] + (i / 500 + seed) % 4;
+  return data;
+}
+
+// Returns |num_blocks| LZ4 blocks of one block each, storing |block_data|
+// bytes of uncompressed data.
+vector<Lz4Block> TestBlocks(size_t num_blocks, size_t block_data) {
+  vector<Lz4Block> blocks(num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) {
+    blocks[i].set_uncompressed_offset(i * block_data);
+    blocks[i].set_uncompressed_length(block_data);
+    blocks[i].set_compressed_length(kTestBlockSize);
+  }
+  return blocks;
+}
+
+// Parses the header of the LZ4DIFF_BSDIFF blob |patch|.
+bool ParseHeader(const brillo::Blob& patch, Lz4diffHeader* header) {
+  if (patch.size() < sizeof(kLz4diffMagic) + 4)
+    return false;
+  size_t size = 0;
+  for (size_t i = 0; i < 4; i++)
+    size = (size << 8) | patch[sizeof(kLz4diffMagic) + i];
+  return header->ParseFromArray(patch.data() + sizeof(kLz4diffMagic) + 4,
+                                size);
+}
+
+}  // namespace
+
+class Lz4diffTest : public ::testing::Test {
+ protected:
+  // Compresses |data| in |blocks| with the LZ4HC level |level|.
+  brillo::Blob Compress(const brillo::Blob& data,
+                        const vector<Lz4Block>& blocks,
+                        bool zero_padding,
+                        uint32_t level) {
+    brillo::Blob compressed;
+    EXPECT_TRUE(Lz4CompressBlocks(
+        data.data(), data.size(), blocks, zero_padding, level, &compressed));
+    return compressed;
+  }
+};
+
+TEST_F(Lz4diffTest, RoundTripTest) {
+  vector<Lz4Block> old_blocks = TestBlocks(3, 3 * kTestBlockSize);
+  vector<Lz4Block> new_blocks = TestBlocks(4, 3 * kTestBlockSize);
+  brillo::Blob old_data =
+      Compress(TestData(9 * kTestBlockSize, 0), old_blocks, true, 0);
+  brillo::Blob new_data =
+      Compress(TestData(12 * kTestBlockSize, 1), new_blocks, true, 0);
+
+  brillo::Blob patch;
+  ASSERT_TRUE(Lz4Diff(
+      old_data, old_blocks, true, new_data, new_blocks, true, &patch));
+  // The uncompressed data is diffed, so the patch is smaller than the new
+  // compressed data.
+  EXPECT_LT(patch.size(), new_data.size());
+
+  Lz4diffHeader header;
+  ASSERT_TRUE(ParseHeader(patch, &header));
+  EXPECT_EQ(0U, header.lz4hc_level());
+  ASSERT_EQ(4, header.dst_blocks_size());
+  for (const Lz4Block& block : header.dst_blocks())
+    EXPECT_TRUE(block.postfix_patch().empty());
+
+  brillo::Blob patched;
+  ASSERT_TRUE(Lz4Patch(
+      old_data, patch.data(), patch.size(), new_data.size(), &patched));
+  EXPECT_EQ(new_data, patched);
+}
+
+TEST_F(Lz4diffTest, PicksLz4hcLevelTest) {
+  vector<Lz4Block> blocks = TestBlocks(2, 3 * kTestBlockSize);
+  brillo::Blob old_data =
+      Compress(TestData(6 * kTestBlockSize, 2), blocks, false, 0);
+  brillo::Blob new_data =
+      Compress(TestData(6 * kTestBlockSize, 3), blocks, false, 12);
+
+  brillo::Blob patch;
+  ASSERT_TRUE(
+      Lz4Diff(old_data, blocks, false, new_data, blocks, false, &patch));
+  Lz4diffHeader header;
+  ASSERT_TRUE(ParseHeader(patch, &header));
+  EXPECT_NE(0U, header.lz4hc_level());
+
+  brillo::Blob patched;
+  ASSERT_TRUE(Lz4Patch(
+      old_data, patch.data(), patch.size(), new_data.size(), &patched));
+  EXPECT_EQ(new_data, patched);
+}
+
+TEST_F(Lz4diffTest, PostfixPatchTest) {
+  vector<Lz4Block> blocks = TestBlocks(2, 3 * kTestBlockSize);
+  brillo::Blob old_data =
+      Compress(TestData(6 * kTestBlockSize, 4), blocks, false, 0);
+  brillo::Blob new_data =
+      Compress(TestData(6 * kTestBlockSize, 5), blocks, false, 0);
+  // The garbage after the compressed data of a block isn't reproduced by the
+  // compressor.
+  ASSERT_EQ(0, new_data.back());
+  new_data.back() = 0x42;
+
+  brillo::Blob patch;
+  ASSERT_TRUE(
+      Lz4Diff(old_data, blocks, false, new_data, blocks, false, &patch));
+  Lz4diffHeader header;
+  ASSERT_TRUE(ParseHeader(patch, &header));
+  ASSERT_EQ(2, header.dst_blocks_size());
+  EXPECT_TRUE(header.dst_blocks(0).postfix_patch().empty());
+  EXPECT_FALSE(header.dst_blocks(1).postfix_patch().empty());
+
+  brillo::Blob patched;
+  ASSERT_TRUE(Lz4Patch(
+      old_data, patch.data(), patch.size(), new_data.size(), &patched));
+  EXPECT_EQ(new_data, patched);
+}
+
+TEST_F(Lz4diffTest, InvalidDataTest) {
+  vector<Lz4Block> blocks = TestBlocks(1, 3 * kTestBlockSize);
+  brillo::Blob old_data =
+      Compress(TestData(3 * kTestBlockSize, 6), blocks, false, 0);
+  brillo::Blob patch;
+  // The new data isn't LZ4 compressed.
+  EXPECT_FALSE(Lz4Diff(old_data,
+                       blocks,
+                       false,
+                       brillo::Blob(kTestBlockSize, 0xff),
+                       blocks,
+                       false,
+                       &patch));
+}
+
+}  // namespace chromeos_update_engine
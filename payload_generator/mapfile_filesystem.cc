@@ -100,7 +100,7 @@ bool MapfileFilesystem::GetFiles(vector<File>* files) const {
       size_t dash = blocks.find('-', 0);
       uint64_t block_start, block_end;
       if (dash == string::npos && base::StringToUint64(blocks, &block_start)) {
-        mapped_file.extents.push_back(ExtentForRange(block_start, 1));
+        mapped_file.extents.emplace_back(block_start, 1);
       } else if (dash != string::npos &&
                  base::StringToUint64(blocks.substr(0, dash), &block_start) &&
                  base::StringToUint64(blocks.substr(dash + 1), &block_end)) {
@@ -118,8 +118,8 @@ bool MapfileFilesystem::GetFiles(vector<File>* files) const {
                      << line;
           return false;
         }
-        mapped_file.extents.push_back(
-            ExtentForRange(block_start, block_end - block_start + 1));
+        mapped_file.extents.emplace_back(block_start,
+                                         block_end - block_start + 1);
       } else {
         // If we can't parse N or N-M, we assume the block is actually part of
         // the name of the file.
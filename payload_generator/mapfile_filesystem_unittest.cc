@@ -44,8 +44,9 @@ namespace chromeos_update_engine {
 namespace {
 
 // Checks that all the blocks in |extents| are in the range [0, total_blocks).
-void ExpectBlocksInRange(const vector<Extent>& extents, uint64_t total_blocks) {
-  for (const Extent& extent : extents) {
+void ExpectBlocksInRange(const vector<BlockExtent>& extents,
+                         uint64_t total_blocks) {
+  for (const BlockExtent& extent : extents) {
     EXPECT_LE(0U, extent.start_block());
     EXPECT_LE(extent.start_block() + extent.num_blocks(), total_blocks);
   }
@@ -95,16 +96,18 @@ TEST_F(MapfileFilesystemTest, SeveralFileFormatTest) {
   }
 
   EXPECT_EQ(map_files["/fileA"].extents,
-            (vector<Extent>{ExtentForRange(1, 1)}));
+            (vector<BlockExtent>{ExtentForRange(1, 1)}));
   EXPECT_EQ(map_files["/fileB"].extents,
-            (vector<Extent>{ExtentForRange(2, 3)}));
+            (vector<BlockExtent>{ExtentForRange(2, 3)}));
   EXPECT_EQ(
       map_files["/fileC"].extents,
-      (vector<Extent>{
+      (vector<BlockExtent>{
           ExtentForRange(5, 2), ExtentForRange(9, 1), ExtentForRange(11, 2)}));
-  EXPECT_EQ(map_files["/file with spaces"].extents,
-            (vector<Extent>{ExtentForRange(14, 1), ExtentForRange(19, 1)}));
-  EXPECT_EQ(map_files["/1234"].extents, (vector<Extent>{ExtentForRange(7, 1)}));
+  EXPECT_EQ(
+      map_files["/file with spaces"].extents,
+      (vector<BlockExtent>{ExtentForRange(14, 1), ExtentForRange(19, 1)}));
+  EXPECT_EQ(map_files["/1234"].extents,
+            (vector<BlockExtent>{ExtentForRange(7, 1)}));
 }
 
 TEST_F(MapfileFilesystemTest, BlockNumberTooBigTest) {
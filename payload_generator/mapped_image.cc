@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/mapped_image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstring>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+MappedImage::~MappedImage() {
+  if (size_ > 0 && munmap(const_cast<uint8_t*>(data_), size_) != 0)
+    PLOG(ERROR) << "Unable to unmap " << path_;
+}
+
+std::unique_ptr<MappedImage> MappedImage::CreateFromFile(const string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    PLOG(ERROR) << "Unable to open " << path;
+    return nullptr;
+  }
+  // The mapping stays valid after the file descriptor is closed.
+  ScopedFdCloser fd_closer(&fd);
+
+  off_t file_size = utils::FileSize(fd);
+  if (file_size < 0) {
+    LOG(ERROR) << "Unable to get the size of " << path;
+    return nullptr;
+  }
+  if (file_size == 0)
+    return std::unique_ptr<MappedImage>(new MappedImage(path, nullptr, 0));
+
+  void* data = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    PLOG(ERROR) << "Unable to mmap " << path;
+    return nullptr;
+  }
+  // Images are mostly scanned from the beginning to the end several times
+  // (block mapping, deflate search, diffing) so prefer read-ahead. These are
+  // only hints, failing to set them is not an error.
+  if (madvise(data, file_size, MADV_SEQUENTIAL) != 0 ||
+      madvise(data, file_size, MADV_WILLNEED) != 0) {
+    PLOG(WARNING) << "Unable to set access hints for " << path;
+  }
+  return std::unique_ptr<MappedImage>(
+      new MappedImage(path, static_cast<const uint8_t*>(data), file_size));
+}
+
+bool MappedImage::IsInRange(uint64_t offset, uint64_t length) const {
+  return offset <= size_ && length <= size_ - offset;
+}
+
+const uint8_t* MappedImage::GetData(uint64_t offset, uint64_t length) const {
+  if (!IsInRange(offset, length))
+    return nullptr;
+  return data_ + offset;
+}
+
+const uint8_t* MappedImage::GetExtentData(const BlockExtent& extent,
+                                          size_t block_size) const {
+  uint64_t offset = extent.start_block() * block_size;
+  uint64_t length = extent.num_blocks() * block_size;
+  if (!IsInRange(offset, length)) {
+    LOG(ERROR) << "Extent [" << extent.start_block() << ", "
+               << extent.num_blocks() << "] is outside of " << path_ << " ("
+               << size_ << " bytes)";
+    return nullptr;
+  }
+  return data_ + offset;
+}
+
+bool MappedImage::GetExtentsData(const vector<BlockExtent>& extents,
+                                 size_t block_size,
+                                 brillo::Blob* scratch,
+                                 const uint8_t** data,
+                                 size_t* size) const {
+  uint64_t num_blocks = 0;
+  bool contiguous = true;
+  for (const BlockExtent& extent : extents) {
+    if (extent.start_block() != extents.front().start_block() + num_blocks)
+      contiguous = false;
+    num_blocks += extent.num_blocks();
+  }
+  if (contiguous && !extents.empty()) {
+    const uint8_t* start = GetExtentData(
+        BlockExtent(extents.front().start_block(), num_blocks), block_size);
+    TEST_AND_RETURN_FALSE(start != nullptr);
+    *data = start;
+    *size = num_blocks * block_size;
+    return true;
+  }
+  TEST_AND_RETURN_FALSE(ReadExtents(extents, block_size, scratch));
+  *data = scratch->data();
+  *size = scratch->size();
+  return true;
+}
+
+bool MappedImage::ReadExtents(const vector<BlockExtent>& extents,
+                              size_t block_size,
+                              brillo::Blob* out_data) const {
+  uint64_t total_size = utils::BlocksInExtents(extents) * block_size;
+  out_data->resize(total_size);
+  uint64_t bytes_read = 0;
+  for (const BlockExtent& extent : extents) {
+    const uint8_t* extent_data = GetExtentData(extent, block_size);
+    TEST_AND_RETURN_FALSE(extent_data != nullptr);
+    uint64_t bytes = extent.num_blocks() * block_size;
+    memcpy(out_data->data() + bytes_read, extent_data, bytes);
+    bytes_read += bytes;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_IMAGE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_IMAGE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_generator/block_extent.h"
+
+namespace chromeos_update_engine {
+
+// A read-only memory mapping of a whole partition image (regular file or block
+// device). A single MappedImage is meant to be shared by all the threads
+// generating operations for a partition: reading from it doesn't require any
+// system call, and since the mapping is never modified it is safe to read from
+// several threads at the same time.
+class MappedImage {
+ public:
+  ~MappedImage();
+
+  // Maps the file or block device |path| in memory. An empty file results in a
+  // valid MappedImage of size 0. Returns nullptr on error.
+  static std::unique_ptr<MappedImage> CreateFromFile(const std::string& path);
+
+  // The path of the mapped file.
+  const std::string& path() const { return path_; }
+
+  // The size in bytes of the mapped file.
+  size_t size() const { return size_; }
+
+  // Returns a pointer to the |length| bytes at byte |offset| of the image,
+  // without copying them. Returns nullptr if the range is not fully inside the
+  // image.
+  const uint8_t* GetData(uint64_t offset, uint64_t length) const;
+
+  // Returns a pointer to the data of the blocks described by |extent| inside
+  // the mapping, without copying it. The returned pointer is valid for
+  // extent.num_blocks() * |block_size| bytes and as long as this object is
+  // alive. Returns nullptr if the extent is not fully inside the image.
+  const uint8_t* GetExtentData(const BlockExtent& extent,
+                               size_t block_size) const;
+
+  // Returns a view of the data in |extents| as a single contiguous buffer. If
+  // all the |extents| are contiguous on disk no data is copied and |*data|
+  // points inside the mapping; otherwise the blocks are gathered into
+  // |scratch|, which may be reused between calls to avoid reallocations.
+  // Stores the size of the data in |size|.
+  bool GetExtentsData(const std::vector<BlockExtent>& extents,
+                      size_t block_size,
+                      brillo::Blob* scratch,
+                      const uint8_t** data,
+                      size_t* size) const;
+
+  // Copies the data of the blocks in |extents|, in order, to |out_data|. The
+  // |out_data| is resized to the number of bytes in |extents|. Returns whether
+  // all the extents were inside the image.
+  bool ReadExtents(const std::vector<BlockExtent>& extents,
+                   size_t block_size,
+                   brillo::Blob* out_data) const;
+
+ private:
+  MappedImage(const std::string& path, const uint8_t* data, size_t size)
+      : path_(path), data_(data), size_(size) {}
+
+  // Returns whether the byte range [offset, offset + length) is inside the
+  // mapping.
+  bool IsInRange(uint64_t offset, uint64_t length) const;
+
+  const std::string path_;
+  const uint8_t* data_;
+  const size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedImage);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_IMAGE_H_
@@ -0,0 +1,126 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/mapped_image.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class MappedImageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kNumBlocks * kTestBlockSize);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(image_file_.path(), data_));
+  }
+
+  static constexpr size_t kTestBlockSize = 1024;
+  static constexpr size_t kNumBlocks = 10;
+
+  ScopedTempFile image_file_{"MappedImageTest.XXXXXX"};
+  brillo::Blob data_;
+};
+
+TEST_F(MappedImageTest, NonExistingFileTest) {
+  EXPECT_EQ(nullptr, MappedImage::CreateFromFile("/non/existing/file"));
+}
+
+TEST_F(MappedImageTest, EmptyFileTest) {
+  ScopedTempFile empty_file("MappedImageTest_empty.XXXXXX");
+  auto image = MappedImage::CreateFromFile(empty_file.path());
+  ASSERT_NE(nullptr, image);
+  EXPECT_EQ(0U, image->size());
+  EXPECT_EQ(nullptr, image->GetExtentData(ExtentForRange(0, 1), 1));
+}
+
+TEST_F(MappedImageTest, GetExtentDataTest) {
+  auto image = MappedImage::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, image);
+  EXPECT_EQ(data_.size(), image->size());
+
+  const uint8_t* extent_data =
+      image->GetExtentData(ExtentForRange(3, 2), kTestBlockSize);
+  ASSERT_NE(nullptr, extent_data);
+  EXPECT_EQ(brillo::Blob(data_.begin() + 3 * kTestBlockSize,
+                         data_.begin() + 5 * kTestBlockSize),
+            brillo::Blob(extent_data, extent_data + 2 * kTestBlockSize));
+
+  // Extents past the end of the image are rejected.
+  EXPECT_EQ(nullptr,
+            image->GetExtentData(ExtentForRange(9, 2), kTestBlockSize));
+}
+
+TEST_F(MappedImageTest, ReadExtentsTest) {
+  auto image = MappedImage::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, image);
+
+  brillo::Blob result;
+  EXPECT_TRUE(image->ReadExtents(
+      {ExtentForRange(7, 1), ExtentForRange(1, 2)}, kTestBlockSize, &result));
+  brillo::Blob expected(data_.begin() + 7 * kTestBlockSize,
+                        data_.begin() + 8 * kTestBlockSize);
+  expected.insert(expected.end(),
+                  data_.begin() + 1 * kTestBlockSize,
+                  data_.begin() + 3 * kTestBlockSize);
+  EXPECT_EQ(expected, result);
+
+  EXPECT_FALSE(
+      image->ReadExtents({ExtentForRange(10, 1)}, kTestBlockSize, &result));
+}
+
+TEST_F(MappedImageTest, GetExtentsDataContiguousIsZeroCopyTest) {
+  auto image = MappedImage::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, image);
+
+  brillo::Blob scratch;
+  const uint8_t* data;
+  size_t size;
+  vector<BlockExtent> extents = {ExtentForRange(2, 1), ExtentForRange(3, 2)};
+  EXPECT_TRUE(
+      image->GetExtentsData(extents, kTestBlockSize, &scratch, &data, &size));
+  EXPECT_EQ(3 * kTestBlockSize, size);
+  EXPECT_TRUE(scratch.empty());
+  EXPECT_EQ(image->GetExtentData(ExtentForRange(2, 1), kTestBlockSize), data);
+}
+
+TEST_F(MappedImageTest, GetExtentsDataGatherTest) {
+  auto image = MappedImage::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, image);
+
+  brillo::Blob scratch;
+  const uint8_t* data;
+  size_t size;
+  vector<BlockExtent> extents = {ExtentForRange(5, 1), ExtentForRange(0, 1)};
+  EXPECT_TRUE(
+      image->GetExtentsData(extents, kTestBlockSize, &scratch, &data, &size));
+  EXPECT_EQ(2 * kTestBlockSize, size);
+  EXPECT_EQ(scratch.data(), data);
+
+  brillo::Blob expected;
+  EXPECT_TRUE(image->ReadExtents(extents, kTestBlockSize, &expected));
+  EXPECT_EQ(expected, brillo::Blob(data, data + size));
+}
+
+}  // namespace chromeos_update_engine
@@ -84,7 +84,7 @@ std::unique_ptr<MergeSequenceGenerator> MergeSequenceGenerator::Create(
       continue;
     }
     if (aop.op.dst_extents().size() != 1) {
-      std::vector<Extent> out_extents;
+      std::vector<BlockExtent> out_extents;
       ExtentsToVector(aop.op.dst_extents(), &out_extents);
       LOG(ERROR) << "The dst extents for source_copy expects to be contiguous,"
                  << " dst extents: " << ExtentsToString(out_extents);
@@ -32,6 +32,7 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/xz.h"
 
 using std::string;
 using std::vector;
@@ -51,6 +52,37 @@ struct DeltaObject {
   off_t size;
 };
 
+// Moves the |extents| to |packed| in the packed format described in
+// update_metadata.proto.
+void PackExtents(google::protobuf::RepeatedPtrField<Extent>* extents,
+                 google::protobuf::RepeatedField<int64_t>* packed) {
+  packed->Reserve(2 * extents->size());
+  uint64_t end_block = 0;
+  for (const Extent& extent : *extents) {
+    packed->Add(static_cast<int64_t>(extent.start_block() - end_block));
+    packed->Add(extent.num_blocks());
+    end_block = extent.start_block() + extent.num_blocks();
+  }
+  extents->Clear();
+}
+
+// Serializes the operations of |partition| as a PartitionOperations message
+// to |serialized_operations|, with their extents packed and their data
+// offsets moved forward by |data_offset_shift|.
+bool SerializePartitionOperations(const PartitionUpdate& partition,
+                                  uint64_t data_offset_shift,
+                                  string* serialized_operations) {
+  PartitionOperations operations;
+  *operations.mutable_operations() = partition.operations();
+  for (InstallOperation& op : *operations.mutable_operations()) {
+    if (op.has_data_offset())
+      op.set_data_offset(op.data_offset() + data_offset_shift);
+    PackExtents(op.mutable_src_extents(), op.mutable_packed_src_extents());
+    PackExtents(op.mutable_dst_extents(), op.mutable_packed_dst_extents());
+  }
+  return operations.SerializeToString(serialized_operations);
+}
+
 // Writes the uint64_t passed in in host-endian to the file as big-endian.
 // Returns true on success.
 bool WriteUint64AsBigEndian(FileWriter* writer, const uint64_t value) {
@@ -64,6 +96,10 @@ bool WriteUint64AsBigEndian(FileWriter* writer, const uint64_t value) {
 bool PayloadFile::Init(const PayloadGenerationConfig& config) {
   TEST_AND_RETURN_FALSE(config.version.Validate());
   major_version_ = config.version.major;
+  pack_extents_ = config.pack_extents;
+  compress_manifest_ = config.compress_manifest;
+  stream_operations_ = config.stream_operations;
+  target_cache_ = config.target_cache;
   manifest_.set_minor_version(config.version.minor);
   manifest_.set_block_size(config.block_size);
   manifest_.set_max_timestamp(config.max_timestamp);
@@ -109,8 +145,13 @@ bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
   if (!old_conf.path.empty())
     TEST_AND_RETURN_FALSE(
         diff_utils::InitializePartitionInfo(old_conf, &part.old_info));
-  TEST_AND_RETURN_FALSE(
-      diff_utils::InitializePartitionInfo(new_conf, &part.new_info));
+  if (target_cache_) {
+    TEST_AND_RETURN_FALSE(
+        target_cache_->GetPartitionInfo(new_conf, &part.new_info));
+  } else {
+    TEST_AND_RETURN_FALSE(
+        diff_utils::InitializePartitionInfo(new_conf, &part.new_info));
+  }
   part_vec_.push_back(std::move(part));
   return true;
 }
@@ -138,9 +179,12 @@ bool PayloadFile::WritePayload(const string& payload_file,
     }
   }
 
-  // Copy the operations and partition info from the part_vec_ to the manifest.
+  // Move the operations and partition info from the part_vec_ to the manifest.
+  // The operations in |part_vec_| are left empty, only their names are kept
+  // for the report.
   manifest_.clear_partitions();
-  for (const auto& part : part_vec_) {
+  manifest_.mutable_partitions()->Reserve(part_vec_.size());
+  for (auto& part : part_vec_) {
     PartitionUpdate* partition = manifest_.add_partitions();
     partition->set_partition_name(part.name);
     if (!part.version.empty()) {
@@ -173,17 +217,31 @@ bool PayloadFile::WritePayload(const string& payload_file,
         partition->set_fec_roots(part.verity.fec_roots);
       }
     }
-    for (const AnnotatedOperation& aop : part.aops) {
-      *partition->add_operations() = aop.op;
+    partition->mutable_operations()->Reserve(part.aops.size());
+    for (AnnotatedOperation& aop : part.aops) {
+      *partition->add_operations() = std::move(aop.op);
     }
-    for (const auto& merge_op : part.cow_merge_sequence) {
-      *partition->add_merge_operations() = merge_op;
+    partition->mutable_merge_operations()->Reserve(
+        part.cow_merge_sequence.size());
+    for (auto& merge_op : part.cow_merge_sequence) {
+      *partition->add_merge_operations() = std::move(merge_op);
     }
 
     if (part.old_info.has_size() || part.old_info.has_hash())
-      *(partition->mutable_old_partition_info()) = part.old_info;
+      *(partition->mutable_old_partition_info()) = std::move(part.old_info);
     if (part.new_info.has_size() || part.new_info.has_hash())
-      *(partition->mutable_new_partition_info()) = part.new_info;
+      *(partition->mutable_new_partition_info()) = std::move(part.new_info);
+  }
+
+  // The operations are moved out of the manifest before the signature
+  // location is known, since they are stored in the data blobs.
+  ScopedTempFile streamed_blobs_file("CrAU_temp_data.streamed.XXXXXX");
+  string blobs_path = ordered_blobs_file.path();
+  if (stream_operations_) {
+    TEST_AND_RETURN_FALSE(StreamOperations(ordered_blobs_file.path(),
+                                           streamed_blobs_file.path(),
+                                           &next_blob_offset));
+    blobs_path = streamed_blobs_file.path();
   }
 
   // Signatures appear at the end of the blobs. Note the offset in the
@@ -198,7 +256,7 @@ bool PayloadFile::WritePayload(const string& payload_file,
 
   // Serialize protobuf
   string serialized_manifest;
-  TEST_AND_RETURN_FALSE(manifest_.SerializeToString(&serialized_manifest));
+  TEST_AND_RETURN_FALSE(SerializeManifest(&serialized_manifest));
 
   uint64_t metadata_size =
       sizeof(kDeltaMagic) + 2 * sizeof(uint64_t) + serialized_manifest.size();
@@ -249,7 +307,7 @@ bool PayloadFile::WritePayload(const string& payload_file,
 
   // Append the data blobs.
   LOG(INFO) << "Writing final delta file data blobs...";
-  int blobs_fd = open(ordered_blobs_file.path().c_str(), O_RDONLY, 0);
+  int blobs_fd = open(blobs_path.c_str(), O_RDONLY, 0);
   ScopedFdCloser blobs_fd_closer(&blobs_fd);
   TEST_AND_RETURN_FALSE(blobs_fd >= 0);
   for (;;) {
@@ -319,6 +377,82 @@ bool PayloadFile::ReorderDataBlobs(const string& data_blobs_path,
   return true;
 }
 
+bool PayloadFile::StreamOperations(const string& data_blobs_path,
+                                   const string& new_data_blobs_path,
+                                   uint64_t* data_blobs_size) {
+  int in_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+
+  DirectFileWriter writer;
+  TEST_AND_RETURN_FALSE_ERRNO(
+      writer.Open(new_data_blobs_path.c_str(),
+                  O_WRONLY | O_TRUNC | O_CREAT,
+                  0644) == 0);
+  ScopedFileWriterCloser writer_closer(&writer);
+
+  streamed_operations_.clear();
+  streamed_operations_.resize(manifest_.partitions_size());
+  uint64_t in_offset = 0;
+  uint64_t out_offset = 0;
+  for (int i = 0; i < manifest_.partitions_size(); i++) {
+    PartitionUpdate* partition = manifest_.mutable_partitions(i);
+    // The client skips the partitions without operations.
+    if (partition->operations_size() == 0)
+      continue;
+    uint64_t data_size = 0;
+    for (const InstallOperation& op : partition->operations())
+      data_size += op.data_length();
+
+    // The data blobs of the partition are moved forward by the size of its
+    // serialized operations, which in turn depends on the new data offsets.
+    // The size only grows with the offsets, so repeating this converges.
+    string serialized_operations;
+    uint64_t operations_size;
+    do {
+      operations_size = serialized_operations.size();
+      TEST_AND_RETURN_FALSE(SerializePartitionOperations(
+          *partition,
+          out_offset + operations_size - in_offset,
+          &serialized_operations));
+    } while (serialized_operations.size() != operations_size);
+
+    for (InstallOperation& op : *partition->mutable_operations()) {
+      if (op.has_data_offset())
+        op.set_data_offset(op.data_offset() + out_offset + operations_size -
+                           in_offset);
+    }
+    brillo::Blob hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        serialized_operations.data(), serialized_operations.size(), &hash));
+    partition->set_operations_data_offset(out_offset);
+    partition->set_operations_data_length(operations_size);
+    partition->set_operations_data_sha256_hash(hash.data(), hash.size());
+    partition->set_num_operations(partition->operations_size());
+    streamed_operations_[i].Swap(partition->mutable_operations());
+    TEST_AND_RETURN_FALSE_ERRNO(
+        writer.Write(serialized_operations.data(), operations_size));
+    out_offset += operations_size;
+
+    // Copy the data blobs of the partition.
+    brillo::Blob buf(std::min(data_size, static_cast<uint64_t>(1024 * 1024)));
+    for (uint64_t copied = 0; copied < data_size;) {
+      size_t size =
+          std::min(data_size - copied, static_cast<uint64_t>(buf.size()));
+      ssize_t rc = pread(in_fd, buf.data(), size, in_offset + copied);
+      TEST_AND_RETURN_FALSE(rc == static_cast<ssize_t>(size));
+      TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), size));
+      copied += size;
+    }
+    in_offset += data_size;
+    out_offset += data_size;
+  }
+  LOG(INFO) << "Stored the operations of the partitions in the data blobs, "
+            << out_offset - in_offset << " bytes.";
+  *data_blobs_size = out_offset;
+  return true;
+}
+
 bool PayloadFile::AddOperationHash(InstallOperation* op,
                                    const brillo::Blob& buf) {
   brillo::Blob hash;
@@ -327,18 +461,88 @@ bool PayloadFile::AddOperationHash(InstallOperation* op,
   return true;
 }
 
+bool PayloadFile::SerializeManifest(string* serialized_manifest) {
+  if (!pack_extents_)
+    return manifest_.SerializeToString(serialized_manifest);
+
+  size_t unpacked_size = manifest_.ByteSizeLong();
+  for (PartitionUpdate& partition : *manifest_.mutable_partitions()) {
+    for (InstallOperation& op : *partition.mutable_operations()) {
+      PackExtents(op.mutable_src_extents(), op.mutable_packed_src_extents());
+      PackExtents(op.mutable_dst_extents(), op.mutable_packed_dst_extents());
+    }
+  }
+  if (!compress_manifest_) {
+    TEST_AND_RETURN_FALSE(manifest_.SerializeToString(serialized_manifest));
+    LOG(INFO) << "Packing the extents reduced the manifest from "
+              << unpacked_size << " to " << serialized_manifest->size()
+              << " bytes.";
+    return true;
+  }
+
+  // The minor version and the signature location stay out of the compressed
+  // manifest, since they are needed before decompressing it and the signature
+  // location is updated when signing the payload.
+  DeltaArchiveManifest manifest;
+  manifest.set_minor_version(manifest_.minor_version());
+  if (manifest_.has_signatures_offset()) {
+    manifest.set_signatures_offset(manifest_.signatures_offset());
+    manifest.set_signatures_size(manifest_.signatures_size());
+    manifest_.clear_signatures_offset();
+    manifest_.clear_signatures_size();
+  }
+  string packed_manifest;
+  bool serialized = manifest_.SerializeToString(&packed_manifest);
+  if (manifest.has_signatures_offset()) {
+    manifest_.set_signatures_offset(manifest.signatures_offset());
+    manifest_.set_signatures_size(manifest.signatures_size());
+  }
+  TEST_AND_RETURN_FALSE(serialized);
+
+  brillo::Blob compressed_manifest;
+  TEST_AND_RETURN_FALSE(XzCompress(
+      brillo::Blob(packed_manifest.begin(), packed_manifest.end()),
+      &compressed_manifest));
+  manifest.set_compressed_manifest(compressed_manifest.data(),
+                                   compressed_manifest.size());
+  TEST_AND_RETURN_FALSE(manifest.SerializeToString(serialized_manifest));
+  LOG(INFO) << "Packing the extents and compressing the manifest reduced it "
+            << "from " << unpacked_size << " to " << packed_manifest.size()
+            << " and " << serialized_manifest->size() << " bytes.";
+  return true;
+}
+
 void PayloadFile::ReportPayloadUsage(uint64_t metadata_size) const {
   std::map<DeltaObject, int> object_counts;
   off_t total_size = 0;
   int total_op = 0;
 
-  for (const auto& part : part_vec_) {
+  // The operations were moved to |manifest_| by WritePayload(), in the same
+  // order as in |part_vec_|, or to |streamed_operations_| if they are stored
+  // in the data blobs.
+  CHECK_EQ(part_vec_.size(),
+           static_cast<size_t>(manifest_.partitions_size()));
+  for (size_t i = 0; i < part_vec_.size(); i++) {
+    const Partition& part = part_vec_[i];
+    const PartitionUpdate& partition = manifest_.partitions(i);
+    const auto& operations = partition.has_operations_data_offset()
+                                 ? streamed_operations_[i]
+                                 : partition.operations();
+    CHECK_EQ(part.aops.size(), static_cast<size_t>(operations.size()));
     string part_prefix = "<" + part.name + ">:";
-    for (const AnnotatedOperation& aop : part.aops) {
+    if (partition.has_operations_data_offset()) {
+      DeltaObject delta(part_prefix + "<operations>",
+                        -1,
+                        partition.operations_data_length());
+      object_counts[delta]++;
+      total_size += partition.operations_data_length();
+    }
+    for (size_t j = 0; j < part.aops.size(); j++) {
+      const InstallOperation& op = operations.Get(j);
       DeltaObject delta(
-          part_prefix + aop.name, aop.op.type(), aop.op.data_length());
+          part_prefix + part.aops[j].name, op.type(), op.data_length());
       object_counts[delta]++;
-      total_size += aop.op.data_length();
+      total_size += op.data_length();
     }
     total_op += part.aops.size();
   }
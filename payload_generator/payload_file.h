@@ -50,7 +50,8 @@ class PayloadFile {
   // Write the payload to the |payload_file| file. The operations reference
   // blobs in the |data_blobs_path| file and the blobs will be reordered in the
   // payload file to match the order of the operations. The size of the metadata
-  // section of the payload is stored in |metadata_size_out|.
+  // section of the payload is stored in |metadata_size_out|. The operations are
+  // moved into the manifest, so this can only be called once.
   bool WritePayload(const std::string& payload_file,
                     const std::string& data_blobs_path,
                     const std::string& private_key_path,
@@ -58,6 +59,8 @@ class PayloadFile {
 
  private:
   FRIEND_TEST(PayloadFileTest, ReorderBlobsTest);
+  FRIEND_TEST(PayloadFileTest, SerializeManifestTest);
+  FRIEND_TEST(PayloadFileTest, StreamOperationsTest);
 
   // Computes a SHA256 hash of the given buf and sets the hash value in the
   // operation so that update_engine could verify. This hash should be set
@@ -77,12 +80,46 @@ class PayloadFile {
   bool ReorderDataBlobs(const std::string& data_blobs_path,
                         const std::string& new_data_blobs_path);
 
-  // Print in stderr the Payload usage report.
+  // Moves the operations of every partition in |manifest_| with operations
+  // out of the manifest, see |PartitionUpdate.operations_data_offset|. The
+  // data blobs in |data_blobs_path|, ordered by ReorderDataBlobs(), are
+  // copied to |new_data_blobs_path| with the serialized operations of every
+  // partition right before its data blobs. The moved operations are kept in
+  // |streamed_operations_|. The new size of the data blobs is stored in
+  // |data_blobs_size|.
+  bool StreamOperations(const std::string& data_blobs_path,
+                        const std::string& new_data_blobs_path,
+                        uint64_t* data_blobs_size);
+
+  // Print in stderr the Payload usage report. Must be called after the
+  // operations were moved to |manifest_|.
   void ReportPayloadUsage(uint64_t metadata_size) const;
 
+  // Serializes |manifest_| to |serialized_manifest| as stored in the payload.
+  // If |pack_extents_|, the extents of the operations in |manifest_| are
+  // packed and the manifest is compressed if |compress_manifest_|.
+  bool SerializeManifest(std::string* serialized_manifest);
+
   // The major_version of the requested payload.
   uint64_t major_version_;
 
+  // Whether to pack the extents and compress the manifest, see
+  // SerializeManifest().
+  bool pack_extents_ = false;
+  bool compress_manifest_ = false;
+
+  // Whether to store the operations in the data blobs, see
+  // StreamOperations().
+  bool stream_operations_ = false;
+
+  // The operations moved out of every partition in |manifest_| by
+  // StreamOperations(), for the report.
+  std::vector<google::protobuf::RepeatedPtrField<InstallOperation>>
+      streamed_operations_;
+
+  // The cache of the target partition hashes, if any. Not owned.
+  TargetCache* target_cache_ = nullptr;
+
   DeltaArchiveManifest manifest_;
 
   // Struct has necessary information to write PartitionUpdate in protobuf.
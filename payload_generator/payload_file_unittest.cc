@@ -22,7 +22,10 @@
 
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 using std::string;
@@ -84,4 +87,133 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   EXPECT_EQ(6U, part1_aops[0].op.data_length());
 }
 
+TEST_F(PayloadFileTest, SerializeManifestTest) {
+  DeltaArchiveManifest expected_manifest;
+  expected_manifest.set_minor_version(kPackedExtentsMinorPayloadVersion);
+  expected_manifest.set_signatures_offset(1234);
+  expected_manifest.set_signatures_size(256);
+  PartitionUpdate* partition = expected_manifest.add_partitions();
+  partition->set_partition_name("system");
+  for (uint64_t i = 0; i < 100; i++) {
+    InstallOperation* op = partition->add_operations();
+    op->set_type(InstallOperation::SOURCE_COPY);
+    // The source extents go backwards.
+    *op->add_src_extents() = ExtentForRange(1000 - 2 * i, 1);
+    *op->add_src_extents() = ExtentForRange(10, 5);
+    *op->add_dst_extents() = ExtentForRange(i, 1);
+  }
+
+  // Without packing, the manifest is stored as is.
+  payload_.manifest_ = expected_manifest;
+  string unpacked_manifest;
+  EXPECT_TRUE(payload_.SerializeManifest(&unpacked_manifest));
+  EXPECT_EQ(expected_manifest.SerializeAsString(), unpacked_manifest);
+
+  payload_.pack_extents_ = true;
+  for (bool compress_manifest : {false, true}) {
+    payload_.manifest_ = expected_manifest;
+    payload_.compress_manifest_ = compress_manifest;
+    string serialized_manifest;
+    EXPECT_TRUE(payload_.SerializeManifest(&serialized_manifest));
+
+    DeltaArchiveManifest manifest;
+    ASSERT_TRUE(manifest.ParseFromString(serialized_manifest));
+    EXPECT_EQ(compress_manifest, manifest.has_compressed_manifest());
+    EXPECT_EQ(compress_manifest, manifest.partitions().empty());
+    EXPECT_EQ(kPackedExtentsMinorPayloadVersion, manifest.minor_version());
+    EXPECT_EQ(1234U, manifest.signatures_offset());
+    EXPECT_LT(serialized_manifest.size(), expected_manifest.ByteSizeLong());
+
+    EXPECT_TRUE(PayloadMetadata::DecodeManifest(&manifest));
+    EXPECT_EQ(expected_manifest.SerializeAsString(),
+              manifest.SerializeAsString());
+  }
+}
+
+TEST_F(PayloadFileTest, StreamOperationsTest) {
+  // The first partition has a blob per byte, so the data offsets need
+  // several sizes of varints. The second partition has no operations.
+  string orig_data;
+  payload_.manifest_.set_minor_version(kStreamedOperationsMinorPayloadVersion);
+  PartitionUpdate* partition = payload_.manifest_.add_partitions();
+  for (uint64_t i = 0; i < 300; i++) {
+    InstallOperation* op = partition->add_operations();
+    op->set_type(InstallOperation::REPLACE);
+    op->set_data_offset(i);
+    op->set_data_length(1);
+    *op->add_dst_extents() = ExtentForRange(i, 1);
+    orig_data.push_back('a' + i % 26);
+  }
+  payload_.manifest_.add_partitions();
+  partition = payload_.manifest_.add_partitions();
+  InstallOperation* op = partition->add_operations();
+  op->set_type(InstallOperation::REPLACE);
+  op->set_data_offset(orig_data.size());
+  op->set_data_length(6);
+  orig_data += "kernel";
+
+  ScopedTempFile orig_blobs("StreamOperationsTest.orig.XXXXXX");
+  ScopedTempFile new_blobs("StreamOperationsTest.new.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileString(orig_blobs.path(), orig_data));
+  uint64_t data_blobs_size;
+  EXPECT_TRUE(payload_.StreamOperations(
+      orig_blobs.path(), new_blobs.path(), &data_blobs_size));
+  string new_data;
+  EXPECT_TRUE(utils::ReadFile(new_blobs.path(), &new_data));
+  EXPECT_EQ(new_data.size(), data_blobs_size);
+
+  EXPECT_FALSE(payload_.manifest_.partitions(1).has_operations_data_offset());
+  uint64_t orig_offset = 0;
+  for (int i : {0, 2}) {
+    const PartitionUpdate& partition = payload_.manifest_.partitions(i);
+    EXPECT_EQ(0, partition.operations_size());
+    ASSERT_EQ(static_cast<uint64_t>(payload_.streamed_operations_[i].size()),
+              partition.num_operations());
+
+    // The operations are right before their data.
+    string operations_data = new_data.substr(
+        partition.operations_data_offset(), partition.operations_data_length());
+    brillo::Blob hash;
+    ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+        operations_data.data(), operations_data.size(), &hash));
+    EXPECT_EQ(hash,
+              brillo::Blob(partition.operations_data_sha256_hash().begin(),
+                           partition.operations_data_sha256_hash().end()));
+    google::protobuf::RepeatedPtrField<InstallOperation> operations;
+    ASSERT_TRUE(PayloadMetadata::DecodePartitionOperations(
+        partition, operations_data.data(), operations_data.size(),
+        &operations));
+    uint64_t data_offset = partition.operations_data_offset() +
+                           partition.operations_data_length();
+    for (int j = 0; j < operations.size(); j++) {
+      const InstallOperation& op = operations.Get(j);
+      EXPECT_EQ(payload_.streamed_operations_[i].Get(j).SerializeAsString(),
+                op.SerializeAsString());
+      EXPECT_EQ(data_offset, op.data_offset());
+      EXPECT_EQ(orig_data.substr(orig_offset, op.data_length()),
+                new_data.substr(op.data_offset(), op.data_length()));
+      data_offset += op.data_length();
+      orig_offset += op.data_length();
+    }
+  }
+  EXPECT_EQ(orig_offset, orig_data.size());
+}
+
+TEST_F(PayloadFileTest, DecodeInvalidPackedExtentsTest) {
+  DeltaArchiveManifest manifest;
+  InstallOperation* op = manifest.add_partitions()->add_operations();
+  // An extent starting before block 0.
+  op->add_packed_dst_extents(10);
+  op->add_packed_dst_extents(1);
+  op->add_packed_dst_extents(-12);
+  op->add_packed_dst_extents(1);
+  EXPECT_FALSE(PayloadMetadata::DecodeManifest(&manifest));
+
+  // An odd number of values.
+  op->clear_dst_extents();
+  op->clear_packed_dst_extents();
+  op->add_packed_dst_extents(10);
+  EXPECT_FALSE(PayloadMetadata::DecodeManifest(&manifest));
+}
+
 }  // namespace chromeos_update_engine
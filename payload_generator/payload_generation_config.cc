@@ -29,6 +29,7 @@
 #include "update_engine/payload_generator/boot_img_filesystem.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/erofs_filesystem.h"
 #include "update_engine/payload_generator/ext2_filesystem.h"
 #include "update_engine/payload_generator/mapfile_filesystem.h"
 #include "update_engine/payload_generator/raw_filesystem.h"
@@ -38,6 +39,10 @@ using std::string;
 
 namespace chromeos_update_engine {
 
+// No budget, so the payloads built without one keep the fixed bsdiff and
+// puffdiff size limits.
+const uint64_t kDefaultApplyMemoryBudget = 0;
+
 bool PostInstallConfig::IsEmpty() const {
   return !run && path.empty() && filesystem_type.empty() && !optional;
 }
@@ -87,6 +92,12 @@ bool PartitionConfig::OpenFilesystem() {
     return true;
   }
 
+  fs_interface = ErofsFilesystem::CreateFromFile(path);
+  if (fs_interface) {
+    TEST_AND_RETURN_FALSE(fs_interface->GetBlockSize() == kBlockSize);
+    return true;
+  }
+
   fs_interface = SquashfsFilesystem::CreateFromFile(path,
                                                     /*extract_deflates=*/true,
                                                     /*load_settings=*/true);
@@ -236,7 +247,13 @@ bool PayloadVersion::Validate() const {
                         minor == kBrotliBsdiffMinorPayloadVersion ||
                         minor == kPuffdiffMinorPayloadVersion ||
                         minor == kVerityMinorPayloadVersion ||
-                        minor == kPartialUpdateMinorPayloadVersion);
+                        minor == kPartialUpdateMinorPayloadVersion ||
+                        minor == kPackedExtentsMinorPayloadVersion ||
+                        minor == kStreamedOperationsMinorPayloadVersion ||
+                        minor == kCrossPartitionMinorPayloadVersion ||
+                        minor == kTargetCopyMinorPayloadVersion ||
+                        minor == kLz4diffMinorPayloadVersion ||
+                        minor == kExecutableDiffMinorPayloadVersion);
   return true;
 }
 
@@ -268,6 +285,15 @@ bool PayloadVersion::OperationAllowed(InstallOperation::Type operation) const {
     case InstallOperation::PUFFDIFF:
       return minor >= kPuffdiffMinorPayloadVersion;
 
+    case InstallOperation::TARGET_COPY:
+      return minor >= kTargetCopyMinorPayloadVersion;
+
+    case InstallOperation::LZ4DIFF_BSDIFF:
+      return minor >= kLz4diffMinorPayloadVersion;
+
+    case InstallOperation::EXECUTABLE_BSDIFF:
+      return minor >= kExecutableDiffMinorPayloadVersion;
+
     case InstallOperation::MOVE:
     case InstallOperation::BSDIFF:
       NOTREACHED();
@@ -311,9 +337,27 @@ bool PayloadGenerationConfig::Validate() const {
     TEST_AND_RETURN_FALSE(!is_partial_update);
   }
 
+  if (version.minor < kPackedExtentsMinorPayloadVersion) {
+    TEST_AND_RETURN_FALSE(!pack_extents);
+  }
+  if (!pack_extents) {
+    TEST_AND_RETURN_FALSE(!compress_manifest);
+  }
+
+  if (version.minor < kStreamedOperationsMinorPayloadVersion) {
+    TEST_AND_RETURN_FALSE(!stream_operations);
+  }
+  // Without VABC, no COW size is estimated, so the device sizes the snapshots
+  // from the operations in the manifest.
+  if (stream_operations && target.dynamic_partition_metadata &&
+      target.dynamic_partition_metadata->snapshot_enabled()) {
+    TEST_AND_RETURN_FALSE(target.dynamic_partition_metadata->vabc_enabled());
+  }
+
   TEST_AND_RETURN_FALSE(hard_chunk_size == -1 ||
                         hard_chunk_size % block_size == 0);
   TEST_AND_RETURN_FALSE(soft_chunk_size % block_size == 0);
+  TEST_AND_RETURN_FALSE(source_locality_window_size % block_size == 0);
 
   TEST_AND_RETURN_FALSE(rootfs_partition_size % block_size == 0);
 
@@ -23,11 +23,14 @@
 #include <string>
 #include <vector>
 
+#include <base/time/time.h>
 #include <brillo/key_value_store.h>
 #include <brillo/secure_blob.h>
 
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/generation_report.h"
+#include "update_engine/payload_generator/target_cache.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -176,6 +179,9 @@ struct PayloadVersion {
   uint32_t minor;
 };
 
+// The default PayloadGenerationConfig::apply_memory_budget.
+extern const uint64_t kDefaultApplyMemoryBudget;
+
 // The PayloadGenerationConfig struct encapsulates all the configuration to
 // build the requested payload. This includes information about the old and new
 // image as well as the restrictions applied to the payload (like minor-version
@@ -221,6 +227,31 @@ struct PayloadGenerationConfig {
   // chunks.
   size_t soft_chunk_size = 2 * 1024 * 1024;
 
+  // If not 0, the operations of every partition are reordered to read the
+  // source partition more sequentially: the operations writing to the same
+  // window of |source_locality_window_size| bytes of the target partition are
+  // sorted by the first source block they read. A/B updates can apply the
+  // operations in any order, this only keeps the writes roughly sequential.
+  size_t source_locality_window_size = 0;
+
+  // The maximum memory in bytes the target devices may use to apply a single
+  // operation, as estimated by diff_utils::EstimateApplyMemory(). The diff
+  // operations that need more are not generated, and the files are split in
+  // chunks small enough to be diffed within it. Set it for the device with
+  // the least RAM the payload is built for. The default of 0 doesn't estimate
+  // the memory and keeps the fixed limits of 200 MiB of data for bsdiff and
+  // 150 MiB for puffdiff.
+  uint64_t apply_memory_budget = kDefaultApplyMemoryBudget;
+
+  // If not zero, the maximum time spent on a single chunk of data, counting
+  // from the start of the chunk. The diffs still running then are killed and
+  // the chunk gets the best operation found until then, usually a full one.
+  base::TimeDelta chunk_diff_time_budget;
+
+  // If not null, no chunk is diffed after this time and the remaining chunks
+  // get full operations, which bounds the total generation time.
+  base::TimeTicks diff_deadline;
+
   // TODO(deymo): Remove the block_size member and maybe replace it with a
   // minimum alignment size for blocks (if needed). Algorithms should be able to
   // pick the block_size they want, but for now only 4 KiB is supported.
@@ -231,8 +262,35 @@ struct PayloadGenerationConfig {
   // The maximum timestamp of the OS allowed to apply this payload.
   int64_t max_timestamp = 0;
 
+  // Whether to store the extents of the operations in the manifest in the
+  // packed format. Only allowed on minor version
+  // kPackedExtentsMinorPayloadVersion or newer. It is opt-in since the payload
+  // tools in scripts/update_payload don't understand the packed extents.
+  bool pack_extents = false;
+
+  // Whether to compress the manifest with xz. Requires |pack_extents|.
+  bool compress_manifest = false;
+
+  // Whether to store the operations of every partition in the data blobs,
+  // right before the blobs of the partition, instead of the manifest. Only
+  // allowed on minor version kStreamedOperationsMinorPayloadVersion or newer.
+  bool stream_operations = false;
+
   // Path to apex_info.pb, extracted from target_file.zip
   std::string apex_info_file;
+
+  // If not empty, the directory where the deflate locations found in zip and
+  // gzip files are cached between runs, keyed by the file content.
+  std::string deflate_cache_dir;
+
+  // If not null, the timings and statistics of the generation are collected
+  // in this report. Not owned.
+  GenerationReport* report = nullptr;
+
+  // If not null, the work depending only on the target image is cached here
+  // to be reused by the payloads generated later for the same target image.
+  // Not owned.
+  TargetCache* target_cache = nullptr;
 };
 
 }  // namespace chromeos_update_engine
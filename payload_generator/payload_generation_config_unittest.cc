@@ -16,10 +16,13 @@
 
 #include "update_engine/payload_generator/payload_generation_config.h"
 
+#include <memory>
 #include <utility>
 
 #include <gtest/gtest.h>
 
+#include "update_engine/payload_consumer/payload_constants.h"
+
 namespace chromeos_update_engine {
 
 class PayloadGenerationConfigTest : public ::testing::Test {};
@@ -142,4 +145,40 @@ TEST_F(PayloadGenerationConfigTest, ValidateDynamicPartitionMetadataTooBig) {
 
   EXPECT_FALSE(image_config.ValidateDynamicPartitionMetadata());
 }
+
+TEST_F(PayloadGenerationConfigTest, ValidatePackedExtentsTest) {
+  PayloadGenerationConfig config;
+  config.is_delta = true;
+  config.version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                  kPackedExtentsMinorPayloadVersion);
+  EXPECT_TRUE(config.Validate());
+
+  // The manifest is only compressed with packed extents.
+  config.compress_manifest = true;
+  EXPECT_FALSE(config.Validate());
+  config.pack_extents = true;
+  EXPECT_TRUE(config.Validate());
+
+  config.version.minor = kPartialUpdateMinorPayloadVersion;
+  EXPECT_FALSE(config.Validate());
+}
+
+TEST_F(PayloadGenerationConfigTest, ValidateStreamedOperationsSnapshotsTest) {
+  PayloadGenerationConfig config;
+  config.is_delta = true;
+  config.version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                  kStreamedOperationsMinorPayloadVersion);
+  config.stream_operations = true;
+  config.target.dynamic_partition_metadata =
+      std::make_unique<DynamicPartitionMetadata>();
+  EXPECT_TRUE(config.Validate());
+
+  // The snapshots of Virtual A/B without compression are sized from the
+  // operations in the manifest.
+  config.target.dynamic_partition_metadata->set_snapshot_enabled(true);
+  EXPECT_FALSE(config.Validate());
+  config.target.dynamic_partition_metadata->set_vabc_enabled(true);
+  EXPECT_TRUE(config.Validate());
+}
+
 }  // namespace chromeos_update_engine
@@ -119,8 +119,9 @@ bool AddSignatureBlobToPayload(const string& payload_path,
   metadata_signature_size = metadata_signature.size();
   LOG(INFO) << "Metadata signature size: " << metadata_signature_size;
 
+  // The manifest is serialized again below, so keep it as stored.
   DeltaArchiveManifest manifest;
-  TEST_AND_RETURN_FALSE(payload_metadata.GetManifest(payload, &manifest));
+  TEST_AND_RETURN_FALSE(payload_metadata.GetRawManifest(payload, &manifest));
 
   // Is there already a signature op in place?
   if (manifest.has_signatures_size()) {
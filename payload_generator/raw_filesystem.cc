@@ -48,7 +48,7 @@ bool RawFilesystem::GetFiles(std::vector<File>* files) const {
   files->clear();
   File file;
   file.name = filename_;
-  file.extents = {ExtentForRange(0, block_count_)};
+  file.extents = {BlockExtent(0, block_count_)};
   files->push_back(file);
   return true;
 }
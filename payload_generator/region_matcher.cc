@@ -0,0 +1,167 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/region_matcher.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The chunks are cut where the top |kChunkMaskBits| bits of the gear hash of
+// the last 64 bytes are zero, so they are 1 KiB long on average past the
+// minimum size.
+constexpr size_t kMinChunkSize = 256;
+constexpr size_t kMaxChunkSize = 8192;
+constexpr int kChunkMaskBits = 10;
+
+// Chunks found more than this many times in the old data (like padding) say
+// nothing about where a region came from, so they don't vote.
+constexpr size_t kMaxChunkOccurrences = 16;
+
+// The old data at a different position is only used if at least this fraction
+// of the new region is found there.
+constexpr uint64_t kMinMatchDivisor = 16;
+
+// Returns the table of random values of the gear hash for every byte value.
+const std::array<uint64_t, 256>& GearTable() {
+  static const std::array<uint64_t, 256> table = [] {
+    // Generated with splitmix64 from a fixed seed, so the chunks are the same
+    // on every run.
+    std::array<uint64_t, 256> values;
+    uint64_t state = 0;
+    for (uint64_t& value : values) {
+      uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      value = z ^ (z >> 31);
+    }
+    return values;
+  }();
+  return table;
+}
+
+}  // namespace
+
+std::unique_ptr<RegionMatcher> RegionMatcher::Create(
+    const MappedImage& old_image,
+    vector<BlockExtent> old_extents,
+    size_t block_size) {
+  std::unique_ptr<RegionMatcher> matcher(
+      new RegionMatcher(std::move(old_extents), block_size));
+  uint64_t offset = 0;
+  for (const BlockExtent& extent : matcher->old_extents_) {
+    const uint8_t* data = old_image.GetExtentData(extent, block_size);
+    if (!data) {
+      LOG(ERROR) << "Unable to read " << extent << " from "
+                 << old_image.path();
+      return nullptr;
+    }
+    size_t size = extent.num_blocks() * block_size;
+    for (const Chunk& chunk : SplitInChunks(data, size))
+      matcher->old_chunks_.emplace_back(chunk.hash, offset + chunk.offset);
+    offset += size;
+  }
+  std::sort(matcher->old_chunks_.begin(), matcher->old_chunks_.end());
+  return matcher;
+}
+
+vector<BlockExtent> RegionMatcher::FindSource(const uint8_t* data,
+                                              uint64_t block_offset,
+                                              uint64_t num_blocks) const {
+  uint64_t offset = block_offset * block_size_;
+  uint64_t size = num_blocks * block_size_;
+
+  // The number of bytes of the region found at every distance from it.
+  std::unordered_map<int64_t, uint64_t> votes;
+  for (const Chunk& chunk : SplitInChunks(data, size)) {
+    auto range = std::equal_range(
+        old_chunks_.begin(),
+        old_chunks_.end(),
+        std::make_pair(chunk.hash, uint64_t{0}),
+        [](const std::pair<uint64_t, uint64_t>& a,
+           const std::pair<uint64_t, uint64_t>& b) {
+          return a.first < b.first;
+        });
+    if (static_cast<size_t>(range.second - range.first) > kMaxChunkOccurrences)
+      continue;
+    for (auto it = range.first; it != range.second; ++it) {
+      votes[static_cast<int64_t>(it->second) -
+            static_cast<int64_t>(offset + chunk.offset)] += chunk.size;
+    }
+  }
+
+  // Prefer the closest distance when several have the same votes.
+  int64_t best_distance = 0;
+  uint64_t best_votes = votes[0];
+  for (const auto& distance_votes : votes) {
+    int64_t distance = distance_votes.first;
+    if (distance_votes.second > best_votes ||
+        (distance_votes.second == best_votes &&
+         std::make_pair(std::abs(distance), distance) <
+             std::make_pair(std::abs(best_distance), best_distance))) {
+      best_distance = distance;
+      best_votes = distance_votes.second;
+    }
+  }
+  if (best_votes < size / kMinMatchDivisor)
+    best_distance = 0;
+
+  // Include the block with the end of the region when it isn't aligned.
+  int64_t start = static_cast<int64_t>(offset) + best_distance;
+  uint64_t start_block = start < 0 ? 0 : start / block_size_;
+  bool aligned = best_distance % static_cast<int64_t>(block_size_) == 0;
+  uint64_t source_blocks = num_blocks + (aligned ? 0 : 1);
+  return ExtentsSublist(old_extents_, start_block, source_blocks);
+}
+
+vector<RegionMatcher::Chunk> RegionMatcher::SplitInChunks(const uint8_t* data,
+                                                          size_t size) {
+  // FNV-1a, for the hash of the content of the chunks.
+  constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+  constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+  const std::array<uint64_t, 256>& gear_table = GearTable();
+  vector<Chunk> chunks;
+  chunks.reserve(size / kMinChunkSize / 4);
+  uint64_t gear = 0;
+  uint64_t hash = kFnvOffsetBasis;
+  size_t start = 0;
+  for (size_t i = 0; i < size; i++) {
+    gear = (gear << 1) + gear_table[data[i]];
+    hash = (hash ^ data[i]) * kFnvPrime;
+    size_t chunk_size = i + 1 - start;
+    if ((chunk_size >= kMinChunkSize && gear >> (64 - kChunkMaskBits) == 0) ||
+        chunk_size == kMaxChunkSize || i + 1 == size) {
+      chunks.push_back({start, static_cast<uint32_t>(chunk_size), hash});
+      start = i + 1;
+      hash = kFnvOffsetBasis;
+    }
+  }
+  return chunks;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_REGION_MATCHER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_REGION_MATCHER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/block_extent.h"
+#include "update_engine/payload_generator/mapped_image.h"
+
+namespace chromeos_update_engine {
+
+// Finds the old data to diff a region of new data against when there's no file
+// to relate them, like the data not included in any file of the filesystem.
+//
+// The old and new data are split in content-defined chunks with a rolling
+// hash, so the same content results in the same chunks even when it moved by a
+// number of bytes that isn't a multiple of the block size. Every chunk of a new
+// region found in the old data votes for the distance between its old and new
+// position, and the region is diffed against the old blocks at the distance
+// with most votes. When not enough of the region is found elsewhere, the old
+// blocks at the same position are used, since the old and new data usually
+// have the same layout.
+//
+// The positions are offsets in the data of the old and new extents given, as if
+// the blocks of the extents were concatenated.
+class RegionMatcher {
+ public:
+  // A content-defined chunk of data.
+  struct Chunk {
+    // The position and size of the chunk in the data, in bytes.
+    uint64_t offset;
+    uint32_t size;
+    // A hash of the content of the chunk.
+    uint64_t hash;
+  };
+
+  // Indexes the data of the blocks in |old_extents| of |old_image|. Returns
+  // nullptr on error.
+  static std::unique_ptr<RegionMatcher> Create(
+      const MappedImage& old_image,
+      std::vector<BlockExtent> old_extents,
+      size_t block_size);
+
+  // Returns the old extents to use as the source of the |num_blocks| blocks
+  // at block |block_offset| of the new extents, whose content is |data|. The
+  // returned extents can have one block more than the new region when the
+  // content moved by a number of bytes that isn't a multiple of the block
+  // size. This method is thread safe.
+  std::vector<BlockExtent> FindSource(const uint8_t* data,
+                                      uint64_t block_offset,
+                                      uint64_t num_blocks) const;
+
+  // Splits the |size| bytes of |data| in content-defined chunks. Every byte of
+  // |data| is in exactly one chunk.
+  static std::vector<Chunk> SplitInChunks(const uint8_t* data, size_t size);
+
+ private:
+  RegionMatcher(std::vector<BlockExtent> old_extents, size_t block_size)
+      : old_extents_(std::move(old_extents)), block_size_(block_size) {}
+
+  const std::vector<BlockExtent> old_extents_;
+  const size_t block_size_;
+
+  // The hash and offset of every chunk of the old data, sorted by hash.
+  std::vector<std::pair<uint64_t, uint64_t>> old_chunks_;
+
+  DISALLOW_COPY_AND_ASSIGN(RegionMatcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_REGION_MATCHER_H_
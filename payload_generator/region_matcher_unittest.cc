@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/region_matcher.h"
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kTestBlockSize = 4096;
+
+brillo::Blob RandomData(size_t size, uint32_t seed) {
+  std::mt19937 gen(seed);
+  brillo::Blob data(size);
+  for (uint8_t& byte : data)
+    byte = gen();
+  return data;
+}
+
+}  // namespace
+
+class RegionMatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    old_data_ = RandomData(kNumBlocks * kTestBlockSize, 1);
+    ASSERT_TRUE(test_utils::WriteFileVector(old_file_.path(), old_data_));
+    old_image_ = MappedImage::CreateFromFile(old_file_.path());
+    ASSERT_NE(nullptr, old_image_);
+  }
+
+  static constexpr size_t kNumBlocks = 16;
+
+  ScopedTempFile old_file_{"RegionMatcherTest.XXXXXX"};
+  brillo::Blob old_data_;
+  std::unique_ptr<MappedImage> old_image_;
+};
+
+TEST_F(RegionMatcherTest, SplitInChunksTest) {
+  brillo::Blob data = RandomData(100000, 2);
+  vector<RegionMatcher::Chunk> chunks =
+      RegionMatcher::SplitInChunks(data.data(), data.size());
+  ASSERT_LT(1U, chunks.size());
+  uint64_t offset = 0;
+  for (const RegionMatcher::Chunk& chunk : chunks) {
+    EXPECT_EQ(offset, chunk.offset);
+    EXPECT_LE(chunk.size, 8192U);
+    offset += chunk.size;
+  }
+  EXPECT_EQ(data.size(), offset);
+  EXPECT_TRUE(RegionMatcher::SplitInChunks(data.data(), 0).empty());
+}
+
+TEST_F(RegionMatcherTest, ChunksDontDependOnPositionTest) {
+  brillo::Blob data = RandomData(100000, 3);
+  brillo::Blob shifted_data = RandomData(123, 4);
+  shifted_data.insert(shifted_data.end(), data.begin(), data.end());
+
+  std::set<uint64_t> hashes;
+  for (const auto& chunk :
+       RegionMatcher::SplitInChunks(data.data(), data.size())) {
+    hashes.insert(chunk.hash);
+  }
+  size_t num_found = 0;
+  vector<RegionMatcher::Chunk> shifted_chunks =
+      RegionMatcher::SplitInChunks(shifted_data.data(), shifted_data.size());
+  for (const auto& chunk : shifted_chunks)
+    num_found += hashes.count(chunk.hash);
+  // Only the first chunks differ.
+  EXPECT_LE(shifted_chunks.size() - 3, num_found);
+}
+
+TEST_F(RegionMatcherTest, FindSourceOfMovedDataTest) {
+  auto matcher =
+      RegionMatcher::Create(*old_image_, {{0, kNumBlocks}}, kTestBlockSize);
+  ASSERT_NE(nullptr, matcher);
+
+  // The new data is the old data moved by 3 blocks and 100 bytes.
+  brillo::Blob new_data = RandomData(3 * kTestBlockSize + 100, 5);
+  new_data.insert(new_data.end(), old_data_.begin(), old_data_.end());
+  new_data.resize(kNumBlocks * kTestBlockSize);
+
+  // The new blocks 8 to 11 were in the old blocks 4 to 8.
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(4, 5)},
+            matcher->FindSource(new_data.data() + 8 * kTestBlockSize, 8, 4));
+}
+
+TEST_F(RegionMatcherTest, FindSourceDefaultsToSamePositionTest) {
+  auto matcher = RegionMatcher::Create(
+      *old_image_, {{10, 4}, {0, 4}}, kTestBlockSize);
+  ASSERT_NE(nullptr, matcher);
+
+  brillo::Blob new_data = RandomData(4 * kTestBlockSize, 6);
+  EXPECT_EQ((vector<BlockExtent>{{12, 2}, {0, 2}}),
+            matcher->FindSource(new_data.data(), 2, 4));
+  // The part past the end of the old data is left out.
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(2, 2)},
+            matcher->FindSource(new_data.data(), 6, 4));
+}
+
+TEST_F(RegionMatcherTest, CreateFailsOutsideImageTest) {
+  EXPECT_EQ(nullptr,
+            RegionMatcher::Create(
+                *old_image_, {{kNumBlocks - 1, 2}}, kTestBlockSize));
+}
+
+}  // namespace chromeos_update_engine
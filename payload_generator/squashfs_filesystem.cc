@@ -23,22 +23,20 @@
 #include <utility>
 
 #include <base/files/file_util.h>
-#include <base/files/scoped_temp_dir.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <brillo/streams/file_stream.h>
 
-#include "update_engine/common/subprocess.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/squashfs_reader.h"
 #include "update_engine/update_metadata.pb.h"
 
 using base::FilePath;
-using base::ScopedTempDir;
 using std::string;
 using std::unique_ptr;
 using std::vector;
@@ -71,52 +69,49 @@ bool CheckHeader(const SquashfsFilesystem::SquashfsHeader& header) {
   return header.magic == 0x73717368 && header.major_version == 4;
 }
 
-bool GetFileMapContent(const string& sqfs_path, string* map) {
-  ScopedTempFile map_file("squashfs_file_map.XXXXXX");
-  // Run unsquashfs to get the system file map.
-  // unsquashfs -m <map-file> <squashfs-file>
-  vector<string> cmd = {"unsquashfs", "-m", map_file.path(), sqfs_path};
-  string stdout, stderr;
-  int exit_code;
-  if (!Subprocess::SynchronousExec(cmd, &exit_code, &stdout, &stderr) ||
-      exit_code != 0) {
-    LOG(ERROR) << "Failed to run `unsquashfs -m` with stdout content: "
-               << stdout << " and stderr content: " << stderr;
-    return false;
+// Parses a file map as described in |CreateFromFileMap()|. Only the path,
+// the start and the block sizes of the files are filled.
+bool ParseFileMap(const string& map, vector<SquashfsReader::File>* files) {
+  auto lines = base::SplitStringPiece(map,
+                                      "\n",
+                                      base::WhitespaceHandling::KEEP_WHITESPACE,
+                                      base::SplitResult::SPLIT_WANT_NONEMPTY);
+  for (const auto& line : lines) {
+    auto splits =
+        base::SplitStringPiece(line,
+                               " \t",
+                               base::WhitespaceHandling::TRIM_WHITESPACE,
+                               base::SplitResult::SPLIT_WANT_NONEMPTY);
+    // Only filename is invalid.
+    TEST_AND_RETURN_FALSE(splits.size() > 1);
+    SquashfsReader::File file;
+    file.path = splits[0].as_string();
+    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &file.start));
+    for (size_t i = 2; i < splits.size(); ++i) {
+      uint32_t blk_size;
+      TEST_AND_RETURN_FALSE(base::StringToUint(splits[i], &blk_size));
+      file.block_sizes.push_back(blk_size);
+    }
+    files->push_back(std::move(file));
   }
-  TEST_AND_RETURN_FALSE(utils::ReadFile(map_file.path(), map));
   return true;
 }
 
-bool GetUpdateEngineConfig(const std::string& sqfs_path, string* config) {
-  ScopedTempDir unsquash_dir;
-  if (!unsquash_dir.CreateUniqueTempDir()) {
-    PLOG(ERROR) << "Failed to create a temporary directory.";
+bool GetUpdateEngineConfig(SquashfsReader* reader,
+                           const vector<SquashfsReader::File>& files,
+                           string* config) {
+  auto it = std::find_if(
+      files.begin(), files.end(), [](const SquashfsReader::File& file) {
+        return file.path == kUpdateEngineConf;
+      });
+  if (it == files.end()) {
+    LOG(ERROR) << "Failed to find " << kUpdateEngineConf;
     return false;
   }
 
-  // Run unsquashfs to extract update_engine.conf
-  // -f: To force overriding if the target directory exists.
-  // -d: The directory to unsquash the files.
-  vector<string> cmd = {"unsquashfs",
-                        "-f",
-                        "-d",
-                        unsquash_dir.GetPath().value(),
-                        sqfs_path,
-                        kUpdateEngineConf};
-  string stdout, stderr;
-  int exit_code;
-  if (!Subprocess::SynchronousExec(cmd, &exit_code, &stdout, &stderr) ||
-      exit_code != 0) {
-    PLOG(ERROR) << "Failed to unsquashfs etc/update_engine.conf with stdout: "
-                << stdout << " and stderr: " << stderr;
-    return false;
-  }
-
-  auto config_path = unsquash_dir.GetPath().Append(kUpdateEngineConf);
-  string config_content;
-  if (!utils::ReadFile(config_path.value(), &config_content)) {
-    PLOG(ERROR) << "Failed to read " << config_path.value();
+  brillo::Blob config_content;
+  if (!reader->ReadFile(*it, &config_content)) {
+    LOG(ERROR) << "Failed to read " << kUpdateEngineConf;
     return false;
   }
 
@@ -125,13 +120,13 @@ bool GetUpdateEngineConfig(const std::string& sqfs_path, string* config) {
     return false;
   }
 
-  *config = std::move(config_content);
+  config->assign(config_content.begin(), config_content.end());
   return true;
 }
 
 }  // namespace
 
-bool SquashfsFilesystem::Init(const string& map,
+bool SquashfsFilesystem::Init(const vector<SquashfsReader::File>& entries,
                               const string& sqfs_path,
                               size_t size,
                               const SquashfsHeader& header,
@@ -144,27 +139,10 @@ bool SquashfsFilesystem::Init(const string& map,
   }
   vector<puffin::ByteExtent> zlib_blks;
 
-  // Reading files map. For the format of the file map look at the comments for
-  // |CreateFromFileMap()|.
-  auto lines = base::SplitStringPiece(map,
-                                      "\n",
-                                      base::WhitespaceHandling::KEEP_WHITESPACE,
-                                      base::SplitResult::SPLIT_WANT_NONEMPTY);
-  for (const auto& line : lines) {
-    auto splits =
-        base::SplitStringPiece(line,
-                               " \t",
-                               base::WhitespaceHandling::TRIM_WHITESPACE,
-                               base::SplitResult::SPLIT_WANT_NONEMPTY);
-    // Only filename is invalid.
-    TEST_AND_RETURN_FALSE(splits.size() > 1);
-    uint64_t start;
-    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &start));
-    uint64_t cur_offset = start;
+  for (const auto& entry : entries) {
+    uint64_t cur_offset = entry.start;
     bool is_compressed = false;
-    for (size_t i = 2; i < splits.size(); ++i) {
-      uint64_t blk_size;
-      TEST_AND_RETURN_FALSE(base::StringToUint64(splits[i], &blk_size));
+    for (uint64_t blk_size : entry.block_sizes) {
       // TODO(ahassani): For puffin push it into a proper list if uncompressed.
       auto new_blk_size = blk_size & ~kSquashfsCompressedBit;
       TEST_AND_RETURN_FALSE(new_blk_size <= header.block_size);
@@ -179,10 +157,11 @@ bool SquashfsFilesystem::Init(const string& map,
     }
 
     // If size is zero do not add the file.
-    if (cur_offset - start > 0) {
+    if (cur_offset - entry.start > 0) {
       File file;
-      file.name = splits[0].as_string();
-      file.extents = {ExtentForBytes(kBlockSize, start, cur_offset - start)};
+      file.name = entry.path;
+      file.extents = {
+          ExtentForBytes(kBlockSize, entry.start, cur_offset - entry.start)};
       file.is_compressed = is_compressed;
       files_.emplace_back(file);
     }
@@ -229,7 +208,7 @@ bool SquashfsFilesystem::Init(const string& map,
   for (const auto& file : files_) {
     file_extents.AddExtents(file.extents);
   }
-  vector<Extent> full = {ExtentForBytes(kBlockSize, 0, size_)};
+  vector<BlockExtent> full = {ExtentForBytes(kBlockSize, 0, size_)};
   auto metadata_extents = FilterExtentRanges(full, file_extents);
   // For now there should be at most two extents. One for superblock and one for
   // metadata at the end. Just create appropriate files with <metadata-i> name.
@@ -317,22 +296,24 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFile(
     return nullptr;
   }
 
-  // Read the map file.
-  string filemap;
-  if (!GetFileMapContent(sqfs_path, &filemap)) {
-    LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
+  // List the files in-process instead of asking unsquashfs for a file map.
+  auto reader = SquashfsReader::CreateFromFile(sqfs_path);
+  vector<SquashfsReader::File> entries;
+  if (!reader || !reader->GetFiles(&entries)) {
+    LOG(ERROR) << "Failed to list the files of squashfs: " << sqfs_path;
     return nullptr;
   }
 
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
   if (!sqfs->Init(
-          filemap, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
+          entries, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
     LOG(ERROR) << "Failed to initialized the Squashfs file system";
     return nullptr;
   }
 
   if (load_settings) {
-    if (!GetUpdateEngineConfig(sqfs_path, &sqfs->update_engine_config_)) {
+    if (!GetUpdateEngineConfig(
+            reader.get(), entries, &sqfs->update_engine_config_)) {
       return nullptr;
     }
   }
@@ -347,8 +328,10 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFileMap(
     return nullptr;
   }
 
+  vector<SquashfsReader::File> entries;
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
-  if (!sqfs->Init(filemap, "", size, header, false)) {
+  if (!ParseFileMap(filemap, &entries) ||
+      !sqfs->Init(entries, "", size, header, false)) {
     LOG(ERROR) << "Failed to initialize the Squashfs file system using filemap";
     return nullptr;
   }
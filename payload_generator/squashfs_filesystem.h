@@ -33,6 +33,7 @@
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/squashfs_reader.h"
 
 namespace chromeos_update_engine {
 
@@ -55,9 +56,9 @@ class SquashfsFilesystem : public FilesystemInterface {
 
   ~SquashfsFilesystem() override = default;
 
-  // Creates the file system from the Squashfs file itself. If
-  // |extract_deflates| is true, it will process files to find location of all
-  // deflate streams.
+  // Creates the file system from the Squashfs file itself, which is parsed
+  // in-process. If |extract_deflates| is true, it will process files to find
+  // location of all deflate streams.
   static std::unique_ptr<SquashfsFilesystem> CreateFromFile(
       const std::string& sqfs_path, bool extract_deflates, bool load_settings);
 
@@ -100,8 +101,9 @@ class SquashfsFilesystem : public FilesystemInterface {
  private:
   SquashfsFilesystem() = default;
 
-  // Initialize and populates the files in the file system.
-  bool Init(const std::string& map,
+  // Initialize and populates the files in the file system from the file
+  // |entries| listed by SquashfsReader or parsed from a file map.
+  bool Init(const std::vector<SquashfsReader::File>& entries,
             const std::string& sqfs_path,
             size_t size,
             const SquashfsHeader& header,
@@ -51,8 +51,9 @@ constexpr uint64_t kTestBlockSize = 4096;
 constexpr uint64_t kTestSqfsBlockSize = 1 << 15;
 
 // Checks that all the blocks in |extents| are in the range [0, total_blocks).
-void ExpectBlocksInRange(const vector<Extent>& extents, uint64_t total_blocks) {
-  for (const Extent& extent : extents) {
+void ExpectBlocksInRange(const vector<BlockExtent>& extents,
+                         uint64_t total_blocks) {
+  for (const BlockExtent& extent : extents) {
     EXPECT_LE(0U, extent.start_block());
     EXPECT_LE(extent.start_block() + extent.num_blocks(), total_blocks);
   }
@@ -108,7 +109,7 @@ class SquashfsFilesystemTest : public ::testing::Test {
   }
 };
 
-// CreateFromFile() depends on unsquashfs -m, which only exists in Chrome OS.
+// The sample squashfs images are only generated in Chrome OS.
 #ifdef __CHROMEOS__
 TEST_F(SquashfsFilesystemTest, EmptyFilesystemTest) {
   unique_ptr<SquashfsFilesystem> fs = SquashfsFilesystem::CreateFromFile(
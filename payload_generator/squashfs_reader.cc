@@ -0,0 +1,422 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/squashfs_reader.h"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <base/logging.h>
+#include <lz4.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Super block layout, see squashfs_fs.h of squashfs-tools.
+constexpr size_t kSuperBlockSize = 96;
+constexpr uint32_t kSquashfsMagic = 0x73717368;
+constexpr uint16_t kSquashfsMajorVersion = 4;
+
+// Compression ids.
+constexpr uint16_t kZlibCompression = 1;
+constexpr uint16_t kLzmaCompression = 2;
+constexpr uint16_t kXzCompression = 4;
+constexpr uint16_t kLz4Compression = 5;
+
+// Metadata blocks are stored as a 16-bit header followed by at most 8 KiB of
+// (possibly compressed) data. The header holds the on-disk size of the block
+// and a bit set when the block is stored uncompressed.
+constexpr size_t kMetadataSize = 8192;
+constexpr uint16_t kMetadataUncompressedBit = 1 << 15;
+
+// Inode types.
+constexpr uint16_t kDirType = 1;
+constexpr uint16_t kFileType = 2;
+constexpr uint16_t kLongDirType = 8;
+constexpr uint16_t kLongFileType = 9;
+
+// The size of the part of the inodes common to all the types and the size of
+// the type specific part (without the block list) of the inodes we parse.
+constexpr size_t kInodeBaseSize = 16;
+constexpr size_t kDirInodeSize = 16;
+constexpr size_t kLongDirInodeSize = 24;
+constexpr size_t kFileInodeSize = 16;
+constexpr size_t kLongFileInodeSize = 40;
+
+// A directory listing is a sequence of headers, each followed by up to 256
+// entries whose inodes are in the same metadata block.
+constexpr size_t kDirHeaderSize = 12;
+constexpr size_t kDirEntrySize = 8;
+constexpr uint32_t kMaxDirHeaderEntries = 256;
+
+// Every metadata block of the fragment table holds 512 entries of 16 bytes.
+constexpr size_t kFragmentEntrySize = 16;
+constexpr size_t kFragmentEntriesPerBlock = kMetadataSize / kFragmentEntrySize;
+
+// Squashfs images don't have cycles, but don't trust a corrupted image.
+constexpr size_t kMaxDirectoryDepth = 256;
+
+uint16_t ReadLE16(const uint8_t* data) {
+  uint16_t value;
+  memcpy(&value, data, sizeof(value));
+  return le16toh(value);
+}
+
+uint32_t ReadLE32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return le32toh(value);
+}
+
+uint64_t ReadLE64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return le64toh(value);
+}
+
+}  // namespace
+
+std::unique_ptr<SquashfsReader> SquashfsReader::CreateFromFile(
+    const string& path) {
+  auto image = MappedImage::CreateFromFile(path);
+  if (!image)
+    return nullptr;
+  std::unique_ptr<SquashfsReader> reader(new SquashfsReader(std::move(image)));
+  if (!reader->Init()) {
+    LOG(ERROR) << "Unable to parse the squashfs image " << path;
+    return nullptr;
+  }
+  return reader;
+}
+
+bool SquashfsReader::Init() {
+  const uint8_t* super_block = image_->GetData(0, kSuperBlockSize);
+  TEST_AND_RETURN_FALSE(super_block);
+  TEST_AND_RETURN_FALSE(ReadLE32(super_block) == kSquashfsMagic);
+  TEST_AND_RETURN_FALSE(ReadLE16(super_block + 28) == kSquashfsMajorVersion);
+
+  block_size_ = ReadLE32(super_block + 12);
+  fragment_count_ = ReadLE32(super_block + 16);
+  compression_ = ReadLE16(super_block + 20);
+  root_inode_ = ReadLE64(super_block + 32);
+  inode_table_ = ReadLE64(super_block + 64);
+  directory_table_ = ReadLE64(super_block + 72);
+  uint64_t fragment_table = ReadLE64(super_block + 80);
+  TEST_AND_RETURN_FALSE(block_size_ > 0);
+
+  // The fragment table is made of metadata blocks whose offsets are stored
+  // uncompressed at |fragment_table|.
+  if (fragment_count_ > 0) {
+    size_t index_size =
+        (fragment_count_ + kFragmentEntriesPerBlock - 1) /
+        kFragmentEntriesPerBlock;
+    const uint8_t* index =
+        image_->GetData(fragment_table, index_size * sizeof(uint64_t));
+    TEST_AND_RETURN_FALSE(index);
+    for (size_t i = 0; i < index_size; i++)
+      fragment_index_.push_back(ReadLE64(index + i * sizeof(uint64_t)));
+  }
+  return true;
+}
+
+bool SquashfsReader::Decompress(const uint8_t* data,
+                                size_t size,
+                                size_t max_size,
+                                brillo::Blob* out) const {
+  out->resize(max_size);
+  switch (compression_) {
+    case kZlibCompression: {
+      uLongf out_size = max_size;
+      int ret = uncompress(out->data(), &out_size, data, size);
+      if (ret != Z_OK) {
+        LOG(ERROR) << "zlib decompression failed with error " << ret;
+        return false;
+      }
+      out->resize(out_size);
+      return true;
+    }
+    case kLzmaCompression:
+    case kXzCompression: {
+      lzma_stream stream = LZMA_STREAM_INIT;
+      lzma_ret ret = compression_ == kLzmaCompression
+                         ? lzma_alone_decoder(&stream, UINT64_MAX)
+                         : lzma_stream_decoder(&stream, UINT64_MAX, 0);
+      if (ret == LZMA_OK) {
+        stream.next_in = data;
+        stream.avail_in = size;
+        stream.next_out = out->data();
+        stream.avail_out = max_size;
+        ret = lzma_code(&stream, LZMA_FINISH);
+      }
+      size_t out_size = max_size - stream.avail_out;
+      lzma_end(&stream);
+      if (ret != LZMA_STREAM_END) {
+        LOG(ERROR) << "lzma decompression failed with error " << ret;
+        return false;
+      }
+      out->resize(out_size);
+      return true;
+    }
+    case kLz4Compression: {
+      int out_size = LZ4_decompress_safe(reinterpret_cast<const char*>(data),
+                                         reinterpret_cast<char*>(out->data()),
+                                         size,
+                                         max_size);
+      if (out_size < 0) {
+        LOG(ERROR) << "lz4 decompression failed with error " << out_size;
+        return false;
+      }
+      out->resize(out_size);
+      return true;
+    }
+    default:
+      LOG(ERROR) << "Unsupported squashfs compression " << compression_;
+      return false;
+  }
+}
+
+const SquashfsReader::MetadataBlock* SquashfsReader::GetMetadataBlock(
+    uint64_t offset) {
+  auto it = metadata_blocks_.find(offset);
+  if (it != metadata_blocks_.end())
+    return &it->second;
+
+  const uint8_t* header = image_->GetData(offset, sizeof(uint16_t));
+  if (!header) {
+    LOG(ERROR) << "Metadata block at " << offset << " is outside the image.";
+    return nullptr;
+  }
+  uint16_t size = ReadLE16(header) & ~kMetadataUncompressedBit;
+  bool compressed = !(ReadLE16(header) & kMetadataUncompressedBit);
+  const uint8_t* data = image_->GetData(offset + sizeof(uint16_t), size);
+  if (!data) {
+    LOG(ERROR) << "Metadata block at " << offset << " is truncated.";
+    return nullptr;
+  }
+
+  MetadataBlock block;
+  if (compressed) {
+    if (!Decompress(data, size, kMetadataSize, &block.data))
+      return nullptr;
+  } else {
+    block.data.assign(data, data + size);
+  }
+  block.next = offset + sizeof(uint16_t) + size;
+  return &metadata_blocks_.emplace(offset, std::move(block)).first->second;
+}
+
+bool SquashfsReader::ReadMetadata(MetadataCursor* cursor,
+                                  size_t size,
+                                  brillo::Blob* out) {
+  out->clear();
+  while (size > 0) {
+    const MetadataBlock* block = GetMetadataBlock(cursor->block);
+    TEST_AND_RETURN_FALSE(block);
+    TEST_AND_RETURN_FALSE(cursor->offset <= block->data.size());
+    if (cursor->offset == block->data.size()) {
+      cursor->block = block->next;
+      cursor->offset = 0;
+      continue;
+    }
+    size_t chunk = std::min(size, block->data.size() - cursor->offset);
+    out->insert(out->end(),
+                block->data.begin() + cursor->offset,
+                block->data.begin() + cursor->offset + chunk);
+    cursor->offset += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+bool SquashfsReader::ReadInode(uint64_t inode_ref, Inode* inode) {
+  // The upper bits of an inode reference are the offset of the metadata block
+  // relative to the inode table and the lower 16 bits the offset in it.
+  MetadataCursor cursor = {inode_table_ + (inode_ref >> 16),
+                           static_cast<size_t>(inode_ref & 0xFFFF)};
+  brillo::Blob data;
+  TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kInodeBaseSize, &data));
+  inode->type = ReadLE16(data.data());
+
+  File* file = &inode->file;
+  switch (inode->type) {
+    case kDirType:
+      TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kDirInodeSize, &data));
+      inode->listing_block = ReadLE32(data.data());
+      inode->listing_size = ReadLE16(data.data() + 8);
+      inode->listing_offset = ReadLE16(data.data() + 10);
+      return true;
+    case kLongDirType:
+      TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kLongDirInodeSize, &data));
+      inode->listing_size = ReadLE32(data.data() + 4);
+      inode->listing_block = ReadLE32(data.data() + 8);
+      inode->listing_offset = ReadLE16(data.data() + 18);
+      return true;
+    case kFileType:
+      TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kFileInodeSize, &data));
+      file->start = ReadLE32(data.data());
+      file->fragment = ReadLE32(data.data() + 4);
+      file->fragment_offset = ReadLE32(data.data() + 8);
+      file->size = ReadLE32(data.data() + 12);
+      break;
+    case kLongFileType:
+      TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kLongFileInodeSize, &data));
+      file->start = ReadLE64(data.data());
+      file->size = ReadLE64(data.data() + 8);
+      file->fragment = ReadLE32(data.data() + 28);
+      file->fragment_offset = ReadLE32(data.data() + 32);
+      break;
+    default:
+      // Symlinks, devices, etc. don't have any data.
+      return true;
+  }
+
+  // The tail of the file is either in a fragment or in a last partial block.
+  uint64_t num_blocks = file->size / block_size_;
+  if (file->fragment == kNoFragment && file->size % block_size_ != 0)
+    num_blocks++;
+  TEST_AND_RETURN_FALSE(
+      ReadMetadata(&cursor, num_blocks * sizeof(uint32_t), &data));
+  file->block_sizes.resize(num_blocks);
+  for (uint64_t i = 0; i < num_blocks; i++)
+    file->block_sizes[i] = ReadLE32(data.data() + i * sizeof(uint32_t));
+  return true;
+}
+
+bool SquashfsReader::ReadDirectory(const Inode& dir,
+                                   const string& prefix,
+                                   size_t depth,
+                                   vector<File>* files) {
+  TEST_AND_RETURN_FALSE(depth <= kMaxDirectoryDepth);
+  // The listing size includes three bytes for the "." and ".." entries which
+  // are not stored.
+  if (dir.listing_size <= 3)
+    return true;
+  size_t remaining = dir.listing_size - 3;
+  MetadataCursor cursor = {directory_table_ + dir.listing_block,
+                           dir.listing_offset};
+  brillo::Blob data;
+  while (remaining > 0) {
+    TEST_AND_RETURN_FALSE(remaining >= kDirHeaderSize);
+    TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kDirHeaderSize, &data));
+    remaining -= kDirHeaderSize;
+    uint32_t count = ReadLE32(data.data()) + 1;
+    uint64_t inode_block = ReadLE32(data.data() + 4);
+    TEST_AND_RETURN_FALSE(count <= kMaxDirHeaderEntries);
+
+    for (uint32_t i = 0; i < count; i++) {
+      TEST_AND_RETURN_FALSE(remaining >= kDirEntrySize);
+      TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kDirEntrySize, &data));
+      remaining -= kDirEntrySize;
+      uint16_t inode_offset = ReadLE16(data.data());
+      size_t name_size = ReadLE16(data.data() + 6) + 1;
+
+      TEST_AND_RETURN_FALSE(remaining >= name_size);
+      TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, name_size, &data));
+      remaining -= name_size;
+      string name(data.begin(), data.end());
+      TEST_AND_RETURN_FALSE(name.find('/') == string::npos);
+
+      Inode inode;
+      TEST_AND_RETURN_FALSE(ReadInode((inode_block << 16) | inode_offset,
+                                      &inode));
+      if (inode.type == kDirType || inode.type == kLongDirType) {
+        TEST_AND_RETURN_FALSE(
+            ReadDirectory(inode, prefix + name + "/", depth + 1, files));
+      } else if (inode.type == kFileType || inode.type == kLongFileType) {
+        inode.file.path = prefix + name;
+        files->push_back(std::move(inode.file));
+      }
+    }
+  }
+  return true;
+}
+
+bool SquashfsReader::GetFiles(vector<File>* files) {
+  Inode root;
+  TEST_AND_RETURN_FALSE(ReadInode(root_inode_, &root));
+  TEST_AND_RETURN_FALSE(root.type == kDirType || root.type == kLongDirType);
+  return ReadDirectory(root, "", 0, files);
+}
+
+bool SquashfsReader::ReadFile(const File& file, brillo::Blob* data) {
+  data->clear();
+  brillo::Blob block;
+  uint64_t offset = file.start;
+  for (uint32_t block_size : file.block_sizes) {
+    uint32_t disk_size = block_size & ~kUncompressedBit;
+    if (disk_size == 0) {
+      // A sparse block.
+      data->insert(data->end(), block_size_, 0);
+      continue;
+    }
+    const uint8_t* disk_data = image_->GetData(offset, disk_size);
+    TEST_AND_RETURN_FALSE(disk_data);
+    if (block_size & kUncompressedBit) {
+      data->insert(data->end(), disk_data, disk_data + disk_size);
+    } else {
+      TEST_AND_RETURN_FALSE(
+          Decompress(disk_data, disk_size, block_size_, &block));
+      data->insert(data->end(), block.begin(), block.end());
+    }
+    offset += disk_size;
+  }
+
+  if (file.fragment != kNoFragment) {
+    TEST_AND_RETURN_FALSE(file.fragment < fragment_count_);
+    MetadataCursor cursor = {
+        fragment_index_[file.fragment / kFragmentEntriesPerBlock],
+        (file.fragment % kFragmentEntriesPerBlock) * kFragmentEntrySize};
+    brillo::Blob entry;
+    TEST_AND_RETURN_FALSE(ReadMetadata(&cursor, kFragmentEntrySize, &entry));
+    uint64_t fragment_start = ReadLE64(entry.data());
+    uint32_t fragment_size = ReadLE32(entry.data() + 8);
+    uint32_t disk_size = fragment_size & ~kUncompressedBit;
+
+    const uint8_t* disk_data = image_->GetData(fragment_start, disk_size);
+    TEST_AND_RETURN_FALSE(disk_data);
+    if (fragment_size & kUncompressedBit) {
+      block.assign(disk_data, disk_data + disk_size);
+    } else {
+      TEST_AND_RETURN_FALSE(
+          Decompress(disk_data, disk_size, block_size_, &block));
+    }
+    TEST_AND_RETURN_FALSE(file.size >= data->size());
+    uint64_t tail_size = file.size - data->size();
+    TEST_AND_RETURN_FALSE(file.fragment_offset <= block.size() &&
+                          tail_size <= block.size() - file.fragment_offset);
+    data->insert(data->end(),
+                 block.begin() + file.fragment_offset,
+                 block.begin() + file.fragment_offset + tail_size);
+  }
+
+  // The last block may be padded.
+  TEST_AND_RETURN_FALSE(data->size() >= file.size);
+  data->resize(file.size);
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,159 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_SQUASHFS_READER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_SQUASHFS_READER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_generator/mapped_image.h"
+
+namespace chromeos_update_engine {
+
+// An in-process reader of squashfs (version 4) images. It parses the super
+// block, the inode, directory and fragment tables directly from a memory
+// mapping of the image, so listing the files or reading the content of a file
+// doesn't require running unsquashfs nor any temporary file. zlib, lzma, xz and
+// lz4 compressed images are supported.
+class SquashfsReader {
+ public:
+  // The fragment index of files that don't have a tail in a fragment block.
+  static constexpr uint32_t kNoFragment = 0xFFFFFFFF;
+  // The bit set in the on-disk size of a data block stored uncompressed.
+  static constexpr uint32_t kUncompressedBit = 1 << 24;
+
+  // A regular file in the image.
+  struct File {
+    // The path of the file relative to the root, e.g. "etc/update_engine.conf".
+    std::string path;
+    // The byte offset in the image of the first data block of the file.
+    uint64_t start;
+    // The uncompressed size of the file in bytes.
+    uint64_t size;
+    // The on-disk size of every data block of the file, which are stored
+    // back-to-back starting at |start|. |kUncompressedBit| is set for blocks
+    // stored uncompressed and a size of 0 is a sparse block.
+    std::vector<uint32_t> block_sizes;
+    // The fragment block holding the tail of the file, or |kNoFragment|, and
+    // the offset of the tail inside the uncompressed fragment block.
+    uint32_t fragment;
+    uint32_t fragment_offset;
+  };
+
+  ~SquashfsReader() = default;
+
+  // Opens the squashfs image |path|. Returns nullptr if the file can't be read
+  // or is not a valid squashfs image.
+  static std::unique_ptr<SquashfsReader> CreateFromFile(
+      const std::string& path);
+
+  // The size in bytes of the data blocks of the image.
+  uint32_t block_size() const { return block_size_; }
+
+  // The compression id of the image as stored in the super block.
+  uint16_t compression() const { return compression_; }
+
+  // Lists all the regular files in the image, in directory order.
+  bool GetFiles(std::vector<File>* files);
+
+  // Reads and decompresses the content of |file| into |data|.
+  bool ReadFile(const File& file, brillo::Blob* data);
+
+ private:
+  // A position in a metadata table: the byte offset in the image of a
+  // metadata block and an offset inside its uncompressed data.
+  struct MetadataCursor {
+    uint64_t block;
+    size_t offset;
+  };
+
+  // The fields of an inode we care about.
+  struct Inode {
+    uint16_t type;
+    // For directories, the position of the directory listing relative to the
+    // start of the directory table and its size.
+    uint32_t listing_block;
+    uint16_t listing_offset;
+    uint32_t listing_size;
+    // For regular files.
+    File file;
+  };
+
+  // A decompressed metadata block and the byte offset of the next one.
+  struct MetadataBlock {
+    brillo::Blob data;
+    uint64_t next;
+  };
+
+  explicit SquashfsReader(std::unique_ptr<MappedImage> image)
+      : image_(std::move(image)) {}
+
+  // Parses the super block and the fragment index.
+  bool Init();
+
+  // Decompresses |size| bytes at |data| into |out|, which is resized to the
+  // decompressed size. The result can't be bigger than |max_size|.
+  bool Decompress(const uint8_t* data,
+                  size_t size,
+                  size_t max_size,
+                  brillo::Blob* out) const;
+
+  // Returns the metadata block at byte offset |offset| of the image,
+  // decompressing and caching it if needed.
+  const MetadataBlock* GetMetadataBlock(uint64_t offset);
+
+  // Reads |size| bytes of metadata from |cursor| into |out|, crossing metadata
+  // block boundaries as needed, and advances |cursor| past them.
+  bool ReadMetadata(MetadataCursor* cursor, size_t size, brillo::Blob* out);
+
+  // Reads the inode referenced by |inode_ref|.
+  bool ReadInode(uint64_t inode_ref, Inode* inode);
+
+  // Appends the regular files in the directory |dir| and its subdirectories
+  // to |files|, prefixing their names with |prefix|.
+  bool ReadDirectory(const Inode& dir,
+                     const std::string& prefix,
+                     size_t depth,
+                     std::vector<File>* files);
+
+  std::unique_ptr<MappedImage> image_;
+
+  // Super block fields.
+  uint32_t block_size_{0};
+  uint16_t compression_{0};
+  uint64_t root_inode_{0};
+  uint64_t inode_table_{0};
+  uint64_t directory_table_{0};
+
+  // The byte offset of the metadata blocks holding the fragment entries.
+  std::vector<uint64_t> fragment_index_;
+  uint32_t fragment_count_{0};
+
+  // The metadata blocks decompressed so far, by byte offset in the image.
+  std::map<uint64_t, MetadataBlock> metadata_blocks_;
+
+  DISALLOW_COPY_AND_ASSIGN(SquashfsReader);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_SQUASHFS_READER_H_
@@ -0,0 +1,382 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/squashfs_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <brillo/key_value_store.h>
+#include <gtest/gtest.h>
+#include <lz4.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/squashfs_filesystem.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr uint32_t kSqfsBlockSize = 4096;
+constexpr char kConfContent[] = "PAYLOAD_MINOR_VERSION=7\n";
+
+// The compression ids of the super block.
+constexpr uint16_t kZlibCompression = 1;
+constexpr uint16_t kLzoCompression = 3;
+constexpr uint16_t kXzCompression = 4;
+constexpr uint16_t kLz4Compression = 5;
+
+void AppendLE16(uint16_t value, brillo::Blob* out) {
+  out->push_back(value & 0xFF);
+  out->push_back(value >> 8);
+}
+
+void AppendLE32(uint32_t value, brillo::Blob* out) {
+  AppendLE16(value & 0xFFFF, out);
+  AppendLE16(value >> 16, out);
+}
+
+void AppendLE64(uint64_t value, brillo::Blob* out) {
+  AppendLE32(value & 0xFFFFFFFF, out);
+  AppendLE32(value >> 32, out);
+}
+
+// Compresses |data| like mksquashfs does with the compression id
+// |compression|. Unsupported compressions store the data as is.
+brillo::Blob Compress(uint16_t compression, const brillo::Blob& data) {
+  brillo::Blob compressed;
+  switch (compression) {
+    case kZlibCompression: {
+      compressed.resize(compressBound(data.size()));
+      uLongf size = compressed.size();
+      EXPECT_EQ(
+          Z_OK,
+          compress2(compressed.data(), &size, data.data(), data.size(), 9));
+      compressed.resize(size);
+      break;
+    }
+    case kXzCompression: {
+      compressed.resize(lzma_stream_buffer_bound(data.size()));
+      size_t size = 0;
+      EXPECT_EQ(LZMA_OK,
+                lzma_easy_buffer_encode(6,
+                                        LZMA_CHECK_CRC32,
+                                        nullptr,
+                                        data.data(),
+                                        data.size(),
+                                        compressed.data(),
+                                        &size,
+                                        compressed.size()));
+      compressed.resize(size);
+      break;
+    }
+    case kLz4Compression: {
+      compressed.resize(LZ4_compressBound(data.size()));
+      int size =
+          LZ4_compress_default(reinterpret_cast<const char*>(data.data()),
+                               reinterpret_cast<char*>(compressed.data()),
+                               data.size(),
+                               compressed.size());
+      EXPECT_GT(size, 0);
+      compressed.resize(size);
+      break;
+    }
+    default:
+      compressed = data;
+  }
+  return compressed;
+}
+
+// Appends a metadata block with |data| to |image|, compressed with
+// |compression| if |compress| is true.
+void AppendMetadataBlock(const brillo::Blob& data,
+                         bool compress,
+                         uint16_t compression,
+                         brillo::Blob* image) {
+  if (compress) {
+    brillo::Blob compressed = Compress(compression, data);
+    AppendLE16(compressed.size(), image);
+    image->insert(image->end(), compressed.begin(), compressed.end());
+  } else {
+    AppendLE16(data.size() | 0x8000, image);
+    image->insert(image->end(), data.begin(), data.end());
+  }
+}
+
+void AppendInodeHeader(uint16_t type, uint32_t number, brillo::Blob* out) {
+  AppendLE16(type, out);
+  AppendLE16(0644, out);  // mode
+  AppendLE16(0, out);     // uid
+  AppendLE16(0, out);     // gid
+  AppendLE32(0, out);     // mtime
+  AppendLE32(number, out);
+}
+
+void AppendDirEntry(uint16_t inode_offset,
+                    int16_t inode_delta,
+                    uint16_t type,
+                    const string& name,
+                    brillo::Blob* out) {
+  AppendLE16(inode_offset, out);
+  AppendLE16(inode_delta, out);
+  AppendLE16(type, out);
+  AppendLE16(name.size() - 1, out);
+  out->insert(out->end(), name.begin(), name.end());
+}
+
+}  // namespace
+
+class SquashfsReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override { BuildImage(kZlibCompression); }
+
+  // Builds a squashfs image compressed with |compression| with the following
+  // files:
+  //   etc/file1: One compressed block and a partial uncompressed block.
+  //   etc/update_engine.conf: Stored in the fragment block.
+  // The inode table is compressed and the directory table is not.
+  void BuildImage(uint16_t compression) {
+    file1_.assign(kSqfsBlockSize, 'a');
+    for (size_t i = 0; i < 1000; i++)
+      file1_.push_back(i % 251);
+    brillo::Blob file1_block0 = Compress(
+        compression,
+        brillo::Blob(file1_.begin(), file1_.begin() + kSqfsBlockSize));
+    block0_size_ = file1_block0.size();
+
+    brillo::Blob image(96, 0);
+    file1_start_ = image.size();
+    image.insert(image.end(), file1_block0.begin(), file1_block0.end());
+    image.insert(image.end(), file1_.begin() + kSqfsBlockSize, file1_.end());
+    uint64_t fragment_start = image.size();
+    string conf = kConfContent;
+    image.insert(image.end(), conf.begin(), conf.end());
+
+    // The inodes of the files.
+    brillo::Blob inodes;
+    uint16_t file1_inode = inodes.size();
+    AppendInodeHeader(2, 1, &inodes);
+    AppendLE32(file1_start_, &inodes);
+    AppendLE32(SquashfsReader::kNoFragment, &inodes);
+    AppendLE32(0, &inodes);
+    AppendLE32(file1_.size(), &inodes);
+    AppendLE32(block0_size_, &inodes);
+    AppendLE32(1000 | SquashfsReader::kUncompressedBit, &inodes);
+    uint16_t conf_inode = inodes.size();
+    AppendInodeHeader(2, 2, &inodes);
+    AppendLE32(0, &inodes);
+    AppendLE32(0, &inodes);  // fragment
+    AppendLE32(0, &inodes);  // offset in the fragment
+    AppendLE32(conf.size(), &inodes);
+
+    // The directory listings, both in the first directory table block.
+    brillo::Blob directories;
+    AppendLE32(1, &directories);  // Two entries.
+    AppendLE32(0, &directories);
+    AppendLE32(1, &directories);
+    AppendDirEntry(file1_inode, 0, 2, "file1", &directories);
+    AppendDirEntry(conf_inode, 1, 2, "update_engine.conf", &directories);
+    uint16_t etc_listing_size = directories.size();
+    uint16_t etc_inode = inodes.size();
+    AppendLE32(0, &directories);  // One entry.
+    AppendLE32(0, &directories);
+    AppendLE32(3, &directories);
+    AppendDirEntry(etc_inode, 0, 1, "etc", &directories);
+    uint16_t root_listing_size = directories.size() - etc_listing_size;
+
+    // The inodes of the directories.
+    AppendInodeHeader(1, 3, &inodes);
+    AppendLE32(0, &inodes);
+    AppendLE32(2, &inodes);
+    AppendLE16(etc_listing_size + 3, &inodes);
+    AppendLE16(0, &inodes);
+    AppendLE32(4, &inodes);
+    uint16_t root_inode = inodes.size();
+    AppendInodeHeader(1, 4, &inodes);
+    AppendLE32(0, &inodes);
+    AppendLE32(3, &inodes);
+    AppendLE16(root_listing_size + 3, &inodes);
+    AppendLE16(etc_listing_size, &inodes);
+    AppendLE32(5, &inodes);
+
+    uint64_t inode_table = image.size();
+    AppendMetadataBlock(inodes, true, compression, &image);
+    uint64_t directory_table = image.size();
+    AppendMetadataBlock(directories, false, compression, &image);
+
+    brillo::Blob fragments;
+    AppendLE64(fragment_start, &fragments);
+    AppendLE32(conf.size() | SquashfsReader::kUncompressedBit, &fragments);
+    AppendLE32(0, &fragments);
+    uint64_t fragment_block = image.size();
+    AppendMetadataBlock(fragments, false, compression, &image);
+    uint64_t fragment_table = image.size();
+    AppendLE64(fragment_block, &image);
+
+    brillo::Blob super_block;
+    AppendLE32(0x73717368, &super_block);
+    AppendLE32(4, &super_block);  // inodes
+    AppendLE32(0, &super_block);  // mkfs_time
+    AppendLE32(kSqfsBlockSize, &super_block);
+    AppendLE32(1, &super_block);  // fragments
+    AppendLE16(compression, &super_block);
+    AppendLE16(12, &super_block);  // block_log
+    AppendLE16(0, &super_block);   // flags
+    AppendLE16(1, &super_block);   // no_ids
+    AppendLE16(4, &super_block);   // major
+    AppendLE16(0, &super_block);   // minor
+    AppendLE64(root_inode, &super_block);
+    AppendLE64(image.size(), &super_block);
+    AppendLE64(~0ULL, &super_block);  // id_table
+    AppendLE64(~0ULL, &super_block);  // xattr_table
+    AppendLE64(inode_table, &super_block);
+    AppendLE64(directory_table, &super_block);
+    AppendLE64(fragment_table, &super_block);
+    AppendLE64(~0ULL, &super_block);  // lookup_table
+    ASSERT_EQ(96U, super_block.size());
+    std::copy(super_block.begin(), super_block.end(), image.begin());
+
+    image_ = image;
+    ASSERT_TRUE(utils::WriteFile(
+        image_file_.path().c_str(), image_.data(), image_.size()));
+  }
+
+  ScopedTempFile image_file_{"SquashfsReaderTest.XXXXXX"};
+  brillo::Blob image_;
+  brillo::Blob file1_;
+  uint64_t file1_start_;
+  uint32_t block0_size_;
+};
+
+TEST_F(SquashfsReaderTest, GetFilesTest) {
+  auto reader = SquashfsReader::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, reader);
+  EXPECT_EQ(kSqfsBlockSize, reader->block_size());
+
+  vector<SquashfsReader::File> files;
+  ASSERT_TRUE(reader->GetFiles(&files));
+  ASSERT_EQ(2U, files.size());
+
+  EXPECT_EQ("etc/file1", files[0].path);
+  EXPECT_EQ(file1_start_, files[0].start);
+  EXPECT_EQ(file1_.size(), files[0].size);
+  EXPECT_EQ(vector<uint32_t>(
+                {block0_size_, 1000 | SquashfsReader::kUncompressedBit}),
+            files[0].block_sizes);
+  EXPECT_EQ(SquashfsReader::kNoFragment, files[0].fragment);
+
+  EXPECT_EQ("etc/update_engine.conf", files[1].path);
+  EXPECT_EQ(strlen(kConfContent), files[1].size);
+  EXPECT_TRUE(files[1].block_sizes.empty());
+  EXPECT_EQ(0U, files[1].fragment);
+}
+
+TEST_F(SquashfsReaderTest, ReadFileTest) {
+  auto reader = SquashfsReader::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, reader);
+  vector<SquashfsReader::File> files;
+  ASSERT_TRUE(reader->GetFiles(&files));
+  ASSERT_EQ(2U, files.size());
+
+  brillo::Blob data;
+  EXPECT_TRUE(reader->ReadFile(files[0], &data));
+  EXPECT_EQ(file1_, data);
+  EXPECT_TRUE(reader->ReadFile(files[1], &data));
+  EXPECT_EQ(kConfContent, string(data.begin(), data.end()));
+}
+
+TEST_F(SquashfsReaderTest, XzAndLz4CompressionTest) {
+  for (uint16_t compression : {kXzCompression, kLz4Compression}) {
+    BuildImage(compression);
+    auto reader = SquashfsReader::CreateFromFile(image_file_.path());
+    ASSERT_NE(nullptr, reader);
+    vector<SquashfsReader::File> files;
+    ASSERT_TRUE(reader->GetFiles(&files));
+    ASSERT_EQ(2U, files.size());
+    EXPECT_EQ("etc/file1", files[0].path);
+    EXPECT_EQ(block0_size_, files[0].block_sizes[0]);
+
+    brillo::Blob data;
+    EXPECT_TRUE(reader->ReadFile(files[0], &data));
+    EXPECT_EQ(file1_, data);
+    EXPECT_TRUE(reader->ReadFile(files[1], &data));
+    EXPECT_EQ(kConfContent, string(data.begin(), data.end()));
+  }
+}
+
+TEST_F(SquashfsReaderTest, UnsupportedCompressionTest) {
+  // The compressed inode table can't be read.
+  BuildImage(kLzoCompression);
+  auto reader = SquashfsReader::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, reader);
+  vector<SquashfsReader::File> files;
+  EXPECT_FALSE(reader->GetFiles(&files));
+}
+
+TEST_F(SquashfsReaderTest, NotSquashfsTest) {
+  ScopedTempFile file("SquashfsReaderTest.XXXXXX");
+  brillo::Blob zeros(kSqfsBlockSize);
+  ASSERT_TRUE(
+      utils::WriteFile(file.path().c_str(), zeros.data(), zeros.size()));
+  EXPECT_EQ(nullptr, SquashfsReader::CreateFromFile(file.path()));
+}
+
+TEST_F(SquashfsReaderTest, TruncatedImageTest) {
+  // Drop the fragment index at the end of the image.
+  ASSERT_TRUE(utils::WriteFile(
+      image_file_.path().c_str(), image_.data(), image_.size() - 8));
+  EXPECT_EQ(nullptr, SquashfsReader::CreateFromFile(image_file_.path()));
+}
+
+TEST_F(SquashfsReaderTest, InvalidRootInodeTest) {
+  // Point the root inode to a metadata block past the end of the image.
+  image_[36] = 0x01;
+  ASSERT_TRUE(utils::WriteFile(
+      image_file_.path().c_str(), image_.data(), image_.size()));
+  auto reader = SquashfsReader::CreateFromFile(image_file_.path());
+  ASSERT_NE(nullptr, reader);
+  vector<SquashfsReader::File> files;
+  EXPECT_FALSE(reader->GetFiles(&files));
+}
+
+TEST_F(SquashfsReaderTest, SquashfsFilesystemTest) {
+  auto fs = SquashfsFilesystem::CreateFromFile(image_file_.path(), false, true);
+  ASSERT_NE(nullptr, fs);
+
+  vector<FilesystemInterface::File> files;
+  ASSERT_TRUE(fs->GetFiles(&files));
+  auto it = std::find_if(
+      files.begin(), files.end(), [](const FilesystemInterface::File& file) {
+        return file.name == "etc/file1";
+      });
+  ASSERT_NE(files.end(), it);
+  EXPECT_TRUE(it->is_compressed);
+
+  brillo::KeyValueStore store;
+  EXPECT_TRUE(fs->LoadSettings(&store));
+  string minor_version;
+  EXPECT_TRUE(store.GetString("PAYLOAD_MINOR_VERSION", &minor_version));
+  EXPECT_EQ("7", minor_version);
+}
+
+}  // namespace chromeos_update_engine
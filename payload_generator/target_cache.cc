@@ -0,0 +1,120 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/target_cache.h"
+
+#include <inttypes.h>
+
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/payload_generator/deflate_utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+bool TargetCache::GetPartitionInfo(const PartitionConfig& part,
+                                   PartitionInfo* info) {
+  {
+    base::AutoLock lock(lock_);
+    auto it = partition_infos_.find(part.path);
+    if (it != partition_infos_.end()) {
+      *info = it->second;
+      return true;
+    }
+  }
+  TEST_AND_RETURN_FALSE(diff_utils::InitializePartitionInfo(part, info));
+  base::AutoLock lock(lock_);
+  partition_infos_[part.path] = *info;
+  return true;
+}
+
+bool TargetCache::GetPartitionFiles(const PartitionConfig& part,
+                                    bool extract_deflates,
+                                    const DeflateCache* deflate_cache,
+                                    vector<FilesystemInterface::File>* files) {
+  auto key = std::make_pair(part.path, extract_deflates);
+  {
+    base::AutoLock lock(lock_);
+    auto it = partition_files_.find(key);
+    if (it != partition_files_.end()) {
+      *files = it->second;
+      return true;
+    }
+  }
+  TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
+      part, files, extract_deflates, deflate_cache));
+  base::AutoLock lock(lock_);
+  partition_files_[key] = *files;
+  return true;
+}
+
+bool TargetCache::LookupFullOperation(const brillo::Blob& data_hash,
+                                      const PayloadVersion& version,
+                                      brillo::Blob* blob,
+                                      InstallOperation::Type* type) {
+  FullOperation full_operation;
+  {
+    base::AutoLock lock(lock_);
+    auto it = full_operations_.find(FullOperationKey(data_hash, version));
+    if (it == full_operations_.end())
+      return false;
+    full_operation = it->second;
+  }
+  blob->resize(full_operation.size);
+  ssize_t bytes_read;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(blobs_file_.fd(),
+                                        blob->data(),
+                                        blob->size(),
+                                        full_operation.offset,
+                                        &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(blob->size()));
+  *type = full_operation.type;
+  return true;
+}
+
+bool TargetCache::StoreFullOperation(const brillo::Blob& data_hash,
+                                     const PayloadVersion& version,
+                                     const brillo::Blob& blob,
+                                     InstallOperation::Type type) {
+  string key = FullOperationKey(data_hash, version);
+  off_t offset;
+  {
+    base::AutoLock lock(lock_);
+    if (full_operations_.count(key))
+      return true;
+    offset = blobs_file_size_;
+    blobs_file_size_ += blob.size();
+  }
+  TEST_AND_RETURN_FALSE(
+      utils::PWriteAll(blobs_file_.fd(), blob.data(), blob.size(), offset));
+  base::AutoLock lock(lock_);
+  full_operations_[key] = {offset, blob.size(), type};
+  return true;
+}
+
+string TargetCache::FullOperationKey(const brillo::Blob& data_hash,
+                                     const PayloadVersion& version) {
+  return base::StringPrintf(
+             "%" PRIu64 ".%" PRIu32 ":", version.major, version.minor) +
+         string(data_hash.begin(), data_hash.end());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,106 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_TARGET_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_TARGET_CACHE_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+class DeflateCache;
+struct PartitionConfig;
+struct PayloadVersion;
+
+// Keeps the results of the work that only depends on the target image while
+// generating several payloads for the same target image from different source
+// images, so it's done only once: the hash of every target partition, the
+// preprocessed files of every target partition and the best full operation of
+// every chunk of new data. The blobs of the full operations are stored in a
+// temporary file instead of memory. All the methods are thread safe.
+class TargetCache {
+ public:
+  TargetCache() = default;
+
+  // Stores the size and hash of the partition |part| in |info|. Only the
+  // first call for every partition path reads the partition.
+  bool GetPartitionInfo(const PartitionConfig& part, PartitionInfo* info);
+
+  // Stores the files of the partition |part| in |files|, preprocessed with
+  // deflate_utils::PreprocessPartitionFiles(). Only the first call for every
+  // partition path and value of |extract_deflates| preprocesses the files.
+  bool GetPartitionFiles(const PartitionConfig& part,
+                         bool extract_deflates,
+                         const DeflateCache* deflate_cache,
+                         std::vector<FilesystemInterface::File>* files);
+
+  // Looks up the best full operation allowed in |version| for the new data
+  // with SHA-256 hash |data_hash|. Returns whether it was found and stored in
+  // |blob| and |type|.
+  bool LookupFullOperation(const brillo::Blob& data_hash,
+                           const PayloadVersion& version,
+                           brillo::Blob* blob,
+                           InstallOperation::Type* type);
+
+  // Stores the best full operation allowed in |version|, of type |type| and
+  // with blob |blob|, for the new data with SHA-256 hash |data_hash|.
+  bool StoreFullOperation(const brillo::Blob& data_hash,
+                          const PayloadVersion& version,
+                          const brillo::Blob& blob,
+                          InstallOperation::Type type);
+
+ private:
+  // The location of a full operation blob in |blobs_file_|, and the type of
+  // the operation.
+  struct FullOperation {
+    off_t offset;
+    size_t size;
+    InstallOperation::Type type;
+  };
+
+  // Returns the key of the full operations for the data with hash |data_hash|
+  // in the payload version |version|.
+  static std::string FullOperationKey(const brillo::Blob& data_hash,
+                                      const PayloadVersion& version);
+
+  base::Lock lock_;
+
+  std::map<std::string, PartitionInfo> partition_infos_;
+  std::map<std::pair<std::string, bool>,
+           std::vector<FilesystemInterface::File>>
+      partition_files_;
+
+  ScopedTempFile blobs_file_{"CrAU_target_cache.XXXXXX", true};
+  off_t blobs_file_size_ = 0;
+  std::map<std::string, FullOperation> full_operations_;
+
+  DISALLOW_COPY_AND_ASSIGN(TargetCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_TARGET_CACHE_H_
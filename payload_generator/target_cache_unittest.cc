@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/target_cache.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+namespace chromeos_update_engine {
+
+class TargetCacheTest : public ::testing::Test {
+ protected:
+  const PayloadVersion version_{kBrilloMajorPayloadVersion,
+                                kSourceMinorPayloadVersion};
+  const brillo::Blob hash_ = brillo::Blob(32, 0x42);
+
+  TargetCache cache_;
+};
+
+TEST_F(TargetCacheTest, FullOperationRoundTripTest) {
+  brillo::Blob blob;
+  InstallOperation::Type type;
+  EXPECT_FALSE(cache_.LookupFullOperation(hash_, version_, &blob, &type));
+
+  brillo::Blob other_hash(32, 0x24);
+  EXPECT_TRUE(cache_.StoreFullOperation(
+      hash_, version_, {1, 2, 3, 4}, InstallOperation::REPLACE_XZ));
+  EXPECT_TRUE(cache_.StoreFullOperation(
+      other_hash, version_, {5, 6}, InstallOperation::REPLACE));
+
+  EXPECT_TRUE(cache_.LookupFullOperation(hash_, version_, &blob, &type));
+  EXPECT_EQ((brillo::Blob{1, 2, 3, 4}), blob);
+  EXPECT_EQ(InstallOperation::REPLACE_XZ, type);
+  EXPECT_TRUE(cache_.LookupFullOperation(other_hash, version_, &blob, &type));
+  EXPECT_EQ((brillo::Blob{5, 6}), blob);
+  EXPECT_EQ(InstallOperation::REPLACE, type);
+}
+
+TEST_F(TargetCacheTest, FullOperationDependsOnVersionTest) {
+  EXPECT_TRUE(cache_.StoreFullOperation(
+      hash_, version_, {1, 2, 3}, InstallOperation::REPLACE_XZ));
+
+  brillo::Blob blob;
+  InstallOperation::Type type;
+  PayloadVersion other_version(kBrilloMajorPayloadVersion,
+                               kFullPayloadMinorVersion);
+  EXPECT_FALSE(cache_.LookupFullOperation(hash_, other_version, &blob, &type));
+}
+
+TEST_F(TargetCacheTest, PartitionInfoIsReadOnceTest) {
+  ScopedTempFile part_file("TargetCacheTest_part.XXXXXX");
+  brillo::Blob part_data(4096, 0x11);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file.path(), part_data));
+  PartitionConfig part("part");
+  part.path = part_file.path();
+  part.size = part_data.size();
+
+  PartitionInfo info;
+  EXPECT_TRUE(cache_.GetPartitionInfo(part, &info));
+  brillo::Blob expected_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(part_data, &expected_hash));
+  EXPECT_EQ(part_data.size(), info.size());
+  EXPECT_EQ(expected_hash,
+            brillo::Blob(info.hash().begin(), info.hash().end()));
+
+  // The cached info is returned even when the partition changed.
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(part_file.path(), brillo::Blob(4096, 0x22)));
+  PartitionInfo cached_info;
+  EXPECT_TRUE(cache_.GetPartitionInfo(part, &cached_info));
+  EXPECT_EQ(info.hash(), cached_info.hash());
+}
+
+}  // namespace chromeos_update_engine
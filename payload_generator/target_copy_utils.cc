@@ -0,0 +1,152 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/target_copy_utils.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/mapped_image.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+namespace target_copy_utils {
+
+namespace {
+
+// Returns whether the new data of an operation of type |type| is stored in the
+// payload.
+bool HasNewData(InstallOperation::Type type) {
+  return diff_utils::IsAReplaceOperation(type) ||
+         type == InstallOperation::SOURCE_BSDIFF ||
+         type == InstallOperation::BROTLI_BSDIFF ||
+         type == InstallOperation::PUFFDIFF ||
+         type == InstallOperation::LZ4DIFF_BSDIFF ||
+         type == InstallOperation::EXECUTABLE_BSDIFF;
+}
+
+}  // namespace
+
+bool AddTargetCopyOperations(const PartitionConfig& new_part,
+                             const PayloadVersion& version,
+                             ssize_t chunk_blocks,
+                             BlobFileWriter* blob_file,
+                             vector<AnnotatedOperation>* aops) {
+  TEST_AND_RETURN_FALSE(
+      version.OperationAllowed(InstallOperation::TARGET_COPY));
+  std::unique_ptr<MappedImage> new_image =
+      MappedImage::CreateFromFile(new_part.path);
+  TEST_AND_RETURN_FALSE(new_image);
+
+  // The first block written with every content, excluding the zero blocks.
+  // The keys point to the data in |new_image|.
+  std::unordered_map<std::string_view, uint64_t> written_blocks;
+  const string zero_block(kBlockSize, '\0');
+  auto block_data = [&](uint64_t block) -> std::string_view {
+    const uint8_t* data = new_image->GetData(block * kBlockSize, kBlockSize);
+    if (!data)
+      return {};
+    return std::string_view(reinterpret_cast<const char*>(data), kBlockSize);
+  };
+
+  vector<AnnotatedOperation> new_aops;
+  uint64_t num_copied_blocks = 0;
+  for (AnnotatedOperation& aop : *aops) {
+    vector<uint64_t> dst_blocks = ExpandExtents(aop.op.dst_extents());
+    vector<std::string_view> dst_data;
+    dst_data.reserve(dst_blocks.size());
+    for (uint64_t block : dst_blocks) {
+      dst_data.push_back(block_data(block));
+      TEST_AND_RETURN_FALSE(!dst_data.back().empty());
+    }
+
+    vector<BlockExtent> src_extents, dst_extents, remaining_extents;
+    if (HasNewData(aop.op.type())) {
+      for (size_t i = 0; i < dst_blocks.size(); i++) {
+        auto it = dst_data[i] == zero_block ? written_blocks.end()
+                                            : written_blocks.find(dst_data[i]);
+        if (it == written_blocks.end()) {
+          AppendBlockToExtents(&remaining_extents, dst_blocks[i]);
+          continue;
+        }
+        AppendBlockToExtents(&src_extents, it->second);
+        AppendBlockToExtents(&dst_extents, dst_blocks[i]);
+      }
+    }
+
+    // The diff operations can only be replaced as a whole.
+    bool copy_blocks = !dst_extents.empty() &&
+                       (diff_utils::IsAReplaceOperation(aop.op.type()) ||
+                        remaining_extents.empty());
+    if (!copy_blocks) {
+      new_aops.push_back(std::move(aop));
+    } else {
+      AnnotatedOperation copy_aop;
+      copy_aop.name = aop.name;
+      copy_aop.op.set_type(InstallOperation::TARGET_COPY);
+      StoreExtents(src_extents, copy_aop.op.mutable_src_extents());
+      StoreExtents(dst_extents, copy_aop.op.mutable_dst_extents());
+      num_copied_blocks += utils::BlocksInExtents(dst_extents);
+      new_aops.push_back(std::move(copy_aop));
+
+      if (!remaining_extents.empty()) {
+        TEST_AND_RETURN_FALSE(
+            diff_utils::DeltaReadFile(&new_aops,
+                                      nullptr,  // old_image
+                                      new_image.get(),
+                                      {},  // old_extents
+                                      remaining_extents,
+                                      {},  // old_deflates
+                                      {},  // new_deflates
+                                      nullptr,  // old_lz4_file
+                                      nullptr,  // new_lz4_file
+                                      aop.name,
+                                      chunk_blocks,
+                                      version,
+                                      diff_utils::DiffLimits(),
+                                      nullptr,  // target_cache
+                                      blob_file,
+                                      nullptr));
+      }
+    }
+
+    // The blocks of this operation can only be copied by the next ones.
+    for (size_t i = 0; i < dst_blocks.size(); i++) {
+      if (dst_data[i] != zero_block)
+        written_blocks.emplace(dst_data[i], dst_blocks[i]);
+    }
+  }
+
+  LOG(INFO) << "Copying " << num_copied_blocks << " blocks of "
+            << new_part.name << " from blocks written earlier.";
+  *aops = std::move(new_aops);
+  return true;
+}
+
+}  // namespace target_copy_utils
+}  // namespace chromeos_update_engine
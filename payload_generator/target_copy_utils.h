@@ -0,0 +1,49 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_TARGET_COPY_UTILS_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_TARGET_COPY_UTILS_H_
+
+#include <vector>
+
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+namespace chromeos_update_engine {
+namespace target_copy_utils {
+
+// Replaces the new data of the operations in |aops| of the new partition
+// |new_part| that an earlier operation of |aops| already wrote, like the same
+// library or resource stored more than once, with TARGET_COPY operations
+// copying it from the blocks written by that earlier operation. The order of
+// the operations must not change afterwards.
+//
+// The blocks of full operations are copied one by one, and the remaining
+// blocks are encoded again as full operations of up to |chunk_blocks| blocks
+// allowed in |version|, with their data written to |blob_file|. The diff
+// operations are only replaced when all their blocks were already written,
+// since their blocks can't be encoded separately.
+bool AddTargetCopyOperations(const PartitionConfig& new_part,
+                             const PayloadVersion& version,
+                             ssize_t chunk_blocks,
+                             BlobFileWriter* blob_file,
+                             std::vector<AnnotatedOperation>* aops);
+
+}  // namespace target_copy_utils
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_TARGET_COPY_UTILS_H_
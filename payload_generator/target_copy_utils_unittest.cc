@@ -0,0 +1,169 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/target_copy_utils.h"
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kNumBlocks = 8;
+
+vector<BlockExtent> ToVector(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) {
+  vector<BlockExtent> result;
+  ExtentsToVector(extents, &result);
+  return result;
+}
+
+}  // namespace
+
+class TargetCopyUtilsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    new_data_.resize(kNumBlocks * kBlockSize);
+    std::mt19937 gen(1);
+    for (uint8_t& byte : new_data_)
+      byte = gen();
+  }
+
+  // Writes |new_data_| to the new partition.
+  void WriteNewPartition() {
+    new_part_.path = new_part_file_.path();
+    new_part_.size = new_data_.size();
+    ASSERT_TRUE(test_utils::WriteFileVector(new_part_.path, new_data_));
+  }
+
+  // Copies the block |src_block| of the new data to the block |dst_block|.
+  void CopyBlock(size_t src_block, size_t dst_block) {
+    std::copy(new_data_.begin() + src_block * kBlockSize,
+              new_data_.begin() + (src_block + 1) * kBlockSize,
+              new_data_.begin() + dst_block * kBlockSize);
+  }
+
+  static AnnotatedOperation MakeOperation(InstallOperation::Type type,
+                                          uint64_t start_block,
+                                          uint64_t num_blocks) {
+    AnnotatedOperation aop;
+    aop.name = "op";
+    aop.op.set_type(type);
+    *aop.op.add_dst_extents() = ExtentForRange(start_block, num_blocks);
+    return aop;
+  }
+
+  bool AddTargetCopyOperations(vector<AnnotatedOperation>* aops) {
+    BlobFileWriter blob_file(blob_file_.fd(), &blob_size_);
+    return target_copy_utils::AddTargetCopyOperations(
+        new_part_, version_, -1, &blob_file, aops);
+  }
+
+  ScopedTempFile new_part_file_{"TargetCopyUtilsTest_new.XXXXXX"};
+  ScopedTempFile blob_file_{"TargetCopyUtilsTest_blob.XXXXXX", true};
+  off_t blob_size_ = 0;
+
+  PartitionConfig new_part_{"system"};
+  brillo::Blob new_data_;
+  const PayloadVersion version_{kBrilloMajorPayloadVersion,
+                                kTargetCopyMinorPayloadVersion};
+};
+
+TEST_F(TargetCopyUtilsTest, CopiesBlocksWrittenEarlierTest) {
+  // The blocks 5 and 6 are the same as the blocks 1 and 2, and the block 7 is
+  // all zeros in both places.
+  CopyBlock(1, 5);
+  CopyBlock(2, 6);
+  std::fill(new_data_.begin() + 3 * kBlockSize,
+            new_data_.begin() + 4 * kBlockSize,
+            0);
+  std::fill(new_data_.begin() + 7 * kBlockSize, new_data_.end(), 0);
+  WriteNewPartition();
+
+  vector<AnnotatedOperation> aops = {
+      MakeOperation(InstallOperation::REPLACE_XZ, 0, 4),
+      MakeOperation(InstallOperation::REPLACE_XZ, 4, 4)};
+  EXPECT_TRUE(AddTargetCopyOperations(&aops));
+
+  ASSERT_EQ(3U, aops.size());
+  EXPECT_EQ(InstallOperation::REPLACE_XZ, aops[0].op.type());
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(0, 4)},
+            ToVector(aops[0].op.dst_extents()));
+
+  EXPECT_EQ(InstallOperation::TARGET_COPY, aops[1].op.type());
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(1, 2)},
+            ToVector(aops[1].op.src_extents()));
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(5, 2)},
+            ToVector(aops[1].op.dst_extents()));
+
+  EXPECT_TRUE(diff_utils::IsAReplaceOperation(aops[2].op.type()));
+  EXPECT_EQ((vector<BlockExtent>{{4, 1}, {7, 1}}),
+            ToVector(aops[2].op.dst_extents()));
+}
+
+TEST_F(TargetCopyUtilsTest, OnlyCopiesFromEarlierOperationsTest) {
+  // The first operation writes the same data as the second one, but it can't
+  // copy it since it's written later.
+  CopyBlock(6, 0);
+  WriteNewPartition();
+
+  vector<AnnotatedOperation> aops = {
+      MakeOperation(InstallOperation::REPLACE, 0, 2),
+      MakeOperation(InstallOperation::REPLACE, 6, 1)};
+  EXPECT_TRUE(AddTargetCopyOperations(&aops));
+
+  ASSERT_EQ(2U, aops.size());
+  EXPECT_EQ(InstallOperation::REPLACE, aops[0].op.type());
+  EXPECT_EQ(InstallOperation::TARGET_COPY, aops[1].op.type());
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(0, 1)},
+            ToVector(aops[1].op.src_extents()));
+}
+
+TEST_F(TargetCopyUtilsTest, ReplacesDiffOperationsAsAWholeTest) {
+  CopyBlock(0, 4);
+  CopyBlock(1, 5);
+  CopyBlock(2, 6);
+  WriteNewPartition();
+
+  vector<AnnotatedOperation> aops = {
+      MakeOperation(InstallOperation::REPLACE, 0, 4),
+      MakeOperation(InstallOperation::SOURCE_BSDIFF, 4, 2),
+      MakeOperation(InstallOperation::SOURCE_BSDIFF, 6, 2)};
+  EXPECT_TRUE(AddTargetCopyOperations(&aops));
+
+  // Only the first diff operation has all its blocks written earlier.
+  ASSERT_EQ(3U, aops.size());
+  EXPECT_EQ(InstallOperation::TARGET_COPY, aops[1].op.type());
+  EXPECT_EQ(vector<BlockExtent>{BlockExtent(0, 2)},
+            ToVector(aops[1].op.src_extents()));
+  EXPECT_EQ(InstallOperation::SOURCE_BSDIFF, aops[2].op.type());
+  EXPECT_EQ(0, blob_size_);
+}
+
+}  // namespace chromeos_update_engine
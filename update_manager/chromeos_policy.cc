@@ -210,6 +210,10 @@ const NextUpdateCheckPolicyConstants
 const int ChromeOSPolicy::kMaxP2PAttempts = 10;
 const int ChromeOSPolicy::kMaxP2PAttemptsPeriodInSeconds = 5 * 24 * 60 * 60;
 
+const int ChromeOSPolicy::kBackgroundDownloadCapacityPercent = 50;
+const int64_t ChromeOSPolicy::kBackgroundDownloadDefaultRateBps = 1024 * 1024;
+const int64_t ChromeOSPolicy::kBackgroundDownloadMinRateBps = 128 * 1024;
+
 EvalStatus ChromeOSPolicy::UpdateCheckAllowed(EvaluationContext* ec,
                                               State* state,
                                               string* error,
@@ -514,6 +518,48 @@ EvalStatus ChromeOSPolicy::P2PEnabledChanged(EvaluationContext* ec,
   return status;
 }
 
+EvalStatus ChromeOSPolicy::DownloadRateLimit(EvaluationContext* ec,
+                                             State* state,
+                                             string* error,
+                                             int64_t* result,
+                                             bool interactive,
+                                             int64_t link_capacity) const {
+  // Updates the user is waiting for, including a background download the user
+  // asked for since it started, go at full speed.
+  const UpdateRequestStatus* forced_update_requested_p =
+      ec->GetValue(state->updater_provider()->var_forced_update_requested());
+  if (interactive ||
+      (forced_update_requested_p &&
+       *forced_update_requested_p == UpdateRequestStatus::kInteractive)) {
+    *result = 0;
+    return EvalStatus::kSucceeded;
+  }
+
+  // Metered connections are left to the user as much as possible.
+  ShillProvider* const shill_provider = state->shill_provider();
+  const ConnectionType* conn_type_p =
+      ec->GetValue(shill_provider->var_conn_type());
+  const ConnectionTethering* conn_tethering_p =
+      ec->GetValue(shill_provider->var_conn_tethering());
+  if ((conn_type_p && *conn_type_p == ConnectionType::kCellular) ||
+      (conn_tethering_p &&
+       *conn_tethering_p == ConnectionTethering::kConfirmed)) {
+    *result = kBackgroundDownloadMinRateBps;
+    return EvalStatus::kSucceeded;
+  }
+
+  // Otherwise a background download leaves part of the link to the rest of
+  // the traffic.
+  if (link_capacity > 0) {
+    *result = std::max(
+        link_capacity * kBackgroundDownloadCapacityPercent / 100,
+        kBackgroundDownloadMinRateBps);
+  } else {
+    *result = kBackgroundDownloadDefaultRateBps;
+  }
+  return EvalStatus::kSucceeded;
+}
+
 EvalStatus ChromeOSPolicy::UpdateBackoffAndDownloadUrl(
     EvaluationContext* ec,
     State* state,
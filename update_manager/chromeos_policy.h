@@ -83,6 +83,13 @@ class ChromeOSPolicy : public Policy {
                                bool* result,
                                bool prev_result) const override;
 
+  EvalStatus DownloadRateLimit(EvaluationContext* ec,
+                               State* state,
+                               std::string* error,
+                               int64_t* result,
+                               bool interactive,
+                               int64_t link_capacity) const override;
+
  protected:
   // Policy override.
   std::string PolicyName() const override { return "ChromeOSPolicy"; }
@@ -108,6 +115,10 @@ class ChromeOSPolicy : public Policy {
               UpdateCanStartAllowedP2PDownloadingBlockedDueToAttemptsPeriod);
   FRIEND_TEST(UmChromeOSPolicyTest,
               UpdateCheckAllowedNextUpdateCheckOutsideDisallowedInterval);
+  FRIEND_TEST(UmChromeOSPolicyTest, DownloadRateLimitBackgroundUsesDefault);
+  FRIEND_TEST(UmChromeOSPolicyTest, DownloadRateLimitBackgroundFollowsCapacity);
+  FRIEND_TEST(UmChromeOSPolicyTest,
+              DownloadRateLimitBackgroundOnTetheredNetwork);
 
   // Auxiliary constant (zero by default).
   const base::TimeDelta kZeroInterval;
@@ -119,6 +130,16 @@ class ChromeOSPolicy : public Policy {
   // Maximum period of time allowed for download a payload via P2P, in seconds.
   static const int kMaxP2PAttemptsPeriodInSeconds;
 
+  // Share of the measured link capacity a background download may use, in
+  // percent.
+  static const int kBackgroundDownloadCapacityPercent;
+  // Rate limit of a background download before the link capacity is measured,
+  // in bytes per second.
+  static const int64_t kBackgroundDownloadDefaultRateBps;
+  // Lowest rate limit of a background download, also used on metered
+  // connections, in bytes per second.
+  static const int64_t kBackgroundDownloadMinRateBps;
+
   // A private policy for determining backoff and the download URL to use.
   // Within |update_state|, |backoff_expiry| and |is_backoff_disabled| are used
   // for determining whether backoff is still in effect; if not,
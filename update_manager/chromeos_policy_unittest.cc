@@ -1507,6 +1507,73 @@ TEST_F(UmChromeOSPolicyTest, P2PEnabledChangedBlocks) {
       EvalStatus::kAskMeAgainLater, &Policy::P2PEnabledChanged, &result, false);
 }
 
+TEST_F(UmChromeOSPolicyTest, DownloadRateLimitInteractiveIsUnlimited) {
+  int64_t result = -1;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::DownloadRateLimit,
+                     &result,
+                     true,
+                     static_cast<int64_t>(0));
+  EXPECT_EQ(0, result);
+}
+
+TEST_F(UmChromeOSPolicyTest, DownloadRateLimitForcedInteractiveIsUnlimited) {
+  // The user asked for an update while a background download was running.
+  fake_state_.updater_provider()->var_forced_update_requested()->reset(
+      new UpdateRequestStatus(UpdateRequestStatus::kInteractive));
+
+  int64_t result = -1;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::DownloadRateLimit,
+                     &result,
+                     false,
+                     static_cast<int64_t>(0));
+  EXPECT_EQ(0, result);
+}
+
+TEST_F(UmChromeOSPolicyTest, DownloadRateLimitBackgroundUsesDefault) {
+  int64_t result = 0;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::DownloadRateLimit,
+                     &result,
+                     false,
+                     static_cast<int64_t>(0));
+  EXPECT_EQ(ChromeOSPolicy::kBackgroundDownloadDefaultRateBps, result);
+}
+
+TEST_F(UmChromeOSPolicyTest, DownloadRateLimitBackgroundFollowsCapacity) {
+  int64_t result = 0;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::DownloadRateLimit,
+                     &result,
+                     false,
+                     static_cast<int64_t>(10 * 1024 * 1024));
+  EXPECT_EQ(10 * 1024 * 1024 *
+                ChromeOSPolicy::kBackgroundDownloadCapacityPercent / 100,
+            result);
+
+  // A slow link still gets the lowest limit.
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::DownloadRateLimit,
+                     &result,
+                     false,
+                     static_cast<int64_t>(1024));
+  EXPECT_EQ(ChromeOSPolicy::kBackgroundDownloadMinRateBps, result);
+}
+
+TEST_F(UmChromeOSPolicyTest, DownloadRateLimitBackgroundOnTetheredNetwork) {
+  fake_state_.shill_provider()->var_conn_tethering()->reset(
+      new ConnectionTethering(ConnectionTethering::kConfirmed));
+
+  int64_t result = 0;
+  ExpectPolicyStatus(EvalStatus::kSucceeded,
+                     &Policy::DownloadRateLimit,
+                     &result,
+                     false,
+                     static_cast<int64_t>(10 * 1024 * 1024));
+  EXPECT_EQ(ChromeOSPolicy::kBackgroundDownloadMinRateBps, result);
+}
+
 TEST_F(UmChromeOSPolicyTest,
        UpdateCanBeAppliedForcedUpdatesDisablesTimeRestrictions) {
   Time curr_time = fake_clock_->GetWallclockTime();
@@ -109,4 +109,14 @@ EvalStatus DefaultPolicy::P2PEnabledChanged(EvaluationContext* ec,
   return EvalStatus::kSucceeded;
 }
 
+EvalStatus DefaultPolicy::DownloadRateLimit(EvaluationContext* ec,
+                                            State* state,
+                                            std::string* error,
+                                            int64_t* result,
+                                            bool interactive,
+                                            int64_t link_capacity) const {
+  *result = 0;
+  return EvalStatus::kSucceeded;
+}
+
 }  // namespace chromeos_update_manager
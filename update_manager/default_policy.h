@@ -92,6 +92,13 @@ class DefaultPolicy : public Policy {
                                bool* result,
                                bool prev_result) const override;
 
+  EvalStatus DownloadRateLimit(EvaluationContext* ec,
+                               State* state,
+                               std::string* error,
+                               int64_t* result,
+                               bool interactive,
+                               int64_t link_capacity) const override;
+
  protected:
   // Policy override.
   std::string PolicyName() const override { return "DefaultPolicy"; }
@@ -53,6 +53,15 @@ class MockPolicy : public Policy {
                 testing::_, testing::_, testing::_, testing::_, testing::_))
         .WillByDefault(testing::Invoke(&default_policy_,
                                        &DefaultPolicy::P2PEnabledChanged));
+    ON_CALL(*this,
+            DownloadRateLimit(testing::_,
+                              testing::_,
+                              testing::_,
+                              testing::_,
+                              testing::_,
+                              testing::_))
+        .WillByDefault(testing::Invoke(&default_policy_,
+                                       &DefaultPolicy::DownloadRateLimit));
   }
   ~MockPolicy() override {}
 
@@ -86,6 +95,14 @@ class MockPolicy : public Policy {
       P2PEnabledChanged,
       EvalStatus(EvaluationContext*, State*, std::string*, bool*, bool));
 
+  MOCK_CONST_METHOD6(DownloadRateLimit,
+                     EvalStatus(EvaluationContext*,
+                                State*,
+                                std::string*,
+                                int64_t*,
+                                bool,
+                                int64_t));
+
  protected:
   // Policy override.
   std::string PolicyName() const override { return "MockPolicy"; }
@@ -236,6 +236,9 @@ class Policy {
     if (reinterpret_cast<typeof(&Policy::P2PEnabledChanged)>(policy_method) ==
         &Policy::P2PEnabledChanged)
       return class_name + "P2PEnabledChanged";
+    if (reinterpret_cast<typeof(&Policy::DownloadRateLimit)>(policy_method) ==
+        &Policy::DownloadRateLimit)
+      return class_name + "DownloadRateLimit";
 
     NOTREACHED();
     return class_name + "(unknown)";
@@ -296,6 +299,17 @@ class Policy {
                                        bool* result,
                                        bool prev_result) const = 0;
 
+  // Returns in |result| the rate in bytes per second the payload download is
+  // limited to, or 0 for no limit. |interactive| tells whether the update was
+  // requested by the user and |link_capacity| is the rate the link was
+  // measured to carry so far, or 0 if it wasn't measured yet.
+  virtual EvalStatus DownloadRateLimit(EvaluationContext* ec,
+                                       State* state,
+                                       std::string* error,
+                                       int64_t* result,
+                                       bool interactive,
+                                       int64_t link_capacity) const = 0;
+
  protected:
   Policy() {}
 
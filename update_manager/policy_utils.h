@@ -106,6 +106,15 @@ class PolicyImplBase : public Policy {
                                bool prev_result) const override {
     return EvalStatus::kContinue;
   };
+
+  EvalStatus DownloadRateLimit(EvaluationContext* ec,
+                               State* state,
+                               std::string* error,
+                               int64_t* result,
+                               bool interactive,
+                               int64_t link_capacity) const override {
+    return EvalStatus::kContinue;
+  };
 };
 
 }  // namespace chromeos_update_manager